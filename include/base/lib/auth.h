@@ -16,10 +16,22 @@
  *   32 raw random bytes, mode 0640, group server uid.
  *
  * Replay protection: server rejects headers older than AUTH_MAX_AGE seconds.
+ *
+ * Sessions: a long lived connection may open a session with one signed
+ * exchange of random nonces, from which both ends derive a key for each
+ * direction. Every later message of the connection is then signed with
+ * SipHash-2-4 over its encoded header and a message counter, kept by
+ * both ends and never sent in full: a replayed, reordered or dropped
+ * message fails. The tag takes the first AUTH_SESSION_TAG_SIZE bytes of
+ * hmac, the low 32 bits of the counter the timestamp.
  */
 
 #define AUTH_KEY_SIZE 32
 #define AUTH_MAX_AGE 60
+#define AUTH_NONCE_SIZE 16
+#define AUTH_SESSION_TAG_SIZE 16
+
+struct auth_session;
 
 int auth_init(uint8_t, uint32_t);
 void auth_set_required(int);
@@ -27,3 +39,9 @@ int auth_load_key(void);
 int auth_generate_key(void);
 int auth_sign_header(struct protocol_header *);
 int auth_verify_header(const struct protocol_header *);
+int auth_nonce(uint8_t *);
+struct auth_session *auth_session_new(const uint8_t *, const uint8_t *, int);
+void auth_session_free(struct auth_session *);
+int auth_sign_packet(struct auth_session *, char *);
+int auth_verify_packet(struct auth_session *, const char *,
+                       const struct protocol_header *);
@@ -9,7 +9,11 @@
 #include "base/lib/ll.protocol.h"
 #include "base/lib/ll.list.h"
 
-#define CHAN_MAX 10204
+// Channel ids are the descriptors of their sockets; the table covers
+// the descriptor limit of the process, up to CHAN_MAX channels
+#define CHAN_MAX (128 * 1024)
+// Events taken by one chan_epoll() call
+#define CHAN_EVENTS 1024
 
 // Channel type
 enum chan_type {
@@ -19,6 +23,7 @@ enum chan_type {
     TCP_CLIENT,
     UDP_CLIENT,
     TIMER_FD,
+    EVENT_FD,
 };
 
 // chan_events is a simple state machine, not a bitmask.
@@ -30,30 +35,58 @@ enum chan_events {
     CHAN_EPOLLERR,
 };
 
+// Encoded message sent to several channels, see chan_share()
+struct chan_shared {
+    int refs;
+    int len;
+    char *data;
+};
+
 struct chan_buffer {
     struct ll_list_entry link; // intrusive list node
     char *data;
     int pos;
     int len;
+    struct chan_shared *shared; // owns data when set
+    int cap;                    // pool size class of data, 0 if malloc'ed
+    // sent in place of the first head_len bytes of data, so a shared
+    // message can carry a header word of its own per channel
+    char head[sizeof(int32_t)];
+    int head_len;
 };
 
+struct auth_session;
+
 struct chan_data {
     int sock;
     enum chan_type type;
     struct ll_list send;
-    struct ll_list recv;
+    struct ll_list recv; // complete messages, in arrival order
     enum chan_events chan_events;
+    int write_interest; // EPOLLOUT registered, see chan_set_write_interest()
+    char *ring;         // bytes read and not yet framed, NULL when none
+    int ring_start;
+    int ring_end;
+    struct chan_buffer *big; // message larger than the ring, being read
+    int owner;               // set by the daemon, see chan_set_owner()
+    void *owner_data;
+    struct auth_session *session; // NULL: messages signed in full
 };
 
-extern struct chan_data channels[];
+extern struct chan_data *channels;
+extern int chan_max;
 
-void chan_init(void);
+int chan_init(void);
+void chan_set_owner(int, int, void *);
+void chan_set_session(int, struct auth_session *);
 int chan_close(int);
 int chan_sock(int);
 int chan_epoll(int, struct epoll_event *, int, int);
 // timeout is in seconds
 int chan_connect(int, struct sockaddr_in *, int);
 int chan_enqueue(int, struct chan_buffer *);
+int chan_send(int, struct chan_buffer *, int);
+int chan_flush(int, int);
 int chan_dequeue(int, struct chan_buffer **);
 int chan_accept(int, struct sockaddr_in *);
 int chan_rpc(int, struct chan_buffer *, struct chan_buffer *,
@@ -63,6 +96,9 @@ ssize_t chan_read_nonblock(int, void *, size_t, int);
 ssize_t chan_write(int, void *, size_t);
 int chan_alloc_buf(struct chan_buffer **, int);
 void chan_free_buf(struct chan_buffer *);
+struct chan_shared *chan_share(struct chan_buffer *);
+struct chan_buffer *chan_shared_buf(struct chan_shared *);
+void chan_shared_unref(struct chan_shared *);
 int chan_open(int);
 int chan_dup_stdio(int);
 int io_non_block(int);
@@ -70,6 +106,7 @@ int io_block(int);
 int chan_send_dgram(int, char *, size_t, struct sockaddr_in *);
 int chan_recv_dgram(int, void *, size_t, struct sockaddr_in *, int);
 int chan_create_timer(int);
+int chan_create_event(void);
 struct chan_buffer *chan_make_buf(void);
 int chan_connect_begin(int, struct sockaddr_in *, int);
 int chan_connect_finish(int);
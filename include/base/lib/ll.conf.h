@@ -21,9 +21,20 @@ enum ll_params {
     LL_CGROUP_ROOT,
     LL_SBD_JOB_FINISH_RETAIN,
     LL_SBD_PRUNE_INTERVAL,
+    LL_SBD_MSG_BATCH,
 
     // mbd
     LL_MBD_JOB_FINISH_THRESHOLD,
+    LL_MBD_MANIFEST_FORMAT,
+    LL_MBD_CHECKPOINT_INTERVAL,
+    LL_MBD_REPLAY_THREADS,
+    LL_HIST_SCAN_THREADS,
+    LL_MBD_SPOOL_REAP_RATE,
+    LL_MBD_JOB_ID_LEASE,
+    LL_MBD_DISPATCH_CACHE_MB,
+    LL_MBD_QUERY_THREAD,
+    LL_MBD_QUERY_REFRESH_MS,
+    LL_MBD_STATUS_EXPORT,
     LL_MBD_PORT,
     LL_MBD_HOST,
     LL_MBD_USER,
@@ -31,6 +42,7 @@ enum ll_params {
     LL_DEFAULT_QUEUE,
     // auth
     LL_AUTH_MAX_AGE,
+    LL_AUTH_SESSION,
     // Debug
     LL_API_CONNTIMEOUT,
     LL_API_RECVTIMEOUT,
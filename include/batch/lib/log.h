@@ -16,6 +16,38 @@
 
 #define LOG_VERSION 1
 
+/*
+ * Binary record format.
+ *
+ *   0  u8   LOG_BIN_MAGIC, never the first byte of a text record
+ *   1  u8   LOG_BIN_VERSION
+ *   2  u8   event type
+ *   3  u8   reserved, 0
+ *   4  u32  payload length
+ *   8  i64  event time
+ *  16       payload: fixed-width little-endian integers and
+ *           varint length-prefixed strings
+ *   .. u32  CRC32C of everything above
+ *
+ * Each record carries its own magic, so text and binary records may be
+ * mixed in one file and log_read_hdr() handles both transparently. A
+ * record whose version is above LOG_BIN_VERSION was written by a newer
+ * mbd, log_read_hdr() rejects it with EPROTO rather than decode it.
+ */
+#define LOG_BIN_MAGIC 0xB7
+#define LOG_BIN_VERSION 1
+#define LOG_BIN_HDRSIZ 16
+#define LOG_BIN_CRCSIZ 4
+
+/*
+ * On-disk format used by the log_write_* functions.
+ * Readers do not care, the format is detected per record.
+ */
+enum log_format {
+    LOG_FORMAT_TEXT,
+    LOG_FORMAT_BINARY
+};
+
 /*
  * Event types. Values are stable on disk -- do not reorder.
  */
@@ -37,14 +69,18 @@ enum event_type {
 
 /*
  * event_rec: the record header.
- * log_read_hdr() reads one line from the file, parses the header fields,
+ * log_read_hdr() reads one record from the file, parses the header fields,
  * and stores the unparsed remainder in rest[] for the payload reader.
+ * For text records rest[] is the tail of the line, for binary records
+ * it is the raw payload and len is its size.
  */
 struct event_rec {
     int version;
+    enum log_format format;
     enum event_type type;
     time_t event_time;
-    char rest[LL_BUFSIZ_4K]; /* unparsed payload tail */
+    uint32_t len;
+    char rest[LL_BUFSIZ_8K]; /* unparsed payload tail */
 };
 
 /*
@@ -59,8 +95,17 @@ struct event_rec {
  *
  * log_job_new: everything mbd needs for scheduling, display and replay.
  * Fields only needed at execution time (cwd, command, in/out/err files)
- * live in the per-job sidecar, not here.
+ * live in the submit sidecar, not here.
+ *
+ * script is the content hash naming the job script in the mbd script
+ * store, empty for a job whose script is the per-job script.sh of an
+ * older mbd. journal_seq, journal_off and journal_len locate the
+ * sidecar in the submit journal, journal_len is 0 for a job whose
+ * sidecar is a file in its spool directory. Both trail the record and
+ * are optional on read.
  */
+#define LOG_SCRIPT_HASH_LEN 64
+
 struct log_job_new {
     int64_t job_id;
     int64_t array_id;
@@ -89,6 +134,10 @@ struct log_job_new {
     char machines[LL_BUFSIZ_1K];
     char tokenpool[LL_BUFSIZ_256];
     char depend_cond[LL_BUFSIZ_4K];
+    char script[LOG_SCRIPT_HASH_LEN + 1];
+    uint32_t journal_seq;
+    uint32_t journal_len;
+    int64_t journal_off;
 };
 
 /* log_job_start: mbd dispatched the job to sbd.
@@ -176,12 +225,67 @@ struct log_job_pend {
 };
 
 /*
- * Read the record header from one line.
+ * log_record: one record decoded by log_decode(), the event type and
+ * its payload. rc is the result of the payload parser, a record whose
+ * header read fine but whose payload did not parse has rc -1.
+ */
+union log_payload {
+    struct log_job_new job_new;
+    struct log_job_start start;
+    struct log_job_fork fork;
+    struct log_job_signal signal;
+    struct log_job_finish finish;
+    struct log_job_pend_susp pend_susp;
+    struct log_job_pend_resume pend_resume;
+    struct log_job_susp susp;
+    struct log_job_move move;
+    struct log_job_priority priority;
+    struct log_job_pend pend;
+};
+
+struct log_record {
+    enum event_type type;
+    int rc;
+    union log_payload p;
+};
+
+/* Select the format used by the writers, LOG_FORMAT_TEXT by default */
+void log_set_format(enum log_format);
+enum log_format log_get_format(void);
+int log_format_parse(const char *, enum log_format *);
+const char *log_format_str(enum log_format);
+
+/* CRC32C (Castagnoli), seed with 0 */
+uint32_t log_crc32c(uint32_t, const void *, size_t);
+
+/*
+ * Read the record header of the next text or binary record.
  * The unparsed payload tail is stored in rec->rest.
- * Returns 0 on success, -1 on EOF or parse error.
+ * Returns 0 on success, -1 on EOF or parse error. A binary record
+ * failing its checksum sets errno to EBADMSG.
  */
 int log_read_hdr(FILE *, struct event_rec *);
 
+/*
+ * Size in bytes of the record starting at buf, given len bytes are
+ * available. Returns 0 when buf holds only part of a record and -1
+ * when it does not start a valid one. A text record without its
+ * trailing newline extends to len, as fgets() would read it.
+ */
+ssize_t log_rec_size(const void *, size_t);
+
+/*
+ * Parse the payload of rec into out according to rec->type.
+ * Returns 0, -1 when the payload does not parse, 1 for an event type
+ * that has no payload parser. out->rc holds the same value.
+ */
+int log_decode(const struct event_rec *, struct log_record *);
+
+/* job_id of a decoded record, 0 for a type without one */
+int64_t log_record_job_id(const struct log_record *);
+
+const char *log_event_name(enum event_type);
+
 /* Payload parsers -- operate on rec->rest from log_read_hdr */
 int log_parse_job_new(const struct event_rec *, struct log_job_new *);
 int log_parse_job_start(const struct event_rec *, struct log_job_start *);
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Archive index.
+ *
+ * Every manifest.N archive is immutable once mbd has rotated it, so it
+ * can carry an index, manifest.N.idx, that maps each job_id to the
+ * offsets of its records. The index is laid out as
+ *
+ *   struct log_index_job   jobs[njobs]     sorted by job_id
+ *   uint64_t               offsets[nrecs]  grouped per job, file order
+ *   uint32_t               uids[nuids]     sorted
+ *   struct log_index_footer
+ *
+ * in host byte order. The footer holds the ranges a reader uses to skip
+ * the archive without loading the rest, the size and mtime of the
+ * archive it was built from and a CRC32C of everything before it. An
+ * index that does not match its archive is ignored and the archive is
+ * scanned in full.
+ */
+
+#define LOG_INDEX_MAGIC "LLIDX\0\0\0"
+#define LOG_INDEX_VERSION 1
+#define LOG_INDEX_SUFFIX ".idx"
+
+/* log_index_job flags */
+#define LOG_INDEX_NEW 0x0001 /* JOB_NEW in this archive, array fields valid */
+#define LOG_INDEX_UID 0x0002 /* uid valid, from JOB_NEW or JOB_FINISH */
+
+struct log_index_job {
+    int64_t job_id;
+    int64_t array_id;
+    int32_t array_index;
+    uint32_t uid;
+    uint32_t first; /* index of the first offset of this job */
+    uint32_t count;
+    uint32_t flags;
+    uint32_t pad;
+};
+
+struct log_index_footer {
+    char magic[8];
+    uint32_t version;
+    uint32_t njobs;
+    uint64_t nrecs;
+    uint32_t nuids;
+    uint32_t crc;
+    int64_t min_job_id;
+    int64_t max_job_id;
+    int64_t min_time;
+    int64_t max_time;
+    uint64_t archive_size;
+    int64_t archive_mtime;
+};
+
+struct log_index {
+    struct log_index_footer f;
+    struct log_index_job *jobs; /* NULL until log_index_load() */
+    uint64_t *offsets;
+    uint32_t *uids;
+    char *path;
+};
+
+/*
+ * Scan the archive at path and write path.idx next to it, through a
+ * temporary file and rename. Returns 0 on success, -1 with errno set.
+ */
+int log_index_build(const char *);
+
+/*
+ * Open the index of the archive at path and validate its footer
+ * against the archive. Returns NULL with errno ENOENT when there is no
+ * index, ESTALE when it belongs to another version of the archive and
+ * EBADMSG when it is corrupt.
+ */
+struct log_index *log_index_open(const char *);
+
+/* Read the job table, offsets and uids, checking the CRC. */
+int log_index_load(struct log_index *);
+
+void log_index_close(struct log_index *);
+
+/* Entry of job_id, NULL when the archive holds no record of it. */
+const struct log_index_job *log_index_find(const struct log_index *,
+                                           int64_t);
+
+/* 1 when uid owns a job with a JOB_NEW or JOB_FINISH in the archive. */
+int log_index_has_uid(const struct log_index *, uid_t);
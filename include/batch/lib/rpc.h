@@ -45,7 +45,27 @@ enum batch_lib_op {
     BATCH_JOB_MOVE_ACK,
     BATCH_JOB_PRIORITY,
     BATCH_JOB_PRIORITY_ACK,
+    BATCH_JOB_INFO2,
+    BATCH_JOB_INFO2_ACK,
+    BATCH_JOB_SUMMARY,
+    BATCH_JOB_SUMMARY_ACK,
+    BATCH_JOB_DELTA,
+    BATCH_JOB_DELTA_ACK,
+    BATCH_JOB_SUBMIT_MANY,
+    BATCH_JOB_SUBMIT_MANY_ACK,
+    BATCH_AUTH_SESSION,
+    BATCH_AUTH_SESSION_ACK,
+    // sbd - mbd messages carrying the records of several jobs
+    BATCH_NEW_JOB_REPLY_MANY,
+    BATCH_JOB_FINISH_MANY,
+    BATCH_JOB_ACK_MANY,
 };
 
 int call_mbd(const void *, size_t, void **, struct protocol_header *);
+// reply of an asynchronous call, see call_mbd_async()
+typedef void (*mbd_reply_fn)(void *, const struct protocol_header *, XDR *);
+struct llb_conn;
+int call_mbd_async(struct llb_conn *, struct protocol_header *, void *,
+                   bool_t (*)(), size_t, mbd_reply_fn, void *);
 const char *batch_op_str(enum batch_lib_op);
+int mbd_session_open(int, int);
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Job spool.
+ *
+ * mbd keeps a directory per job under LL_STATE_DIR/mbd/jobs holding the
+ * submit sidecar and the usage of the job. The layout is
+ *
+ *   jobs/<job_id % 1000>/<job_id / 1000000>/<job_id>
+ *
+ * the first level named by the low three digits, zero padded, so that
+ * consecutive jobs spread over 1000 directories, the second by the
+ * millions, so that no directory holds more than 1000 entries up to a
+ * billion jobs. The file jobs/VERSION holds the layout version; it is
+ * written by the first mbd that uses this layout. Before it, job
+ * directories lived in jobs/<job_id % 10>/<job_id>; readers look there
+ * too until bmanifest --spool has moved them.
+ */
+
+#define SPOOL_VERSION 2
+#define SPOOL_VERSION_FILE "VERSION"
+#define SPOOL_LEGACY_BUCKETS 10
+
+/*
+ * Layout version of the spool at jobs_dir: 0 when there is no marker,
+ * the legacy layout, -1 with errno set when it cannot be read.
+ */
+int spool_version(const char *);
+
+/* Write the version marker through a temporary file and rename. */
+int spool_set_version(const char *, int);
+
+/* Directory of job_id in the current and in the legacy layout. */
+int spool_job_dir(char *, size_t, const char *, int64_t);
+int spool_legacy_dir(char *, size_t, const char *, int64_t);
+
+/*
+ * Existing directory of job_id in either layout. Returns -1 with errno
+ * ENOENT, and the current layout path in the buffer, when there is none.
+ */
+int spool_find_dir(char *, size_t, const char *, int64_t);
+
+/* Create the directory of job_id, and its parents, in the current layout. */
+int spool_create_dir(char *, size_t, const char *, int64_t);
+
+/* Create only the two levels above the directory of job_id. */
+int spool_create_parents(const char *, int64_t);
+
+/* Remove a job directory and the files in it. */
+int spool_remove_dir(const char *);
+
+/*
+ * Submit journal.
+ *
+ * mbd appends the submit sidecar of every submission, once for all the
+ * elements of an array, to LL_STATE_DIR/mbd/journal/submit.<seq>, and
+ * the JOB_NEW records of its jobs carry the segment, offset and length
+ * of that record. A segment is removed once no job in memory refers to
+ * it.
+ */
+#define SPOOL_JOURNAL_DIR "journal"
+#define SPOOL_JOURNAL_PREFIX "submit."
+
+int spool_journal_path(char *, size_t, const char *, uint32_t);
+
+/*
+ * Read the journal record at offset, length bytes, of segment seq under
+ * the mbd state directory into a malloc'ed, NUL terminated buffer.
+ */
+char *spool_journal_read(const char *, uint32_t, int64_t, uint32_t);
+
+/* Pace a loop to at most rate iterations per second, 0 for no limit. */
+struct spool_rate {
+    int rate;
+    int64_t count;
+    struct timespec start;
+};
+
+void spool_rate_init(struct spool_rate *, int);
+void spool_rate_wait(struct spool_rate *);
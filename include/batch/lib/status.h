@@ -0,0 +1,82 @@
+/* Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+#pragma once
+
+#include <stdint.h>
+#include <sys/param.h>
+
+#include "base/lib/ll.bufsiz.h"
+
+/*
+ * Cluster status file.
+ *
+ * mbd publishes the hosts, the queues and the token pools in
+ * LL_STATE_DIR/mbd/status, a file of fixed layout records that it keeps
+ * mapped and rewrites in place at every scheduling pass. Readers map it
+ * read only and copy the records under the sequence lock of the header:
+ * gen is odd while mbd writes, a copy is consistent when gen was even
+ * and unchanged across it. The number of records is fixed for the life
+ * of an mbd; a new mbd replaces the file and clears the magic of the
+ * one it replaces, so that readers still mapping it know to map again.
+ *
+ * All fields are naturally aligned, the layout changes only with
+ * LL_STATUS_VERSION.
+ */
+
+#define LL_STATUS_FILE "status"
+#define LL_STATUS_MAGIC 0x4c4c5354u /* "LLST" */
+#define LL_STATUS_VERSION 1
+
+struct ll_status_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t gen;           /* odd while mbd writes the records */
+    int64_t update_time;    /* of the last write */
+    uint64_t size;          /* of the file */
+    uint32_t nhosts;
+    uint32_t host_off;      /* from the start of the file */
+    uint32_t nqueues;
+    uint32_t queue_off;
+    uint32_t ntokens;
+    uint32_t token_off;
+};
+
+struct ll_status_host {
+    char name[MAXHOSTNAMELEN];
+    int32_t state;
+    int32_t total_cpu;
+    int32_t free_cpu;
+    int32_t total_gpu;
+    int32_t free_gpu;
+    int32_t num_jobs;
+    int32_t num_run;
+    int32_t num_susp;
+    uint64_t total_mem_mb;
+    uint64_t free_mem_mb;
+    uint64_t total_storage_mb;
+    uint64_t free_storage_mb;
+    char gpu_model[LL_BUFSIZ_64];
+    char gpu_ids[LL_BUFSIZ_64];
+};
+
+struct ll_status_queue {
+    char name[LL_BUFSIZ_64];
+    char description[LL_BUFSIZ_256];
+    int32_t status;
+    int32_t priority;
+    int32_t max_jobs;
+    int32_t num_jobs;
+    int32_t num_pend;
+    int32_t num_held;
+    int32_t num_run;
+    int32_t num_susp;
+    int32_t num_cpus_used;
+    int32_t num_hosts_used;
+};
+
+struct ll_status_token {
+    char name[LL_BUFSIZ_64];
+    int32_t total;
+    int32_t free;
+};
@@ -11,6 +11,7 @@
 
 #include "base/lib/ll.bufsiz.h"
 #include "base/lib/ll.host.h"
+#include "base/lib/auth.h"
 
 #include "llbatch.h"
 
@@ -29,6 +30,14 @@ struct wire_sbd_register {
     struct wire_sbd_job *jobs;
 };
 
+/* -----------------------------------------------------------------------
+ * session opening  (sbd or client -> mbd, and back), see base/lib/auth.h
+ * ----------------------------------------------------------------------- */
+
+struct wire_auth_session {
+    uint8_t nonce[AUTH_NONCE_SIZE];
+};
+
 /* -----------------------------------------------------------------------
  * job signal  (mbd -> sbd)
  * ----------------------------------------------------------------------- */
@@ -125,6 +134,31 @@ struct wire_job_ack {
     int32_t ack_op;
 };
 
+/* -----------------------------------------------------------------------
+ * job records of several jobs in one message  (sbd -> mbd, and back)
+ *
+ * sbd coalesces the pid replies and the finish reports it has ready in
+ * a pass of its event loop, mbd answers each message with one vector
+ * of acks. At most WIRE_JOB_BATCH_MAX records a message.
+ * ----------------------------------------------------------------------- */
+
+#define WIRE_JOB_BATCH_MAX 4096
+
+struct wire_job_reply_many {
+    int32_t num_replies;
+    struct wire_job_reply *replies;
+};
+
+struct wire_job_finish_many {
+    int32_t num_finish;
+    struct wire_job_finish *finish;
+};
+
+struct wire_job_ack_many {
+    int32_t num_acks;
+    struct wire_job_ack *acks;
+};
+
 /* -----------------------------------------------------------------------
  * job submit  (client -> mbd)
  *
@@ -176,6 +210,19 @@ struct wire_job_submit_reply {
     int64_t job_id;
 };
 
+/* -----------------------------------------------------------------------
+ * bulk submit  (client -> mbd)
+ *
+ * A uint32 count, then count pairs of a packed wire_job_submit and its
+ * wire_job_script. The reply carries the job IDs of the whole batch,
+ * consecutive in the order of the pairs: an array takes one per element.
+ * ----------------------------------------------------------------------- */
+
+struct wire_job_submit_many_reply {
+    int64_t first_id;
+    int64_t last_id;
+};
+
 /* -----------------------------------------------------------------------
  * job info request  (client -> mbd)
  * ----------------------------------------------------------------------- */
@@ -225,6 +272,80 @@ struct wire_job_query {
     int32_t uid;    /* -1 = all */
 };
 
+/*
+ * Position of a paged job listing: the list, in pend, run, finish
+ * order, the last job sent and its entry number into that list.
+ * list -1 is the start of the listing.
+ */
+struct wire_job_cursor {
+    int32_t list;
+    int64_t job_id;
+    uint64_t seq;
+};
+
+/*
+ * Predicates of a job listing, mbd sends only the jobs satisfying all
+ * of them. An empty string or 0 does not filter.
+ */
+struct wire_job_filter {
+    char queue[LL_BUFSIZ_64];
+    char name[LL_BUFSIZ_64];        /* fnmatch(3) pattern */
+    char project[LL_BUFSIZ_256];
+    char host[MAXHOSTNAMELEN];      /* one of the execution hosts */
+    int64_t array_id;               /* elements of the array */
+    int64_t submit_from;            /* submit time window, inclusive */
+    int64_t submit_to;
+    int32_t pend_reason;            /* pending for this reason */
+    int32_t has_pend_reason;        /* pend_reason filters */
+};
+
+struct wire_job_query2 {
+    struct wire_job_query query;
+    uint32_t fields;    /* LLB_JOB_F_*, 0 = all */
+    int32_t limit;      /* jobs per page, 0 = all in one reply */
+    struct wire_job_cursor after;
+    struct wire_job_filter filter;
+};
+
+/* -----------------------------------------------------------------------
+ * job info v2  (client -> mbd -> client)
+ *
+ * The request is a wire_job_query followed by the LLB_JOB_F_* fields
+ * the client wants, the page and the filter of a listing. The reply
+ * carries
+ *
+ *   fields, nhosts, host names[nhosts], njobs, wire_job_info2[njobs],
+ *   more, wire_job_cursor
+ *
+ * every job encoding only the requested fields, strings with their own
+ * length, and its execution hosts as indices into the host names sent
+ * once for the whole reply. With a limit, more is set when the listing
+ * continues after the cursor.
+ * ----------------------------------------------------------------------- */
+
+struct wire_job_info2 {
+    int64_t job_id;
+    int64_t array_id;
+    int32_t array_index;
+    uint32_t uid;
+    int32_t pid;
+    int32_t state;
+    int32_t exit_status;
+    int32_t priority;
+    int32_t pend_reason;
+    int64_t submit_time;
+    int64_t dispatch_time;
+    int64_t end_time;
+    int64_t susp_time;
+    char *name;
+    char *queue;
+    char *submit_host;
+    char *comment;
+    int32_t ncpus;     /* per execution host */
+    uint32_t nhosts;
+    uint32_t *hosts;   /* indices into the host names of the reply */
+};
+
 /* -----------------------------------------------------------------------
  * host info  (mbd -> client)
  * ----------------------------------------------------------------------- */
@@ -327,6 +448,57 @@ struct wire_job_priority {
     int32_t priority;
 };
 
+/* -----------------------------------------------------------------------
+ * job summary  (client -> mbd -> client)
+ *
+ * Counts of the jobs a listing with the filter would select, grouped
+ * by queue, user or pending reason, instead of the jobs themselves.
+ * ----------------------------------------------------------------------- */
+struct wire_job_summary_req {
+    int32_t by;                     /* LLB_SUM_* */
+    struct wire_job_filter filter;
+};
+
+struct wire_job_count {
+    char queue[LL_BUFSIZ_64];       /* LLB_SUM_QUEUE */
+    int32_t id;                     /* uid or pending reason */
+    int32_t num_pend;
+    int32_t num_held;
+    int32_t num_run;                /* with the jobs of lost hosts */
+    int32_t num_susp;
+};
+
+struct wire_job_summary {
+    int32_t ncounts;
+    struct wire_job_count *counts;
+};
+
+/* -----------------------------------------------------------------------
+ * job delta  (client -> mbd -> client)
+ *
+ * The jobs changed since a change sequence number of mbd. The reply is
+ * a v2 job info reply, whose more flag tells that changes past seq
+ * remain, followed by the epoch and seq to ask from next, a reset flag
+ * and the IDs of the jobs gone since: purged, or changed and no longer
+ * selected.
+ * ----------------------------------------------------------------------- */
+struct wire_job_delta_req {
+    int64_t epoch;                  /* of the previous reply, 0 at first */
+    uint64_t since;
+    int32_t flags;                  /* LLB_JOB_* lists, 0 for active */
+    uint32_t fields;                /* LLB_JOB_F_*, 0 for all */
+    int32_t limit;                  /* changes per reply, 0 for all */
+    struct wire_job_filter filter;
+};
+
+struct wire_job_delta_tail {
+    int64_t epoch;
+    uint64_t seq;
+    uint32_t reset;                 /* forget every job, since was unknown */
+    uint32_t ngone;
+    int64_t *gone;
+};
+
 /* -----------------------------------------------------------------------
  * XDR serializers
  * ----------------------------------------------------------------------- */
@@ -341,18 +513,30 @@ bool_t xdr_wire_host_admin(XDR *xdrs, struct wire_host_admin *);
 
 /* job */
 bool_t xdr_wire_job_state(XDR *, struct wire_job_state *);
+bool_t xdr_wire_auth_session(XDR *, struct wire_auth_session *);
 bool_t xdr_wire_job_script(XDR *, struct wire_job_script *);
 bool_t xdr_wire_job_sig(XDR *, struct wire_job_sig *);
 bool_t xdr_wire_job_submit(XDR *, struct wire_job_submit *);
 bool_t xdr_wire_job_submit_reply(XDR *, struct wire_job_submit_reply *);
+bool_t xdr_wire_job_submit_packed(XDR *, struct wire_job_submit *);
+bool_t xdr_wire_job_submit_many_reply(XDR *,
+                                      struct wire_job_submit_many_reply *);
 bool_t xdr_wire_job_info_req(XDR *, struct wire_job_info_req *);
 bool_t xdr_wire_job_info(XDR *, struct wire_job_info *);
+bool_t xdr_wire_job_info2(XDR *, struct wire_job_info2 *, uint32_t);
+size_t wire_job_info2_size(const struct wire_job_info2 *, uint32_t);
 bool_t xdr_wire_job_info_array(XDR *, struct wire_job_info_array *);
 bool_t xdr_wire_job_start(XDR *, struct wire_job_start *);
 bool_t xdr_wire_job_reply(XDR *, struct wire_job_reply *);
 bool_t xdr_wire_job_ack(XDR *, struct wire_job_ack *);
 bool_t xdr_wire_job_finish(XDR *, struct wire_job_finish *);
+bool_t xdr_wire_job_reply_many(XDR *, struct wire_job_reply_many *);
+bool_t xdr_wire_job_finish_many(XDR *, struct wire_job_finish_many *);
+bool_t xdr_wire_job_ack_many(XDR *, struct wire_job_ack_many *);
 bool_t xdr_wire_job_query(XDR *, struct wire_job_query *);
+bool_t xdr_wire_job_query2(XDR *, struct wire_job_query2 *);
+bool_t xdr_wire_job_cursor(XDR *, struct wire_job_cursor *);
+bool_t xdr_wire_job_filter(XDR *, struct wire_job_filter *);
 
 /* host */
 bool_t xdr_wire_host_info(XDR *, struct wire_host_info *);
@@ -370,4 +554,9 @@ bool_t xdr_wire_token_info(XDR *, struct wire_token_info *);
 bool_t xdr_wire_token_info_array(XDR *, struct wire_token_info_array *);
 
 bool_t xdr_wire_job_move(XDR *, struct wire_job_move *);
+bool_t xdr_wire_job_summary_req(XDR *, struct wire_job_summary_req *);
+bool_t xdr_wire_job_count(XDR *, struct wire_job_count *);
+bool_t xdr_wire_job_summary(XDR *, struct wire_job_summary *);
+bool_t xdr_wire_job_delta_req(XDR *, struct wire_job_delta_req *);
+bool_t xdr_wire_job_delta_tail(XDR *, struct wire_job_delta_tail *);
 bool_t xdr_wire_job_priority(XDR *, struct wire_job_priority *);
@@ -5,6 +5,7 @@
 #include "base/lib/ll.protocol.h"
 #include "batch/lib/rpc.h"
 #include "batch/lib/wire.h"
+#include "batch/lib/log.h"
 #include "base/lib/ll.bufsiz.h"
 #include "base/lib/ll.sys.h"
 #include "base/lib/ll.hash.h"
@@ -22,6 +23,14 @@ enum job_list_id {
     JOB_LIST_FINISH,
 };
 
+#define JOB_LISTS (JOB_LIST_FINISH + 1)
+
+// chan_set_owner() owner of a channel, client channels have none
+enum mbd_chan_owner {
+    MBD_CHAN_CLIENT = 0,
+    MBD_CHAN_SBD, // owner_data is the struct mbd_host
+};
+
 // mbd_die exit value
 enum mbd_exit {
     MBD_EXIT_CONF = 200,
@@ -59,6 +68,13 @@ struct job_resources {
     struct ll_list tokens;
 };
 
+/* Location of a submit sidecar in the submit journal, len 0 for none */
+struct journal_ref {
+    uint32_t seq;
+    uint32_t len;
+    int64_t off;
+};
+
 struct job_data {
     struct ll_list_entry ent;
     int64_t job_id;
@@ -83,7 +99,11 @@ struct job_data {
     char name[LL_BUFSIZ_64];
     uint32_t flags;
     enum job_list_id list_id;
+    uint64_t list_seq; /* order of entry into its list, for job listings */
+    uint64_t change_seq; /* last change a listing shows, see job_touch() */
     enum pend_reason pend_reason;
+    int payload_failures; /* dispatches that could not read the payload,
+                           * in a row */
     struct ll_list deps;
     char depend_cond[LL_BUFSIZ_4K]; /* raw text, for compaction rewrite */
     int32_t dep_refcnt; /* pending jobs whose deps still reference this job_id */
@@ -100,6 +120,10 @@ struct job_data {
      * Blocks compaction from purging the head while > 0 — see
      * job_move_list()/events_rebuild(). Zero on ordinary jobs. */
     int32_t array_element_cnt;
+    char script[LOG_SCRIPT_HASH_LEN + 1]; /* script store hash, "" for
+                                            * a per-job script.sh */
+    struct journal_ref journal; /* submit sidecar, len 0 for a sidecar
+                                 * file in the spool directory */
 };
 
 struct gpu_id {
@@ -180,6 +204,7 @@ struct mbd_queue {
     int state;
     int num_cpus_used;        /* CPUs consumed by running jobs in this queue */
     int num_hosts_used;       /* distinct exec hosts in use by running jobs  */
+    int queue_idx;            /* dense index assigned at conf_init */
     struct ll_hash host_hash; /* expanded host membership, keyed by hostname */
     struct ll_hash user_hash; /* expanded user membership, empty = all allowed */
 };
@@ -202,10 +227,118 @@ struct mbd_token_pool {
     int free;
 };
 
-#define JOB_BUCKETS 10
 #define SCHED_PLAN_MAX 1024
 #define SCHED_TIMER 2
 
+/* dispatch staging cache key, see stage.c */
+#define STAGE_KEY_LEN (LOG_SCRIPT_HASH_LEN + LL_BUFSIZ_32)
+
+/*
+ * Query snapshot, see query.c. Job, host, queue, group and token
+ * queries are answered from an immutable copy of the state they
+ * report, published by the main thread; the jobs are read by the query
+ * thread, the others are kept as their encoded reply. A part is freed
+ * when the main thread has replaced it and no request uses it.
+ */
+struct query_part {
+    int refs;
+    uint64_t gen;       /* query generation it was built at */
+    void (*free)(struct query_part *);
+};
+
+/*
+ * A job as it is listed. Strings are offsets into the strings of the
+ * snapshot, hosts into its host_idx array. Queues and hosts live as
+ * long as mbd, so the snapshot points at them.
+ */
+struct query_job {
+    int64_t job_id;
+    int64_t array_id;
+    int32_t array_index;
+    int32_t array_start;
+    int32_t array_end;
+    int32_t array_stride;
+    uid_t uid;
+    pid_t pid;
+    int32_t state;      /* public state, UNKNOWN on a lost host */
+    int32_t exit_status;
+    int32_t priority;
+    int32_t pend_reason;
+    int32_t ncpus;
+    int32_t nhosts;
+    uint32_t hosts;
+    uint32_t name;
+    uint32_t project;
+    uint64_t list_seq;
+    uint64_t change_seq;
+    int64_t submit_time;
+    int64_t dispatch_time;
+    int64_t end_time;
+    int64_t susp_time;
+    const struct mbd_queue *queue;
+};
+
+/* A job purged by compaction, for delta job queries */
+struct job_tomb {
+    int64_t job_id;
+    uid_t uid;
+    uint64_t seq;
+};
+
+/* The counters of a queue job.c maintains, as they were at the snapshot */
+struct query_queue_count {
+    const struct mbd_queue *queue;
+    int32_t num_pend;
+    int32_t num_held;
+    int32_t num_run;
+    int32_t num_susp;
+};
+
+/*
+ * Jobs of a snapshot by queue or by execution host: those of key k are
+ * jobs[start[k]..start[k + 1]), indices into the jobs of the snapshot
+ * in ascending order, so in list order.
+ */
+struct query_index {
+    int32_t *start;
+    int32_t *jobs;
+};
+
+struct query_jobs {
+    struct query_part part;
+    int njobs;
+    struct query_job *jobs;     /* pend, run then finish, in list order */
+    int start[JOB_LISTS + 1];   /* list l is jobs[start[l]..start[l + 1]) */
+    uint32_t nslots;
+    int32_t *slots;             /* job_id -> index + 1, 0 for none */
+    char *strings;
+    uint32_t *host_idx;
+    int nhosts;
+    struct mbd_host **hosts;    /* by host_idx */
+    int nqueues;
+    struct query_queue_count *queues;   /* in queue_list order */
+    struct query_index by_queue;        /* by queue_idx */
+    struct query_index by_host;         /* by host_idx */
+    int64_t epoch;
+    uint64_t change_seq;        /* of the last change in the snapshot */
+    uint64_t tomb_floor;
+    int ntombs;
+    struct job_tomb *tombs;     /* in change_seq order */
+};
+
+/* An encoded reply, sent as is to every request for it */
+struct query_reply {
+    struct query_part part;
+    struct chan_shared *msg;
+};
+
+/* What a message may change, see query_touch() */
+#define QUERY_TOUCH_JOBS 0x01
+#define QUERY_TOUCH_HOSTS 0x02
+#define QUERY_TOUCH_QUEUES 0x04
+#define QUERY_TOUCH_TOKENS 0x08
+#define QUERY_TOUCH_ALL 0x0f
+
 struct sched_plan {
     struct mbd_host *hosts[SCHED_PLAN_MAX]; /* hosts[0] is exec host */
     int nhosts;
@@ -229,6 +362,11 @@ struct pend_diag {
 
 extern int64_t job_id_seq;
 extern struct ll_hash job_id_hash;
+extern int64_t job_epoch;
+extern uint64_t job_change_seq;
+extern struct job_tomb *job_tombs;
+extern int job_ntombs;
+extern uint64_t job_tomb_floor;
 
 extern struct ll_list pend_jobs_list;
 extern struct ll_list run_jobs_list;
@@ -238,8 +376,6 @@ extern struct ll_list host_list;
 extern struct ll_hash host_name_hash;
 extern struct ll_hash host_addr_hash;
 
-extern struct ll_hash sbd_chan_hash;
-
 extern struct ll_list group_list;
 extern struct ll_hash group_name_hash;
 
@@ -273,6 +409,11 @@ int mbd_accept(int);
 void mbd_message(int);
 int enqueue_payload(int, struct protocol_header *, void *, size_t,
                     bool_t (*xdr_func)());
+int encode_payload(struct protocol_header *, void *, size_t,
+                   bool_t (*xdr_func)(), struct chan_buffer **);
+int enqueue_buf(int, struct chan_buffer *);
+void net_flush(void);
+void net_reply_sequence(int32_t);
 int32_t enqueue_header(int, int, int);
 void chan_shutdown(int);
 int valid_batch_op(int);
@@ -292,18 +433,81 @@ void event_job_finish(const struct job_data *);
 void event_job_pend_susp(const struct job_data *);
 void event_job_pend_resume(const struct job_data *);
 void event_job_susp(const struct job_data *);
+void event_sync(void);
 void maybe_rebuild_manifest(void);
+void spool_reap_segment(uint32_t);
+void maybe_checkpoint(void);
+int replay_record(const struct log_record *, int64_t *);
 void event_job_move(const struct job_data *, const char *);
 void event_job_priority(const struct job_data *, int32_t);
 void event_job_pend(const struct job_data *);
 
+// replay.c
+int replay_parallel(int, off_t, const char *, int, int64_t *, int *);
+
+// script.c
+int script_store_init(void);
+int script_store_put(const struct wire_job_script *, char *);
+int script_store_stage(const struct wire_job_script *, char *);
+int script_store_sync(void);
+void script_store_drop(const char *);
+int script_store_path(const char *, char *, size_t);
+void script_ref(const char *);
+void script_unref(const char *);
+void script_store_gc(void);
+void script_store_sweep(void);
+
+// journal.c
+int journal_init(void);
+int journal_append(const char *, size_t, struct journal_ref *);
+void journal_commit(void);
+char *journal_read(const struct journal_ref *);
+void journal_ref(const struct journal_ref *);
+void journal_unref(const struct journal_ref *);
+void journal_gc(void);
+void journal_sweep(void);
+
+// stage.c
+int stage_init(void);
+void stage_put(const char *, const char *, size_t);
+const char *stage_get(const char *, size_t *);
+void stage_journal_key(char *, size_t, const struct journal_ref *);
+void stage_script_key(char *, size_t, const char *);
+int64_t stage_clock(void);
+void stage_record(int64_t, int);
+void stage_report(void);
+
+// status.c
+int status_init(void);
+void status_publish(void);
+
+// query.c
+int query_init(void);
+int query_op(int);
+int query_request(int, const struct protocol_header *, struct chan_buffer *,
+                  u_int);
+void query_touch(unsigned);
+void query_flush(void);
+void query_done(void);
+void query_cancel(int);
+int query_timeout(void);
+const struct query_job *query_job_find(const struct query_jobs *, int64_t);
+extern int chan_query;
+
 // dispatch.c
-int jobs_info(XDR *, int, const struct protocol_header *);
+int jobs_info(XDR *, const struct protocol_header *, const struct query_jobs *,
+              struct chan_buffer **);
+int jobs_info2(XDR *, const struct protocol_header *,
+               const struct query_jobs *, struct chan_buffer **);
+int jobs_summary(XDR *, const struct protocol_header *,
+                 const struct query_jobs *, struct chan_buffer **);
+int jobs_delta(XDR *, const struct protocol_header *,
+               const struct query_jobs *, struct chan_buffer **);
 int mbd_sbd_register(XDR *, int);
-int hosts_info(XDR *, int);
-int queues_info(XDR *, int);
-int host_group_info(XDR *, int);
-int tokens_info(XDR *, int);
+int hosts_info(struct chan_buffer **);
+int queues_info(struct chan_buffer **);
+int host_group_info(struct chan_buffer **);
+int tokens_info(struct chan_buffer **);
 
 // admin.c
 int host_admin(XDR *, int, const struct protocol_header *);
@@ -311,6 +515,7 @@ int queue_admin(XDR *, int, const struct protocol_header *);
 
 // job.c
 void job_register(XDR *, int, const struct protocol_header *);
+void job_register_many(XDR *, int, const struct protocol_header *);
 int job_move(XDR *, int, const struct protocol_header *);
 int job_priority(XDR *, int, const struct protocol_header *);
 int jobs_signal(XDR *, int, const struct protocol_header *);
@@ -324,6 +529,10 @@ void job_array_element_finished(struct job_data *);
 struct job_data *job_find(int64_t);
 struct job_data *job_find_array(int64_t, int32_t);
 void job_set_list(struct job_data *, struct ll_list *, enum job_list_id);
+void job_touch(struct job_data *);
+void job_hold(struct job_data *);
+void job_touch_host(const struct mbd_host *);
+void job_tombstone(const struct job_data *);
 
 void machines_hash_populate(struct ll_hash *, const char *);
 void mbd_job_signal_reply(struct mbd_host *, XDR *, struct protocol_header *);
@@ -331,7 +540,7 @@ char *job_state_str(int);
 void token_alloc(const struct job_data *);
 void token_pool_release(const struct job_data *);
 void job_free(struct job_data *);
-void job_id_seq_write(void);
+void job_id_seq_lease(void);
 int gpu_ids_count_free(const struct mbd_gpu *);
 int gpu_ids_mark_free(struct mbd_gpu *, int);
 int gpu_ids_mark_inuse(struct mbd_gpu *, int);
@@ -345,7 +554,10 @@ void job_replay_deps(struct job_data *, const char *);
 int32_t mbd_sbd_route(struct mbd_host *);
 int mbd_sbd_disconnect(struct mbd_host *);
 void mbd_new_job_reply(struct mbd_host *, XDR *, struct protocol_header *);
+void mbd_new_job_reply_many(struct mbd_host *, XDR *,
+                            struct protocol_header *);
 void mbd_job_finish(struct mbd_host *, XDR *);
+void mbd_job_finish_many(struct mbd_host *, XDR *);
 void mbd_job_missing(struct mbd_host *, XDR *);
 
 // debug counters
@@ -144,6 +144,7 @@ void sbd_job_new_reply_ack(XDR *);
 
 int sbd_job_finish(struct sbd_job *);
 void sbd_job_finish_ack(XDR *);
+void sbd_job_ack_many(XDR *);
 
 int sbd_job_signal(XDR *);
 int sbd_enqueue_job_missing(int64_t);
@@ -173,6 +174,10 @@ int sbd_client(int);
  * Wire send helpers.
  */
 int sbd_send_msg(int32_t, int32_t, void *, size_t, bool_t (*)());
+int sbd_send_init(void);
+int sbd_send_job_reply(struct wire_job_reply *);
+int sbd_send_job_finish(struct wire_job_finish *);
+void sbd_send_flush(void);
 int write_all(int, const char *, size_t);
 
 /* cgroups
@@ -41,6 +41,7 @@ enum pend_reason {
     PEND_HOST_EXCLUSIVE,
     PEND_HOST_OVERFLOW,
     PEND_DEPEND,
+    PEND_PAYLOAD,
 };
 
 // Pending messages table
@@ -102,12 +103,73 @@ struct job_submit {
 #define LLB_JOB_RUN 0x0008
 #define LLB_JOB_HELD 0x0010
 
+// llb_job_info fields, job_id, array_id and array_index are always set
+#define LLB_JOB_F_USER 0x0001        /* uid */
+#define LLB_JOB_F_STATE 0x0002       /* state, exit_status, pend_reason */
+#define LLB_JOB_F_PID 0x0004
+#define LLB_JOB_F_PRIORITY 0x0008
+#define LLB_JOB_F_TIMES 0x0010       /* submit, dispatch, end, susp */
+#define LLB_JOB_F_NAME 0x0020
+#define LLB_JOB_F_QUEUE 0x0040
+#define LLB_JOB_F_SUBMIT_HOST 0x0080
+#define LLB_JOB_F_RUN_HOSTS 0x0100
+#define LLB_JOB_F_COMMENT 0x0200
+#define LLB_JOB_F_ALL 0x03ff
+
+// llb_job_summary groups
+#define LLB_SUM_QUEUE 1
+#define LLB_SUM_USER 2
+#define LLB_SUM_PEND_REASON 3
+
+/*
+ * Filter of a job listing, evaluated by mbd; a job is listed when it
+ * satisfies every predicate set. NULL or 0 does not filter, but for
+ * pend_reason which filters when has_pend_reason is set, so that
+ * PEND_NONE can be selected. Ignored for a job reference.
+ */
+struct job_filter {
+    const char *queue;
+    const char *name;     /* glob, see fnmatch(3) */
+    const char *project;
+    const char *host;     /* runs or ran on this host */
+    int64_t array_id;     /* elements of this array */
+    time_t submit_from;   /* submitted within [from, to] */
+    time_t submit_to;
+    int32_t pend_reason;  /* pending for this reason */
+    int32_t has_pend_reason;
+};
+
+/* One group of llb_job_summary(), the active jobs in it by state */
+struct job_count {
+    char *queue;          /* LLB_SUM_QUEUE, NULL otherwise */
+    int32_t id;           /* uid, LLB_SUM_USER, or pend_reason */
+    int32_t num_pend;
+    int32_t num_held;
+    int32_t num_run;      /* with the jobs of unavailable hosts */
+    int32_t num_susp;
+};
+
+/* One reply of llb_job_delta() */
+struct job_delta {
+    int64_t epoch;        /* pass back with seq to the next call */
+    uint64_t seq;
+    int32_t reset;        /* forget the jobs kept so far, before jobs */
+    int32_t more;         /* changes past seq remain, call again */
+    int32_t njobs;
+    struct job_info *jobs;  /* changed jobs the listing selects */
+    int32_t ngone;
+    int64_t *gone;          /* jobs purged or no longer selected */
+};
+
 struct job_info_req {
     int64_t job_id;       /* -1 = all */
     int64_t array_id;     /* 0 = not an array reference */
     int32_t array_index;
     int32_t uid;          /* -1 = all */
     int32_t flags;        /* LLB_JOB_* */
+    uint32_t fields;      /* LLB_JOB_F_*, 0 = all; strings of the fields
+                           * not requested are NULL */
+    struct job_filter filter;
 };
 
 /* runtime resource usage, reported sbd via cgroup at the end of the job
@@ -272,17 +334,55 @@ struct job_hist_info {
 
 // bsub
 int32_t llb_submit(const struct job_submit *, int64_t *);
+// many submissions in one request, all or none of them are created
+#define LLB_SUBMIT_MANY_MAX 10000
+int32_t llb_submit_many(const struct job_submit *, int32_t, int64_t *);
 int32_t llb_parse_array(const char *, int32_t *, int32_t *, int32_t *);
 int32_t llb_parse_dependency(const char *);
 
 // bjobs
 struct job_info *llb_job_info(const struct job_info_req *, int32_t *);
 void llb_free_job_info(struct job_info *, int32_t);
+struct llb_job_iter;
+struct llb_job_iter *llb_job_iter_open(const struct job_info_req *, int32_t);
+struct job_info *llb_job_iter_next(struct llb_job_iter *, int32_t *);
+void llb_job_iter_close(struct llb_job_iter *);
+struct job_count *llb_job_summary(int32_t, const struct job_filter *,
+                                  int32_t *);
+void llb_free_job_summary(struct job_count *, int32_t);
+int llb_job_delta(const struct job_info_req *, int64_t, uint64_t, int32_t,
+                  struct job_delta *);
+void llb_free_job_delta(struct job_delta *);
+
+// asynchronous calls, many in flight on one connection to mbd; watch
+// llb_conn_fd() for input and call llb_conn_dispatch() when readable
+struct llb_conn;
+struct llb_conn *llb_conn_open(void);
+void llb_conn_close(struct llb_conn *);
+int llb_conn_fd(const struct llb_conn *);
+int llb_conn_pending(const struct llb_conn *);
+int llb_conn_dispatch(struct llb_conn *, int);
+typedef void (*llb_signal_cb)(int32_t, void *);
+int32_t llb_signal_job_async(struct llb_conn *, int64_t, int32_t, int32_t,
+                             llb_signal_cb, void *);
+typedef void (*llb_job_info_cb)(int32_t, struct job_info *, int32_t, void *);
+int llb_job_info_async(struct llb_conn *, const struct job_info_req *,
+                       llb_job_info_cb, void *);
 
 // bhosts
 struct host_info *llb_host_info(int32_t *);
 void llb_free_host_info(struct host_info *, int32_t);
 
+// status file of mbd, read without calling it
+struct llb_status;
+struct llb_status *llb_status_open(void);
+void llb_status_close(struct llb_status *);
+time_t llb_status_time(struct llb_status *);
+struct host_info *llb_status_host_info(struct llb_status *, int32_t *);
+struct queue_info *llb_status_queue_info(struct llb_status *, int32_t *);
+struct token_pool_info *llb_status_token_info(struct llb_status *,
+                                              int32_t *);
+
 // bmgroup
 struct host_group *llb_group_info(int32_t *);
 void llb_free_group_info(struct host_group *, int32_t);
@@ -307,6 +407,8 @@ struct job_hist_info *llb_hist_info(int64_t, int64_t, int32_t, uid_t, int32_t *)
 void llb_free_hist_info(struct job_hist_info *, int32_t);
 int llb_caller_is_admin(void);
 void llb_free_hist_entry(struct job_hist_info *);
+typedef int (*llb_hist_cb)(struct job_hist_info *, void *);
+int llb_hist_foreach(int64_t, int64_t, int32_t, uid_t, llb_hist_cb, void *);
 
 // bmove
 int32_t llb_move_job(int64_t, const char *);
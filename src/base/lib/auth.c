@@ -4,11 +4,13 @@
 
 #include <fcntl.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/random.h>
+#include <openssl/crypto.h>
 #include <openssl/hmac.h>
 
 #include "base/lib/ll.protocol.h"
@@ -171,3 +173,247 @@ int auth_verify_header(const struct protocol_header *hdr)
 
     return 0;
 }
+
+/*
+ * Sessions, see auth.h.
+ */
+
+// Offsets in an encoded header: eight 32 bit words, then hmac
+#define HDR_UID_OFF 20
+#define HDR_GID_OFF 24
+#define HDR_TIMESTAMP_OFF 28
+#define HDR_HMAC_OFF 32
+
+struct auth_session {
+    uint64_t tx_key[2];
+    uint64_t rx_key[2];
+    uint64_t tx; // counter of the last message signed
+    uint64_t rx; // counter of the last message verified
+    uint32_t uid;
+    uint32_t gid;
+};
+
+#define ROTL(x, b) (uint64_t) (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND                                                               \
+    do {                                                                       \
+        v0 += v1;                                                              \
+        v1 = ROTL(v1, 13);                                                     \
+        v1 ^= v0;                                                              \
+        v0 = ROTL(v0, 32);                                                     \
+        v2 += v3;                                                              \
+        v3 = ROTL(v3, 16);                                                     \
+        v3 ^= v2;                                                              \
+        v0 += v3;                                                              \
+        v3 = ROTL(v3, 21);                                                     \
+        v3 ^= v0;                                                              \
+        v2 += v1;                                                              \
+        v1 = ROTL(v1, 17);                                                     \
+        v1 ^= v2;                                                              \
+        v2 = ROTL(v2, 32);                                                     \
+    } while (0)
+
+static uint64_t load_le64(const uint8_t *p)
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static void store_le64(uint8_t *p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++)
+        p[i] = (uint8_t) (v >> (8 * i));
+}
+
+/* SipHash-2-4 with a 128 bit tag, of the reference implementation. */
+static void siphash128(const uint64_t key[2], const uint8_t *in, size_t len,
+                       uint8_t out[16])
+{
+    uint64_t v0 = 0x736f6d6570736575ULL ^ key[0];
+    uint64_t v1 = 0x646f72616e646f6dULL ^ key[1] ^ 0xee;
+    uint64_t v2 = 0x6c7967656e657261ULL ^ key[0];
+    uint64_t v3 = 0x7465646279746573ULL ^ key[1];
+    const uint8_t *end = in + (len & ~(size_t) 7);
+
+    for (; in != end; in += 8) {
+        uint64_t m = load_le64(in);
+        v3 ^= m;
+        SIPROUND;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    uint64_t b = (uint64_t) len << 56;
+    for (size_t i = 0; i < (len & 7); i++)
+        b |= (uint64_t) in[i] << (8 * i);
+
+    v3 ^= b;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xee;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    store_le64(out, v0 ^ v1 ^ v2 ^ v3);
+
+    v1 ^= 0xdd;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    store_le64(out + 8, v0 ^ v1 ^ v2 ^ v3);
+}
+
+/* The tag of a message: its header up to hmac, then the counter. */
+static void session_tag(const uint64_t key[2], const char *pkt,
+                        uint64_t counter, uint8_t tag[AUTH_SESSION_TAG_SIZE])
+{
+    uint8_t in[HDR_HMAC_OFF + 8];
+
+    memcpy(in, pkt, HDR_HMAC_OFF);
+    store_le64(in + HDR_HMAC_OFF, counter);
+    siphash128(key, in, sizeof(in), tag);
+}
+
+static void put_be32(char *p, uint32_t v)
+{
+    p[0] = (char) (v >> 24);
+    p[1] = (char) (v >> 16);
+    p[2] = (char) (v >> 8);
+    p[3] = (char) v;
+}
+
+int auth_nonce(uint8_t *nonce)
+{
+    if (getrandom(nonce, AUTH_NONCE_SIZE, 0) != AUTH_NONCE_SIZE) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * auth_session_new - the session of the nonces exchanged by the end that
+ * opened it, initiator, and the one that accepted it. The keys are the
+ * two halves of an HMAC of both nonces with the cluster key.
+ */
+struct auth_session *auth_session_new(const uint8_t *nonce_init,
+                                      const uint8_t *nonce_accept,
+                                      int initiator)
+{
+    if (auth_load_key() < 0)
+        return NULL;
+
+    static const char label[] = "lavalite session";
+    uint8_t in[sizeof(label) + 2 * AUTH_NONCE_SIZE];
+    memcpy(in, label, sizeof(label));
+    memcpy(in + sizeof(label), nonce_init, AUTH_NONCE_SIZE);
+    memcpy(in + sizeof(label) + AUTH_NONCE_SIZE, nonce_accept,
+           AUTH_NONCE_SIZE);
+
+    uint8_t k[AUTH_KEY_SIZE];
+    unsigned int len = 0;
+    if (HMAC(EVP_sha256(), auth_key, AUTH_KEY_SIZE, in, sizeof(in), k, &len)
+            == NULL
+        || len != AUTH_KEY_SIZE) {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    struct auth_session *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        OPENSSL_cleanse(k, sizeof(k));
+        return NULL;
+    }
+
+    // the first half signs what the initiator sends
+    uint64_t *send = initiator ? s->tx_key : s->rx_key;
+    uint64_t *recv = initiator ? s->rx_key : s->tx_key;
+    send[0] = load_le64(k);
+    send[1] = load_le64(k + 8);
+    recv[0] = load_le64(k + 16);
+    recv[1] = load_le64(k + 24);
+    OPENSSL_cleanse(k, sizeof(k));
+
+    s->uid = (uint32_t) getuid();
+    s->gid = (uint32_t) getgid();
+    return s;
+}
+
+void auth_session_free(struct auth_session *s)
+{
+    if (s == NULL)
+        return;
+    OPENSSL_cleanse(s, sizeof(*s));
+    free(s);
+}
+
+/*
+ * auth_sign_packet - sign the encoded header at the start of pkt, with
+ * the session when there is one, else as auth_sign_header() does. The
+ * messages of a session must be sent in the order they are signed.
+ */
+int auth_sign_packet(struct auth_session *s, char *pkt)
+{
+    if (s == NULL) {
+        struct protocol_header hdr;
+        XDR xdrs;
+
+        xdrmem_create(&xdrs, pkt, PACKET_HEADER_SIZE, XDR_DECODE);
+        int ok = xdr_pack_hdr(&xdrs, &hdr);
+        xdr_destroy(&xdrs);
+        if (!ok || auth_sign_header(&hdr) < 0) {
+            errno = errno ? errno : EPROTO;
+            return -1;
+        }
+
+        xdrmem_create(&xdrs, pkt, PACKET_HEADER_SIZE, XDR_ENCODE);
+        ok = xdr_pack_hdr(&xdrs, &hdr);
+        xdr_destroy(&xdrs);
+        if (!ok) {
+            errno = EPROTO;
+            return -1;
+        }
+        return 0;
+    }
+
+    uint64_t counter = ++s->tx;
+
+    put_be32(pkt + HDR_UID_OFF, s->uid);
+    put_be32(pkt + HDR_GID_OFF, s->gid);
+    put_be32(pkt + HDR_TIMESTAMP_OFF, (uint32_t) counter);
+    memset(pkt + HDR_HMAC_OFF, 0, AUTH_KEY_SIZE);
+    session_tag(s->tx_key, pkt, counter, (uint8_t *) pkt + HDR_HMAC_OFF);
+
+    return 0;
+}
+
+/*
+ * auth_verify_packet - verify a message received on a channel, pkt its
+ * encoded header and hdr the same decoded: with the session of the
+ * channel when there is one, else with auth_verify_header().
+ */
+int auth_verify_packet(struct auth_session *s, const char *pkt,
+                       const struct protocol_header *hdr)
+{
+    if (s == NULL)
+        return auth_verify_header(hdr);
+
+    if (!auth_required)
+        return 0;
+
+    uint8_t tag[AUTH_SESSION_TAG_SIZE];
+    session_tag(s->rx_key, pkt, s->rx + 1, tag);
+    if (CRYPTO_memcmp(tag, pkt + HDR_HMAC_OFF, sizeof(tag)) != 0) {
+        errno = EACCES;
+        return -1;
+    }
+
+    s->rx++;
+    return 0;
+}
@@ -3,12 +3,16 @@
 
 #include <string.h>
 #include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
 #include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include <netinet/in.h>
@@ -17,51 +21,193 @@
 #include "base/lib/ll.list.h"
 #include "base/lib/ll.channel.h"
 #include "base/lib/ll.bufsiz.h"
+#include "base/lib/auth.h"
 
-struct chan_data channels[CHAN_MAX];
+/* Indexed by descriptor, chan_max slots, see chan_init() */
+struct chan_data *channels;
+int chan_max;
+
+/*
+ * Message buffers come from per thread pools of a few size classes, the
+ * query thread of mbd allocating and freeing them too. A thread keeps
+ * up to CHAN_POOL_KEEP bytes of each class; larger messages and the
+ * excess go to malloc. Pooled blocks are plain malloc'ed blocks, so
+ * free() remains valid on any of them.
+ */
+#define CHAN_POOL_KEEP (1024 * 1024)
+#define CHAN_BUF_KEEP 1024
+// The receive ring is one pooled block of the 16K class
+#define CHAN_RING_SIZE 16384
+
+static const int pool_class[] = {256, 1024, 4096, 16384, 65536};
+#define CHAN_POOL_CLASSES ((int) (sizeof(pool_class) / sizeof(pool_class[0])))
+
+struct pool_block {
+    struct pool_block *next;
+};
+
+static __thread struct pool_block *pool_free[CHAN_POOL_CLASSES];
+static __thread int pool_count[CHAN_POOL_CLASSES];
+static __thread struct pool_block *buf_free;
+static __thread int buf_count;
+
+/* A block of at least size bytes, its class in *cap, 0 if malloc'ed. */
+static char *pool_get(int size, int *cap)
+{
+    for (int i = 0; i < CHAN_POOL_CLASSES; i++) {
+        if (size > pool_class[i])
+            continue;
+
+        *cap = pool_class[i];
+        struct pool_block *b = pool_free[i];
+        if (b == NULL)
+            return malloc((size_t) pool_class[i]);
+        pool_free[i] = b->next;
+        pool_count[i]--;
+        return (char *) b;
+    }
+
+    *cap = 0;
+    return malloc((size_t) size);
+}
+
+static void pool_put(char *data, int cap)
+{
+    if (data == NULL)
+        return;
+
+    for (int i = 0; i < CHAN_POOL_CLASSES; i++) {
+        if (cap != pool_class[i])
+            continue;
+        if (pool_count[i] >= CHAN_POOL_KEEP / cap)
+            break;
+
+        struct pool_block *b = (struct pool_block *) data;
+        b->next = pool_free[i];
+        pool_free[i] = b;
+        pool_count[i]++;
+        return;
+    }
+
+    free(data);
+}
 
 static struct chan_buffer *make_buf(void)
 {
-    struct chan_buffer *buf = calloc(1, sizeof(*buf));
+    struct pool_block *b = buf_free;
+    if (b == NULL)
+        return calloc(1, sizeof(struct chan_buffer));
+
+    buf_free = b->next;
+    buf_count--;
+
+    struct chan_buffer *buf = (struct chan_buffer *) b;
+    memset(buf, 0, sizeof(*buf));
+    return buf;
+}
+
+static void put_buf(struct chan_buffer *buf)
+{
+    if (buf_count >= CHAN_BUF_KEEP) {
+        free(buf);
+        return;
+    }
+
+    struct pool_block *b = (struct pool_block *) buf;
+    b->next = buf_free;
+    buf_free = b;
+    buf_count++;
+}
+
+/* A pooled buffer for a received message of len bytes. */
+static struct chan_buffer *msg_buf(int len)
+{
+    struct chan_buffer *buf = make_buf();
     if (!buf)
         return NULL;
 
-    // link is zeroed by calloc; no sentinel init needed with ll_list
+    buf->data = pool_get(len, &buf->cap);
+    if (!buf->data) {
+        put_buf(buf);
+        return NULL;
+    }
+    buf->len = len;
+
     return buf;
 }
 
-static void doread(struct chan_data *chan)
+static void ring_release(struct chan_data *chan)
 {
-    struct chan_buffer *rcvbuf;
-    int cc;
+    pool_put(chan->ring, CHAN_RING_SIZE);
+    chan->ring = NULL;
+    chan->ring_start = 0;
+    chan->ring_end = 0;
+}
 
-    // Get or create receive buffer
-    if (ll_list_is_empty(&chan->recv)) {
-        rcvbuf = make_buf();
-        if (!rcvbuf) {
-            chan->chan_events = CHAN_EPOLLERR;
-            return;
+/*
+ * Cut the complete messages out of the ring onto the recv list. A
+ * message that cannot fit in the ring moves to a buffer of its own,
+ * where doread() reads the rest of it.
+ */
+static int ring_frame(struct chan_data *chan)
+{
+    while (chan->ring_end - chan->ring_start >= PACKET_HEADER_SIZE) {
+        char *p = chan->ring + chan->ring_start;
+        int avail = chan->ring_end - chan->ring_start;
+        struct protocol_header hdr;
+        XDR xdrs;
+
+        xdrmem_create(&xdrs, p, PACKET_HEADER_SIZE, XDR_DECODE);
+        if (!xdr_pack_hdr(&xdrs, &hdr)) {
+            xdr_destroy(&xdrs);
+            return -1;
         }
-        ll_list_append(&chan->recv, &rcvbuf->link);
-    } else {
-        rcvbuf = (struct chan_buffer *) chan->recv.head;
-    }
+        xdr_destroy(&xdrs);
 
-    // Phase 1: Read header
-    if (rcvbuf->len == 0) {
-        rcvbuf->data = malloc(PACKET_HEADER_SIZE);
-        if (!rcvbuf->data) {
-            chan->chan_events = CHAN_EPOLLERR;
-            return;
+        if (hdr.length < 0 || hdr.length > INT_MAX - PACKET_HEADER_SIZE)
+            return -1;
+
+        int len = PACKET_HEADER_SIZE + hdr.length;
+        if (avail < len && len <= CHAN_RING_SIZE)
+            break;
+
+        struct chan_buffer *buf = msg_buf(len);
+        if (!buf)
+            return -1;
+
+        if (avail < len) {
+            memcpy(buf->data, p, (size_t) avail);
+            buf->pos = avail;
+            chan->big = buf;
+            chan->ring_start = chan->ring_end;
+            break;
         }
-        rcvbuf->len = PACKET_HEADER_SIZE;
-        rcvbuf->pos = 0;
+
+        memcpy(buf->data, p, (size_t) len);
+        buf->pos = len;
+        ll_list_append(&chan->recv, &buf->link);
+        chan->ring_start += len;
     }
 
-    // Still reading header
-    if (rcvbuf->len == PACKET_HEADER_SIZE && rcvbuf->pos < PACKET_HEADER_SIZE) {
-        cc = read(chan->sock, rcvbuf->data + rcvbuf->pos,
-                  PACKET_HEADER_SIZE - rcvbuf->pos);
+    if (chan->ring_start == chan->ring_end)
+        ring_release(chan);
+
+    return 0;
+}
+
+/*
+ * Read what the socket has, up to the free space of the ring, and
+ * frame every message it completes. The channel is CHAN_EPOLLIN when
+ * at least one message waits on the recv list.
+ */
+static void doread(struct chan_data *chan)
+{
+    int cc;
+
+    if (chan->big) {
+        struct chan_buffer *buf = chan->big;
+
+        cc = read(chan->sock, buf->data + buf->pos, buf->len - buf->pos);
         if (cc < 0) {
             if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
                 return;
@@ -72,99 +218,147 @@ static void doread(struct chan_data *chan)
             chan->chan_events = CHAN_EPOLLERR;
             return;
         }
-        rcvbuf->pos += cc;
-
-        // Header complete - parse and allocate for payload
-        if (rcvbuf->pos == PACKET_HEADER_SIZE) {
-            XDR xdrs;
-            struct protocol_header hdr;
-
-            xdrmem_create(&xdrs, rcvbuf->data, PACKET_HEADER_SIZE, XDR_DECODE);
-            if (!xdr_pack_hdr(&xdrs, &hdr)) {
-                chan->chan_events = CHAN_EPOLLERR;
-                xdr_destroy(&xdrs);
-                return;
-            }
-            xdr_destroy(&xdrs);
-
-            if (hdr.length > 0) {
-                char *payload =
-                    realloc(rcvbuf->data, PACKET_HEADER_SIZE + hdr.length);
-                if (!payload) {
-                    chan->chan_events = CHAN_EPOLLERR;
-                    return;
-                }
-                rcvbuf->data = payload;
-                rcvbuf->len = PACKET_HEADER_SIZE + hdr.length;
-            }
-            if (hdr.length == 0) {
-                chan->chan_events = CHAN_EPOLLIN;
-                return;
-            }
+        buf->pos += cc;
+        if (buf->pos == buf->len) {
+            ll_list_append(&chan->recv, &buf->link);
+            chan->big = NULL;
+            chan->chan_events = CHAN_EPOLLIN;
         }
         return;
     }
 
-    // Phase 2: Read payload
-    if (rcvbuf->pos < rcvbuf->len) {
-        cc = read(chan->sock, rcvbuf->data + rcvbuf->pos,
-                  rcvbuf->len - rcvbuf->pos);
-        if (cc < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
-                return;
+    if (!chan->ring) {
+        int cap;
+        chan->ring = pool_get(CHAN_RING_SIZE, &cap);
+        if (!chan->ring) {
             chan->chan_events = CHAN_EPOLLERR;
             return;
         }
-        if (cc == 0) {
-            chan->chan_events = CHAN_EPOLLERR;
+    } else if (chan->ring_start > 0) {
+        memmove(chan->ring, chan->ring + chan->ring_start,
+                (size_t) (chan->ring_end - chan->ring_start));
+        chan->ring_end -= chan->ring_start;
+        chan->ring_start = 0;
+    }
+
+    cc = read(chan->sock, chan->ring + chan->ring_end,
+              CHAN_RING_SIZE - chan->ring_end);
+    if (cc < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
             return;
-        }
-        rcvbuf->pos += cc;
+        chan->chan_events = CHAN_EPOLLERR;
+        return;
+    }
+    if (cc == 0) {
+        chan->chan_events = CHAN_EPOLLERR;
+        return;
+    }
+    chan->ring_end += cc;
 
-        if (rcvbuf->pos == rcvbuf->len) {
-            chan->chan_events = CHAN_EPOLLIN;
-        }
+    if (ring_frame(chan) < 0) {
+        chan->chan_events = CHAN_EPOLLERR;
+        return;
     }
+
+    if (!ll_list_is_empty(&chan->recv))
+        chan->chan_events = CHAN_EPOLLIN;
 }
 
-static void dowrite(struct chan_data *chan, int chan_id, int efd)
+/* Drop the sent bytes from the head of the send list. */
+static void chan_sent(struct chan_data *chan, size_t sent)
 {
-    struct chan_buffer *sendbuf;
-    int cc;
-
-    if (ll_list_is_empty(&chan->send))
-        return;
+    while (!ll_list_is_empty(&chan->send)) {
+        struct chan_buffer *buf = (struct chan_buffer *) chan->send.head;
+        size_t left = (size_t) (buf->len - buf->pos);
 
-    sendbuf = (struct chan_buffer *) chan->send.head;
-
-    cc = write(chan->sock, sendbuf->data + sendbuf->pos,
-               sendbuf->len - sendbuf->pos);
-    if (cc < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        if (left > sent) {
+            buf->pos += (int) sent;
             return;
-        chan->chan_events = CHAN_EPOLLERR;
-        chan_set_write_interest(chan_id, efd, 0);
-        return;
+        }
+        sent -= left;
+        ll_list_remove(&chan->send, &buf->link);
+        chan_free_buf(buf);
     }
+}
 
-    sendbuf->pos += cc;
-    if (sendbuf->pos == sendbuf->len) {
-        ll_list_remove(&chan->send, &sendbuf->link);
-        free(sendbuf->data);
-        free(sendbuf);
-        if (ll_list_is_empty(&chan->send)) {
+/*
+ * Send as much of the send list as the socket takes, IOV_MAX iovecs per
+ * call, and keep EPOLLOUT interest only while something is left.
+ */
+static void dowrite(struct chan_data *chan, int chan_id, int efd)
+{
+    struct iovec iov[IOV_MAX];
+
+    while (!ll_list_is_empty(&chan->send)) {
+        size_t total = 0;
+        int n = 0;
+
+        for (struct ll_list_entry *e = chan->send.head;
+             e != NULL && n < IOV_MAX - 1; e = e->next) {
+            struct chan_buffer *buf = (struct chan_buffer *) e;
+            int pos = buf->pos;
+
+            if (pos < buf->head_len) {
+                iov[n].iov_base = buf->head + pos;
+                iov[n].iov_len = (size_t) (buf->head_len - pos);
+                total += iov[n].iov_len;
+                n++;
+                pos = buf->head_len;
+            }
+            iov[n].iov_base = buf->data + pos;
+            iov[n].iov_len = (size_t) (buf->len - pos);
+            total += iov[n].iov_len;
+            n++;
+        }
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t) n;
+
+        ssize_t cc = sendmsg(chan->sock, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (cc < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            chan->chan_events = CHAN_EPOLLERR;
             chan_set_write_interest(chan_id, efd, 0);
+            return;
         }
+
+        chan_sent(chan, (size_t) cc);
+        if ((size_t) cc < total)
+            break;
     }
+
+    chan_set_write_interest(chan_id, efd, !ll_list_is_empty(&chan->send));
 }
 
-static int chan_find_free(void)
+/*
+ * chan_take - make descriptor s a channel, its id is s. A slot is in
+ * use when its sock is its own index; a slot never used is zero, a
+ * closed one -1.
+ */
+static int chan_take(int s, enum chan_type type)
 {
-    for (int i = 0; i < CHAN_MAX; i++) {
-        if (channels[i].sock == -1)
-            return i;
+    if (s < 0 || s >= chan_max) {
+        errno = EMFILE;
+        return -1;
     }
-    return -1;
+
+    struct chan_data *chan = &channels[s];
+
+    chan->sock = s;
+    chan->type = type;
+    chan->chan_events = CHAN_EPOLLNONE;
+    chan->write_interest = 0;
+    chan->owner = 0;
+    chan->owner_data = NULL;
+    ll_list_init(&chan->send);
+    ll_list_init(&chan->recv);
+
+    return s;
 }
 
 static inline int chan_is_udp(enum chan_type t)
@@ -177,50 +371,89 @@ static inline int chan_is_udp(enum chan_type t)
 
 static inline int chan_is_valid(int chan_id)
 {
-    if (chan_id < 0 || chan_id > CHAN_MAX)
+    if (chan_id < 0 || chan_id >= chan_max)
         return 0;
 
-    if (channels[chan_id].sock == -1)
+    if (channels[chan_id].sock != chan_id)
         return 0;
 
     return 1;
 }
 
-void chan_init(void)
+/*
+ * chan_init - size the channel table to the descriptor limit of the
+ * process, at most CHAN_MAX. The table is not touched here, a slot is
+ * paged in when its descriptor first becomes a channel.
+ */
+int chan_init(void)
 {
-    static int initialised;
+    if (channels != NULL)
+        return 0;
 
-    if (initialised)
-        return;
+    struct rlimit rl;
+    rlim_t max = CHAN_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY
+        && rl.rlim_cur < max)
+        max = rl.rlim_cur;
 
-    for (int i = 0; i < CHAN_MAX; i++) {
-        channels[i].sock = -1;
-        channels[i].chan_events = CHAN_EPOLLNONE;
-        ll_list_init(&channels[i].send);
-        ll_list_init(&channels[i].recv);
-    }
-    initialised = 1;
+    channels = calloc((size_t) max, sizeof(struct chan_data));
+    if (channels == NULL)
+        return -1;
+    // zero is the slot of descriptor 0 in use, see chan_take()
+    channels[0].sock = -1;
+    chan_max = (int) max;
+
+    return 0;
 }
 
 int chan_sock(int chan_id)
 {
-    if (chan_id < 0 || chan_id > CHAN_MAX)
+    if (!chan_is_valid(chan_id))
         return -1;
 
     return channels[chan_id].sock;
 }
 
-int chan_udp_server(uint16_t port)
+/*
+ * chan_set_owner - attach what the daemon serves on the channel, so
+ * that it routes a message without looking the channel up. Cleared
+ * when the channel closes.
+ */
+void chan_set_owner(int chan_id, int owner, void *data)
 {
-    int chan_id = chan_find_free();
-    if (chan_id < 0)
-        return -1;
+    if (!chan_is_valid(chan_id))
+        return;
+
+    channels[chan_id].owner = owner;
+    channels[chan_id].owner_data = data;
+}
+
+/*
+ * chan_set_session - verify and sign the messages of the channel with
+ * the session from now on, see auth.h. The channel owns it then.
+ */
+void chan_set_session(int chan_id, struct auth_session *s)
+{
+    if (!chan_is_valid(chan_id)) {
+        auth_session_free(s);
+        return;
+    }
+
+    auth_session_free(channels[chan_id].session);
+    channels[chan_id].session = s;
+}
 
+int chan_udp_server(uint16_t port)
+{
     int s = socket(AF_INET, SOCK_DGRAM, 0);
     if (s < 0)
         return -1;
 
-    channels[chan_id].sock = s;
+    int chan_id = chan_take(s, UDP_SERVER);
+    if (chan_id < 0) {
+        close(s);
+        return -1;
+    }
 
     int one = 1;
     if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
@@ -248,15 +481,15 @@ int chan_udp_server(uint16_t port)
 
 int chan_tcp_server(uint16_t port)
 {
-    int chan_id = chan_find_free();
-    if (chan_id < 0)
-        return -1;
-
     int s = socket(AF_INET, SOCK_STREAM, 0);
     if (s < 0)
         return -1;
 
-    channels[chan_id].sock = s;
+    int chan_id = chan_take(s, TCP_SERVER);
+    if (chan_id < 0) {
+        close(s);
+        return -1;
+    }
 
     int one = 1;
     if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0) {
@@ -298,7 +531,10 @@ int chan_accept(int chan_id, struct sockaddr_in *from)
     if (s < 0)
         return -1;
 
-    return chan_open(s);
+    int ch = chan_open(s);
+    if (ch < 0)
+        close(s);
+    return ch;
 }
 
 /*
@@ -436,36 +672,31 @@ int chan_recv_dgram(int chan_id, void *buf, size_t len, struct sockaddr_in *peer
 // Open channel after accept
 int chan_open(int s)
 {
-    int i;
-
-    if ((i = chan_find_free()) < 0)
-        return -1;
-
     if (io_non_block(s) < 0)
         return -1;
 
-    channels[i].type = TCP_CONNECT;
-    channels[i].sock = s;
-    ll_list_init(&channels[i].send);
-    ll_list_init(&channels[i].recv);
-
-    return i;
+    return chan_take(s, TCP_CONNECT);
 }
 
 int chan_close(int chan_id)
 {
-    if (chan_id < 0 || chan_id > CHAN_MAX)
-        return -1;
-
-    if (channels[chan_id].sock < 0)
+    if (!chan_is_valid(chan_id))
         return -1;
 
     close(channels[chan_id].sock);
 
     ll_list_clear(&channels[chan_id].send, (void (*)(void *)) chan_free_buf);
     ll_list_clear(&channels[chan_id].recv, (void (*)(void *)) chan_free_buf);
+    chan_free_buf(channels[chan_id].big);
+    channels[chan_id].big = NULL;
+    ring_release(&channels[chan_id]);
 
     channels[chan_id].chan_events = CHAN_EPOLLNONE;
+    channels[chan_id].write_interest = 0;
+    channels[chan_id].owner = 0;
+    channels[chan_id].owner_data = NULL;
+    auth_session_free(channels[chan_id].session);
+    channels[chan_id].session = NULL;
     channels[chan_id].sock = -1;
 
     return 0;
@@ -480,6 +711,42 @@ int chan_enqueue(int chan_id, struct chan_buffer *msg)
     return 0;
 }
 
+/*
+ * chan_send - queue msg on the channel and write what the socket takes
+ * right away, the rest goes out on EPOLLOUT from chan_epoll(). The
+ * channel owns msg once queued. A write error is left for the event
+ * loop to find, as a read error would be.
+ */
+int chan_send(int chan_id, struct chan_buffer *msg, int efd)
+{
+    if (!chan_is_valid(chan_id))
+        return -1;
+
+    struct chan_data *chan = &channels[chan_id];
+
+    ll_list_append(&chan->send, &msg->link);
+    return chan_flush(chan_id, efd);
+}
+
+/*
+ * chan_flush - write the messages queued with chan_enqueue(), as many as
+ * the socket takes, and leave the rest to EPOLLOUT.
+ */
+int chan_flush(int chan_id, int efd)
+{
+    if (!chan_is_valid(chan_id))
+        return -1;
+
+    struct chan_data *chan = &channels[chan_id];
+
+    // Behind a backlog the messages wait their turn for EPOLLOUT
+    if (chan->write_interest)
+        return 0;
+
+    dowrite(chan, chan_id, efd);
+    return 0;
+}
+
 int chan_dequeue(int chan_id, struct chan_buffer **buf)
 {
     struct ll_list_entry *e;
@@ -593,7 +860,7 @@ int chan_epoll(int efd, struct epoll_event *events, int max_events, int tm)
         chan->chan_events = CHAN_EPOLLNONE;
 
         if (chan->type == TCP_SERVER || chan->type == UDP_SERVER ||
-            chan->type == TIMER_FD) {
+            chan->type == TIMER_FD || chan->type == EVENT_FD) {
             chan->chan_events = CHAN_EPOLLIN;
             continue;
         }
@@ -619,9 +886,16 @@ int chan_alloc_buf(struct chan_buffer **buf, int size)
     if (!*buf)
         return -1;
 
-    (*buf)->data = calloc(size, sizeof(char));
+    // Beyond the largest class calloc() gets zeroed pages for free
+    if (size > pool_class[CHAN_POOL_CLASSES - 1]) {
+        (*buf)->data = calloc(size, sizeof(char));
+    } else {
+        (*buf)->data = pool_get(size, &(*buf)->cap);
+        if ((*buf)->data)
+            memset((*buf)->data, 0, (size_t) size);
+    }
     if (!(*buf)->data) {
-        free(*buf);
+        put_buf(*buf);
         return -1;
     }
 
@@ -632,8 +906,54 @@ void chan_free_buf(struct chan_buffer *buf)
 {
     if (!buf)
         return;
-    free(buf->data);
-    free(buf);
+    if (buf->shared)
+        chan_shared_unref(buf->shared);
+    else
+        pool_put(buf->data, buf->cap);
+    put_buf(buf);
+}
+
+/*
+ * chan_share - turn an encoded message into one that can be queued on
+ * any number of channels without copying it. buf is consumed. The
+ * reference returned is the caller's; the counts are not atomic, all
+ * references must be taken and dropped by the same thread.
+ */
+struct chan_shared *chan_share(struct chan_buffer *buf)
+{
+    struct chan_shared *sh = malloc(sizeof(*sh));
+    if (!sh)
+        return NULL;
+
+    sh->refs = 1;
+    sh->len = buf->len;
+    sh->data = buf->data;
+    put_buf(buf);
+
+    return sh;
+}
+
+/* A send buffer over the shared message, holding a reference to it. */
+struct chan_buffer *chan_shared_buf(struct chan_shared *sh)
+{
+    struct chan_buffer *buf = make_buf();
+    if (!buf)
+        return NULL;
+
+    buf->data = sh->data;
+    buf->len = sh->len;
+    buf->shared = sh;
+    sh->refs++;
+
+    return buf;
+}
+
+void chan_shared_unref(struct chan_shared *sh)
+{
+    if (!sh || --sh->refs > 0)
+        return;
+    free(sh->data);
+    free(sh);
 }
 
 int io_non_block(int s)
@@ -652,16 +972,15 @@ int io_block(int s)
 
 int chan_create_timer(int seconds)
 {
-    int ch = chan_find_free();
-    if (ch < 0)
-        return -1;
-
     int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
     if (tfd < 0)
         return -1;
 
-    channels[ch].sock = tfd;
-    channels[ch].type = TIMER_FD;
+    int ch = chan_take(tfd, TIMER_FD);
+    if (ch < 0) {
+        close(tfd);
+        return -1;
+    }
 
     struct itimerspec its;
     its.it_value.tv_sec = seconds;
@@ -677,6 +996,22 @@ int chan_create_timer(int seconds)
     return ch;
 }
 
+/*
+ * chan_create_event - a channel on an eventfd, readable once another
+ * thread has written to its socket.
+ */
+int chan_create_event(void)
+{
+    int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd < 0)
+        return -1;
+
+    int ch = chan_take(efd, EVENT_FD);
+    if (ch < 0)
+        close(efd);
+    return ch;
+}
+
 int chan_sock_error(int chan_id)
 {
     int err = 0;
@@ -696,6 +1031,10 @@ int chan_set_write_interest(int chan_id, int efd, int on)
         return -1;
     }
 
+    on = on != 0;
+    if (channels[chan_id].write_interest == on)
+        return 0;
+
     struct epoll_event ev;
     memset(&ev, 0, sizeof(ev));
     ev.events = EPOLLIN | EPOLLRDHUP;
@@ -706,6 +1045,7 @@ int chan_set_write_interest(int chan_id, int efd, int on)
     if (epoll_ctl(efd, EPOLL_CTL_MOD, chan_sock(chan_id), &ev) < 0)
         return -1;
 
+    channels[chan_id].write_interest = on;
     return 0;
 }
 
@@ -864,33 +1204,25 @@ const char *chan_addr_str(int chan_id)
 
 int chan_udp_client(void)
 {
-    int ch = chan_find_free();
-    if (ch < 0)
-        return -1;
-
     int s = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
     if (s < 0)
         return -1;
 
-    channels[ch].sock = s;
-    channels[ch].type = UDP_CLIENT;
-    channels[ch].chan_events = CHAN_EPOLLNONE;
+    int ch = chan_take(s, UDP_CLIENT);
+    if (ch < 0)
+        close(s);
     return ch;
 }
 
 int chan_tcp_client(void)
 {
-    int ch = chan_find_free();
-    if (ch < 0)
-        return -1;
-
     int s = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
     if (s < 0)
         return -1;
 
-    channels[ch].sock = s;
-    channels[ch].type = TCP_CLIENT;
-    channels[ch].chan_events = CHAN_EPOLLNONE;
+    int ch = chan_take(s, TCP_CLIENT);
+    if (ch < 0)
+        close(s);
     return ch;
 }
 
@@ -21,13 +21,25 @@ struct ll_kv ll_params[PARAMS_COUNT] = {
     [LL_CGROUP_ROOT] = {"LL_CGROUP_ROOT", "/sys/fs/cgroup/lavalite"},
     [LL_SBD_JOB_FINISH_RETAIN] = {"LL_SBD_JOB_FINISH_RETAIN", "100"},
     [LL_SBD_PRUNE_INTERVAL] = {"LL_SBD_PRUNE_INTERVAL", "900"},
+    [LL_SBD_MSG_BATCH] = {"LL_SBD_MSG_BATCH", "256"},
     [LL_MBD_JOB_FINISH_THRESHOLD] = {"LL_MBD_JOB_FINISH_THRESHOLD", "1000"},
+    [LL_MBD_MANIFEST_FORMAT] = {"LL_MBD_MANIFEST_FORMAT", "text"},
+    [LL_MBD_CHECKPOINT_INTERVAL] = {"LL_MBD_CHECKPOINT_INTERVAL", "300"},
+    [LL_MBD_REPLAY_THREADS] = {"LL_MBD_REPLAY_THREADS", "0"},
+    [LL_HIST_SCAN_THREADS] = {"LL_HIST_SCAN_THREADS", "0"},
+    [LL_MBD_SPOOL_REAP_RATE] = {"LL_MBD_SPOOL_REAP_RATE", "500"},
+    [LL_MBD_JOB_ID_LEASE] = {"LL_MBD_JOB_ID_LEASE", "1000"},
+    [LL_MBD_DISPATCH_CACHE_MB] = {"LL_MBD_DISPATCH_CACHE_MB", "64"},
+    [LL_MBD_QUERY_THREAD] = {"LL_MBD_QUERY_THREAD", "1"},
+    [LL_MBD_QUERY_REFRESH_MS] = {"LL_MBD_QUERY_REFRESH_MS", "100"},
+    [LL_MBD_STATUS_EXPORT] = {"LL_MBD_STATUS_EXPORT", "1"},
     [LL_MBD_PORT] = {"LL_MBD_PORT", "33124"},
     [LL_MBD_HOST] = {"LL_MBD_HOST", NULL},
     [LL_MBD_USER] = {"LL_MBD_USER", "lavalite"},
     [LL_STATE_DIR] = {"LL_STATE_DIR", NULL},
     [LL_DEFAULT_QUEUE] = {"LL_DEFAULT_QUEUE", NULL},
     [LL_AUTH_MAX_AGE] = {"LL_AUTH_MAX_AGE", "60"},
+    [LL_AUTH_SESSION] = {"LL_AUTH_SESSION", "1"},
     [LL_API_CONNTIMEOUT] = {"LL_API_CONNTIMEOUT", "3"},
     [LL_API_RECVTIMEOUT] = {"LL_API_RECVTIMEOUT", "5"},
     [LL_SBD_CONNTIMEOUT] = {"LL_SBD_CONNTIMEOUT", NULL},
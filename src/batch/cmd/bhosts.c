@@ -141,6 +141,7 @@ static void usage(void)
     fprintf(stderr, "bhosts: --help display this help and exit\n"
                     "  -c, --close    HOST close a host\n"
                     "  -o, --open     HOST open a host\n"
+                    "  -s, --shm      read the status file of mbd\n"
                     "  --version      output version information and exit\n");
 }
 
@@ -149,6 +150,7 @@ static struct option longopts[] = {
     { "version", no_argument,       NULL, 'v' },
     { "close",   required_argument, NULL, 'c' },
     { "open",    required_argument, NULL, 'o' },
+    { "shm",     no_argument,       NULL, 's' },
     { NULL, 0, NULL, 0 }
 };
 
@@ -157,8 +159,9 @@ int main(int argc, char **argv)
     int cc;
     const char *close_host = NULL;
     const char *open_host  = NULL;
+    int shm = 0;
 
-    while ((cc = getopt_long(argc, argv, "c:o:hv", longopts, NULL)) != EOF) {
+    while ((cc = getopt_long(argc, argv, "c:o:shv", longopts, NULL)) != EOF) {
         switch (cc) {
         case 'c':
             close_host = optarg;
@@ -166,6 +169,9 @@ int main(int argc, char **argv)
         case 'o':
             open_host = optarg;
             break;
+        case 's':
+            shm = 1;
+            break;
         case 'v':
             fprintf(stderr, "%s\n", LAVALITE_VERSION_STR);
             return 0;
@@ -195,7 +201,18 @@ int main(int argc, char **argv)
     }
 
     int nhosts;
-    struct host_info *hosts = llb_host_info(&nhosts);
+    struct host_info *hosts;
+    if (shm) {
+        struct llb_status *s = llb_status_open();
+        if (s == NULL) {
+            fprintf(stderr, "bhosts: status file: %m\n");
+            return -1;
+        }
+        hosts = llb_status_host_info(s, &nhosts);
+        llb_status_close(s);
+    } else {
+        hosts = llb_host_info(&nhosts);
+    }
     if (!hosts) {
         fprintf(stderr, "bhosts: failed\n");
         return -1;
@@ -14,6 +14,8 @@
 
 #include "llbatch.h"
 
+#define BJOBS_PAGE 1000
+
 static const char *uid_to_name(uid_t uid)
 {
     struct passwd *pw;
@@ -99,12 +101,8 @@ struct col_widths {
     int name;
 };
 
-static void compute_widths(struct job_info *jobs, int n, struct col_widths *w)
+static void init_widths(struct col_widths *w)
 {
-    int i;
-    struct job_info *j;
-    char jobid[64];
-
     w->jobid      = (int) strlen("JOBID");
     w->user       = (int) strlen("USER");
     w->stat       = (int) strlen("STAT");
@@ -112,6 +110,17 @@ static void compute_widths(struct job_info *jobs, int n, struct col_widths *w)
     w->priority   = (int) strlen("PRI");
     w->run_hosts = (int) strlen("RUN_HOSTS");
     w->name       = (int) strlen("JOB_NAME");
+}
+
+/*
+ * Widen the columns to fit a page of jobs. The header is printed with
+ * the widths of the first page, later pages only widen them.
+ */
+static void compute_widths(struct job_info *jobs, int n, struct col_widths *w)
+{
+    int i;
+    struct job_info *j;
+    char jobid[64];
 
     for (i = 0; i < n; i++) {
         j = &jobs[i];
@@ -249,6 +258,63 @@ static int parse_job_ref(const char *s, int64_t *job_id,
     return 0;
 }
 
+static const char *sum_reason(int32_t id)
+{
+    if (id < PEND_NONE || id > PEND_PAYLOAD)
+        return "unknown";
+    return pend_reason_msg[id];
+}
+
+/*
+ * print_summary - the counts of the jobs the filter selects, grouped by
+ * queue, user or pending reason, counted by mbd.
+ */
+static int print_summary(int32_t by, const struct job_filter *filter)
+{
+    int32_t n;
+    struct job_count *c = llb_job_summary(by, filter, &n);
+    if (c == NULL) {
+        if (errno == EINVAL && (filter->queue || filter->host))
+            fprintf(stderr, "bjobs: unknown queue or host\n");
+        else
+            fprintf(stderr, "bjobs: %s\n", strerror(errno));
+        return 1;
+    }
+
+    if (n == 0) {
+        printf("No jobs found.\n");
+        llb_free_job_summary(c, n);
+        return 0;
+    }
+
+    if (by == LLB_SUM_PEND_REASON) {
+        printf("%8s  %s\n", "PEND", "REASON");
+        for (int i = 0; i < n; i++)
+            printf("%8d  %s\n", c[i].num_pend, sum_reason(c[i].id));
+        llb_free_job_summary(c, n);
+        return 0;
+    }
+
+    int w = 5;
+    for (int i = 0; i < n; i++) {
+        const char *s = by == LLB_SUM_QUEUE ? c[i].queue
+                                            : uid_to_name(c[i].id);
+        w = imax(w, (int)strlen(s));
+    }
+
+    printf("%-*s %8s %8s %8s %8s\n", w, by == LLB_SUM_QUEUE ? "QUEUE" : "USER",
+           "PEND", "HELD", "RUN", "SUSP");
+    for (int i = 0; i < n; i++) {
+        const char *s = by == LLB_SUM_QUEUE ? c[i].queue
+                                            : uid_to_name(c[i].id);
+        printf("%-*s %8d %8d %8d %8d\n", w, s, c[i].num_pend,
+               c[i].num_held, c[i].num_run, c[i].num_susp);
+    }
+
+    llb_free_job_summary(c, n);
+    return 0;
+}
+
 static void usage(void)
 {
     fprintf(stderr,
@@ -262,6 +328,13 @@ static void usage(void)
             "  --pend         Show pending jobs with pending reason\n"
             "  --run          Show running jobs only\n"
             "  --done         Show finished jobs (DONE and EXIT)\n"
+            "  -q, --queue QUEUE      Show jobs of a queue\n"
+            "  -J, --name PATTERN     Show jobs whose name matches a glob\n"
+            "  -P, --project PROJECT  Show jobs of a project\n"
+            "  -m, --host HOST        Show jobs running or run on a host\n"
+            "  --array ARRAY_ID       Show elements of an array\n"
+            "  --sum[=BY]     Count the active jobs by queue (default),"
+            " user or reason\n"
             "  --help         Display this help and exit\n"
             "  --version      Output version information and exit\n"
             "\n"
@@ -278,6 +351,12 @@ static struct option longopts[] = {
     { "run",     no_argument, NULL, 'r' },
     { "done",    no_argument, NULL, 'd' },
     { "user",    required_argument, NULL, 'u' },
+    { "queue",   required_argument, NULL, 'q' },
+    { "name",    required_argument, NULL, 'J' },
+    { "project", required_argument, NULL, 'P' },
+    { "host",    required_argument, NULL, 'm' },
+    { "array",   required_argument, NULL, 'A' },
+    { "sum",     optional_argument, NULL, 's' },
     { NULL, 0, NULL, 0 }
 };
 
@@ -285,6 +364,8 @@ int main(int argc, char **argv)
 {
     int flags = 0;
     int show_reason = 0;
+    int filter = 0;
+    int32_t sum_by = 0;
     int cc;
     struct job_info_req req;
 
@@ -292,7 +373,7 @@ int main(int argc, char **argv)
     req.job_id = -1;
     req.uid = getuid();
 
-    while ((cc = getopt_long(argc, argv, "hvaprdu:", longopts, NULL)) != EOF) {
+    while ((cc = getopt_long(argc, argv, "hvaprdu:q:J:P:m:A:", longopts, NULL)) != EOF) {
         switch (cc) {
         case 'v':
             fprintf(stderr, "%s\n", LAVALITE_VERSION_STR);
@@ -322,14 +403,61 @@ int main(int argc, char **argv)
             }
             req.uid = pw->pw_uid;
             break;
+        case 'q':
+            req.filter.queue = optarg;
+            filter = 1;
+            break;
+        case 'J':
+            req.filter.name = optarg;
+            filter = 1;
+            break;
+        case 'P':
+            req.filter.project = optarg;
+            filter = 1;
+            break;
+        case 'm':
+            req.filter.host = optarg;
+            filter = 1;
+            break;
+        case 'A':
+            char *end;
+            errno = 0;
+            req.filter.array_id = strtoll(optarg, &end, 10);
+            if (errno != 0 || end == optarg || *end != 0
+                || req.filter.array_id <= 0) {
+                fprintf(stderr, "bjobs: invalid array id '%s'\n", optarg);
+                return 1;
+            }
+            filter = 1;
+            break;
+        case 's':
+            if (optarg == NULL || strcmp(optarg, "queue") == 0) {
+                sum_by = LLB_SUM_QUEUE;
+            } else if (strcmp(optarg, "user") == 0) {
+                sum_by = LLB_SUM_USER;
+            } else if (strcmp(optarg, "reason") == 0) {
+                sum_by = LLB_SUM_PEND_REASON;
+            } else {
+                fprintf(stderr, "bjobs: invalid summary '%s'\n", optarg);
+                return 1;
+            }
+            break;
         default:
             usage();
             return 1;
         }
     }
 
+    if (sum_by) {
+        if (optind < argc || flags) {
+            fprintf(stderr, "bjobs: --sum takes only filter options\n");
+            return 1;
+        }
+        return print_summary(sum_by, &req.filter);
+    }
+
     if (optind < argc) {
-        if (flags) {
+        if (flags || filter) {
             fprintf(stderr, "bjobs: job_id is mutually exclusive with"
                             " filter options\n");
             return 1;
@@ -345,24 +473,52 @@ int main(int argc, char **argv)
     }
 
     req.flags = flags;
-    int njobs;
-    struct job_info *jobs = llb_job_info(&req, &njobs);
-    if (jobs == NULL) {
-        if (errno != 0) {
-            fprintf(stderr, "bjobs: %s\n", strerror(errno));
-            return 1;
-        }
-        printf("No jobs found.\n");
-        return 0;
+    /* only the columns printed */
+    req.fields = LLB_JOB_F_USER | LLB_JOB_F_STATE | LLB_JOB_F_PRIORITY |
+                 LLB_JOB_F_TIMES | LLB_JOB_F_NAME | LLB_JOB_F_QUEUE |
+                 LLB_JOB_F_RUN_HOSTS;
+    /* print the jobs as the pages arrive */
+    struct llb_job_iter *it = llb_job_iter_open(&req, BJOBS_PAGE);
+    if (it == NULL) {
+        fprintf(stderr, "bjobs: %s\n", strerror(errno));
+        return 1;
     }
 
     struct col_widths w;
-    compute_widths(jobs, njobs, &w);
-    print_header(&w);
+    init_widths(&w);
+
+    int total = 0;
+    for (;;) {
+        int njobs;
+        struct job_info *jobs = llb_job_iter_next(it, &njobs);
+        if (jobs == NULL) {
+            if (errno == EINVAL && (req.filter.queue || req.filter.host)) {
+                fprintf(stderr, "bjobs: unknown queue or host\n");
+                llb_job_iter_close(it);
+                return 1;
+            }
+            if (errno != 0) {
+                fprintf(stderr, "bjobs: %s\n", strerror(errno));
+                llb_job_iter_close(it);
+                return 1;
+            }
+            break;
+        }
+
+        compute_widths(jobs, njobs, &w);
+        if (total == 0)
+            print_header(&w);
 
-    for (int i = 0; i < njobs; i++)
-        print_job(&jobs[i], &w, show_reason);
+        for (int i = 0; i < njobs; i++)
+            print_job(&jobs[i], &w, show_reason);
+
+        total += njobs;
+        llb_free_job_info(jobs, njobs);
+    }
+    llb_job_iter_close(it);
+
+    if (total == 0)
+        printf("No jobs found.\n");
 
-    llb_free_job_info(jobs, njobs);
     return 0;
 }
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch/lib/log.h"
+#include "batch/lib/logindex.h"
+#include "batch/lib/spool.h"
+#include "base/lib/ll.conf.h"
+#include "base/lib/ll.sys.h"
+#include "base/lib/ll.bufsiz.h"
+
+static void usage(FILE *f)
+{
+    fprintf(f,
+            "Usage: bmanifest --to text|binary <input> [output]\n"
+            "       bmanifest --check <input>\n"
+            "       bmanifest --index [archive...]\n"
+            "       bmanifest --spool [--rate N]\n"
+            "\n"
+            "Convert an mbd event manifest between the text and the binary\n"
+            "record format, or decode every record and report timing.\n"
+            "Input records may be in either format, mixed.\n"
+            "\n"
+            "Options:\n"
+            "  -t, --to format  Write output in format, default stdout\n"
+            "  -c, --check      Decode all records, print counts and time\n"
+            "  -i, --index      Build the job index of each archive, or of\n"
+            "                   every manifest.N under LL_STATE_DIR/mbd\n"
+            "                   without a valid one\n"
+            "  -s, --spool      Move the job directories of the legacy\n"
+            "                   layout under LL_STATE_DIR/mbd/jobs to\n"
+            "                   the sharded one\n"
+            "  -r, --rate N     Move at most N directories per second\n"
+            "  -h, --help       Display this help and exit\n"
+            "  -v, --version    Output version information and exit\n");
+}
+
+static struct option longopts[] = {
+    { "to",      required_argument, NULL, 't' },
+    { "check",   no_argument,       NULL, 'c' },
+    { "index",   no_argument,       NULL, 'i' },
+    { "spool",   no_argument,       NULL, 's' },
+    { "rate",    required_argument, NULL, 'r' },
+    { "help",    no_argument,       NULL, 'h' },
+    { "version", no_argument,       NULL, 'v' },
+    { NULL, 0, NULL, 0 }
+};
+
+/*
+ * Decode one record into its payload struct and, when out is not NULL,
+ * write it back with the currently selected writer format.
+ * Returns 0 on success, 1 for a record type that is skipped, -1 on error.
+ */
+static int convert_record(const struct event_rec *rec, FILE *out)
+{
+    union log_payload p;
+
+    memset(&p, 0, sizeof(p));
+
+    switch (rec->type) {
+    case EVENT_JOB_NEW:
+        if (log_parse_job_new(rec, &p.job_new) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_new(out, &p.job_new);
+        return 0;
+    case EVENT_JOB_START:
+        if (log_parse_job_start(rec, &p.start) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_start(out, &p.start);
+        return 0;
+    case EVENT_JOB_FORK:
+        if (log_parse_job_fork(rec, &p.fork) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_fork(out, &p.fork);
+        return 0;
+    case EVENT_JOB_SIGNAL:
+        if (log_parse_job_signal(rec, &p.signal) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_signal(out, &p.signal);
+        return 0;
+    case EVENT_JOB_FINISH:
+        if (log_parse_job_finish(rec, &p.finish) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_finish(out, &p.finish);
+        return 0;
+    case EVENT_JOB_PEND_SUSP:
+        if (log_parse_job_pend_susp(rec, &p.pend_susp) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_pend_susp(out, &p.pend_susp);
+        return 0;
+    case EVENT_JOB_PEND_RESUME:
+        if (log_parse_job_pend_resume(rec, &p.pend_resume) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_pend_resume(out, &p.pend_resume);
+        return 0;
+    case EVENT_JOB_SUSP:
+        if (log_parse_job_susp(rec, &p.susp) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_susp(out, &p.susp);
+        return 0;
+    case EVENT_JOB_MOVE:
+        if (log_parse_job_move(rec, &p.move) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_move(out, &p.move);
+        return 0;
+    case EVENT_JOB_PRIORITY:
+        if (log_parse_job_priority(rec, &p.priority) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_priority(out, &p.priority);
+        return 0;
+    case EVENT_JOB_PEND:
+        if (log_parse_job_pend(rec, &p.pend) < 0)
+            return -1;
+        if (out != NULL)
+            return log_write_job_pend(out, &p.pend);
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec) * 1000.0 +
+           (double) (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+static int scan(const char *path, FILE *in, FILE *out)
+{
+    struct event_rec rec;
+    struct timespec t0;
+    long nrec = 0;
+    long nskip = 0;
+    int rc = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (;;) {
+        memset(&rec, 0, offsetof(struct event_rec, rest));
+        errno = 0;
+        if (log_read_hdr(in, &rec) < 0) {
+            if (errno == EINVAL || errno == EBADMSG || errno == EPROTO) {
+                fprintf(stderr, "bmanifest: %s: bad record %ld: %s\n",
+                        path, nrec + 1, strerror(errno));
+                rc = -1;
+            }
+            break;
+        }
+        int cc = convert_record(&rec, out);
+        if (cc < 0) {
+            fprintf(stderr, "bmanifest: %s: record %ld: %s\n", path,
+                    nrec + 1, strerror(errno));
+            rc = -1;
+            break;
+        }
+        if (cc > 0)
+            nskip++;
+        nrec++;
+    }
+
+    if (ferror(in)) {
+        fprintf(stderr, "bmanifest: %s: read error\n", path);
+        rc = -1;
+    }
+
+    if (out == NULL) {
+        double ms = elapsed_ms(&t0);
+        printf("records=%ld skipped=%ld elapsed_ms=%.3f rate=%.0f/s\n",
+               nrec, nskip, ms, ms > 0 ? nrec / (ms / 1000.0) : 0.0);
+    }
+
+    return rc;
+}
+
+static int index_one(const char *path)
+{
+    struct timespec t0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (log_index_build(path) < 0) {
+        fprintf(stderr, "bmanifest: %s: index: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct log_index *x = log_index_open(path);
+    if (x == NULL) {
+        fprintf(stderr, "bmanifest: %s: index: %s\n", path, strerror(errno));
+        return -1;
+    }
+    printf("%s jobs=%u records=%lu uids=%u job_id=%ld-%ld elapsed_ms=%.3f\n",
+           path, x->f.njobs, (unsigned long) x->f.nrecs, x->f.nuids,
+           (long) x->f.min_job_id, (long) x->f.max_job_id, elapsed_ms(&t0));
+    log_index_close(x);
+
+    return 0;
+}
+
+static int is_archive(const char *name)
+{
+    const char *p;
+
+    if (strncmp(name, "manifest.", 9) != 0)
+        return 0;
+
+    p = name + 9;
+    if (*p == '\0')
+        return 0;
+    while (*p >= '0' && *p <= '9')
+        p++;
+
+    return *p == '\0';
+}
+
+/*
+ * index_missing - build the index of every archive in the mbd state
+ * directory whose index is missing, stale or corrupt. Archives with a
+ * valid index are left alone, so this can run from cron.
+ */
+static int index_missing(void)
+{
+    char dir[PATH_MAX];
+    char path[PATH_MAX + NAME_MAX + 1];
+    struct dirent *de;
+    int rc = 0;
+
+    if (ll_init() < 0 || ll_params[LL_STATE_DIR].val == NULL) {
+        fprintf(stderr, "bmanifest: cannot read LL_STATE_DIR from ll.conf\n");
+        return -1;
+    }
+
+    snprintf(dir, sizeof(dir), "%s/mbd", ll_params[LL_STATE_DIR].val);
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        fprintf(stderr, "bmanifest: %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    while ((de = readdir(dp)) != NULL) {
+        if (!is_archive(de->d_name))
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        struct log_index *x = log_index_open(path);
+        if (x != NULL) {
+            log_index_close(x);
+            continue;
+        }
+
+        if (index_one(path) < 0)
+            rc = -1;
+    }
+
+    closedir(dp);
+    return rc;
+}
+
+/*
+ * spool_migrate - move every job directory of the legacy layout,
+ * jobs/<job_id % 10>/<job_id>, to its place in the sharded layout while
+ * mbd keeps running. Each move is a rename, so a reader finds the
+ * directory in one layout or the other; mbd and bhist look in both.
+ * mbd writes the version marker when it first starts with the sharded
+ * layout, an older mbd would not find the moved directories, so the
+ * marker is required.
+ */
+static int spool_migrate(int rate)
+{
+    char jobs[PATH_MAX];
+    struct timespec t0;
+    struct stat st;
+    long moved = 0;
+    long failed = 0;
+
+    if (ll_init() < 0 || ll_params[LL_STATE_DIR].val == NULL) {
+        fprintf(stderr, "bmanifest: cannot read LL_STATE_DIR from ll.conf\n");
+        return -1;
+    }
+    snprintf(jobs, sizeof(jobs), "%s/mbd/jobs", ll_params[LL_STATE_DIR].val);
+
+    int version = spool_version(jobs);
+    if (version < 0) {
+        fprintf(stderr, "bmanifest: %s: %s\n", jobs, strerror(errno));
+        return -1;
+    }
+    if (version != SPOOL_VERSION) {
+        fprintf(stderr, "bmanifest: %s: layout version %d, start mbd once "
+                "before moving the job directories\n", jobs, version);
+        return -1;
+    }
+
+    /* the new shard directories must belong to the mbd user */
+    if (stat(jobs, &st) < 0) {
+        fprintf(stderr, "bmanifest: %s: %s\n", jobs, strerror(errno));
+        return -1;
+    }
+    if (geteuid() == 0 && st.st_uid != 0) {
+        if (setegid(st.st_gid) < 0 || seteuid(st.st_uid) < 0) {
+            fprintf(stderr, "bmanifest: seteuid %u: %s\n",
+                    (unsigned) st.st_uid, strerror(errno));
+            return -1;
+        }
+    }
+
+    struct spool_rate pace;
+    spool_rate_init(&pace, rate);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (int b = 0; b < SPOOL_LEGACY_BUCKETS; b++) {
+        char bucket[PATH_MAX + LL_BUFSIZ_32];
+        snprintf(bucket, sizeof(bucket), "%s/%d", jobs, b);
+
+        DIR *dp = opendir(bucket);
+        if (dp == NULL)
+            continue;
+
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL) {
+            char *end;
+            errno = 0;
+            long job_id = strtol(de->d_name, &end, 10);
+            if (de->d_name[0] == '.' || *end != 0 || errno != 0)
+                continue;
+
+            char from[PATH_MAX];
+            char to[PATH_MAX];
+            if (spool_legacy_dir(from, sizeof(from), jobs, job_id) < 0
+                || spool_job_dir(to, sizeof(to), jobs, job_id) < 0
+                || spool_create_parents(jobs, job_id) < 0
+                || rename(from, to) < 0) {
+                fprintf(stderr, "bmanifest: %s: %s\n", from, strerror(errno));
+                failed++;
+                continue;
+            }
+            moved++;
+            spool_rate_wait(&pace);
+        }
+        closedir(dp);
+
+        /* empty unless a move failed */
+        rmdir(bucket);
+    }
+
+    printf("%s moved=%ld failed=%ld elapsed_ms=%.3f\n", jobs, moved, failed,
+           elapsed_ms(&t0));
+
+    return failed ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    enum log_format format = LOG_FORMAT_TEXT;
+    int convert = 0;
+    int check = 0;
+    int index = 0;
+    int spool = 0;
+    int rate = 0;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "t:cisr:hv", longopts, NULL)) != -1) {
+        switch (c) {
+        case 't':
+            if (log_format_parse(optarg, &format) < 0) {
+                fprintf(stderr, "bmanifest: unknown format '%s'\n", optarg);
+                return 1;
+            }
+            convert = 1;
+            break;
+        case 'c':
+            check = 1;
+            break;
+        case 'i':
+            index = 1;
+            break;
+        case 's':
+            spool = 1;
+            break;
+        case 'r':
+            if (!ll_atoi(optarg, &rate) || rate < 0) {
+                fprintf(stderr, "bmanifest: invalid rate '%s'\n", optarg);
+                return 1;
+            }
+            break;
+        case 'h':
+            usage(stdout);
+            return 0;
+        case 'v':
+            printf("%s\n", LAVALITE_VERSION_STR);
+            return 0;
+        default:
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    if (spool) {
+        if (convert || check || index || optind < argc) {
+            usage(stderr);
+            return 1;
+        }
+        return spool_migrate(rate) < 0 ? 1 : 0;
+    }
+
+    if (index) {
+        if (convert || check) {
+            usage(stderr);
+            return 1;
+        }
+        if (optind >= argc)
+            return index_missing() < 0 ? 1 : 0;
+
+        int rc = 0;
+        for (int i = optind; i < argc; i++) {
+            if (index_one(argv[i]) < 0)
+                rc = 1;
+        }
+        return rc;
+    }
+
+    if (convert == check || optind >= argc) {
+        usage(stderr);
+        return 1;
+    }
+
+    const char *path = argv[optind];
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "bmanifest: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    FILE *out = NULL;
+    if (convert) {
+        out = stdout;
+        if (optind + 1 < argc) {
+            out = fopen(argv[optind + 1], "w");
+            if (out == NULL) {
+                fprintf(stderr, "bmanifest: %s: %s\n", argv[optind + 1],
+                        strerror(errno));
+                fclose(in);
+                return 1;
+            }
+        }
+        log_set_format(format);
+    }
+
+    int rc = scan(path, in, out);
+    fclose(in);
+
+    if (out != NULL && fclose(out) != 0) {
+        fprintf(stderr, "bmanifest: write failed: %s\n", strerror(errno));
+        rc = -1;
+    }
+
+    if (rc < 0)
+        return 1;
+    return 0;
+}
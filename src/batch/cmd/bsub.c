@@ -22,6 +22,7 @@ static void usage(FILE *f)
     fprintf(
         f,
         "Usage: bsub [options] command [arguments]\n"
+        "       bsub --batch-file file\n"
         "\n"
         "Job identity:\n"
         "  --queue  queue     Queue name (default: system default)\n"
@@ -59,6 +60,11 @@ static void usage(FILE *f)
         "                     combined with && || ! and parentheses.\n"
         "                     ended(id) means done(id) || exit(id).\n"
         "\n"
+        "Bulk submission:\n"
+        "  --batch-file file  Submit one job per line of file, each line\n"
+        "                     the options and command of a bsub; the jobs\n"
+        "                     are created all or none ('-' reads stdin)\n"
+        "\n"
         "  --help             Print this message and exit\n"
         "  --version          Print version and exit\n");
 }
@@ -211,14 +217,15 @@ static int count_machines(const char *machines)
     return n;
 }
 
-int main(int argc, char **argv)
+/*
+ * Parse the options and the command of one submission into js. Called
+ * for the command line with batch_file, where --batch-file, --help and
+ * --version are allowed, and for every line of a batch file without.
+ * Returns 0, 1 when --help or --version was handled, -1 on error.
+ */
+static int parse_submit(int argc, char **argv, struct job_submit *js,
+                        const char **batch_file)
 {
-    struct job_submit js;
-    int64_t job_id;
-    int rc;
-
-    memset(&js, 0, sizeof(js));
-
     static const struct option opts[] = {
         {"queue", required_argument, NULL, 'q'},
         {"name", required_argument, NULL, 'J'},
@@ -241,35 +248,38 @@ int main(int argc, char **argv)
         {"begin", required_argument, NULL, 'b'},
         {"terminate", required_argument, NULL, 't'},
         {"dependency", required_argument, NULL, 'w'},
+        {"batch-file", required_argument, NULL, 'B'},
         {"help", no_argument, NULL, 'h'},
         {"version", no_argument, NULL, 'v'},
         {NULL, 0, NULL, 0}};
 
     int c;
+    optind = 0;
     while (
-        (c = getopt_long(argc, argv, "q:J:P:C:n:N:M:s:g:G:T:xm:o:e:i:Ha:b:t:w:hv",
+        (c = getopt_long(argc, argv,
+                         "q:J:P:C:n:N:M:s:g:G:T:xm:o:e:i:Ha:b:t:w:B:hv",
                          opts, NULL)) != -1) {
         switch (c) {
         case 'q':
-            js.queue = optarg;
+            js->queue = optarg;
             break;
         case 'J':
-            js.name = optarg;
+            js->name = optarg;
             break;
         case 'P':
-            js.project = optarg;
+            js->project = optarg;
             break;
         case 'C':
-            js.comment = optarg;
+            js->comment = optarg;
             break;
         case 'n': {
             char *end;
             long v = strtol(optarg, &end, 10);
             if (*end != '\0' || v <= 0) {
                 fprintf(stderr, "bsub: --cpus: invalid value '%s'\n", optarg);
-                return 1;
+                return -1;
             }
-            js.num_cpus = (int32_t) v;
+            js->num_cpus = (int32_t) v;
             break;
         }
         case 'N': {
@@ -277,22 +287,22 @@ int main(int argc, char **argv)
             long v = strtol(optarg, &end, 10);
             if (*end != '\0' || v <= 0) {
                 fprintf(stderr, "bsub: --nhosts: invalid value '%s'\n", optarg);
-                return 1;
+                return -1;
             }
-            js.num_hosts = (int32_t) v;
+            js->num_hosts = (int32_t) v;
             break;
         }
         case 'M':
-            if (parse_mem(optarg, &js.mem_mb) < 0) {
+            if (parse_mem(optarg, &js->mem_mb) < 0) {
                 fprintf(stderr, "bsub: --mem: invalid value '%s'\n", optarg);
-                return 1;
+                return -1;
             }
             break;
         case 's':
-            if (parse_mem(optarg, &js.storage_mb) < 0) {
+            if (parse_mem(optarg, &js->storage_mb) < 0) {
                 fprintf(stderr, "bsub: --storage: invalid value '%s'\n",
                         optarg);
-                return 1;
+                return -1;
             }
             break;
         case 'g': {
@@ -300,13 +310,13 @@ int main(int argc, char **argv)
             long v = strtol(optarg, &end, 10);
             if (*end != '\0' || v < 0) {
                 fprintf(stderr, "bsub: --gpus: invalid value '%s'\n", optarg);
-                return 1;
+                return -1;
             }
-            js.num_gpus = (int32_t) v;
+            js->num_gpus = (int32_t) v;
             break;
         }
         case 'G':
-            js.gpu_model = optarg;
+            js->gpu_model = optarg;
             break;
         case 'T': {
             /* validate format: name=N */
@@ -316,119 +326,320 @@ int main(int argc, char **argv)
                         "bsub: --tokens: invalid format '%s', "
                         "expected name=N\n",
                         optarg);
-                return 1;
+                return -1;
             }
             char *end;
             long v = strtol(eq + 1, &end, 10);
             if (*end != '\0' || v <= 0) {
                 fprintf(stderr, "bsub: --tokens: invalid count in '%s'\n",
                         optarg);
-                return 1;
+                return -1;
             }
             /* append to tokenpool string: "existing,name=N" */
-            if (js.tokenpool == NULL) {
-                js.tokenpool = strdup(optarg);
+            if (js->tokenpool == NULL) {
+                js->tokenpool = strdup(optarg);
             } else {
-                char *prev = js.tokenpool;
-                if (asprintf(&js.tokenpool, "%s,%s", prev, optarg) < 0) {
+                char *prev = js->tokenpool;
+                if (asprintf(&js->tokenpool, "%s,%s", prev, optarg) < 0) {
                     fprintf(stderr, "bsub: out of memory\n");
                     free(prev);
-                    return 1;
+                    return -1;
                 }
                 free(prev);
             }
             break;
         }
         case 'x':
-            js.flags |= JOB_FLAG_EXCLUSIVE;
+            js->flags |= JOB_FLAG_EXCLUSIVE;
             break;
         case 'm':
-            js.machines = optarg;
+            js->machines = optarg;
             break;
         case 'o':
-            js.out_file = optarg;
+            js->out_file = optarg;
             break;
         case 'e':
-            js.err_file = optarg;
+            js->err_file = optarg;
             break;
         case 'i':
-            js.in_file = optarg;
+            js->in_file = optarg;
             break;
         case 'H':
-            js.flags |= JOB_FLAG_HOLD;
+            js->flags |= JOB_FLAG_HOLD;
             break;
         case 'a':
-            if (llb_parse_array(optarg, &js.array_start, &js.array_end,
-                                &js.array_stride) < 0) {
+            if (llb_parse_array(optarg, &js->array_start, &js->array_end,
+                                &js->array_stride) < 0) {
                 fprintf(stderr, "bsub: --array: invalid spec '%s'\n", optarg);
-                return 1;
+                return -1;
             }
-            js.flags |= JOB_FLAG_ARRAY;
+            js->flags |= JOB_FLAG_ARRAY;
             break;
         case 'b':
-            if (parse_time_arg(optarg, &js.begin_time) < 0) {
+            if (parse_time_arg(optarg, &js->begin_time) < 0) {
                 fprintf(stderr, "bsub: --begin: invalid time '%s'\n", optarg);
-                return 1;
+                return -1;
             }
             break;
         case 't':
-            if (parse_time_arg(optarg, &js.term_time) < 0) {
+            if (parse_time_arg(optarg, &js->term_time) < 0) {
                 fprintf(stderr, "bsub: --terminate: invalid time '%s'\n",
                         optarg);
-                return 1;
+                return -1;
             }
             break;
         case 'w':
             if (llb_parse_dependency(optarg) < 0) {
                 fprintf(stderr, "bsub: --dependency: invalid expression '%s'\n",
                         optarg);
-                return 1;
+                return -1;
             }
-            js.depend_cond = optarg;
+            js->depend_cond = optarg;
+            break;
+        case 'B':
+            if (batch_file == NULL)
+                return -1;
+            *batch_file = optarg;
             break;
         case 'h':
+            if (batch_file == NULL)
+                return -1;
             usage(stdout);
-            return 0;
+            return 1;
         case 'v':
+            if (batch_file == NULL)
+                return -1;
             fprintf(stdout, "%s\n", LAVALITE_VERSION_STR);
-            return 0;
-        default:
-            usage(stderr);
             return 1;
+        default:
+            return -1;
         }
     }
 
+    if (batch_file != NULL && *batch_file != NULL)
+        return 0;
+
     /* --nhosts and --machines are mutually exclusive */
-    if (js.num_hosts > 0 && js.machines != NULL) {
+    if (js->num_hosts > 0 && js->machines != NULL) {
         fprintf(stderr,
                 "bsub: --nhosts and --machines are mutually exclusive\n");
-        return 1;
+        return -1;
     }
 
-    if (js.machines != NULL)
-        js.num_hosts = count_machines(js.machines);
+    if (js->machines != NULL)
+        js->num_hosts = count_machines(js->machines);
 
     /* --gpu-model requires --gpus */
-    if (js.gpu_model != NULL && js.num_gpus == 0) {
+    if (js->gpu_model != NULL && js->num_gpus == 0) {
         fprintf(stderr, "bsub: --gpu-model requires --gpus\n");
-        return 1;
+        return -1;
     }
 
     /* begin must be before terminate */
-    if (js.begin_time > 0 && js.term_time > 0) {
-        if (js.begin_time >= js.term_time) {
+    if (js->begin_time > 0 && js->term_time > 0) {
+        if (js->begin_time >= js->term_time) {
             fprintf(stderr, "bsub: --begin must be before --terminate\n");
-            return 1;
+            return -1;
         }
     }
 
-    js.command = build_command(argc, argv, optind);
-    if (js.command == NULL) {
+    js->command = build_command(argc, argv, optind);
+    if (js->command == NULL) {
         fprintf(stderr, "bsub: no command specified\n");
-        usage(stderr);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Split a line of a batch file into an argv after "bsub", at blanks
+ * outside of single or double quotes. The words point into line.
+ */
+static int split_line(char *line, char ***argvp)
+{
+    size_t cap = 16;
+    int argc = 0;
+    char **argv = malloc(cap * sizeof(char *));
+    if (argv == NULL)
+        return -1;
+
+    argv[argc++] = "bsub";
+    char *p = line;
+    while (*p != '\0') {
+        while (*p == ' ' || *p == '\t' || *p == '\n')
+            p++;
+        if (*p == '\0')
+            break;
+
+        char *w = p;
+        char *q = p;
+        char quote = 0;
+        while (*p != '\0') {
+            if (quote == 0 && (*p == ' ' || *p == '\t' || *p == '\n'))
+                break;
+            if (quote == 0 && (*p == '\'' || *p == '"')) {
+                quote = *p++;
+                continue;
+            }
+            if (quote != 0 && *p == quote) {
+                quote = 0;
+                p++;
+                continue;
+            }
+            *q++ = *p++;
+        }
+        if (quote != 0) {
+            free(argv);
+            return -1;
+        }
+        if (*p != '\0')
+            p++;
+        *q = '\0';
+
+        if ((size_t) argc + 2 > cap) {
+            cap *= 2;
+            char **a = realloc(argv, cap * sizeof(char *));
+            if (a == NULL) {
+                free(argv);
+                return -1;
+            }
+            argv = a;
+        }
+        argv[argc++] = w;
+    }
+    argv[argc] = NULL;
+
+    *argvp = argv;
+    return argc;
+}
+
+static void print_submitted(int64_t job_id, const struct job_submit *js)
+{
+    fprintf(stdout, "Job <%ld> is submitted to queue <%s>.\n", (long) job_id,
+            js->queue ? js->queue : "default");
+}
+
+/*
+ * Submit the jobs of a batch file, one bsub per line, in requests of up
+ * to LLB_SUBMIT_MANY_MAX jobs that mbd takes all or none of. Blank lines
+ * and lines starting with # are skipped.
+ */
+static int submit_batch_file(const char *path)
+{
+    FILE *fp = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (fp == NULL) {
+        fprintf(stderr, "bsub: %s: %m\n", path);
         return 1;
     }
 
+    int rc = 0;
+    int lineno = 0;
+    int eof = 0;
+    char *buf = NULL;
+    size_t bufsz = 0;
+
+    struct job_submit *js = calloc(LLB_SUBMIT_MANY_MAX, sizeof(*js));
+    char **lines = calloc(LLB_SUBMIT_MANY_MAX, sizeof(char *));
+    char ***argvs = calloc(LLB_SUBMIT_MANY_MAX, sizeof(char **));
+    int64_t *job_ids = calloc(LLB_SUBMIT_MANY_MAX, sizeof(int64_t));
+    if (js == NULL || lines == NULL || argvs == NULL || job_ids == NULL) {
+        fprintf(stderr, "bsub: out of memory\n");
+        rc = 1;
+        goto out;
+    }
+
+    while (!eof && rc == 0) {
+        int32_t n = 0;
+
+        while (n < LLB_SUBMIT_MANY_MAX) {
+            if (getline(&buf, &bufsz, fp) < 0) {
+                eof = 1;
+                break;
+            }
+            lineno++;
+
+            char *p = buf + strspn(buf, " \t\n");
+            if (*p == '\0' || *p == '#')
+                continue;
+
+            lines[n] = strdup(p);
+            if (lines[n] == NULL) {
+                fprintf(stderr, "bsub: out of memory\n");
+                rc = 1;
+                break;
+            }
+            int argc = split_line(lines[n], &argvs[n]);
+            memset(&js[n], 0, sizeof(js[n]));
+            if (argc < 0 || parse_submit(argc, argvs[n], &js[n], NULL) != 0) {
+                fprintf(stderr, "bsub: %s:%d: invalid submission\n", path,
+                        lineno);
+                if (argc >= 0)
+                    n++;
+                else
+                    free(lines[n]);
+                rc = 1;
+                break;
+            }
+            n++;
+        }
+
+        if (rc == 0 && n > 0) {
+            if (llb_submit_many(js, n, job_ids) < 0) {
+                fprintf(stderr, "Jobs not submitted");
+                if (errno != 0)
+                    fprintf(stderr, ": %m");
+                fprintf(stderr, "\n");
+                rc = 1;
+            } else {
+                for (int32_t i = 0; i < n; i++)
+                    print_submitted(job_ids[i], &js[i]);
+            }
+        }
+
+        for (int32_t i = 0; i < n; i++) {
+            free(js[i].command);
+            free(js[i].tokenpool);
+            free(argvs[i]);
+            free(lines[i]);
+        }
+    }
+
+out:
+    free(buf);
+    free(job_ids);
+    free(argvs);
+    free(lines);
+    free(js);
+    if (fp != stdin)
+        fclose(fp);
+    return rc;
+}
+
+int main(int argc, char **argv)
+{
+    struct job_submit js;
+    const char *batch_file = NULL;
+    int64_t job_id;
+    int rc;
+
+    memset(&js, 0, sizeof(js));
+
+    rc = parse_submit(argc, argv, &js, &batch_file);
+    if (rc != 0) {
+        if (rc < 0)
+            usage(stderr);
+        return rc < 0 ? 1 : 0;
+    }
+
+    if (batch_file != NULL) {
+        if (optind != argc) {
+            fprintf(stderr, "bsub: --batch-file takes no command\n");
+            return 1;
+        }
+        return submit_batch_file(batch_file);
+    }
+
     rc = llb_submit(&js, &job_id);
     if (rc != 0) {
         fprintf(stderr, "Job not submitted");
@@ -440,8 +651,7 @@ int main(int argc, char **argv)
         return 1;
     }
 
-    fprintf(stdout, "Job <%ld> is submitted to queue <%s>.\n", (long) job_id,
-            js.queue ? js.queue : "default");
+    print_submitted(job_id, &js);
 
     free(js.command);
     free(js.tokenpool);
@@ -31,7 +31,8 @@ const char *pend_reason_msg[] = {
     [PEND_GPU_MODEL] = "no host has the required GPU model",
     [PEND_HOST_EXCLUSIVE] = "exclusive constraint cannot be satisfied",
     [PEND_HOST_OVERFLOW] = "host allocation size overflow buffer",
-    [PEND_DEPEND] = "waiting for job dependency"};
+    [PEND_DEPEND] = "waiting for job dependency",
+    [PEND_PAYLOAD] = "job payload cannot be read"};
 
 struct queue_info *llb_queue_info(int32_t *nqueues)
 {
@@ -291,6 +292,54 @@ int32_t llb_signal_job(int64_t jobid, int32_t array_index, int32_t sig)
     return 0;
 }
 
+struct signal_call {
+    llb_signal_cb done;
+    void *arg;
+};
+
+static void signal_reply(void *arg, const struct protocol_header *hdr,
+                         XDR *xdrs)
+{
+    struct signal_call *s = arg;
+
+    (void) xdrs;
+    s->done(hdr->status, s->arg);
+    free(s);
+}
+
+/*
+ * llb_signal_job_async - llb_signal_job() on the connection c, done
+ * gets the status of the request, 0 or an errno, from
+ * llb_conn_dispatch().
+ */
+int32_t llb_signal_job_async(struct llb_conn *c, int64_t jobid,
+                             int32_t array_index, int32_t sig,
+                             llb_signal_cb done, void *arg)
+{
+    struct signal_call *s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return -1;
+    s->done = done;
+    s->arg = arg;
+
+    struct wire_job_sig req;
+    req.job_id = jobid;
+    req.array_index = array_index;
+    req.sig = sig;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_SIGNAL;
+    hdr.status = MBD_OK;
+
+    if (call_mbd_async(c, &hdr, &req, xdr_wire_job_sig, LL_BUFSIZ_1K,
+                       signal_reply, s) < 0) {
+        free(s);
+        return -1;
+    }
+    return 0;
+}
+
 struct host_info *llb_host_info(int32_t *nhosts)
 {
     char reqbuf[256];
@@ -393,28 +442,211 @@ void llb_free_host_info(struct host_info *h, int32_t n)
     free(h);
 }
 
-struct job_info *llb_job_info(const struct job_info_req *req, int32_t *n)
+/*
+ * Rebuild the "ncpus@host ncpus@host" string of a job from the host
+ * table of a v2 reply.
+ */
+static char *job_run_hosts(const struct wire_job_info2 *w, char **names,
+                           uint32_t nnames)
+{
+    size_t len = 1;
+    for (uint32_t i = 0; i < w->nhosts; i++) {
+        if (w->hosts[i] >= nnames)
+            return NULL;
+        len += strlen(names[w->hosts[i]]) + LL_BUFSIZ_32;
+    }
+
+    char *s = malloc(len);
+    if (s == NULL)
+        return NULL;
+
+    size_t off = 0;
+    s[0] = 0;
+    for (uint32_t i = 0; i < w->nhosts; i++)
+        off += (size_t) snprintf(s + off, len - off, "%s%d@%s",
+                                 i > 0 ? " " : "", w->ncpus,
+                                 names[w->hosts[i]]);
+    return s;
+}
+
+static void free_names(char **names, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+        free(names[i]);
+    free(names);
+}
+
+/*
+ * Decode a v2 job info reply, the host table then every job, taking
+ * over the strings decoded into each wire record, then the position
+ * of the listing.
+ */
+static struct job_info *decode_job_info2(XDR *xdrs, int32_t *n,
+                                         uint32_t *more,
+                                         struct wire_job_cursor *next)
+{
+    uint32_t fields;
+    char **names = NULL;
+    uint32_t nnames = 0;
+    uint32_t njobs;
+
+    if (!xdr_uint32_t(xdrs, &fields)
+        || !xdr_array(xdrs, (char **) &names, &nnames, INT32_MAX,
+                      sizeof(char *), (xdrproc_t) xdr_wrapstring)
+        || !xdr_uint32_t(xdrs, &njobs) || njobs > INT32_MAX) {
+        free_names(names, nnames);
+        goto proto;
+    }
+
+    if (njobs == 0) {
+        free_names(names, nnames);
+        if (!xdr_uint32_t(xdrs, more) || !xdr_wire_job_cursor(xdrs, next))
+            goto proto;
+        // this is a special case in which we return NULL even if
+        // the operation went ok. make sure to 0 the errno not to
+        // fool the caller.
+        *n = 0;
+        errno = 0;
+        return NULL;
+    }
+
+    struct job_info *out = calloc(njobs, sizeof(*out));
+    if (out == NULL) {
+        free_names(names, nnames);
+        return NULL;
+    }
+
+    uint32_t k;
+    for (k = 0; k < njobs; k++) {
+        struct wire_job_info2 w;
+        struct job_info *dst = &out[k];
+
+        memset(&w, 0, sizeof(w));
+        if (!xdr_wire_job_info2(xdrs, &w, fields)) {
+            free(w.name);
+            free(w.queue);
+            free(w.submit_host);
+            free(w.comment);
+            free(w.hosts);
+            break;
+        }
+
+        dst->job_id = w.job_id;
+        dst->array_id = w.array_id;
+        dst->array_index = w.array_index;
+        dst->uid = w.uid;
+        dst->pid = w.pid;
+        dst->state = w.state;
+        dst->exit_status = w.exit_status;
+        dst->priority = w.priority;
+        dst->pend_reason = w.pend_reason;
+        dst->submit_time = w.submit_time;
+        dst->dispatch_time = w.dispatch_time;
+        dst->end_time = w.end_time;
+        dst->susp_time = w.susp_time;
+        dst->name = w.name;
+        dst->queue = w.queue;
+        dst->submit_host = w.submit_host;
+        dst->comment = w.comment;
+        if (fields & LLB_JOB_F_RUN_HOSTS) {
+            dst->run_hosts = job_run_hosts(&w, names, nnames);
+            if (dst->run_hosts == NULL) {
+                free(w.hosts);
+                k++;
+                break;
+            }
+        }
+        free(w.hosts);
+    }
+
+    free_names(names, nnames);
+
+    if (k < njobs
+        || !xdr_uint32_t(xdrs, more) || !xdr_wire_job_cursor(xdrs, next)) {
+        llb_free_job_info(out, (int32_t) k);
+        goto proto;
+    }
+
+    *n = (int32_t) njobs;
+    return out;
+
+proto:
+    errno = EPROTO;
+    return NULL;
+}
+
+/*
+ * One BATCH_JOB_INFO2 round trip, a page of at most limit jobs after
+ * the cursor, 0 for all the jobs.
+ */
+/*
+ * A filter string is not truncated: a shorter queue or pattern would
+ * select other jobs.
+ */
+static int filter_copy(char *dst, const char *src, size_t size)
+{
+    if (src == NULL) {
+        dst[0] = 0;
+        return 0;
+    }
+    if (ll_strlcpy(dst, src, size) >= size) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int job_filter_to_wire(const struct job_filter *f,
+                              struct wire_job_filter *w)
+{
+    memset(w, 0, sizeof(*w));
+    if (filter_copy(w->queue, f->queue, sizeof(w->queue)) < 0
+        || filter_copy(w->name, f->name, sizeof(w->name)) < 0
+        || filter_copy(w->project, f->project, sizeof(w->project)) < 0
+        || filter_copy(w->host, f->host, sizeof(w->host)) < 0)
+        return -1;
+
+    w->array_id = f->array_id;
+    w->submit_from = (int64_t) f->submit_from;
+    w->submit_to = (int64_t) f->submit_to;
+    w->pend_reason = f->pend_reason;
+    w->has_pend_reason = f->has_pend_reason != 0;
+    return 0;
+}
+
+static struct job_info *job_info_call(const struct job_info_req *req,
+                                      const struct wire_job_filter *filter,
+                                      int32_t limit,
+                                      const struct wire_job_cursor *after,
+                                      uint32_t *more,
+                                      struct wire_job_cursor *next,
+                                      int32_t *n)
 {
     *n = -1;
+    *more = 0;
     errno = 0;
 
     size_t bufsz =
-        PACKET_HEADER_SIZE + sizeof(struct wire_job_info_req) + LL_BUFSIZ_64;
+        PACKET_HEADER_SIZE + sizeof(struct wire_job_query2) + LL_BUFSIZ_64;
     char *buf = calloc(bufsz, 1);
     if (buf == NULL)
         return NULL;
 
     struct protocol_header hdr;
     init_protocol_header(&hdr);
-    hdr.operation = BATCH_JOB_INFO;
+    hdr.operation = BATCH_JOB_INFO2;
     hdr.status = MBD_OK;
 
-    struct wire_job_query wreq;
-    wreq.job_id = req->job_id;
-    wreq.array_id = req->array_id;
-    wreq.array_index = req->array_index;
-    wreq.flags = req->flags;
-    wreq.uid = req->uid;
+    struct wire_job_query2 wreq;
+    wreq.query.job_id = req->job_id;
+    wreq.query.array_id = req->array_id;
+    wreq.query.array_index = req->array_index;
+    wreq.query.flags = req->flags;
+    wreq.query.uid = req->uid;
+    wreq.fields = req->fields;
+    wreq.limit = limit;
+    wreq.after = *after;
+    wreq.filter = *filter;
 
     if (auth_sign_header(&hdr) < 0) {
         free(buf);
@@ -424,7 +656,7 @@ struct job_info *llb_job_info(const struct job_info_req *req, int32_t *n)
 
     XDR xdrs;
     xdrmem_create(&xdrs, buf, (uint32_t) bufsz, XDR_ENCODE);
-    if (!ll_encode_msg(&xdrs, (char *) &wreq, xdr_wire_job_query, &hdr)) {
+    if (!ll_encode_msg(&xdrs, (char *) &wreq, xdr_wire_job_query2, &hdr)) {
         xdr_destroy(&xdrs);
         free(buf);
         errno = EPROTO;
@@ -448,9 +680,219 @@ struct job_info *llb_job_info(const struct job_info_req *req, int32_t *n)
     }
 
     xdrmem_create(&xdrs, rep, rhdr.length, XDR_DECODE);
-    struct wire_job_info_array w;
+    struct job_info *out = decode_job_info2(&xdrs, n, more, next);
+    int e = errno;
+    xdr_destroy(&xdrs);
+    free(rep);
+    errno = e;
+
+    return out;
+}
+
+struct job_info *llb_job_info(const struct job_info_req *req, int32_t *n)
+{
+    struct wire_job_cursor start = {.list = -1};
+    struct wire_job_cursor next;
+    struct wire_job_filter filter;
+    uint32_t more;
+
+    *n = -1;
+    if (job_filter_to_wire(&req->filter, &filter) < 0)
+        return NULL;
+
+    return job_info_call(req, &filter, 0, &start, &more, &next, n);
+}
+
+struct llb_job_iter {
+    struct job_info_req req;
+    struct wire_job_filter filter;
+    int32_t page;
+    struct wire_job_cursor next;
+    int done;
+};
+
+/*
+ * llb_job_iter_open - list the jobs of req page jobs at a time, so that
+ * neither mbd nor the caller holds the whole listing. A job reference
+ * is answered in one page.
+ */
+struct llb_job_iter *llb_job_iter_open(const struct job_info_req *req,
+                                       int32_t page)
+{
+    if (page <= 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct llb_job_iter *it = calloc(1, sizeof(*it));
+    if (it == NULL)
+        return NULL;
+
+    it->req = *req;
+    if (job_filter_to_wire(&req->filter, &it->filter) < 0) {
+        free(it);
+        return NULL;
+    }
+    it->page = page;
+    it->next.list = -1;
+
+    return it;
+}
+
+/*
+ * llb_job_iter_next - the next page of jobs, to free with
+ * llb_free_job_info(). At the end of the listing returns NULL with *n
+ * 0 and errno 0; on error NULL with errno set.
+ */
+struct job_info *llb_job_iter_next(struct llb_job_iter *it, int32_t *n)
+{
+    struct wire_job_cursor after = it->next;
+    uint32_t more;
+
+    *n = 0;
+    while (!it->done) {
+        struct job_info *jobs =
+            job_info_call(&it->req, &it->filter, it->page, &after, &more,
+                          &it->next, n);
+        if (jobs == NULL && errno != 0)
+            return NULL;
+        it->done = !more;
+        if (jobs != NULL)
+            return jobs;
+        after = it->next;
+    }
+
+    *n = 0;
+    errno = 0;
+    return NULL;
+}
+
+void llb_job_iter_close(struct llb_job_iter *it)
+{
+    free(it);
+}
+
+struct job_info_call {
+    llb_job_info_cb done;
+    void *arg;
+};
+
+static void job_info_reply(void *arg, const struct protocol_header *hdr,
+                           XDR *xdrs)
+{
+    struct job_info_call *j = arg;
+    struct wire_job_cursor next;
+    struct job_info *jobs = NULL;
+    int32_t status = hdr->status;
+    int32_t n = -1;
+    uint32_t more;
+
+    if (status == MBD_OK) {
+        jobs = decode_job_info2(xdrs, &n, &more, &next);
+        if (jobs == NULL && n < 0)
+            status = errno;
+    }
+
+    j->done(status, jobs, n, j->arg);
+    free(j);
+}
+
+/*
+ * llb_job_info_async - llb_job_info() on the connection c. done gets
+ * the status of the request and, with status 0, the jobs to free with
+ * llb_free_job_info(), from llb_conn_dispatch().
+ */
+int llb_job_info_async(struct llb_conn *c, const struct job_info_req *req,
+                       llb_job_info_cb done, void *arg)
+{
+    struct wire_job_query2 wreq;
+    memset(&wreq, 0, sizeof(wreq));
+    if (job_filter_to_wire(&req->filter, &wreq.filter) < 0)
+        return -1;
+    wreq.query.job_id = req->job_id;
+    wreq.query.array_id = req->array_id;
+    wreq.query.array_index = req->array_index;
+    wreq.query.flags = req->flags;
+    wreq.query.uid = req->uid;
+    wreq.fields = req->fields;
+    wreq.after.list = -1;
+
+    struct job_info_call *j = calloc(1, sizeof(*j));
+    if (j == NULL)
+        return -1;
+    j->done = done;
+    j->arg = arg;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_INFO2;
+    hdr.status = MBD_OK;
+
+    size_t siz =
+        PACKET_HEADER_SIZE + sizeof(struct wire_job_query2) + LL_BUFSIZ_64;
+    if (call_mbd_async(c, &hdr, &wreq, xdr_wire_job_query2, siz,
+                       job_info_reply, j) < 0) {
+        free(j);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * llb_job_summary - the counts of the active jobs filter selects,
+ * grouped by LLB_SUM_QUEUE, LLB_SUM_USER or LLB_SUM_PEND_REASON,
+ * computed by mbd. Like a listing, only the caller's jobs unless the
+ * caller is an administrator. NULL with errno set on error.
+ */
+struct job_count *llb_job_summary(int32_t by, const struct job_filter *filter,
+                                  int32_t *n)
+{
+    *n = -1;
+    errno = 0;
+
+    struct wire_job_summary_req wreq;
+    wreq.by = by;
+    if (job_filter_to_wire(filter, &wreq.filter) < 0)
+        return NULL;
+
+    char buf[PACKET_HEADER_SIZE + sizeof(wreq) + LL_BUFSIZ_64];
+    XDR xdrs;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_SUMMARY;
+
+    if (auth_sign_header(&hdr) < 0) {
+        errno = EPROTO;
+        return NULL;
+    }
+
+    xdrmem_create(&xdrs, buf, sizeof(buf), XDR_ENCODE);
+    if (!ll_encode_msg(&xdrs, (char *) &wreq, xdr_wire_job_summary_req,
+                       &hdr)) {
+        xdr_destroy(&xdrs);
+        errno = EPROTO;
+        return NULL;
+    }
+    size_t len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+
+    void *rep = NULL;
+    struct protocol_header rhdr;
+    if (call_mbd(buf, len, &rep, &rhdr) < 0)
+        return NULL;
+
+    if (rhdr.status != MBD_OK) {
+        errno = rhdr.status;
+        free(rep);
+        return NULL;
+    }
+
+    struct wire_job_summary w;
     memset(&w, 0, sizeof(w));
-    if (!xdr_wire_job_info_array(&xdrs, &w)) {
+
+    xdrmem_create(&xdrs, rep, rhdr.length, XDR_DECODE);
+    if (!xdr_wire_job_summary(&xdrs, &w)) {
         xdr_destroy(&xdrs);
         free(rep);
         errno = EPROTO;
@@ -459,50 +901,139 @@ struct job_info *llb_job_info(const struct job_info_req *req, int32_t *n)
     xdr_destroy(&xdrs);
     free(rep);
 
-    if (w.njobs == 0) {
-        // this is a special case in which we return NULL even if
-        // the operation went ok. make sure to 0 the errno not to
-        // fool the caller.
-        *n = 0;
-        errno = 0;
+    struct job_count *out = calloc(w.ncounts ? w.ncounts : 1, sizeof(*out));
+    if (out == NULL) {
+        xdr_free((xdrproc_t) xdr_wire_job_summary, (char *) &w);
         return NULL;
     }
 
-    struct job_info *out = calloc(w.njobs, sizeof(*out));
-    if (out == NULL) {
-        xdr_free((xdrproc_t) xdr_wire_job_info_array, (char *) &w);
-        return NULL;
-    }
-
-    for (int i = 0; i < w.njobs; i++) {
-        struct wire_job_info *src = &w.jobs[i];
-        struct job_info *dst = &out[i];
-
-        dst->job_id = src->job_id;
-        dst->array_id = src->array_id;
-        dst->array_index = src->array_index;
-        dst->uid = src->uid;
-        dst->pid = src->pid;
-        dst->state = src->state;
-        dst->exit_status = src->exit_status;
-        dst->priority = src->priority;
-        dst->pend_reason = src->pend_reason;
-        dst->submit_time = src->submit_time;
-        dst->dispatch_time = src->dispatch_time;
-        dst->end_time = src->end_time;
-        dst->susp_time = src->susp_time;
-        dst->name = strdup(src->name);
-        dst->queue = strdup(src->queue);
-        dst->submit_host = strdup(src->submit_host);
-        dst->run_hosts = strdup(src->run_hosts);
-        dst->comment = strdup(src->comment);
-    }
-
-    *n = w.njobs;
-    xdr_free((xdrproc_t) xdr_wire_job_info_array, (char *) &w);
+    for (int i = 0; i < w.ncounts; i++) {
+        const struct wire_job_count *c = &w.counts[i];
+
+        if (by == LLB_SUM_QUEUE) {
+            out[i].queue = strndup(c->queue, sizeof(c->queue) - 1);
+            if (out[i].queue == NULL) {
+                llb_free_job_summary(out, i);
+                xdr_free((xdrproc_t) xdr_wire_job_summary, (char *) &w);
+                return NULL;
+            }
+        }
+        out[i].id = c->id;
+        out[i].num_pend = c->num_pend;
+        out[i].num_held = c->num_held;
+        out[i].num_run = c->num_run;
+        out[i].num_susp = c->num_susp;
+    }
+    *n = w.ncounts;
+
+    xdr_free((xdrproc_t) xdr_wire_job_summary, (char *) &w);
     return out;
 }
 
+void llb_free_job_summary(struct job_count *c, int32_t n)
+{
+    if (c == NULL)
+        return;
+    for (int i = 0; i < n; i++)
+        free(c[i].queue);
+    free(c);
+}
+
+/*
+ * llb_job_delta - the jobs of the listing req->flags, req->fields and
+ * req->filter describe that changed since seq since of epoch, at most
+ * limit changes, 0 for all. Start with epoch 0, then pass the epoch
+ * and seq of the previous reply. When d->reset is set the caller drops
+ * every job it keeps before applying d->jobs; jobs in d->gone are to
+ * be dropped. Returns 0, or -1 with errno set.
+ */
+int llb_job_delta(const struct job_info_req *req, int64_t epoch,
+                  uint64_t since, int32_t limit, struct job_delta *d)
+{
+    memset(d, 0, sizeof(*d));
+    errno = 0;
+
+    struct wire_job_delta_req wreq;
+    wreq.epoch = epoch;
+    wreq.since = since;
+    wreq.flags = req->flags;
+    wreq.fields = req->fields;
+    wreq.limit = limit;
+    if (job_filter_to_wire(&req->filter, &wreq.filter) < 0)
+        return -1;
+
+    char buf[PACKET_HEADER_SIZE + sizeof(wreq) + LL_BUFSIZ_64];
+    XDR xdrs;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_DELTA;
+
+    if (auth_sign_header(&hdr) < 0) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    xdrmem_create(&xdrs, buf, sizeof(buf), XDR_ENCODE);
+    if (!ll_encode_msg(&xdrs, (char *) &wreq, xdr_wire_job_delta_req, &hdr)) {
+        xdr_destroy(&xdrs);
+        errno = EPROTO;
+        return -1;
+    }
+    size_t len = xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+
+    void *rep = NULL;
+    struct protocol_header rhdr;
+    if (call_mbd(buf, len, &rep, &rhdr) < 0)
+        return -1;
+
+    if (rhdr.status != MBD_OK) {
+        errno = rhdr.status;
+        free(rep);
+        return -1;
+    }
+
+    uint32_t more;
+    struct wire_job_cursor next;
+    struct wire_job_delta_tail tail;
+
+    memset(&tail, 0, sizeof(tail));
+    xdrmem_create(&xdrs, rep, rhdr.length, XDR_DECODE);
+    d->jobs = decode_job_info2(&xdrs, &d->njobs, &more, &next);
+    if (d->jobs == NULL && errno != 0) {
+        xdr_destroy(&xdrs);
+        free(rep);
+        return -1;
+    }
+    if (!xdr_wire_job_delta_tail(&xdrs, &tail)) {
+        xdr_destroy(&xdrs);
+        free(rep);
+        llb_free_job_info(d->jobs, d->njobs);
+        memset(d, 0, sizeof(*d));
+        errno = EPROTO;
+        return -1;
+    }
+    xdr_destroy(&xdrs);
+    free(rep);
+
+    d->epoch = tail.epoch;
+    d->seq = tail.seq;
+    d->reset = (int32_t) tail.reset;
+    d->more = (int32_t) more;
+    d->ngone = (int32_t) tail.ngone;
+    d->gone = tail.gone;
+
+    return 0;
+}
+
+void llb_free_job_delta(struct job_delta *d)
+{
+    llb_free_job_info(d->jobs, d->njobs);
+    free(d->gone);
+    memset(d, 0, sizeof(*d));
+}
+
 void llb_free_job_info(struct job_info *jobs, int32_t n)
 {
     int i;
@@ -12,14 +12,29 @@
 #include <limits.h>
 #include <pwd.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include "llbatch.h"
 #include "batch/lib/log.h"
+#include "batch/lib/logindex.h"
+#include "batch/lib/spool.h"
 #include "base/lib/ll.conf.h"
 #include "base/lib/ll.bufsiz.h"
 #include "base/lib/ll.hash.h"
+#include "base/lib/ll.sys.h"
 
-#define HIST_JOB_BUCKETS 10
+#define HIST_MAX_THREADS 16
+
+/*
+ * An event read for a job that has no JOB_NEW before it in the archive
+ * being scanned into a partial job_hist. It is kept until the partial is
+ * merged, the job may come from an earlier archive.
+ */
+struct hist_orphan {
+    int64_t job_id;
+    uid_t uid;
+    struct job_event ev;
+};
 
 struct job_hist {
     int64_t job_id;
@@ -37,6 +52,23 @@ struct job_hist {
      * regardless of where the array currently lives.
      */
     struct ll_hash job_hash;
+    /*
+     * Partial job_hist of one archive, scanned on its own and merged
+     * into the caller's in archive order, see hist_merge(). new_state
+     * is the state from the job's first JOB_NEW in the archive, seen
+     * holds the jobs whose JOB_NEW did not match so their events are
+     * not kept as orphans.
+     */
+    int part;
+    int32_t *new_state;
+    struct hist_orphan *orphans;
+    int32_t num_orphans;
+    int32_t max_orphans;
+    struct ll_hash seen;
+    int seen_init;
+    /* merged job_hist of llb_hist_foreach(), jobs the last merged
+     * archive had records of */
+    char *touched;
 };
 
 static char *hist_strdup(const char *s)
@@ -168,11 +200,19 @@ static struct job_hist_info *hist_find(struct job_hist *jh, int64_t job_id)
 static int hist_job_sidecar_path(char *path, size_t size,
                                  int64_t job_id, const char *file)
 {
+    char jobs[PATH_MAX];
+    char dir[PATH_MAX];
     int n;
 
-    n = snprintf(path, size, "%s/mbd/jobs/%d/%ld/%s",
-                 ll_params[LL_STATE_DIR].val,
-                 (int)(job_id % HIST_JOB_BUCKETS), job_id, file);
+    n = snprintf(jobs, sizeof(jobs), "%s/mbd/jobs",
+                 ll_params[LL_STATE_DIR].val);
+    if (n < 0 || n >= (int)sizeof(jobs))
+        return -1;
+
+    if (spool_find_dir(dir, sizeof(dir), jobs, job_id) < 0)
+        return -1;
+
+    n = snprintf(path, size, "%s/%s", dir, file);
     if (n < 0 || n >= (int)size)
         return -1;
 
@@ -236,19 +276,36 @@ static void hist_apply_submit_field(struct job_hist_info *j,
     }
 }
 
-static void hist_load_sidecar(struct job_hist_info *j, const char *file)
+/*
+ * The sidecar of a job submitted to the submit journal is the record
+ * its JOB_NEW points to, the submit file of its spool directory before.
+ */
+static void hist_load_sidecar(struct job_hist_info *j,
+                              const struct log_job_new *e)
 {
     char path[PATH_MAX];
     char line[4096];
+    char *rec = NULL;
     FILE *fp;
     char *eq, *key, *val;
 
-    if (hist_job_sidecar_path(path, sizeof(path), j->job_id, file) < 0)
-        return;
-
-    fp = fopen(path, "r");
-    if (fp == NULL)
+    if (e->journal_len != 0) {
+        snprintf(path, sizeof(path), "%s/mbd", ll_params[LL_STATE_DIR].val);
+        rec = spool_journal_read(path, e->journal_seq, e->journal_off,
+                                 e->journal_len);
+        if (rec == NULL)
+            return;
+        fp = fmemopen(rec, e->journal_len, "r");
+    } else {
+        if (hist_job_sidecar_path(path, sizeof(path), j->job_id,
+                                  "submit") < 0)
+            return;
+        fp = fopen(path, "r");
+    }
+    if (fp == NULL) {
+        free(rec);
         return;
+    }
 
     while (fgets(line, sizeof(line), fp) != NULL) {
         eq = strchr(line, '=');
@@ -261,6 +318,7 @@ static void hist_load_sidecar(struct job_hist_info *j, const char *file)
     }
 
     fclose(fp);
+    free(rec);
 }
 
 static void hist_load_usage_sidecar(struct job_hist_info *j)
@@ -300,12 +358,14 @@ static void hist_load_usage_sidecar(struct job_hist_info *j)
  * hist_add
  * ----------------------------------------------------------------------- */
 
-static struct job_hist_info *hist_add(struct job_hist *jh,
-                                      const struct log_job_new *e)
+/*
+ * hist_slot - room for one more job at jobs[num_jobs], zeroed. The entry
+ * becomes visible to hist_find() with hist_commit().
+ */
+static struct job_hist_info *hist_slot(struct job_hist *jh)
 {
     struct job_hist_info *n;
     struct job_hist_info *j;
-    char key[32];
 
     if (jh->num_jobs == jh->max_jobs) {
         int32_t new_max;
@@ -318,15 +378,44 @@ static struct job_hist_info *hist_add(struct job_hist *jh,
         n = realloc(jh->jobs, new_max * sizeof(struct job_hist_info));
         if (n == NULL)
             return NULL;
-
         jh->jobs = n;
-        memset(&jh->jobs[jh->max_jobs], 0, 64 * sizeof(struct job_hist_info));
+
+        if (jh->part) {
+            int32_t *s = realloc(jh->new_state, new_max * sizeof(int32_t));
+            if (s == NULL)
+                return NULL;
+            jh->new_state = s;
+        }
+
         jh->max_jobs = new_max;
     }
 
     j = &jh->jobs[jh->num_jobs];
     memset(j, 0, sizeof(*j));
 
+    return j;
+}
+
+static void hist_commit(struct job_hist *jh, int64_t job_id)
+{
+    char key[32];
+
+    snprintf(key, sizeof(key), "%ld", job_id);
+    /* idx+1, see hist_find()'s comment on the NULL/index-0 clash */
+    ll_hash_insert(&jh->job_hash, key, (void *)(intptr_t)(jh->num_jobs + 1), 0);
+
+    jh->num_jobs++;
+}
+
+static struct job_hist_info *hist_add(struct job_hist *jh,
+                                      const struct log_job_new *e)
+{
+    struct job_hist_info *j;
+
+    j = hist_slot(jh);
+    if (j == NULL)
+        return NULL;
+
     j->job_id      = e->job_id;
     j->array_id     = e->array_id;
     j->array_index  = e->array_index;
@@ -355,14 +444,13 @@ static struct job_hist_info *hist_add(struct job_hist *jh,
         return NULL;
     }
 
-    hist_load_sidecar(j, "submit");
+    hist_load_sidecar(j, e);
     hist_load_usage_sidecar(j);
 
-    snprintf(key, sizeof(key), "%ld", e->job_id);
-    /* idx+1, see hist_find()'s comment on the NULL/index-0 clash */
-    ll_hash_insert(&jh->job_hash, key, (void *)(intptr_t)(jh->num_jobs + 1), 0);
+    if (jh->part)
+        jh->new_state[jh->num_jobs] = e->state;
 
-    jh->num_jobs++;
+    hist_commit(jh, e->job_id);
 
     return j;
 }
@@ -416,18 +504,18 @@ int llb_caller_is_admin(void)
  * just by guessing/knowing a job_id.
  */
 
-static int hist_match_new(struct job_hist *jh,
-                          const struct log_job_new *e)
+static int hist_match(struct job_hist *jh, int64_t job_id, int64_t array_id,
+                      int32_t array_index, uid_t uid)
 {
     /*
      * Explicit array element: N[m].
      */
     if (jh->array_id != 0) {
-        if (e->array_id != jh->array_id
-            || e->array_index != jh->array_index)
+        if (array_id != jh->array_id
+            || array_index != jh->array_index)
             return 0;
 
-        if (!jh->all && e->uid != jh->uid)
+        if (!jh->all && uid != jh->uid)
             return 0;
 
         return 1;
@@ -439,11 +527,11 @@ static int hist_match_new(struct job_hist *jh,
      * job array    -> array_id == N
      */
     if (jh->job_id > 0) {
-        if (e->job_id != jh->job_id
-            && e->array_id != jh->job_id)
+        if (job_id != jh->job_id
+            && array_id != jh->job_id)
             return 0;
 
-        if (!jh->all && e->uid != jh->uid)
+        if (!jh->all && uid != jh->uid)
             return 0;
 
         return 1;
@@ -452,7 +540,13 @@ static int hist_match_new(struct job_hist *jh,
     if (jh->all)
         return 1;
 
-    return e->uid == jh->uid;
+    return uid == jh->uid;
+}
+
+static int hist_match_new(struct job_hist *jh,
+                          const struct log_job_new *e)
+{
+    return hist_match(jh, e->job_id, e->array_id, e->array_index, e->uid);
 }
 
 static int hist_event_exists(struct job_hist_info *j, int32_t type,
@@ -469,465 +563,970 @@ static int hist_event_exists(struct job_hist_info *j, int32_t type,
     return 0;
 }
 
-static void hist_apply_new(struct job_hist *jh, const struct event_rec *rec)
+static void hist_seen_add(struct job_hist *jh, int64_t job_id)
 {
-    struct log_job_new e;
-    struct job_hist_info *j;
-
-    memset(&e, 0, sizeof(e));
-
-    if (log_parse_job_new(rec, &e) < 0)
-        return;
-
-    if (!hist_match_new(jh, &e))
-        return;
+    char key[32];
 
-    j = hist_find(jh, e.job_id);
-    if (j != NULL) {
-       /* repeated JOB_NEW from compact checkpoint -- only update
-         * state if job hasn't progressed beyond pending/held yet
-         */
-        if (j->state == JOB_PENDING || j->state == JOB_HELD)
-            j->state = e.state;
-        j->submit_time = e.submit_time;
-        return;
+    if (!jh->seen_init) {
+        if (ll_hash_init(&jh->seen, 16411) < 0)
+            return;
+        jh->seen_init = 1;
     }
 
-    hist_add(jh, &e);
+    snprintf(key, sizeof(key), "%ld", job_id);
+    ll_hash_insert(&jh->seen, key, (void *)1, 0);
 }
 
-static void hist_apply_start(struct job_hist *jh, const struct event_rec *rec)
+/*
+ * hist_orphan_wanted - an event for a job not in jh is kept only by a
+ * partial scan, and only when the job's JOB_NEW was not already seen
+ * and rejected in the same archive.
+ */
+static int hist_orphan_wanted(struct job_hist *jh, int64_t job_id)
 {
-    struct log_job_start e;
-    struct job_hist_info *j;
-    struct job_event *ev;
+    char key[32];
 
-    memset(&e, 0, sizeof(e));
+    if (!jh->part)
+        return 0;
+    if (!jh->seen_init)
+        return 1;
 
-    if (log_parse_job_start(rec, &e) < 0)
-        return;
+    snprintf(key, sizeof(key), "%ld", job_id);
+    return ll_hash_search(&jh->seen, key) == NULL;
+}
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+static void hist_orphan_add(struct job_hist *jh, int64_t job_id,
+                            struct job_event *ev, uid_t uid)
+{
+    struct hist_orphan *n;
 
-    if (hist_event_exists(j, EVENT_JOB_START, rec->event_time))
-        return;
+    if (jh->num_orphans == jh->max_orphans) {
+        int32_t new_max = jh->max_orphans ? jh->max_orphans * 2 : 256;
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+        n = realloc(jh->orphans, new_max * sizeof(struct hist_orphan));
+        if (n == NULL) {
+            event_free(ev);
+            return;
+        }
+        jh->orphans = n;
+        jh->max_orphans = new_max;
+    }
 
-    j->state          = JOB_RUNNING;
-    ev->type          = EVENT_JOB_START;
-    ev->event_time    = rec->event_time;
-    ev->state         = JOB_RUNNING;
-    ev->run_hosts    = hist_strdup(e.hosts);
-    ev->gpu_assigned = hist_strdup(e.gpu_assigned);
+    n = &jh->orphans[jh->num_orphans++];
+    n->job_id = job_id;
+    n->uid = uid;
+    n->ev = *ev;
 }
 
-static void hist_apply_fork(struct job_hist *jh, const struct event_rec *rec)
+static void hist_apply_new(struct job_hist *jh, const struct log_job_new *e)
 {
-    struct log_job_fork e;
     struct job_hist_info *j;
-    struct job_event *ev;
-
-    memset(&e, 0, sizeof(e));
-
-    if (log_parse_job_fork(rec, &e) < 0)
-        return;
-
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
 
-    if (hist_event_exists(j, EVENT_JOB_FORK, rec->event_time))
+    if (!hist_match_new(jh, e)) {
+        if (jh->part)
+            hist_seen_add(jh, e->job_id);
         return;
+    }
 
-    ev = event_add(j);
-    if (ev == NULL)
+    j = hist_find(jh, e->job_id);
+    if (j != NULL) {
+       /* repeated JOB_NEW from compact checkpoint -- only update
+         * state if job hasn't progressed beyond pending/held yet
+         */
+        if (j->state == JOB_PENDING || j->state == JOB_HELD)
+            j->state = e->state;
+        j->submit_time = e->submit_time;
         return;
+    }
 
-    ev->type       = EVENT_JOB_FORK;
-    ev->event_time = rec->event_time;
-    ev->pid        = (pid_t)e.job_pid;
+    hist_add(jh, e);
 }
 
-static void hist_apply_signal(struct job_hist *jh, const struct event_rec *rec)
+/*
+ * hist_job_event - append ev to the job and update the job fields it
+ * changes. Takes ownership of ev's strings. uid is the job owner from
+ * JOB_FINISH.
+ */
+static void hist_job_event(struct job_hist_info *j, struct job_event *ev,
+                           uid_t uid)
 {
-    struct log_job_signal e;
-    struct job_hist_info *j;
-    struct job_event *ev;
-
-    memset(&e, 0, sizeof(e));
-
-    if (log_parse_job_signal(rec, &e) < 0)
-        return;
-
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+    struct job_event *n;
 
-    if (hist_event_exists(j, EVENT_JOB_SIGNAL, rec->event_time))
+    if (hist_event_exists(j, ev->type, ev->event_time)) {
+        event_free(ev);
         return;
+    }
 
-    ev = event_add(j);
-    if (ev == NULL)
+    n = event_add(j);
+    if (n == NULL) {
+        event_free(ev);
         return;
+    }
+    *n = *ev;
+
+    switch (ev->type) {
+    case EVENT_JOB_START:
+        j->state = JOB_RUNNING;
+        break;
+    case EVENT_JOB_FINISH:
+        j->state = ev->state;
+        j->uid   = uid;
+        break;
+    case EVENT_JOB_PEND_SUSP:
+        j->state = JOB_HELD;
+        break;
+    case EVENT_JOB_PEND_RESUME:
+    case EVENT_JOB_PEND:
+        j->state = JOB_PENDING;
+        break;
+    case EVENT_JOB_SUSP:
+        j->state = JOB_SUSPENDED;
+        break;
+    case EVENT_JOB_MOVE:
+        free(j->queue);
+        j->queue = hist_strdup(ev->to_queue);
+        break;
+    case EVENT_JOB_PRIORITY:
+        j->priority = ev->new_priority;
+        break;
+    default:
+        break;
+    }
+}
 
-    ev->type       = EVENT_JOB_SIGNAL;
+/*
+ * hist_event_from_record - fill ev from a decoded record other than
+ * JOB_NEW. Returns -1 for a type that is not part of a job's history.
+ */
+static int hist_event_from_record(const struct event_rec *rec,
+                                  const struct log_record *r,
+                                  struct job_event *ev, uid_t *uid)
+{
+    memset(ev, 0, sizeof(*ev));
+    ev->type       = rec->type;
     ev->event_time = rec->event_time;
-    ev->signal     = e.signal_num;
+    *uid = 0;
+
+    switch (r->type) {
+    case EVENT_JOB_START:
+        ev->state        = JOB_RUNNING;
+        ev->run_hosts    = hist_strdup(r->p.start.hosts);
+        ev->gpu_assigned = hist_strdup(r->p.start.gpu_assigned);
+        return 0;
+    case EVENT_JOB_FORK:
+        ev->pid = (pid_t)r->p.fork.job_pid;
+        return 0;
+    case EVENT_JOB_SIGNAL:
+        ev->signal = r->p.signal.signal_num;
+        return 0;
+    case EVENT_JOB_FINISH:
+        ev->state       = r->p.finish.state;
+        ev->exit_status = r->p.finish.exit_status;
+        *uid            = r->p.finish.uid;
+        return 0;
+    case EVENT_JOB_PEND_SUSP:
+        ev->state = JOB_HELD;
+        return 0;
+    case EVENT_JOB_PEND_RESUME:
+    case EVENT_JOB_PEND:
+        ev->state = JOB_PENDING;
+        return 0;
+    case EVENT_JOB_SUSP:
+        ev->state = JOB_SUSPENDED;
+        return 0;
+    case EVENT_JOB_MOVE:
+        ev->from_queue = hist_strdup(r->p.move.from_queue);
+        ev->to_queue   = hist_strdup(r->p.move.to_queue);
+        return 0;
+    case EVENT_JOB_PRIORITY:
+        ev->old_priority = r->p.priority.old_priority;
+        ev->new_priority = r->p.priority.new_priority;
+        return 0;
+    default:
+        return -1;
+    }
 }
 
-static void hist_apply_finish(struct job_hist *jh, const struct event_rec *rec)
+static void hist_apply_event(struct job_hist *jh, const struct event_rec *rec)
 {
-    struct log_job_finish e;
+    struct log_record r;
     struct job_hist_info *j;
-    struct job_event *ev;
-
-    memset(&e, 0, sizeof(e));
+    struct job_event ev;
+    int64_t job_id;
+    uid_t uid;
 
-    if (log_parse_job_finish(rec, &e) < 0)
+    if (log_decode(rec, &r) != 0)
         return;
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
+    if (r.type == EVENT_JOB_NEW) {
+        hist_apply_new(jh, &r.p.job_new);
         return;
+    }
 
-    if (hist_event_exists(j, EVENT_JOB_FINISH, rec->event_time))
+    job_id = log_record_job_id(&r);
+    j = hist_find(jh, job_id);
+    if (j == NULL && !hist_orphan_wanted(jh, job_id))
         return;
 
-    ev = event_add(j);
-    if (ev == NULL)
+    if (hist_event_from_record(rec, &r, &ev, &uid) < 0)
         return;
 
-    j->state       = e.state;
-    j->uid         = e.uid;
-    ev->type       = EVENT_JOB_FINISH;
-    ev->event_time = rec->event_time;
-    ev->state      = e.state;
-    ev->exit_status = e.exit_status;
+    if (j != NULL)
+        hist_job_event(j, &ev, uid);
+    else
+        hist_orphan_add(jh, job_id, &ev, uid);
 }
 
-static void hist_apply_pend_susp(struct job_hist *jh,
-                                 const struct event_rec *rec)
-{
-    struct log_job_pend_susp e;
-    struct job_hist_info *j;
-    struct job_event *ev;
+/* -----------------------------------------------------------------------
+ * Event file scanning.
+ *
+ * All manifest files live in the same directory. Archives are scanned
+ * oldest first and the live manifest last, so a job's JOB_NEW is seen
+ * before the events that follow it in later files; duplicate events
+ * across archives are deduplicated by hist_event_exists() via
+ * type + timestamp.
+ * ----------------------------------------------------------------------- */
 
-    memset(&e, 0, sizeof(e));
+static int hist_scan_file(struct job_hist *jh, const char *path)
+{
+    FILE *fp;
+    struct event_rec rec;
 
-    if (log_parse_job_pend_susp(rec, &e) < 0)
-        return;
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+    while (1) {
+        memset(&rec, 0, sizeof(rec));
+        if (log_read_hdr(fp, &rec) < 0)
+            break;
+        hist_apply_event(jh, &rec);
+    }
 
-    if (hist_event_exists(j, EVENT_JOB_PEND_SUSP, rec->event_time))
-        return;
+    fclose(fp);
+    return 0;
+}
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+static int hist_offset_cmp(const void *a, const void *b)
+{
+    uint64_t oa = *(const uint64_t *)a;
+    uint64_t ob = *(const uint64_t *)b;
 
-    j->state       = JOB_HELD;
-    ev->type       = EVENT_JOB_PEND_SUSP;
-    ev->event_time = rec->event_time;
-    ev->state      = JOB_HELD;
+    if (oa < ob)
+        return -1;
+    if (oa > ob)
+        return 1;
+    return 0;
 }
 
-static void hist_apply_pend_resume(struct job_hist *jh,
-                                   const struct event_rec *rec)
+/*
+ * A job already collected from an earlier file may have more records in
+ * this archive whatever its footer says about owners.
+ */
+static int hist_known_in_range(struct job_hist *jh, int64_t min_id,
+                               int64_t max_id)
 {
-    struct log_job_pend_resume e;
-    struct job_hist_info *j;
-    struct job_event *ev;
+    int32_t i;
 
-    memset(&e, 0, sizeof(e));
+    for (i = 0; i < jh->num_jobs; i++) {
+        if (jh->jobs[i].job_id >= min_id && jh->jobs[i].job_id <= max_id)
+            return 1;
+    }
 
-    if (log_parse_job_pend_resume(rec, &e) < 0)
-        return;
+    return 0;
+}
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+/*
+ * hist_index_skip - decide from the footer alone that no job created in
+ * the archive can match. Array elements are numbered after the array
+ * head, so job N cannot be in an archive whose highest job_id is below N.
+ */
+static int hist_index_skip(struct job_hist *jh, const struct log_index *x)
+{
+    int64_t target;
 
-    if (hist_event_exists(j, EVENT_JOB_PEND_RESUME, rec->event_time))
-        return;
+    if (!jh->all && !log_index_has_uid(x, jh->uid))
+        return 1;
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+    target = jh->array_id != 0 ? jh->array_id : jh->job_id;
+    if (target > 0 && target > x->f.max_job_id)
+        return 1;
 
-    j->state       = JOB_PENDING;
-    ev->type       = EVENT_JOB_PEND_RESUME;
-    ev->event_time = rec->event_time;
-    ev->state      = JOB_PENDING;
+    return 0;
 }
 
-static void hist_apply_susp(struct job_hist *jh, const struct event_rec *rec)
+/*
+ * hist_scan_indexed - apply only the records of the jobs that match the
+ * query or were already collected, in file order, reading them at the
+ * offsets the index gives. Returns 1 when the index cannot be used and
+ * the archive has to be scanned in full.
+ */
+static int hist_scan_indexed(struct job_hist *jh, const char *path,
+                             struct log_index *x)
 {
-    struct log_job_susp e;
-    struct job_hist_info *j;
-    struct job_event *ev;
-
-    memset(&e, 0, sizeof(e));
-
-    if (log_parse_job_susp(rec, &e) < 0)
-        return;
-
-    j = hist_find(jh, e.job_id);
-    if (j == NULL) {
-        return;
-    }
+    struct event_rec rec;
+    uint64_t *offs;
+    uint64_t noffs = 0;
+    uint32_t i;
+    FILE *fp;
 
-    if (hist_event_exists(j, EVENT_JOB_SUSP, rec->event_time))
-        return;
+    /* A partial cannot skip on the footer, the archive may hold events
+     * of jobs matched in an earlier archive it knows nothing of.
+     */
+    if (!jh->part
+        && !hist_known_in_range(jh, x->f.min_job_id, x->f.max_job_id)
+        && hist_index_skip(jh, x))
+        return 0;
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+    if (log_index_load(x) < 0)
+        return 1;
 
-    j->state       = JOB_SUSPENDED;
-    ev->type       = EVENT_JOB_SUSP;
-    ev->event_time = rec->event_time;
-    ev->state      = JOB_SUSPENDED;
-}
+    offs = malloc((x->f.nrecs + 1) * sizeof(uint64_t));
+    if (offs == NULL)
+        return -1;
 
-static void hist_apply_move(struct job_hist *jh, const struct event_rec *rec)
-{
-    struct log_job_move e;
-    struct job_hist_info *j;
-    struct job_event *ev;
+    for (i = 0; i < x->f.njobs; i++) {
+        const struct log_index_job *e = &x->jobs[i];
+
+        if (hist_find(jh, e->job_id) == NULL) {
+            if (!(e->flags & LOG_INDEX_NEW)) {
+                if (!jh->part)
+                    continue;
+            } else if (!hist_match(jh, e->job_id, e->array_id,
+                                   e->array_index, (uid_t)e->uid)) {
+                continue;
+            }
+        }
 
-    memset(&e, 0, sizeof(e));
+        memcpy(&offs[noffs], &x->offsets[e->first],
+               e->count * sizeof(uint64_t));
+        noffs += e->count;
+    }
 
-    if (log_parse_job_move(rec, &e) < 0)
-        return;
+    if (noffs == 0) {
+        free(offs);
+        return 0;
+    }
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+    qsort(offs, noffs, sizeof(uint64_t), hist_offset_cmp);
 
-    if (hist_event_exists(j, EVENT_JOB_MOVE, rec->event_time))
-        return;
+    fp = fopen(path, "r");
+    if (fp == NULL) {
+        free(offs);
+        return -1;
+    }
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+    for (i = 0; i < noffs; i++) {
+        if (fseeko(fp, (off_t)offs[i], SEEK_SET) < 0)
+            break;
+        memset(&rec, 0, sizeof(rec));
+        if (log_read_hdr(fp, &rec) < 0)
+            break;
+        hist_apply_event(jh, &rec);
+    }
 
-    free(j->queue);
-    j->queue       = hist_strdup(e.to_queue);
-    ev->type       = EVENT_JOB_MOVE;
-    ev->event_time = rec->event_time;
-    ev->from_queue = hist_strdup(e.from_queue);
-    ev->to_queue   = hist_strdup(e.to_queue);
+    fclose(fp);
+    free(offs);
+    return 0;
 }
 
-static void hist_apply_priority(struct job_hist *jh, const struct event_rec *rec)
+/*
+ * hist_scan_archive - scan a rotated manifest.N, through its index when
+ * it has a valid one and the query selects on a job or an owner.
+ */
+static int hist_scan_archive(struct job_hist *jh, const char *path)
 {
-    struct log_job_priority e;
-    struct job_hist_info *j;
-    struct job_event *ev;
-
-    memset(&e, 0, sizeof(e));
+    struct log_index *x;
+    int rc;
 
-    if (log_parse_job_priority(rec, &e) < 0)
-        return;
-
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+    if (jh->all && jh->job_id == 0 && jh->array_id == 0)
+        return hist_scan_file(jh, path);
 
-    if (hist_event_exists(j, EVENT_JOB_PRIORITY, rec->event_time))
-        return;
+    x = log_index_open(path);
+    if (x == NULL)
+        return hist_scan_file(jh, path);
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+    rc = hist_scan_indexed(jh, path, x);
+    log_index_close(x);
 
-    ev->type         = EVENT_JOB_PRIORITY;
-    ev->event_time   = rec->event_time;
-    ev->old_priority = e.old_priority;
-    ev->new_priority = e.new_priority;
-    j->priority = e.new_priority;
+    if (rc > 0)
+        return hist_scan_file(jh, path);
+    return rc;
 }
 
-
-static void hist_apply_pend(struct job_hist *jh, const struct event_rec *rec)
+/*
+ * Sequence number of a manifest file name, the live manifest sorts
+ * after every archive. -1 when the name is not a manifest.
+ */
+static long hist_manifest_seq(const char *name)
 {
-    struct log_job_pend e;
-    struct job_hist_info *j;
-    struct job_event *ev;
+    const char *p;
 
-    memset(&e, 0, sizeof(e));
+    if (strncmp(name, "manifest", 8) != 0)
+        return -1;
 
-    if (log_parse_job_pend(rec, &e) < 0)
-        return;
+    p = name + 8;
+    if (*p == '\0')
+        return LONG_MAX;
 
-    j = hist_find(jh, e.job_id);
-    if (j == NULL)
-        return;
+    if (*p != '.')
+        return -1;
 
-    if (hist_event_exists(j, EVENT_JOB_PEND, rec->event_time))
-        return;
+    p++;
+    if (*p == '\0')
+        return -1;
 
-    ev = event_add(j);
-    if (ev == NULL)
-        return;
+    while (*p != '\0') {
+        if (*p < '0' || *p > '9')
+            return -1;
+        p++;
+    }
 
-    j->state       = JOB_PENDING;
-    ev->type       = EVENT_JOB_PEND;
-    ev->event_time = rec->event_time;
-    ev->state      = JOB_PENDING;
+    return atol(name + 9);
 }
 
-static void hist_apply_event(struct job_hist *jh, const struct event_rec *rec)
+struct hist_file {
+    long seq;
+    char name[NAME_MAX + 1];
+};
+
+static int hist_file_cmp(const void *a, const void *b)
 {
-    if (rec->type == EVENT_JOB_NEW) {
-        hist_apply_new(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_START) {
-        hist_apply_start(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_FORK) {
-        hist_apply_fork(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_SIGNAL) {
-        hist_apply_signal(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_FINISH) {
-        hist_apply_finish(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_PEND_SUSP) {
-        hist_apply_pend_susp(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_PEND_RESUME) {
-        hist_apply_pend_resume(jh, rec);
-        return;
-    }
-    if (rec->type == EVENT_JOB_SUSP) {
-        hist_apply_susp(jh, rec);
-        return;
+    const struct hist_file *fa = (const struct hist_file *)a;
+    const struct hist_file *fb = (const struct hist_file *)b;
+
+    if (fa->seq < fb->seq)
+        return -1;
+    if (fa->seq > fb->seq)
+        return 1;
+    return 0;
+}
+
+/*
+ * hist_list_files - the manifest files of dir sorted oldest first, the
+ * live manifest last.
+ */
+static int hist_list_files(const char *dir, struct hist_file **out,
+                           int *nout)
+{
+    struct hist_file *files = NULL;
+    int nfiles = 0;
+    int max_files = 0;
+    DIR *dp;
+    struct dirent *de;
+
+    *out = NULL;
+    *nout = 0;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        return -1;
     }
-    if (rec->type == EVENT_JOB_MOVE) {
-        hist_apply_move(jh, rec);
-        return;
+
+    while ((de = readdir(dp)) != NULL) {
+        long seq = hist_manifest_seq(de->d_name);
+        if (seq < 0)
+            continue;
+
+        if (nfiles == max_files) {
+            int new_max = max_files ? max_files * 2 : 64;
+            struct hist_file *f = realloc(files,
+                                          new_max * sizeof(struct hist_file));
+            if (f == NULL) {
+                free(files);
+                closedir(dp);
+                return -1;
+            }
+            files = f;
+            max_files = new_max;
+        }
+        files[nfiles].seq = seq;
+        strcpy(files[nfiles].name, de->d_name);
+        nfiles++;
     }
-    if (rec->type == EVENT_JOB_PRIORITY) {
-        hist_apply_priority(jh, rec);
-        return;
+
+    closedir(dp);
+
+    if (nfiles > 0)
+        qsort(files, nfiles, sizeof(struct hist_file), hist_file_cmp);
+
+    *out = files;
+    *nout = nfiles;
+    return 0;
+}
+
+static int hist_scan_one(struct job_hist *jh, const char *dir,
+                         const struct hist_file *f)
+{
+    char path[PATH_MAX];
+    int n;
+
+    n = snprintf(path, sizeof(path), "%s/%s", dir, f->name);
+    if (n < 0 || n >= (int)sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
     }
-    if (rec->type == EVENT_JOB_PEND) {
-        hist_apply_pend(jh, rec);
-        return;
+
+    if (f->seq == LONG_MAX)
+        n = hist_scan_file(jh, path);
+    else
+        n = hist_scan_archive(jh, path);
+    if (n < 0 && errno != ENOENT)
+        return -1;
+
+    return 0;
+}
+
+static int hist_scan_sequential(struct job_hist *jh, const char *dir,
+                                const struct hist_file *files, int nfiles)
+{
+    int i;
+
+    for (i = 0; i < nfiles; i++) {
+        if (hist_scan_one(jh, dir, &files[i]) < 0)
+            return -1;
     }
+
+    return 0;
 }
 
 /* -----------------------------------------------------------------------
- * Event file scanning.
+ * Parallel scan.
  *
- * All manifest files live in the same directory. Scan them all in
- * readdir order; duplicate events across archives are deduplicated
- * by hist_event_exists() via type + timestamp.
+ * Every file is scanned into its own partial job_hist by a bounded pool
+ * of threads, the calling thread merges the partials strictly in file
+ * order. The merge applies a partial's jobs and events to the merged
+ * job_hist exactly as a sequential scan of the file would have: a job
+ * seen before gets the repeated JOB_NEW handling and its events are
+ * deduplicated by hist_event_exists(), then the partial's orphan events
+ * are applied to jobs from earlier files. At most window partials exist
+ * at any time, which bounds memory no matter how many archives there are.
  * ----------------------------------------------------------------------- */
 
-static int hist_scan_file(struct job_hist *jh, const char *path)
+struct hist_part {
+    struct job_hist jh;
+    int done;
+    int rc;
+    int err;
+};
+
+struct hist_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const struct job_hist *query;
+    const char *dir;
+    const struct hist_file *files;
+    int nfiles;
+    struct hist_part *parts;
+    int next;
+    int merged;
+    int window;
+    int stop;
+};
+
+static int hist_part_init(struct hist_part *p, const struct job_hist *q)
 {
-    FILE *fp;
-    struct event_rec rec;
+    memset(p, 0, sizeof(*p));
+    p->jh.job_id      = q->job_id;
+    p->jh.array_id    = q->array_id;
+    p->jh.array_index = q->array_index;
+    p->jh.uid         = q->uid;
+    p->jh.all         = q->all;
+    p->jh.part        = 1;
+
+    return ll_hash_init(&p->jh.job_hash, 1021);
+}
 
-    fp = fopen(path, "r");
-    if (fp == NULL)
-        return -1;
+static void hist_part_free(struct hist_part *p)
+{
+    int32_t i;
 
-    while (1) {
-        memset(&rec, 0, sizeof(rec));
-        if (log_read_hdr(fp, &rec) < 0)
-            break;
-        hist_apply_event(jh, &rec);
-    }
+    for (i = 0; i < p->jh.num_orphans; i++)
+        event_free(&p->jh.orphans[i].ev);
+    free(p->jh.orphans);
+    free(p->jh.new_state);
+    llb_free_hist_info(p->jh.jobs, p->jh.num_jobs);
+    /* ll_hash_clear() frees the struct itself when it has no buckets */
+    if (p->jh.job_hash.buckets != NULL)
+        ll_hash_clear(&p->jh.job_hash, NULL);
+    if (p->jh.seen_init)
+        ll_hash_clear(&p->jh.seen, NULL);
+    memset(&p->jh, 0, sizeof(p->jh));
+}
 
-    fclose(fp);
-    return 0;
+static void *hist_worker(void *arg)
+{
+    struct hist_pool *pool = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->next < pool->nfiles
+               && pool->next >= pool->merged + pool->window)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        if (pool->stop || pool->next >= pool->nfiles) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        int i = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct hist_part *p = &pool->parts[i];
+        if (hist_part_init(p, pool->query) < 0) {
+            p->rc = -1;
+            p->err = ENOMEM;
+        } else if (hist_scan_one(&p->jh, pool->dir, &pool->files[i]) < 0) {
+            p->rc = -1;
+            p->err = errno;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        p->done = 1;
+        pthread_cond_broadcast(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+    }
 }
 
-static int hist_is_manifest(const char *name)
+static void hist_touch(struct job_hist *m, int32_t idx)
 {
-    const char *p;
+    if (m->touched == NULL)
+        return;
+    m->touched[idx] = 1;
+}
 
-    if (strncmp(name, "manifest", 8) != 0)
-        return 0;
+/*
+ * hist_merge - move the jobs and events of partial p into m. p is left
+ * empty but allocated, hist_part_free() releases it.
+ */
+static void hist_merge(struct job_hist *m, struct job_hist *p)
+{
+    int32_t i;
 
-    p = name + 8;
-    if (*p == '\0')
-        return 1;
+    for (i = 0; i < p->num_jobs; i++) {
+        struct job_hist_info *pj = &p->jobs[i];
+        struct job_hist_info *mj = hist_find(m, pj->job_id);
+
+        if (mj == NULL) {
+            mj = hist_slot(m);
+            if (mj == NULL)
+                continue;
+            *mj = *pj;
+            memset(pj, 0, sizeof(*pj));
+            hist_touch(m, m->num_jobs);
+            hist_commit(m, mj->job_id);
+            continue;
+        }
 
-    if (*p != '.')
-        return 0;
+        /* repeated JOB_NEW, as in hist_apply_new() */
+        if (mj->state == JOB_PENDING || mj->state == JOB_HELD)
+            mj->state = p->new_state[i];
+        mj->submit_time = pj->submit_time;
 
-    p++;
-    if (*p == '\0')
-        return 0;
+        for (int32_t k = 0; k < pj->num_events; k++)
+            hist_job_event(mj, &pj->events[k], pj->uid);
+        free(pj->events);
+        pj->events = NULL;
+        pj->num_events = 0;
+        llb_free_hist_entry(pj);
+        memset(pj, 0, sizeof(*pj));
 
-    while (*p != '\0') {
-        if (*p < '0' || *p > '9')
-            return 0;
-        p++;
+        hist_touch(m, (int32_t)(mj - m->jobs));
     }
 
-    return 1;
+    for (i = 0; i < p->num_orphans; i++) {
+        struct hist_orphan *o = &p->orphans[i];
+        struct job_hist_info *mj = hist_find(m, o->job_id);
+
+        if (mj == NULL) {
+            event_free(&o->ev);
+            continue;
+        }
+        hist_job_event(mj, &o->ev, o->uid);
+        hist_touch(m, (int32_t)(mj - m->jobs));
+    }
+    p->num_orphans = 0;
 }
 
-static int hist_scan_events(struct job_hist *jh)
+static int hist_idx_cmp(const void *a, const void *b, void *arg)
 {
-    char dir[PATH_MAX];
-    char path[PATH_MAX];
-    DIR *dp;
-    struct dirent *de;
-    int n;
+    const struct job_hist_info *jobs = arg;
+    int64_t ja = jobs[*(const int32_t *)a].job_id;
+    int64_t jb = jobs[*(const int32_t *)b].job_id;
 
-    n = snprintf(dir, sizeof(dir), "%s/mbd", ll_params[LL_STATE_DIR].val);
-    if (n < 0 || n >= (int)sizeof(dir))
+    if (ja < jb)
         return -1;
+    if (ja > jb)
+        return 1;
+    return 0;
+}
 
-    dp = opendir(dir);
-    if (dp == NULL) {
-        if (errno == ENOENT)
-            return 0;
+/*
+ * hist_emit - pass the jobs of m that the last merged file did not
+ * touch, or all of them when final is set, to emit in job_id order and
+ * drop them from m. mbd rewrites every job it still holds at the head
+ * of each new manifest, so a job absent from one file never shows up
+ * in a later one. Returns the number of jobs passed, *stop is set when
+ * emit asked to stop.
+ */
+static int hist_emit(struct job_hist *m, int final, llb_hist_cb emit,
+                     void *arg, int *stop)
+{
+    int32_t *idx;
+    int32_t n = 0;
+    int32_t total;
+    int32_t i;
+    int count = 0;
+
+    idx = malloc((m->num_jobs + 1) * sizeof(int32_t));
+    if (idx == NULL)
         return -1;
+
+    for (i = 0; i < m->num_jobs; i++) {
+        if (final || !m->touched[i])
+            idx[n++] = i;
     }
 
-    while ((de = readdir(dp)) != NULL) {
-        if (!hist_is_manifest(de->d_name))
+    qsort_r(idx, n, sizeof(int32_t), hist_idx_cmp, m->jobs);
+
+    for (i = 0; i < n; i++) {
+        struct job_hist_info *j = &m->jobs[idx[i]];
+
+        if (!*stop) {
+            count++;
+            if (emit(j, arg) != 0)
+                *stop = 1;
+        }
+        llb_free_hist_entry(j);
+        j->job_id = -1;
+    }
+    free(idx);
+
+    if (n == 0)
+        return count;
+
+    /* compact jobs[] and rebuild the job_id -> index hash */
+    ll_hash_clear(&m->job_hash, NULL);
+    if (ll_hash_init(&m->job_hash, 16411) < 0)
+        return -1;
+
+    total = m->num_jobs;
+    m->num_jobs = 0;
+    for (i = 0; i < total; i++) {
+        if (m->jobs[i].job_id == -1)
             continue;
+        m->jobs[m->num_jobs] = m->jobs[i];
+        hist_commit(m, m->jobs[m->num_jobs].job_id);
+    }
 
-        n = snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
-        if (n < 0 || n >= (int)sizeof(path)) {
-            closedir(dp);
-            return -1;
+    return count;
+}
+
+static int hist_threads(void)
+{
+    int n = 0;
+
+    if (ll_params[LL_HIST_SCAN_THREADS].val != NULL)
+        ll_atoi(ll_params[LL_HIST_SCAN_THREADS].val, &n);
+    if (n <= 0)
+        n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+        n = 1;
+    if (n > HIST_MAX_THREADS)
+        n = HIST_MAX_THREADS;
+
+    return n;
+}
+
+/*
+ * hist_scan_parallel - scan files with nthreads threads into m. With
+ * emit set, jobs whose history is complete are passed to it after each
+ * file and the rest at the end, m then ends up empty.
+ */
+static int hist_scan_parallel(struct job_hist *m, const char *dir,
+                              const struct hist_file *files, int nfiles,
+                              int nthreads, llb_hist_cb emit, void *arg)
+{
+    struct hist_pool pool;
+    pthread_t tids[HIST_MAX_THREADS];
+    int nstarted = 0;
+    int stop = 0;
+    int count = 0;
+    int rc = 0;
+    int i;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.query  = m;
+    pool.dir    = dir;
+    pool.files  = files;
+    pool.nfiles = nfiles;
+    pool.window = 2 * nthreads;
+    pool.parts  = calloc(nfiles + 1, sizeof(struct hist_part));
+    if (pool.parts == NULL)
+        return -1;
+
+    /* the CRC table is built on first use, not under a lock */
+    log_crc32c(0, NULL, 0);
+
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.cond, NULL);
+
+    for (i = 0; i < nthreads && i < nfiles; i++) {
+        if (pthread_create(&tids[i], NULL, hist_worker, &pool) != 0)
+            break;
+        nstarted++;
+    }
+
+    if (nstarted == 0 && nfiles > 0) {
+        rc = -1;
+        goto out;
+    }
+
+    for (i = 0; i < nfiles; i++) {
+        struct hist_part *p = &pool.parts[i];
+
+        pthread_mutex_lock(&pool.lock);
+        while (!p->done)
+            pthread_cond_wait(&pool.cond, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (p->rc < 0) {
+            errno = p->err;
+            rc = -1;
+            break;
         }
 
-        if (hist_scan_file(jh, path) < 0 && errno != ENOENT) {
-            closedir(dp);
-            return -1;
+        if (emit != NULL) {
+            m->touched = realloc(m->touched, m->max_jobs
+                                 + p->jh.num_jobs + 1);
+            if (m->touched == NULL) {
+                errno = ENOMEM;
+                rc = -1;
+                break;
+            }
+            memset(m->touched, 0, m->max_jobs + p->jh.num_jobs + 1);
         }
+
+        hist_merge(m, &p->jh);
+        hist_part_free(p);
+
+        if (emit != NULL && !stop) {
+            int n = hist_emit(m, 0, emit, arg, &stop);
+            if (n < 0) {
+                rc = -1;
+                break;
+            }
+            count += n;
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        pool.merged++;
+        if (stop)
+            pool.stop = 1;
+        pthread_cond_broadcast(&pool.cond);
+        pthread_mutex_unlock(&pool.lock);
+
+        if (stop)
+            break;
     }
 
-    closedir(dp);
+out:
+    pthread_mutex_lock(&pool.lock);
+    pool.stop = 1;
+    pthread_cond_broadcast(&pool.cond);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (i = 0; i < nstarted; i++)
+        pthread_join(tids[i], NULL);
+
+    for (i = 0; i < nfiles; i++) {
+        if (pool.parts[i].done)
+            hist_part_free(&pool.parts[i]);
+    }
+    free(pool.parts);
+
+    pthread_cond_destroy(&pool.cond);
+    pthread_mutex_destroy(&pool.lock);
+
+    if (rc == 0 && emit != NULL && !stop) {
+        int n = hist_emit(m, 1, emit, arg, &stop);
+        if (n < 0)
+            rc = -1;
+        else
+            count += n;
+    }
+
+    if (rc < 0)
+        return -1;
+    return count;
+}
+
+/*
+ * hist_any_index - 1 when some archive has a valid index. A job or user
+ * query then reads little of each archive and is left to the sequential
+ * scan, which can skip archives on the footer alone.
+ */
+static int hist_any_index(const char *dir, const struct hist_file *files,
+                          int nfiles)
+{
+    char path[PATH_MAX];
+    int i;
+
+    for (i = 0; i < nfiles; i++) {
+        if (files[i].seq == LONG_MAX)
+            continue;
+        int n = snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+        if (n < 0 || n >= (int)sizeof(path))
+            continue;
+        struct log_index *x = log_index_open(path);
+        if (x != NULL) {
+            log_index_close(x);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int hist_state_dir(char *dir, size_t size)
+{
+    int n;
+
+    n = snprintf(dir, size, "%s/mbd", ll_params[LL_STATE_DIR].val);
+    if (n < 0 || n >= (int)size)
+        return -1;
 
     return 0;
 }
 
+static int hist_scan_events(struct job_hist *jh)
+{
+    char dir[PATH_MAX];
+    struct hist_file *files;
+    int nfiles;
+    int nthreads;
+    int rc;
+
+    if (hist_state_dir(dir, sizeof(dir)) < 0)
+        return -1;
+
+    if (hist_list_files(dir, &files, &nfiles) < 0)
+        return -1;
+
+    nthreads = hist_threads();
+    if (nthreads > 1 && nfiles > 1
+        && ((jh->all && jh->job_id == 0 && jh->array_id == 0)
+            || !hist_any_index(dir, files, nfiles)))
+        rc = hist_scan_parallel(jh, dir, files, nfiles, nthreads, NULL, NULL);
+    else
+        rc = hist_scan_sequential(jh, dir, files, nfiles);
+
+    free(files);
+    if (rc < 0)
+        return -1;
+    return 0;
+}
+
 static int hist_job_cmp(const void *a, const void *b)
 {
     const struct job_hist_info *ja = (const struct job_hist_info *)a;
@@ -944,36 +1543,26 @@ static int hist_job_cmp(const void *a, const void *b)
  * Public API
  * ----------------------------------------------------------------------- */
 
-struct job_hist_info *llb_hist_info(int64_t job_id,
-                                    int64_t array_id,
-                                    int32_t array_index,
-                                    uid_t uid,
-                                    int32_t *num)
+static int hist_init(struct job_hist *jh, int64_t job_id, int64_t array_id,
+                     int32_t array_index, uid_t uid)
 {
-    struct job_hist jh;
-
-    if (num == NULL)
-        return NULL;
-
-    *num = 0;
-
-    memset(&jh, 0, sizeof(jh));
-    jh.job_id = job_id;
-    jh.array_id = array_id;
-    jh.array_index = array_index;
-    jh.uid    = uid;
+    memset(jh, 0, sizeof(*jh));
+    jh->job_id = job_id;
+    jh->array_id = array_id;
+    jh->array_index = array_index;
+    jh->uid    = uid;
 
-    if (ll_hash_init(&jh.job_hash, 16411) < 0) {
+    if (ll_hash_init(&jh->job_hash, 16411) < 0) {
         errno = ENOMEM;
-        return NULL;
+        return -1;
     }
 
     errno = 0;
 
     if (ll_init() < 0) {
-        ll_hash_clear(&jh.job_hash, NULL);
+        ll_hash_clear(&jh->job_hash, NULL);
         errno = EINVAL;
-        return NULL;
+        return -1;
     }
 
     /*
@@ -983,7 +1572,26 @@ struct job_hist_info *llb_hist_info(int64_t job_id,
      * non-admin callers (see hist_match_new comment above).
      */
     if (llb_caller_is_admin())
-        jh.all = 1;
+        jh->all = 1;
+
+    return 0;
+}
+
+struct job_hist_info *llb_hist_info(int64_t job_id,
+                                    int64_t array_id,
+                                    int32_t array_index,
+                                    uid_t uid,
+                                    int32_t *num)
+{
+    struct job_hist jh;
+
+    if (num == NULL)
+        return NULL;
+
+    *num = 0;
+
+    if (hist_init(&jh, job_id, array_id, array_index, uid) < 0)
+        return NULL;
 
     if (hist_scan_events(&jh) < 0) {
         ll_hash_clear(&jh.job_hash, NULL);
@@ -1004,3 +1612,44 @@ struct job_hist_info *llb_hist_info(int64_t job_id,
     *num = jh.num_jobs;
     return jh.jobs;
 }
+
+/*
+ * llb_hist_foreach - stream the history selected as by llb_hist_info()
+ * to cb, one job at a time, without building the whole array. Jobs are
+ * passed once their history is complete: after each archive those it
+ * no longer mentions, in job_id order, and the rest at the end. The
+ * entry is freed when cb returns, a nonzero return stops the scan.
+ * Returns the number of jobs passed, -1 on error with errno set.
+ */
+int llb_hist_foreach(int64_t job_id, int64_t array_id, int32_t array_index,
+                     uid_t uid, llb_hist_cb cb, void *arg)
+{
+    struct job_hist jh;
+    char dir[PATH_MAX];
+    struct hist_file *files;
+    int nfiles;
+    int rc;
+
+    if (cb == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (hist_init(&jh, job_id, array_id, array_index, uid) < 0)
+        return -1;
+
+    if (hist_state_dir(dir, sizeof(dir)) < 0
+        || hist_list_files(dir, &files, &nfiles) < 0) {
+        ll_hash_clear(&jh.job_hash, NULL);
+        return -1;
+    }
+
+    rc = hist_scan_parallel(&jh, dir, files, nfiles, hist_threads(), cb, arg);
+
+    free(files);
+    free(jh.touched);
+    ll_hash_clear(&jh.job_hash, NULL);
+    llb_free_hist_info(jh.jobs, jh.num_jobs);
+
+    return rc;
+}
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
 #include <errno.h>
 #include <time.h>
@@ -87,10 +88,333 @@ static enum event_type parse_event_type(const char *name)
     return EVENT_NULL;
 }
 
+/* -----------------------------------------------------------------------
+ * Format selection
+ * ----------------------------------------------------------------------- */
+
+static enum log_format log_format = LOG_FORMAT_TEXT;
+
+void log_set_format(enum log_format format)
+{
+    log_format = format;
+}
+
+enum log_format log_get_format(void)
+{
+    return log_format;
+}
+
+int log_format_parse(const char *s, enum log_format *format)
+{
+    if (s == NULL || strcasecmp(s, "text") == 0) {
+        *format = LOG_FORMAT_TEXT;
+        return 0;
+    }
+    if (strcasecmp(s, "binary") == 0) {
+        *format = LOG_FORMAT_BINARY;
+        return 0;
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+const char *log_format_str(enum log_format format)
+{
+    if (format == LOG_FORMAT_BINARY)
+        return "binary";
+    return "text";
+}
+
+/* -----------------------------------------------------------------------
+ * CRC32C, reflected polynomial 0x82F63B78, table driven
+ * ----------------------------------------------------------------------- */
+
+static uint32_t crc32c_table[256];
+static int crc32c_ready;
+
+static void crc32c_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) {
+            if (c & 1)
+                c = (c >> 1) ^ 0x82F63B78;
+            else
+                c >>= 1;
+        }
+        crc32c_table[i] = c;
+    }
+    crc32c_ready = 1;
+}
+
+uint32_t log_crc32c(uint32_t crc, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    if (!crc32c_ready)
+        crc32c_init();
+
+    crc = ~crc;
+    while (len-- > 0)
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+/* -----------------------------------------------------------------------
+ * Binary encoding helpers.
+ *
+ * Writers build the whole record in memory and emit it with a single
+ * fwrite(), readers decode straight out of rec->rest. Overflow and
+ * underflow latch err so the per-event code checks once at the end.
+ * ----------------------------------------------------------------------- */
+
+struct bin_wr {
+    unsigned char buf[LOG_BIN_HDRSIZ + LL_BUFSIZ_8K + LOG_BIN_CRCSIZ];
+    size_t pos;
+    int err;
+};
+
+struct bin_rd {
+    const unsigned char *p;
+    size_t len;
+    size_t pos;
+    int err;
+};
+
+static void le32_put(unsigned char *p, uint32_t v)
+{
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+    p[3] = (v >> 24) & 0xff;
+}
+
+static uint32_t le32_get(const unsigned char *p)
+{
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) |
+           ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static void put_bytes(struct bin_wr *w, const void *src, size_t len)
+{
+    /* keep room for the trailing crc */
+    if (w->pos + len > sizeof(w->buf) - LOG_BIN_CRCSIZ) {
+        w->err = 1;
+        return;
+    }
+    memcpy(w->buf + w->pos, src, len);
+    w->pos += len;
+}
+
+static void put_u32(struct bin_wr *w, uint32_t v)
+{
+    unsigned char b[4];
+
+    le32_put(b, v);
+    put_bytes(w, b, sizeof(b));
+}
+
+static void put_u64(struct bin_wr *w, uint64_t v)
+{
+    unsigned char b[8];
+
+    le32_put(b, (uint32_t) v);
+    le32_put(b + 4, (uint32_t) (v >> 32));
+    put_bytes(w, b, sizeof(b));
+}
+
+static void put_str(struct bin_wr *w, const char *s)
+{
+    unsigned char b[5];
+    int n = 0;
+
+    if (s == NULL)
+        s = "";
+    size_t len = strlen(s);
+    uint32_t v = (uint32_t) len;
+
+    /* LEB128 length, a single byte for anything under 128 */
+    do {
+        b[n] = v & 0x7f;
+        v >>= 7;
+        if (v != 0)
+            b[n] |= 0x80;
+        n++;
+    } while (v != 0);
+
+    put_bytes(w, b, n);
+    put_bytes(w, s, len);
+}
+
+static void bin_begin(struct bin_wr *w, enum event_type type, time_t t)
+{
+    assert(t > 0);
+    w->pos = 0;
+    w->err = 0;
+    w->buf[0] = LOG_BIN_MAGIC;
+    w->buf[1] = LOG_BIN_VERSION;
+    w->buf[2] = (unsigned char) type;
+    w->buf[3] = 0;
+    w->pos = 8;
+    put_u64(w, (uint64_t) t);
+}
+
+static int bin_end(FILE *fp, struct bin_wr *w)
+{
+    if (w->err) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    le32_put(w->buf + 4, (uint32_t) (w->pos - LOG_BIN_HDRSIZ));
+    le32_put(w->buf + w->pos, log_crc32c(0, w->buf, w->pos));
+    w->pos += LOG_BIN_CRCSIZ;
+
+    if (fwrite(w->buf, 1, w->pos, fp) != w->pos)
+        return -1;
+    return 0;
+}
+
+static void bin_rd_init(struct bin_rd *r, const struct event_rec *rec)
+{
+    r->p = (const unsigned char *) rec->rest;
+    r->len = rec->len;
+    r->pos = 0;
+    r->err = 0;
+}
+
+static const unsigned char *get_bytes(struct bin_rd *r, size_t len)
+{
+    if (r->err || r->pos + len > r->len) {
+        r->err = 1;
+        return NULL;
+    }
+    const unsigned char *p = r->p + r->pos;
+    r->pos += len;
+    return p;
+}
+
+static uint32_t get_u32(struct bin_rd *r)
+{
+    const unsigned char *p = get_bytes(r, 4);
+
+    if (p == NULL)
+        return 0;
+    return le32_get(p);
+}
+
+static uint64_t get_u64(struct bin_rd *r)
+{
+    const unsigned char *p = get_bytes(r, 8);
+
+    if (p == NULL)
+        return 0;
+    return (uint64_t) le32_get(p) | ((uint64_t) le32_get(p + 4) << 32);
+}
+
+static void get_str(struct bin_rd *r, char *dst, size_t maxlen)
+{
+    uint32_t len = 0;
+    int shift = 0;
+
+    dst[0] = 0;
+    for (;;) {
+        const unsigned char *b = get_bytes(r, 1);
+        if (b == NULL)
+            return;
+        len |= (uint32_t) (*b & 0x7f) << shift;
+        if (!(*b & 0x80))
+            break;
+        shift += 7;
+        if (shift > 28) {
+            r->err = 1;
+            return;
+        }
+    }
+
+    if (len >= maxlen) {
+        r->err = 1;
+        return;
+    }
+    const unsigned char *s = get_bytes(r, len);
+    if (s == NULL)
+        return;
+    memcpy(dst, s, len);
+    dst[len] = 0;
+}
+
+/*
+ * Trailing payload bytes are ignored so a newer minor revision may
+ * append fields without breaking older readers.
+ */
+static int bin_rd_done(const struct bin_rd *r)
+{
+    if (r->err) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
+static int bin_read_hdr(FILE *fp, struct event_rec *rec)
+{
+    unsigned char hdr[LOG_BIN_HDRSIZ];
+    unsigned char crc[LOG_BIN_CRCSIZ];
+
+    /* the caller already consumed the magic byte */
+    hdr[0] = LOG_BIN_MAGIC;
+    if (fread(hdr + 1, 1, sizeof(hdr) - 1, fp) != sizeof(hdr) - 1) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t len = le32_get(hdr + 4);
+    if (len > sizeof(rec->rest)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fread(rec->rest, 1, len, fp) != len ||
+        fread(crc, 1, sizeof(crc), fp) != sizeof(crc)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    uint32_t sum = log_crc32c(0, hdr, sizeof(hdr));
+    sum = log_crc32c(sum, rec->rest, len);
+    if (sum != le32_get(crc)) {
+        errno = EBADMSG;
+        return -1;
+    }
+    /* the record is consumed, a newer layout is not decoded as ours */
+    if (hdr[1] > LOG_BIN_VERSION) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    rec->format = LOG_FORMAT_BINARY;
+    rec->version = hdr[1];
+    rec->type = EVENT_NULL;
+    if (hdr[2] < EVENT_COUNT)
+        rec->type = (enum event_type) hdr[2];
+    rec->event_time =
+        (time_t) ((uint64_t) le32_get(hdr + 8) |
+                  ((uint64_t) le32_get(hdr + 12) << 32));
+    rec->len = len;
+
+    return 0;
+}
+
 int log_read_hdr(FILE *fp, struct event_rec *rec)
 {
     char line[LL_BUFSIZ_4K];
 
+    int c = getc(fp);
+    if (c == EOF)
+        return -1;
+    if (c == LOG_BIN_MAGIC)
+        return bin_read_hdr(fp, rec);
+    ungetc(c, fp);
+
     if (fgets(line, sizeof(line), fp) == NULL)
         return -1;
 
@@ -103,6 +427,7 @@ int log_read_hdr(FILE *fp, struct event_rec *rec)
         return -1;
     }
 
+    rec->format = LOG_FORMAT_TEXT;
     rec->version = ver;
     rec->event_time = (time_t) ts;
     rec->type = parse_event_type(etype);
@@ -112,12 +437,213 @@ int log_read_hdr(FILE *fp, struct event_rec *rec)
     return 0;
 }
 
+ssize_t log_rec_size(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    if (len == 0)
+        return 0;
+
+    if (p[0] == LOG_BIN_MAGIC) {
+        if (len < LOG_BIN_HDRSIZ)
+            return 0;
+        uint32_t plen = le32_get(p + 4);
+        if (plen > LL_BUFSIZ_8K)
+            return -1;
+        size_t total = LOG_BIN_HDRSIZ + plen + LOG_BIN_CRCSIZ;
+        if (len < total)
+            return 0;
+        return (ssize_t) total;
+    }
+
+    const unsigned char *nl = memchr(p, '\n', len);
+    if (nl == NULL)
+        return (ssize_t) len;
+    return nl - p + 1;
+}
+
+int log_decode(const struct event_rec *rec, struct log_record *out)
+{
+    union log_payload *p = &out->p;
+
+    out->type = rec->type;
+    switch (rec->type) {
+    case EVENT_JOB_NEW:
+        memset(&p->job_new, 0, sizeof(p->job_new));
+        out->rc = log_parse_job_new(rec, &p->job_new);
+        break;
+    case EVENT_JOB_START:
+        memset(&p->start, 0, sizeof(p->start));
+        out->rc = log_parse_job_start(rec, &p->start);
+        break;
+    case EVENT_JOB_FORK:
+        out->rc = log_parse_job_fork(rec, &p->fork);
+        break;
+    case EVENT_JOB_SIGNAL:
+        out->rc = log_parse_job_signal(rec, &p->signal);
+        break;
+    case EVENT_JOB_FINISH:
+        memset(&p->finish, 0, sizeof(p->finish));
+        out->rc = log_parse_job_finish(rec, &p->finish);
+        break;
+    case EVENT_JOB_PEND_SUSP:
+        out->rc = log_parse_job_pend_susp(rec, &p->pend_susp);
+        break;
+    case EVENT_JOB_PEND_RESUME:
+        out->rc = log_parse_job_pend_resume(rec, &p->pend_resume);
+        break;
+    case EVENT_JOB_SUSP:
+        out->rc = log_parse_job_susp(rec, &p->susp);
+        break;
+    case EVENT_JOB_MOVE:
+        out->rc = log_parse_job_move(rec, &p->move);
+        break;
+    case EVENT_JOB_PRIORITY:
+        out->rc = log_parse_job_priority(rec, &p->priority);
+        break;
+    case EVENT_JOB_PEND:
+        out->rc = log_parse_job_pend(rec, &p->pend);
+        break;
+    default:
+        out->rc = 1;
+        break;
+    }
+
+    return out->rc;
+}
+
+int64_t log_record_job_id(const struct log_record *r)
+{
+    switch (r->type) {
+    case EVENT_JOB_NEW:
+        return r->p.job_new.job_id;
+    case EVENT_JOB_START:
+        return r->p.start.job_id;
+    case EVENT_JOB_FORK:
+        return r->p.fork.job_id;
+    case EVENT_JOB_SIGNAL:
+        return r->p.signal.job_id;
+    case EVENT_JOB_FINISH:
+        return r->p.finish.job_id;
+    case EVENT_JOB_PEND_SUSP:
+        return r->p.pend_susp.job_id;
+    case EVENT_JOB_PEND_RESUME:
+        return r->p.pend_resume.job_id;
+    case EVENT_JOB_SUSP:
+        return r->p.susp.job_id;
+    case EVENT_JOB_MOVE:
+        return r->p.move.job_id;
+    case EVENT_JOB_PRIORITY:
+        return r->p.priority.job_id;
+    case EVENT_JOB_PEND:
+        return r->p.pend.job_id;
+    default:
+        return 0;
+    }
+}
+
+const char *log_event_name(enum event_type type)
+{
+    if (type <= EVENT_NULL || type >= EVENT_COUNT)
+        return event_names[EVENT_NULL];
+    return event_names[type];
+}
+
 /* -----------------------------------------------------------------------
  * JOB_NEW
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_new(FILE *fp, const struct log_job_new *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_NEW, j->submit_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u64(&w, (uint64_t) j->array_id);
+    put_u32(&w, (uint32_t) j->array_index);
+    put_u32(&w, (uint32_t) j->array_start);
+    put_u32(&w, (uint32_t) j->array_end);
+    put_u32(&w, (uint32_t) j->array_stride);
+    put_u32(&w, (uint32_t) j->uid);
+    put_u32(&w, (uint32_t) j->gid);
+    put_u32(&w, (uint32_t) j->state);
+    put_u32(&w, (uint32_t) j->priority);
+    put_u64(&w, (uint64_t) j->begin_time);
+    put_u64(&w, (uint64_t) j->term_time);
+    put_u32(&w, (uint32_t) j->num_cpu);
+    put_u32(&w, (uint32_t) j->num_hosts);
+    put_u32(&w, (uint32_t) j->num_gpus);
+    put_u64(&w, j->mem_mb);
+    put_u64(&w, j->storage_mb);
+    put_u32(&w, j->flags);
+    put_str(&w, j->username);
+    put_str(&w, j->job_name);
+    put_str(&w, j->queue);
+    put_str(&w, j->project_name);
+    put_str(&w, j->gpu_model);
+    put_str(&w, j->machines);
+    put_str(&w, j->tokenpool);
+    put_str(&w, j->depend_cond);
+    put_str(&w, j->script);
+    if (j->journal_len != 0) {
+        put_u32(&w, j->journal_seq);
+        put_u64(&w, (uint64_t) j->journal_off);
+        put_u32(&w, j->journal_len);
+    }
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_new(const struct event_rec *rec, struct log_job_new *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->array_id = (int64_t) get_u64(&r);
+    j->array_index = (int32_t) get_u32(&r);
+    j->array_start = (int32_t) get_u32(&r);
+    j->array_end = (int32_t) get_u32(&r);
+    j->array_stride = (int32_t) get_u32(&r);
+    j->uid = (uid_t) get_u32(&r);
+    j->gid = (gid_t) get_u32(&r);
+    j->state = (int32_t) get_u32(&r);
+    j->priority = (int32_t) get_u32(&r);
+    j->begin_time = (time_t) get_u64(&r);
+    j->term_time = (time_t) get_u64(&r);
+    j->num_cpu = (int32_t) get_u32(&r);
+    j->num_hosts = (int32_t) get_u32(&r);
+    j->num_gpus = (int32_t) get_u32(&r);
+    j->mem_mb = get_u64(&r);
+    j->storage_mb = get_u64(&r);
+    j->flags = get_u32(&r);
+    get_str(&r, j->username, sizeof(j->username));
+    get_str(&r, j->job_name, sizeof(j->job_name));
+    get_str(&r, j->queue, sizeof(j->queue));
+    get_str(&r, j->project_name, sizeof(j->project_name));
+    get_str(&r, j->gpu_model, sizeof(j->gpu_model));
+    get_str(&r, j->machines, sizeof(j->machines));
+    get_str(&r, j->tokenpool, sizeof(j->tokenpool));
+    get_str(&r, j->depend_cond, sizeof(j->depend_cond));
+    j->script[0] = 0;
+    if (r.pos < r.len)
+        get_str(&r, j->script, sizeof(j->script));
+    j->journal_seq = 0;
+    j->journal_off = 0;
+    j->journal_len = 0;
+    if (r.pos < r.len) {
+        j->journal_seq = get_u32(&r);
+        j->journal_off = (int64_t) get_u64(&r);
+        j->journal_len = get_u32(&r);
+    }
+    j->submit_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_new(FILE *fp, const struct log_job_new *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_new(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_NEW, j->submit_time) < 0)
         return -1;
 
@@ -160,6 +686,13 @@ int log_write_job_new(FILE *fp, const struct log_job_new *j)
         return -1;
     if (write_qstr(fp, j->depend_cond) < 0)
         return -1;
+    if ((j->script[0] != 0 || j->journal_len != 0)
+        && write_qstr(fp, j->script) < 0)
+        return -1;
+    if (j->journal_len != 0
+        && fprintf(fp, " %u %ld %u", j->journal_seq, j->journal_off,
+                   j->journal_len) < 0)
+        return -1;
     if (fprintf(fp, "\n") < 0)
         return -1;
     return 0;
@@ -167,6 +700,9 @@ int log_write_job_new(FILE *fp, const struct log_job_new *j)
 
 int log_parse_job_new(const struct event_rec *rec, struct log_job_new *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_new(rec, j);
+
     const char *p = rec->rest;
     int cc;
     int n = sscanf(p,
@@ -214,6 +750,19 @@ int log_parse_job_new(const struct event_rec *rec, struct log_job_new *j)
     if (read_qstr(&p, j->depend_cond, sizeof(j->depend_cond)) < 0)
         return -1;
 
+    j->script[0] = 0;
+    while (*p == ' ')
+        p++;
+    if (*p == '"' && read_qstr(&p, j->script, sizeof(j->script)) < 0)
+        return -1;
+
+    j->journal_seq = 0;
+    j->journal_off = 0;
+    j->journal_len = 0;
+    if (sscanf(p, " %u %ld %u", &j->journal_seq, &j->journal_off,
+               &j->journal_len) != 3)
+        j->journal_len = 0;
+
     return 0;
 }
 
@@ -225,8 +774,43 @@ int log_parse_job_new(const struct event_rec *rec, struct log_job_new *j)
  * h2 ..." replay only needs exec_host; bhist/ebd use the rest.
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_start(FILE *fp, const struct log_job_start *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_START, j->dispatch_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u32(&w, (uint32_t) j->nhosts);
+    put_u32(&w, (uint32_t) j->cpus_per_host);
+    put_u32(&w, (uint32_t) j->gpus_per_host);
+    put_str(&w, j->gpu_model);
+    put_str(&w, j->gpu_assigned);
+    put_str(&w, j->hosts);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_start(const struct event_rec *rec,
+                               struct log_job_start *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->nhosts = (int) get_u32(&r);
+    j->cpus_per_host = (int) get_u32(&r);
+    j->gpus_per_host = (int) get_u32(&r);
+    get_str(&r, j->gpu_model, sizeof(j->gpu_model));
+    get_str(&r, j->gpu_assigned, sizeof(j->gpu_assigned));
+    get_str(&r, j->hosts, sizeof(j->hosts));
+    j->dispatch_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_start(FILE *fp, const struct log_job_start *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_start(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_START, j->dispatch_time) < 0)
         return -1;
     if (fprintf(fp, " %ld %d %d %d", j->job_id, j->nhosts, j->cpus_per_host,
@@ -245,6 +829,9 @@ int log_write_job_start(FILE *fp, const struct log_job_start *j)
 
 int log_parse_job_start(const struct event_rec *rec, struct log_job_start *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_start(rec, j);
+
     const char *p = rec->rest;
     int cc;
     int n = sscanf(p, " %ld %d %d %d%n", &j->job_id, &j->nhosts,
@@ -271,8 +858,33 @@ int log_parse_job_start(const struct event_rec *rec, struct log_job_start *j)
  * JOB_FORK
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_fork(FILE *fp, const struct log_job_fork *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_FORK, j->fork_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u32(&w, (uint32_t) j->job_pid);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_fork(const struct event_rec *rec,
+                              struct log_job_fork *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->job_pid = (int32_t) get_u32(&r);
+    j->fork_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_fork(FILE *fp, const struct log_job_fork *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_fork(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_FORK, j->fork_time) < 0)
         return -1;
     if (fprintf(fp, " %ld %d\n", (long) j->job_id, j->job_pid) < 0)
@@ -282,6 +894,9 @@ int log_write_job_fork(FILE *fp, const struct log_job_fork *j)
 
 int log_parse_job_fork(const struct event_rec *rec, struct log_job_fork *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_fork(rec, j);
+
     int n = sscanf(rec->rest, " %ld %d", &j->job_id, &j->job_pid);
     if (n != 2) {
         errno = EINVAL;
@@ -297,8 +912,35 @@ int log_parse_job_fork(const struct event_rec *rec, struct log_job_fork *j)
  * JOB_SIGNAL
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_signal(FILE *fp, const struct log_job_signal *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_SIGNAL, j->signal_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u32(&w, (uint32_t) j->signal_num);
+    put_u32(&w, j->uid);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_signal(const struct event_rec *rec,
+                                struct log_job_signal *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->signal_num = (int32_t) get_u32(&r);
+    j->uid = get_u32(&r);
+    j->signal_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_signal(FILE *fp, const struct log_job_signal *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_signal(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_SIGNAL, j->signal_time) < 0)
         return -1;
     if (fprintf(fp, " %ld %d %u\n", (long) j->job_id, j->signal_num, j->uid) <
@@ -309,6 +951,9 @@ int log_write_job_signal(FILE *fp, const struct log_job_signal *j)
 
 int log_parse_job_signal(const struct event_rec *rec, struct log_job_signal *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_signal(rec, j);
+
     int n =
         sscanf(rec->rest, " %ld %d %u", &j->job_id, &j->signal_num, &j->uid);
     if (n != 3) {
@@ -325,8 +970,37 @@ int log_parse_job_signal(const struct event_rec *rec, struct log_job_signal *j)
  * JOB_FINISH
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_finish(FILE *fp, const struct log_job_finish *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_FINISH, j->end_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u32(&w, (uint32_t) j->uid);
+    put_u32(&w, (uint32_t) j->state);
+    put_u32(&w, (uint32_t) j->exit_status);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_finish(const struct event_rec *rec,
+                                struct log_job_finish *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->uid = (uid_t) get_u32(&r);
+    j->state = (int32_t) get_u32(&r);
+    j->exit_status = (int32_t) get_u32(&r);
+    j->end_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_finish(FILE *fp, const struct log_job_finish *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_finish(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_FINISH, j->end_time) < 0)
         return -1;
     if (fprintf(fp, " %ld %u %d %d %ld", (long) j->job_id, (unsigned) j->uid,
@@ -339,6 +1013,9 @@ int log_write_job_finish(FILE *fp, const struct log_job_finish *j)
 
 int log_parse_job_finish(const struct event_rec *rec, struct log_job_finish *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_finish(rec, j);
+
     const char *p = rec->rest;
     int cc;
     int n = sscanf(p, " %ld %u %d %d %n", &j->job_id, (unsigned *) &j->uid,
@@ -357,8 +1034,32 @@ int log_parse_job_finish(const struct event_rec *rec, struct log_job_finish *j)
  * JOB_PEND_SUSP / JOB_PEND_RESUME / JOB_SUSP
  * ----------------------------------------------------------------------- */
 
+/* The job_id only events share one binary layout */
+static int bin_write_job_id(FILE *fp, enum event_type type, int64_t job_id,
+                            time_t t)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, type, t);
+    put_u64(&w, (uint64_t) job_id);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_id(const struct event_rec *rec, int64_t *job_id)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    *job_id = (int64_t) get_u64(&r);
+    return bin_rd_done(&r);
+}
+
 int log_write_job_pend_susp(FILE *fp, const struct log_job_pend_susp *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_id(fp, EVENT_JOB_PEND_SUSP, j->job_id,
+                                j->event_time);
+
     if (write_hdr(fp, EVENT_JOB_PEND_SUSP, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld\n", (long) j->job_id) < 0)
@@ -369,6 +1070,11 @@ int log_write_job_pend_susp(FILE *fp, const struct log_job_pend_susp *j)
 int log_parse_job_pend_susp(const struct event_rec *rec,
                             struct log_job_pend_susp *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY) {
+        j->event_time = rec->event_time;
+        return bin_parse_job_id(rec, &j->job_id);
+    }
+
     int n = sscanf(rec->rest, " %ld", &j->job_id);
     if (n != 1) {
         errno = EINVAL;
@@ -382,6 +1088,10 @@ int log_parse_job_pend_susp(const struct event_rec *rec,
 
 int log_write_job_pend_resume(FILE *fp, const struct log_job_pend_resume *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_id(fp, EVENT_JOB_PEND_RESUME, j->job_id,
+                                j->event_time);
+
     if (write_hdr(fp, EVENT_JOB_PEND_RESUME, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld\n", (long) j->job_id) < 0)
@@ -392,6 +1102,11 @@ int log_write_job_pend_resume(FILE *fp, const struct log_job_pend_resume *j)
 int log_parse_job_pend_resume(const struct event_rec *rec,
                               struct log_job_pend_resume *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY) {
+        j->event_time = rec->event_time;
+        return bin_parse_job_id(rec, &j->job_id);
+    }
+
     int n = sscanf(rec->rest, " %ld", &j->job_id);
     if (n != 1) {
         errno = EINVAL;
@@ -405,6 +1120,10 @@ int log_parse_job_pend_resume(const struct event_rec *rec,
 
 int log_write_job_susp(FILE *fp, const struct log_job_susp *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_id(fp, EVENT_JOB_SUSP, j->job_id,
+                                j->event_time);
+
     if (write_hdr(fp, EVENT_JOB_SUSP, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld\n", (long) j->job_id) < 0)
@@ -414,6 +1133,11 @@ int log_write_job_susp(FILE *fp, const struct log_job_susp *j)
 
 int log_parse_job_susp(const struct event_rec *rec, struct log_job_susp *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY) {
+        j->event_time = rec->event_time;
+        return bin_parse_job_id(rec, &j->job_id);
+    }
+
     int n = sscanf(rec->rest, " %ld", &j->job_id);
     if (n != 1) {
         errno = EINVAL;
@@ -430,8 +1154,35 @@ int log_parse_job_susp(const struct event_rec *rec, struct log_job_susp *j)
  * -----------------------------------------------------------------------
  */
 
+static int bin_write_job_move(FILE *fp, const struct log_job_move *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_MOVE, j->event_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_str(&w, j->from_queue);
+    put_str(&w, j->to_queue);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_move(const struct event_rec *rec,
+                              struct log_job_move *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    get_str(&r, j->from_queue, sizeof(j->from_queue));
+    get_str(&r, j->to_queue, sizeof(j->to_queue));
+    j->event_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_move(FILE *fp, const struct log_job_move *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_move(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_MOVE, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld", (long) j->job_id) < 0)
@@ -447,6 +1198,9 @@ int log_write_job_move(FILE *fp, const struct log_job_move *j)
 
 int log_parse_job_move(const struct event_rec *rec, struct log_job_move *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_move(rec, j);
+
     const char *p = rec->rest;
     int cc;
     int n = sscanf(p, " %ld%n", &j->job_id, &cc);
@@ -470,8 +1224,35 @@ int log_parse_job_move(const struct event_rec *rec, struct log_job_move *j)
  * JOB_PRIORITY
  * ----------------------------------------------------------------------- */
 
+static int bin_write_job_priority(FILE *fp, const struct log_job_priority *j)
+{
+    struct bin_wr w;
+
+    bin_begin(&w, EVENT_JOB_PRIORITY, j->event_time);
+    put_u64(&w, (uint64_t) j->job_id);
+    put_u32(&w, (uint32_t) j->old_priority);
+    put_u32(&w, (uint32_t) j->new_priority);
+    return bin_end(fp, &w);
+}
+
+static int bin_parse_job_priority(const struct event_rec *rec,
+                                  struct log_job_priority *j)
+{
+    struct bin_rd r;
+
+    bin_rd_init(&r, rec);
+    j->job_id = (int64_t) get_u64(&r);
+    j->old_priority = (int32_t) get_u32(&r);
+    j->new_priority = (int32_t) get_u32(&r);
+    j->event_time = rec->event_time;
+    return bin_rd_done(&r);
+}
+
 int log_write_job_priority(FILE *fp, const struct log_job_priority *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_priority(fp, j);
+
     if (write_hdr(fp, EVENT_JOB_PRIORITY, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld %d %d\n", (long) j->job_id,
@@ -482,6 +1263,9 @@ int log_write_job_priority(FILE *fp, const struct log_job_priority *j)
 
 int log_parse_job_priority(const struct event_rec *rec, struct log_job_priority *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY)
+        return bin_parse_job_priority(rec, j);
+
     int n = sscanf(rec->rest, " %ld %d %d",
                    &j->job_id, &j->old_priority, &j->new_priority);
     if (n != 3) {
@@ -495,6 +1279,10 @@ int log_parse_job_priority(const struct event_rec *rec, struct log_job_priority
 // Job goes back to pend since it failed to dispatch
 int log_write_job_pend(FILE *fp, const struct log_job_pend *j)
 {
+    if (log_format == LOG_FORMAT_BINARY)
+        return bin_write_job_id(fp, EVENT_JOB_PEND, j->job_id,
+                                j->event_time);
+
     if (write_hdr(fp, EVENT_JOB_PEND, j->event_time) < 0)
         return -1;
     if (fprintf(fp, " %ld\n", (long) j->job_id) < 0)
@@ -504,6 +1292,11 @@ int log_write_job_pend(FILE *fp, const struct log_job_pend *j)
 
 int log_parse_job_pend(const struct event_rec *rec, struct log_job_pend *j)
 {
+    if (rec->format == LOG_FORMAT_BINARY) {
+        j->event_time = rec->event_time;
+        return bin_parse_job_id(rec, &j->job_id);
+    }
+
     int n = sscanf(rec->rest, " %ld", &j->job_id);
     if (n != 1) {
         errno = EINVAL;
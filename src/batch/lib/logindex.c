@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch/lib/log.h"
+#include "batch/lib/logindex.h"
+#include "base/lib/ll.bufsiz.h"
+
+/* One record of the archive while the index is built */
+struct idx_rec {
+    int64_t job_id;
+    uint64_t offset;
+    int64_t array_id;
+    int32_t array_index;
+    uint32_t uid;
+    uint32_t flags;
+};
+
+struct idx_build {
+    struct idx_rec *recs;
+    uint64_t nrecs;
+    uint64_t max_recs;
+    uint32_t *uids;
+    uint32_t nuids;
+    uint32_t max_uids;
+    int64_t min_time;
+    int64_t max_time;
+};
+
+static int build_add_uid(struct idx_build *b, uint32_t uid)
+{
+    for (uint32_t i = 0; i < b->nuids; i++) {
+        if (b->uids[i] == uid)
+            return 0;
+    }
+
+    if (b->nuids == b->max_uids) {
+        uint32_t n = b->max_uids ? b->max_uids * 2 : 64;
+        uint32_t *u = realloc(b->uids, n * sizeof(uint32_t));
+        if (u == NULL)
+            return -1;
+        b->uids = u;
+        b->max_uids = n;
+    }
+    b->uids[b->nuids++] = uid;
+    return 0;
+}
+
+static int build_add(struct idx_build *b, const struct log_record *r,
+                     time_t event_time, uint64_t offset)
+{
+    struct idx_rec *x;
+
+    if (b->nrecs == b->max_recs) {
+        uint64_t n = b->max_recs ? b->max_recs * 2 : 4096;
+        x = realloc(b->recs, n * sizeof(struct idx_rec));
+        if (x == NULL)
+            return -1;
+        b->recs = x;
+        b->max_recs = n;
+    }
+
+    x = &b->recs[b->nrecs++];
+    memset(x, 0, sizeof(*x));
+    x->job_id = log_record_job_id(r);
+    x->offset = offset;
+
+    if (r->type == EVENT_JOB_NEW) {
+        x->array_id = r->p.job_new.array_id;
+        x->array_index = r->p.job_new.array_index;
+        x->uid = r->p.job_new.uid;
+        x->flags = LOG_INDEX_NEW | LOG_INDEX_UID;
+    } else if (r->type == EVENT_JOB_FINISH) {
+        x->uid = r->p.finish.uid;
+        x->flags = LOG_INDEX_UID;
+    }
+
+    if (x->flags & LOG_INDEX_UID) {
+        if (build_add_uid(b, x->uid) < 0)
+            return -1;
+    }
+
+    if (b->min_time == 0 || event_time < b->min_time)
+        b->min_time = event_time;
+    if (event_time > b->max_time)
+        b->max_time = event_time;
+
+    return 0;
+}
+
+static int rec_cmp(const void *a, const void *b)
+{
+    const struct idx_rec *ra = a;
+    const struct idx_rec *rb = b;
+
+    if (ra->job_id != rb->job_id)
+        return ra->job_id < rb->job_id ? -1 : 1;
+    if (ra->offset != rb->offset)
+        return ra->offset < rb->offset ? -1 : 1;
+    return 0;
+}
+
+static int uid_cmp(const void *a, const void *b)
+{
+    uint32_t ua = *(const uint32_t *) a;
+    uint32_t ub = *(const uint32_t *) b;
+
+    if (ua != ub)
+        return ua < ub ? -1 : 1;
+    return 0;
+}
+
+/*
+ * build_scan - read every record of the archive. Decoding stops at the
+ * first bad record, as the manifest readers do, the index then covers
+ * the records before it.
+ */
+static int build_scan(struct idx_build *b, FILE *fp)
+{
+    struct event_rec rec;
+    struct log_record r;
+
+    for (;;) {
+        off_t offset = ftello(fp);
+
+        memset(&rec, 0, sizeof(struct event_rec));
+        if (log_read_hdr(fp, &rec) < 0)
+            break;
+        if (log_decode(&rec, &r) != 0)
+            continue;
+        if (build_add(b, &r, rec.event_time, (uint64_t) offset) < 0)
+            return -1;
+    }
+
+    if (ferror(fp)) {
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+static int build_write(struct idx_build *b, FILE *fp,
+                       const struct stat *st)
+{
+    struct log_index_footer f;
+    struct log_index_job j;
+    uint32_t crc = 0;
+    uint64_t i = 0;
+
+    memset(&f, 0, sizeof(f));
+    memcpy(f.magic, LOG_INDEX_MAGIC, sizeof(f.magic));
+    f.version = LOG_INDEX_VERSION;
+    f.nrecs = b->nrecs;
+    f.nuids = b->nuids;
+    f.min_time = b->min_time;
+    f.max_time = b->max_time;
+    f.archive_size = (uint64_t) st->st_size;
+    f.archive_mtime = (int64_t) st->st_mtime;
+
+    if (b->nrecs > 0) {
+        f.min_job_id = b->recs[0].job_id;
+        f.max_job_id = b->recs[b->nrecs - 1].job_id;
+    }
+
+    while (i < b->nrecs) {
+        memset(&j, 0, sizeof(j));
+        j.job_id = b->recs[i].job_id;
+        j.first = (uint32_t) i;
+        for (; i < b->nrecs && b->recs[i].job_id == j.job_id; i++) {
+            const struct idx_rec *x = &b->recs[i];
+            if (x->flags & LOG_INDEX_NEW) {
+                j.array_id = x->array_id;
+                j.array_index = x->array_index;
+            }
+            if (x->flags & LOG_INDEX_UID)
+                j.uid = x->uid;
+            j.flags |= x->flags;
+            j.count++;
+        }
+        crc = log_crc32c(crc, &j, sizeof(j));
+        if (fwrite(&j, sizeof(j), 1, fp) != 1)
+            return -1;
+        f.njobs++;
+    }
+
+    for (i = 0; i < b->nrecs; i++) {
+        uint64_t off = b->recs[i].offset;
+        crc = log_crc32c(crc, &off, sizeof(off));
+        if (fwrite(&off, sizeof(off), 1, fp) != 1)
+            return -1;
+    }
+
+    if (b->nuids > 0) {
+        crc = log_crc32c(crc, b->uids, b->nuids * sizeof(uint32_t));
+        if (fwrite(b->uids, sizeof(uint32_t), b->nuids, fp) != b->nuids)
+            return -1;
+    }
+
+    f.crc = crc;
+    if (fwrite(&f, sizeof(f), 1, fp) != 1)
+        return -1;
+
+    return 0;
+}
+
+int log_index_build(const char *path)
+{
+    struct idx_build b;
+    struct stat st;
+    char idx[PATH_MAX];
+    char tmp[PATH_MAX];
+    int rc = -1;
+
+    int n = snprintf(idx, sizeof(idx), "%s%s", path, LOG_INDEX_SUFFIX);
+    if (n < 0 || n >= (int) sizeof(idx)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    n = snprintf(tmp, sizeof(tmp), "%s.tmp", idx);
+    if (n < 0 || n >= (int) sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+        return -1;
+    if (fstat(fileno(in), &st) < 0) {
+        fclose(in);
+        return -1;
+    }
+
+    memset(&b, 0, sizeof(b));
+    if (build_scan(&b, in) < 0) {
+        int e = errno;
+        fclose(in);
+        free(b.recs);
+        free(b.uids);
+        errno = e;
+        return -1;
+    }
+    fclose(in);
+
+    qsort(b.recs, b.nrecs, sizeof(struct idx_rec), rec_cmp);
+    qsort(b.uids, b.nuids, sizeof(uint32_t), uid_cmp);
+
+    if (b.nrecs > UINT32_MAX) {
+        errno = EFBIG;
+        goto out;
+    }
+
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL)
+        goto out;
+
+    if (build_write(&b, out, &st) < 0 || fflush(out) != 0
+        || fsync(fileno(out)) < 0) {
+        int e = errno;
+        fclose(out);
+        unlink(tmp);
+        errno = e;
+        goto out;
+    }
+    if (fclose(out) != 0) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+        goto out;
+    }
+
+    if (rename(tmp, idx) < 0) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+        goto out;
+    }
+    rc = 0;
+
+out:
+    free(b.recs);
+    free(b.uids);
+    return rc;
+}
+
+struct log_index *log_index_open(const char *path)
+{
+    struct log_index *x;
+    struct log_index_footer f;
+    struct stat ast;
+    struct stat ist;
+    char idx[PATH_MAX];
+
+    int n = snprintf(idx, sizeof(idx), "%s%s", path, LOG_INDEX_SUFFIX);
+    if (n < 0 || n >= (int) sizeof(idx)) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (stat(path, &ast) < 0)
+        return NULL;
+
+    int fd = open(idx, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    x = NULL;
+
+    if (fstat(fd, &ist) < 0 || ist.st_size < (off_t) sizeof(f)
+        || pread(fd, &f, sizeof(f), ist.st_size - (off_t) sizeof(f))
+               != (ssize_t) sizeof(f)) {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    if (memcmp(f.magic, LOG_INDEX_MAGIC, sizeof(f.magic)) != 0
+        || f.version != LOG_INDEX_VERSION) {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    uint64_t body = (uint64_t) f.njobs * sizeof(struct log_index_job)
+                    + f.nrecs * sizeof(uint64_t);
+    size_t usize = (size_t) f.nuids * sizeof(uint32_t);
+    if (body + usize + sizeof(f) != (uint64_t) ist.st_size) {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    if (f.archive_size != (uint64_t) ast.st_size
+        || f.archive_mtime != (int64_t) ast.st_mtime) {
+        errno = ESTALE;
+        goto fail;
+    }
+
+    x = calloc(1, sizeof(struct log_index));
+    if (x == NULL)
+        goto fail;
+    x->f = f;
+    x->path = strdup(idx);
+    /* the uid set sits just before the footer and is read with it,
+     * the job table is only loaded when the archive cannot be skipped */
+    x->uids = malloc(usize + 1);
+    if (x->path == NULL || x->uids == NULL)
+        goto fail;
+    if (pread(fd, x->uids, usize, (off_t) body) != (ssize_t) usize) {
+        errno = EBADMSG;
+        goto fail;
+    }
+
+    close(fd);
+    return x;
+
+fail:;
+    int e = errno;
+    close(fd);
+    log_index_close(x);
+    errno = e;
+    return NULL;
+}
+
+int log_index_load(struct log_index *x)
+{
+    if (x->jobs != NULL)
+        return 0;
+
+    size_t jsize = (size_t) x->f.njobs * sizeof(struct log_index_job);
+    size_t osize = (size_t) x->f.nrecs * sizeof(uint64_t);
+    size_t usize = (size_t) x->f.nuids * sizeof(uint32_t);
+
+    /* one block, jobs first so the offsets stay aligned, the uids are
+     * read again only to check the CRC */
+    char *buf = malloc(jsize + osize + usize + 1);
+    if (buf == NULL)
+        return -1;
+
+    int fd = open(x->path, O_RDONLY);
+    if (fd < 0) {
+        free(buf);
+        return -1;
+    }
+
+    size_t want = jsize + osize + usize;
+    size_t got = 0;
+    while (got < want) {
+        ssize_t cc = pread(fd, buf + got, want - got, (off_t) got);
+        if (cc <= 0) {
+            if (cc < 0 && errno == EINTR)
+                continue;
+            close(fd);
+            free(buf);
+            errno = EBADMSG;
+            return -1;
+        }
+        got += (size_t) cc;
+    }
+    close(fd);
+
+    if (log_crc32c(0, buf, want) != x->f.crc) {
+        free(buf);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    if (memcmp(buf + jsize + osize, x->uids, usize) != 0) {
+        free(buf);
+        errno = EBADMSG;
+        return -1;
+    }
+
+    x->jobs = (struct log_index_job *) buf;
+    x->offsets = (uint64_t *) (buf + jsize);
+
+    return 0;
+}
+
+void log_index_close(struct log_index *x)
+{
+    if (x == NULL)
+        return;
+
+    free(x->jobs);
+    free(x->uids);
+    free(x->path);
+    free(x);
+}
+
+const struct log_index_job *log_index_find(const struct log_index *x,
+                                           int64_t job_id)
+{
+    uint32_t lo = 0;
+    uint32_t hi = x->f.njobs;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (x->jobs[mid].job_id == job_id)
+            return &x->jobs[mid];
+        if (x->jobs[mid].job_id < job_id)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return NULL;
+}
+
+int log_index_has_uid(const struct log_index *x, uid_t uid)
+{
+    uint32_t lo = 0;
+    uint32_t hi = x->f.nuids;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (x->uids[mid] == (uint32_t) uid)
+            return 1;
+        if (x->uids[mid] < (uint32_t) uid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return 0;
+}
@@ -8,6 +8,7 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <unistd.h>
 #include <sys/epoll.h>
 
 #include "base/lib/ll.protocol.h"
@@ -17,8 +18,10 @@
 #include "base/lib/ll.channel.h"
 #include "base/lib/ll.host.h"
 #include "base/lib/ll.sys.h"
+#include "base/lib/auth.h"
 
 #include "batch/lib/rpc.h"
+#include "batch/lib/wire.h"
 #include "llbatch.h"
 
 static int chan_mbd = -1;
@@ -28,6 +31,8 @@ static int recvtimeout;
 static struct ll_host mbd_node;
 static uint16_t mbd_port;
 
+static int session_on;
+
 static int initialized;
 
 static int mbd_rpc_init(void)
@@ -55,22 +60,105 @@ static int mbd_rpc_init(void)
         return -1;
     }
 
+    if (!ll_atoi(ll_params[LL_AUTH_SESSION].val, &session_on)) {
+        errno = EINVAL;
+        return -1;
+    }
+
     if (get_host_by_name(ll_params[LL_MBD_HOST].val, &mbd_node) < 0) {
         errno = EINVAL;
         return -1;
     }
-    chan_init();
+    if (chan_init() < 0)
+        return -1;
 
     initialized = 1;
     return 0;
 }
 
+static int mbd_connect(void)
+{
+    int chan_id = chan_tcp_client();
+    if (chan_id < 0)
+        return -1;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    get_host_addrv4(&mbd_node, &addr);
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t) mbd_port);
+
+    if (chan_connect(chan_id, &addr, conntimeout) < 0) {
+        chan_close(chan_id);
+        return -1;
+    }
+
+    return chan_id;
+}
+
+/*
+ * mbd_session_open - open a session on chan_id, a connection to mbd
+ * still in blocking mode: send a nonce signed in full, derive the keys
+ * from it and the nonce of the reply, see base/lib/auth.h. From then on
+ * the messages of the channel are signed and verified with the session.
+ */
+int mbd_session_open(int chan_id, int timeout)
+{
+    struct wire_auth_session req;
+    if (auth_nonce(req.nonce) < 0)
+        return -1;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_AUTH_SESSION;
+    if (auth_sign_header(&hdr) < 0)
+        return -1;
+
+    char buf[PACKET_HEADER_SIZE + LL_BUFSIZ_64];
+    XDR xdrs;
+    xdrmem_create(&xdrs, buf, sizeof(buf), XDR_ENCODE);
+    if (!ll_encode_msg(&xdrs, &req, xdr_wire_auth_session, &hdr)) {
+        xdr_destroy(&xdrs);
+        errno = EPROTO;
+        return -1;
+    }
+    struct chan_buffer snd = {.data = buf, .len = (int) xdr_getpos(&xdrs)};
+    xdr_destroy(&xdrs);
+
+    struct chan_buffer rcv = {0};
+    struct protocol_header rhdr;
+    if (chan_rpc(chan_id, &snd, &rcv, &rhdr, timeout) < 0)
+        return -1;
+
+    struct wire_auth_session rep;
+    int ok = rhdr.operation == BATCH_AUTH_SESSION_ACK
+             && rhdr.status == MBD_OK && auth_verify_header(&rhdr) == 0;
+    if (ok) {
+        xdrmem_create(&xdrs, rcv.data, (u_int) rcv.len, XDR_DECODE);
+        ok = xdr_wire_auth_session(&xdrs, &rep);
+        xdr_destroy(&xdrs);
+    }
+    free(rcv.data);
+    if (!ok) {
+        errno = rhdr.status != MBD_OK ? rhdr.status : EPROTO;
+        return -1;
+    }
+
+    struct auth_session *s = auth_session_new(req.nonce, rep.nonce, 1);
+    if (s == NULL)
+        return -1;
+    chan_set_session(chan_id, s);
+
+    return 0;
+}
+
 /*
  * Send req_len bytes to mbd via TCP, receive reply.
  * On success: *rep points to allocated payload (caller must free),
  *             reply_hdr is filled.
  * On error: returns -1, sets lserrno.
- * Keeps a persistent TCP connection; reconnects on failure.
+ * Keeps a persistent TCP connection; reconnects on failure. A reply
+ * with an error status leaves the connection open.
  */
 int call_mbd(const void *req, size_t req_len, void **rep,
              struct protocol_header *reply_hdr)
@@ -79,22 +167,9 @@ int call_mbd(const void *req, size_t req_len, void **rep,
         return -1;
 
     if (chan_mbd < 0) {
-        chan_mbd = chan_tcp_client();
-        if (chan_mbd < 0) {
-            return -1;
-        }
-
-        struct sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        get_host_addrv4(&mbd_node, &addr);
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons((uint16_t) mbd_port);
-
-        if (chan_connect(chan_mbd, &addr, conntimeout) < 0) {
-            chan_close(chan_mbd);
-            chan_mbd = -1;
+        chan_mbd = mbd_connect();
+        if (chan_mbd < 0)
             return -1;
-        }
     }
 
     struct chan_buffer sndbuf = {.data = (void *) req, .len = req_len};
@@ -109,8 +184,6 @@ int call_mbd(const void *req, size_t req_len, void **rep,
     if (reply_hdr->status != MBD_OK) {
         errno = reply_hdr->status;
         free(rcvbuf.data);
-        chan_close(chan_mbd);
-        chan_mbd = -1;
         return -1;
     }
 
@@ -118,6 +191,285 @@ int call_mbd(const void *req, size_t req_len, void **rep,
     return 0;
 }
 
+/*
+ * Asynchronous calls. A connection keeps any number of requests in
+ * flight, each with the next sequence number of the connection, which
+ * mbd echoes in its reply; replies are matched by it, since mbd answers
+ * queries from its query thread, after requests that came later. The
+ * channel is registered in an epoll descriptor of the connection, that
+ * the caller watches for input in its own poll or epoll loop:
+ * readable means llb_conn_dispatch() has replies to deliver or queued
+ * requests to write.
+ */
+struct mbd_call {
+    struct ll_list_entry ent;
+    int32_t sequence;
+    mbd_reply_fn done;
+    void *arg;
+};
+
+struct llb_conn {
+    int chan_id;
+    int efd;
+    int32_t sequence;
+    struct ll_list calls;
+};
+
+static int conn_connect(struct llb_conn *c)
+{
+    int chan_id = mbd_connect();
+    if (chan_id < 0)
+        return -1;
+
+    // the connection lasts, its requests are signed with a session
+    if (session_on && mbd_session_open(chan_id, recvtimeout) < 0) {
+        int err = errno;
+        chan_close(chan_id);
+        errno = err;
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u32 = (uint32_t) chan_id;
+
+    if (io_non_block(chan_sock(chan_id)) < 0
+        || epoll_ctl(c->efd, EPOLL_CTL_ADD, chan_sock(chan_id), &ev) < 0) {
+        chan_close(chan_id);
+        return -1;
+    }
+
+    c->chan_id = chan_id;
+    return 0;
+}
+
+/*
+ * Fail the calls in flight with err and drop the channel. The calls are
+ * detached first: a completion that issues a new call reconnects and
+ * queues it on c->calls, which this failure must not reach.
+ */
+static void conn_fail(struct llb_conn *c, int err)
+{
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.status = err;
+
+    if (c->chan_id >= 0) {
+        chan_close(c->chan_id);
+        c->chan_id = -1;
+    }
+
+    struct ll_list calls = c->calls;
+    ll_list_init(&c->calls);
+
+    struct ll_list_entry *e;
+    while ((e = ll_list_dequeue(&calls)) != NULL) {
+        struct mbd_call *call = (struct mbd_call *) e;
+        hdr.sequence = call->sequence;
+        call->done(call->arg, &hdr, NULL);
+        free(call);
+    }
+}
+
+struct llb_conn *llb_conn_open(void)
+{
+    if (mbd_rpc_init() < 0)
+        return NULL;
+
+    struct llb_conn *c = calloc(1, sizeof(*c));
+    if (c == NULL)
+        return NULL;
+
+    ll_list_init(&c->calls);
+    c->efd = epoll_create1(EPOLL_CLOEXEC);
+    if (c->efd < 0) {
+        free(c);
+        return NULL;
+    }
+
+    if (conn_connect(c) < 0) {
+        int err = errno;
+        close(c->efd);
+        free(c);
+        errno = err;
+        return NULL;
+    }
+
+    return c;
+}
+
+/*
+ * llb_conn_close - close the connection, the calls still in flight
+ * complete with ECANCELED. Not to be called from a completion.
+ */
+void llb_conn_close(struct llb_conn *c)
+{
+    if (c == NULL)
+        return;
+
+    conn_fail(c, ECANCELED);
+    close(c->efd);
+    free(c);
+}
+
+int llb_conn_fd(const struct llb_conn *c)
+{
+    return c->efd;
+}
+
+int llb_conn_pending(const struct llb_conn *c)
+{
+    return c->calls.count;
+}
+
+/*
+ * call_mbd_async - encode the request of hdr and payload into siz bytes
+ * at most with the next sequence number of the connection, sign it and
+ * send it. done is called from llb_conn_dispatch() with the reply
+ * header and the XDR stream of its payload, or with a NULL stream and
+ * the errno in the status of the header when the connection failed.
+ * A connection that failed is connected again on the next call.
+ */
+int call_mbd_async(struct llb_conn *c, struct protocol_header *hdr,
+                   void *payload, bool_t (*xdr_func)(), size_t siz,
+                   mbd_reply_fn done, void *arg)
+{
+    if (c->chan_id < 0 && conn_connect(c) < 0)
+        return -1;
+
+    struct mbd_call *call = calloc(1, sizeof(*call));
+    if (call == NULL)
+        return -1;
+
+    hdr->sequence = c->sequence++;
+
+    struct chan_buffer *buf;
+    if (chan_alloc_buf(&buf, (int) siz) < 0) {
+        free(call);
+        return -1;
+    }
+
+    XDR xdrs;
+    xdrmem_create(&xdrs, buf->data, (u_int) siz, XDR_ENCODE);
+    if (!ll_encode_msg(&xdrs, payload, xdr_func, hdr)) {
+        xdr_destroy(&xdrs);
+        chan_free_buf(buf);
+        free(call);
+        errno = EPROTO;
+        return -1;
+    }
+    buf->len = (size_t) xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+
+    if (auth_sign_packet(channels[c->chan_id].session, buf->data) < 0) {
+        chan_free_buf(buf);
+        free(call);
+        return -1;
+    }
+
+    if (chan_send(c->chan_id, buf, c->efd) < 0) {
+        chan_free_buf(buf);
+        free(call);
+        return -1;
+    }
+
+    call->sequence = hdr->sequence;
+    call->done = done;
+    call->arg = arg;
+    ll_list_append(&c->calls, &call->ent);
+
+    return 0;
+}
+
+/* Replies mostly come in order, the call is near the head. */
+static struct mbd_call *conn_call(struct llb_conn *c, int32_t sequence)
+{
+    for (struct ll_list_entry *e = c->calls.head; e != NULL; e = e->next) {
+        struct mbd_call *call = (struct mbd_call *) e;
+        if (call->sequence == sequence)
+            return call;
+    }
+    return NULL;
+}
+
+static int conn_reply(struct llb_conn *c, struct chan_buffer *buf)
+{
+    struct protocol_header hdr;
+    XDR xdrs;
+
+    xdrmem_create(&xdrs, buf->data, buf->len, XDR_DECODE);
+    if (!xdr_pack_hdr(&xdrs, &hdr)) {
+        xdr_destroy(&xdrs);
+        return -1;
+    }
+
+    struct mbd_call *call = conn_call(c, hdr.sequence);
+    if (call == NULL) {
+        xdr_destroy(&xdrs);
+        return -1;
+    }
+
+    ll_list_remove(&c->calls, &call->ent);
+    call->done(call->arg, &hdr, &xdrs);
+    free(call);
+    xdr_destroy(&xdrs);
+
+    return 0;
+}
+
+/*
+ * llb_conn_dispatch - write the queued requests the socket takes and
+ * complete the calls the replies of which arrived, waiting up to
+ * timeout milliseconds for the descriptor of the connection to be
+ * ready; 0 does not wait. Returns the number of calls completed, -1
+ * with errno set when the connection failed, after failing its calls.
+ */
+int llb_conn_dispatch(struct llb_conn *c, int timeout)
+{
+    struct epoll_event ev;
+
+    if (c->chan_id < 0)
+        return 0;
+
+    if (chan_epoll(c->efd, &ev, 1, timeout) < 0) {
+        if (errno == EINTR)
+            return 0;
+        int err = errno;
+        conn_fail(c, err);
+        errno = err;
+        return -1;
+    }
+
+    int chan_id = c->chan_id;
+    int n = 0;
+    while (!ll_list_is_empty(&channels[chan_id].recv)) {
+        struct chan_buffer *buf;
+
+        if (chan_dequeue(chan_id, &buf) < 0)
+            break;
+        int cc = conn_reply(c, buf);
+        chan_free_buf(buf);
+        if (cc < 0) {
+            conn_fail(c, EPROTO);
+            errno = EPROTO;
+            return -1;
+        }
+        n++;
+        // a completion may have failed the connection
+        if (c->chan_id != chan_id)
+            return n;
+    }
+
+    if (chan_has_error(chan_id)) {
+        conn_fail(c, ECONNRESET);
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    return n;
+}
+
 const char *batch_op_str(enum batch_lib_op op)
 {
     static const char *names[] = {
@@ -153,6 +505,19 @@ const char *batch_op_str(enum batch_lib_op op)
         [BATCH_JOB_PRIORITY] = "BATCH_JOB_PRIORITY",
         [BATCH_JOB_PRIORITY_ACK] = "BATCH_JOB_PRIORITY_ACK",
         [BATCH_JOB_MISSING] = "BATCH_JOB_MISSING",
+        [BATCH_JOB_INFO2] = "BATCH_JOB_INFO2",
+        [BATCH_JOB_INFO2_ACK] = "BATCH_JOB_INFO2_ACK",
+        [BATCH_JOB_SUMMARY] = "BATCH_JOB_SUMMARY",
+        [BATCH_JOB_SUMMARY_ACK] = "BATCH_JOB_SUMMARY_ACK",
+        [BATCH_JOB_DELTA] = "BATCH_JOB_DELTA",
+        [BATCH_JOB_DELTA_ACK] = "BATCH_JOB_DELTA_ACK",
+        [BATCH_JOB_SUBMIT_MANY] = "BATCH_JOB_SUBMIT_MANY",
+        [BATCH_JOB_SUBMIT_MANY_ACK] = "BATCH_JOB_SUBMIT_MANY_ACK",
+        [BATCH_AUTH_SESSION] = "BATCH_AUTH_SESSION",
+        [BATCH_AUTH_SESSION_ACK] = "BATCH_AUTH_SESSION_ACK",
+        [BATCH_NEW_JOB_REPLY_MANY] = "BATCH_NEW_JOB_REPLY_MANY",
+        [BATCH_JOB_FINISH_MANY] = "BATCH_JOB_FINISH_MANY",
+        [BATCH_JOB_ACK_MANY] = "BATCH_JOB_ACK_MANY",
     };
     static const size_t nnames = sizeof(names) / sizeof(names[0]);
 
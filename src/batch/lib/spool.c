@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "batch/lib/spool.h"
+#include "base/lib/ll.bufsiz.h"
+
+/* snprintf result n into a buffer of size, ENAMETOOLONG if cut */
+static int spool_fmt(int n, size_t size)
+{
+    if (n < 0 || n >= (int) size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+int spool_version(const char *jobs_dir)
+{
+    char path[PATH_MAX];
+    if (spool_fmt(snprintf(path, sizeof(path), "%s/%s", jobs_dir,
+                           SPOOL_VERSION_FILE), sizeof(path)) < 0)
+        return -1;
+
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    int version;
+    int n = fscanf(fp, "%d", &version);
+    fclose(fp);
+    if (n != 1 || version <= 0) {
+        errno = EBADMSG;
+        return -1;
+    }
+
+    return version;
+}
+
+int spool_set_version(const char *jobs_dir, int version)
+{
+    char path[PATH_MAX];
+    if (spool_fmt(snprintf(path, sizeof(path), "%s/%s", jobs_dir,
+                           SPOOL_VERSION_FILE), sizeof(path)) < 0)
+        return -1;
+
+    char tmp[PATH_MAX + LL_BUFSIZ_32];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+        return -1;
+
+    fprintf(fp, "%d\n", version);
+    if (fflush(fp) != 0 || fsync(fileno(fp)) < 0) {
+        int e = errno;
+        fclose(fp);
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+    fclose(fp);
+
+    if (rename(tmp, path) < 0) {
+        int e = errno;
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+
+    return 0;
+}
+
+int spool_job_dir(char *buf, size_t size, const char *jobs_dir,
+                  int64_t job_id)
+{
+    return spool_fmt(snprintf(buf, size, "%s/%03ld/%ld/%ld", jobs_dir,
+                              (long) (job_id % 1000),
+                              (long) (job_id / 1000000), (long) job_id), size);
+}
+
+int spool_legacy_dir(char *buf, size_t size, const char *jobs_dir,
+                     int64_t job_id)
+{
+    return spool_fmt(snprintf(buf, size, "%s/%ld/%ld", jobs_dir,
+                              (long) (job_id % SPOOL_LEGACY_BUCKETS),
+                              (long) job_id), size);
+}
+
+int spool_find_dir(char *buf, size_t size, const char *jobs_dir,
+                   int64_t job_id)
+{
+    struct stat st;
+
+    if (spool_job_dir(buf, size, jobs_dir, job_id) < 0)
+        return -1;
+    if (stat(buf, &st) == 0)
+        return 0;
+
+    if (spool_legacy_dir(buf, size, jobs_dir, job_id) < 0)
+        return -1;
+    if (stat(buf, &st) == 0)
+        return 0;
+
+    /* bmanifest --spool may have moved it between the two lookups */
+    if (spool_job_dir(buf, size, jobs_dir, job_id) < 0)
+        return -1;
+    if (stat(buf, &st) == 0)
+        return 0;
+
+    errno = ENOENT;
+    return -1;
+}
+
+int spool_create_parents(const char *jobs_dir, int64_t job_id)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%03ld", jobs_dir, (long) (job_id % 1000));
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    if (spool_fmt(snprintf(dir, sizeof(dir), "%s/%03ld/%ld", jobs_dir,
+                           (long) (job_id % 1000),
+                           (long) (job_id / 1000000)), sizeof(dir)) < 0)
+        return -1;
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+int spool_create_dir(char *buf, size_t size, const char *jobs_dir,
+                     int64_t job_id)
+{
+    if (spool_job_dir(buf, size, jobs_dir, job_id) < 0)
+        return -1;
+
+    if (mkdir(buf, 0755) == 0 || errno == EEXIST)
+        return 0;
+    if (errno != ENOENT)
+        return -1;
+
+    /* first job of its shard, create the two levels above it */
+    if (spool_create_parents(jobs_dir, job_id) < 0)
+        return -1;
+
+    if (mkdir(buf, 0755) < 0 && errno != EEXIST)
+        return -1;
+
+    return 0;
+}
+
+int spool_remove_dir(const char *dir)
+{
+    DIR *dp = opendir(dir);
+    if (dp == NULL)
+        return errno == ENOENT ? 0 : -1;
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+            continue;
+        unlinkat(dirfd(dp), de->d_name, 0);
+    }
+    closedir(dp);
+
+    if (rmdir(dir) < 0 && errno != ENOENT)
+        return -1;
+
+    return 0;
+}
+
+int spool_journal_path(char *buf, size_t size, const char *mbd_dir,
+                       uint32_t seq)
+{
+    return spool_fmt(snprintf(buf, size, "%s/%s/%s%u", mbd_dir,
+                              SPOOL_JOURNAL_DIR, SPOOL_JOURNAL_PREFIX, seq),
+                     size);
+}
+
+char *spool_journal_read(const char *mbd_dir, uint32_t seq, int64_t off,
+                         uint32_t len)
+{
+    char path[PATH_MAX];
+    if (spool_journal_path(path, sizeof(path), mbd_dir, seq) < 0)
+        return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    char *buf = malloc((size_t) len + 1);
+    if (buf == NULL) {
+        close(fd);
+        return NULL;
+    }
+
+    ssize_t n = pread(fd, buf, len, (off_t) off);
+    int e = errno;
+    close(fd);
+    if (n != (ssize_t) len) {
+        free(buf);
+        errno = n < 0 ? e : EIO;
+        return NULL;
+    }
+    buf[len] = 0;
+
+    return buf;
+}
+
+void spool_rate_init(struct spool_rate *r, int rate)
+{
+    r->rate = rate;
+    r->count = 0;
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+}
+
+void spool_rate_wait(struct spool_rate *r)
+{
+    if (r->rate <= 0)
+        return;
+
+    r->count++;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t elapsed = (now.tv_sec - r->start.tv_sec) * 1000000000L
+                      + (now.tv_nsec - r->start.tv_nsec);
+    int64_t due = r->count * 1000000000L / r->rate;
+    if (due <= elapsed)
+        return;
+
+    struct timespec ts;
+    ts.tv_sec = (due - elapsed) / 1000000000L;
+    ts.tv_nsec = (due - elapsed) % 1000000000L;
+    nanosleep(&ts, NULL);
+}
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "base/lib/ll.sys.h"
+#include "base/lib/ll.conf.h"
+#include "batch/lib/status.h"
+
+#include "llbatch.h"
+
+/*
+ * Reader of the cluster status file of mbd, see batch/lib/status.h.
+ * Every call copies the whole file out of the mapping under the
+ * sequence lock and builds its records from the copy, so the hosts, the
+ * queues and the tokens of one call are of the same scheduling pass.
+ */
+
+/* a copy is retried while mbd writes, for about a second at most */
+#define STATUS_RETRIES 1000
+
+struct llb_status {
+    char path[PATH_MAX];
+    void *map;
+    size_t size;
+};
+
+static int status_map_file(struct llb_status *s)
+{
+    int fd = open(s->path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t) st.st_size < sizeof(struct ll_status_header)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+
+    void *p = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return -1;
+
+    const struct ll_status_header *h = p;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != LL_STATUS_MAGIC
+        || h->version != LL_STATUS_VERSION
+        || h->size != (uint64_t) st.st_size) {
+        munmap(p, (size_t) st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    s->map = p;
+    s->size = (size_t) st.st_size;
+    return 0;
+}
+
+struct llb_status *llb_status_open(void)
+{
+    if (ll_init() < 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    struct llb_status *s = calloc(1, sizeof(*s));
+    if (s == NULL)
+        return NULL;
+
+    int n = snprintf(s->path, sizeof(s->path), "%s/mbd/%s",
+                     ll_params[LL_STATE_DIR].val, LL_STATUS_FILE);
+    if (n < 0 || n >= (int) sizeof(s->path)) {
+        free(s);
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+
+    if (status_map_file(s) < 0) {
+        int err = errno;
+        free(s);
+        errno = err;
+        return NULL;
+    }
+    return s;
+}
+
+void llb_status_close(struct llb_status *s)
+{
+    if (s == NULL)
+        return;
+    if (s->map != NULL)
+        munmap(s->map, s->size);
+    free(s);
+}
+
+/* A section of n records of rec bytes at off must lie in the file. */
+static int status_section_ok(uint32_t off, uint32_t n, size_t rec, size_t size)
+{
+    if (off < sizeof(struct ll_status_header) || off > size)
+        return 0;
+    return (uint64_t) n * rec <= (uint64_t) (size - off);
+}
+
+/*
+ * Copy the file under the sequence lock. A file retired by a new mbd is
+ * mapped again, the copy is returned with a consistent header the
+ * sections of which are within the copy.
+ */
+static char *status_copy(struct llb_status *s)
+{
+    for (int i = 0; i < STATUS_RETRIES; i++) {
+        const struct ll_status_header *h = s->map;
+
+        if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != LL_STATUS_MAGIC) {
+            munmap(s->map, s->size);
+            s->map = NULL;
+            if (status_map_file(s) < 0)
+                return NULL;
+            continue;
+        }
+
+        uint64_t gen = __atomic_load_n(&h->gen, __ATOMIC_ACQUIRE);
+        if (gen & 1) {
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, NULL);
+            continue;
+        }
+
+        char *buf = malloc(s->size);
+        if (buf == NULL)
+            return NULL;
+        memcpy(buf, s->map, s->size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&h->gen, __ATOMIC_RELAXED) != gen) {
+            free(buf);
+            continue;
+        }
+
+        const struct ll_status_header *c = (struct ll_status_header *) buf;
+        if (!status_section_ok(c->host_off, c->nhosts,
+                               sizeof(struct ll_status_host), s->size)
+            || !status_section_ok(c->queue_off, c->nqueues,
+                                  sizeof(struct ll_status_queue), s->size)
+            || !status_section_ok(c->token_off, c->ntokens,
+                                  sizeof(struct ll_status_token), s->size)) {
+            free(buf);
+            errno = EPROTO;
+            return NULL;
+        }
+        return buf;
+    }
+
+    errno = EAGAIN;
+    return NULL;
+}
+
+time_t llb_status_time(struct llb_status *s)
+{
+    char *buf = status_copy(s);
+    if (buf == NULL)
+        return -1;
+
+    time_t t = (time_t) ((struct ll_status_header *) buf)->update_time;
+    free(buf);
+    return t;
+}
+
+struct host_info *llb_status_host_info(struct llb_status *s, int32_t *nhosts)
+{
+    char *buf = status_copy(s);
+    if (buf == NULL)
+        return NULL;
+
+    const struct ll_status_header *h = (struct ll_status_header *) buf;
+    const struct ll_status_host *w =
+        (const struct ll_status_host *) (buf + h->host_off);
+    int32_t n = (int32_t) h->nhosts;
+
+    struct host_info *hosts = calloc(n > 0 ? n : 1, sizeof(*hosts));
+    if (hosts == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        hosts[i].name = strndup(w[i].name, sizeof(w[i].name));
+        hosts[i].state = w[i].state;
+        hosts[i].total_cpu = w[i].total_cpu;
+        hosts[i].free_cpu = w[i].free_cpu;
+        hosts[i].total_gpu = w[i].total_gpu;
+        hosts[i].free_gpu = w[i].free_gpu;
+        hosts[i].total_mem_mb = w[i].total_mem_mb;
+        hosts[i].free_mem_mb = w[i].free_mem_mb;
+        hosts[i].total_storage_mb = w[i].total_storage_mb;
+        hosts[i].free_storage_mb = w[i].free_storage_mb;
+        hosts[i].num_jobs = w[i].num_jobs;
+        hosts[i].num_run = w[i].num_run;
+        hosts[i].num_susp = w[i].num_susp;
+        hosts[i].gpu_model =
+            strndup(w[i].gpu_model, sizeof(w[i].gpu_model));
+        hosts[i].gpu_ids =
+            strndup(w[i].gpu_ids, sizeof(w[i].gpu_ids));
+        if (hosts[i].name == NULL || hosts[i].gpu_model == NULL
+            || hosts[i].gpu_ids == NULL) {
+            llb_free_host_info(hosts, i + 1);
+            free(buf);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    free(buf);
+    *nhosts = n;
+    return hosts;
+}
+
+struct queue_info *llb_status_queue_info(struct llb_status *s,
+                                         int32_t *nqueues)
+{
+    char *buf = status_copy(s);
+    if (buf == NULL)
+        return NULL;
+
+    const struct ll_status_header *h = (struct ll_status_header *) buf;
+    const struct ll_status_queue *w =
+        (const struct ll_status_queue *) (buf + h->queue_off);
+    int32_t n = (int32_t) h->nqueues;
+
+    struct queue_info *queues = calloc(n > 0 ? n : 1, sizeof(*queues));
+    if (queues == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        queues[i].name = strndup(w[i].name, sizeof(w[i].name));
+        queues[i].description =
+            strndup(w[i].description, sizeof(w[i].description));
+        queues[i].status = w[i].status;
+        queues[i].priority = w[i].priority;
+        queues[i].max_jobs = w[i].max_jobs;
+        queues[i].num_jobs = w[i].num_jobs;
+        queues[i].num_pend = w[i].num_pend;
+        queues[i].num_held = w[i].num_held;
+        queues[i].num_run = w[i].num_run;
+        queues[i].num_susp = w[i].num_susp;
+        queues[i].num_cpus_used = w[i].num_cpus_used;
+        queues[i].num_hosts_used = w[i].num_hosts_used;
+        if (queues[i].name == NULL || queues[i].description == NULL) {
+            llb_free_queue_info(queues, i + 1);
+            free(buf);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    free(buf);
+    *nqueues = n;
+    return queues;
+}
+
+struct token_pool_info *llb_status_token_info(struct llb_status *s,
+                                              int32_t *ntokens)
+{
+    char *buf = status_copy(s);
+    if (buf == NULL)
+        return NULL;
+
+    const struct ll_status_header *h = (struct ll_status_header *) buf;
+    const struct ll_status_token *w =
+        (const struct ll_status_token *) (buf + h->token_off);
+    int32_t n = (int32_t) h->ntokens;
+
+    struct token_pool_info *tokens = calloc(n > 0 ? n : 1, sizeof(*tokens));
+    if (tokens == NULL) {
+        free(buf);
+        return NULL;
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        tokens[i].name = strndup(w[i].name, sizeof(w[i].name));
+        tokens[i].total = w[i].total;
+        tokens[i].free = w[i].free;
+        tokens[i].used = w[i].total - w[i].free;
+        if (tokens[i].name == NULL) {
+            llb_free_token_info(tokens, i + 1);
+            free(buf);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+
+    free(buf);
+    *ntokens = n;
+    return tokens;
+}
@@ -244,3 +244,153 @@ int32_t llb_submit(const struct job_submit *js, int64_t *job_id)
     *job_id = rep.job_id;
     return 0;
 }
+
+/*
+ * Encode one pair of a bulk submission at the end of buf, growing it.
+ */
+static int submit_many_append(char **buf, size_t *len, size_t *cap,
+                              struct wire_job_submit *w,
+                              struct wire_job_script *script)
+{
+    size_t need = sizeof(*w) + XDR_OPAQUE_OVERHEAD + script->len + 8;
+
+    if (*len + need > *cap) {
+        size_t ncap = *cap ? *cap : 64 * LL_BUFSIZ_1K;
+        while (*len + need > ncap)
+            ncap *= 2;
+        char *p = realloc(*buf, ncap);
+        if (p == NULL)
+            return -1;
+        *buf = p;
+        *cap = ncap;
+    }
+
+    XDR xdrs;
+    xdrmem_create(&xdrs, *buf + *len, (u_int) need, XDR_ENCODE);
+    if (!xdr_wire_job_submit_packed(&xdrs, w)
+        || !xdr_wire_job_script(&xdrs, script)) {
+        xdr_destroy(&xdrs);
+        errno = EPROTO;
+        return -1;
+    }
+    *len += xdr_getpos(&xdrs);
+    xdr_destroy(&xdrs);
+
+    return 0;
+}
+
+/*
+ * llb_submit_many - submit n jobs in one request. mbd creates all of
+ * them or none; on success job_ids[i] is the job ID of js[i], the array
+ * ID for an array. A dependency may only name jobs submitted before.
+ */
+int32_t llb_submit_many(const struct job_submit *js, int32_t n,
+                        int64_t *job_ids)
+{
+    if (n <= 0 || n > LLB_SUBMIT_MANY_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* the header and the count are encoded last, in front */
+    size_t cap = 0;
+    size_t len = PACKET_HEADER_SIZE + sizeof(uint32_t);
+    char *buf = NULL;
+    int64_t *njobs = calloc((size_t) n, sizeof(int64_t));
+    if (njobs == NULL)
+        return -1;
+
+    struct wire_job_submit *w = malloc(sizeof(*w));
+    if (w == NULL) {
+        free(njobs);
+        return -1;
+    }
+
+    for (int32_t i = 0; i < n; i++) {
+        struct wire_job_script script;
+        memset(&script, 0, sizeof(script));
+
+        if (fill_wire(&js[i], w) < 0 || create_jobscript(&js[i], &script) < 0
+            || submit_many_append(&buf, &len, &cap, w, &script) < 0) {
+            int e = errno;
+            free(script.data);
+            free(w);
+            free(buf);
+            free(njobs);
+            errno = e;
+            return -1;
+        }
+        free(script.data);
+
+        njobs[i] = 1;
+        if (js[i].flags & JOB_FLAG_ARRAY && js[i].array_stride > 0)
+            njobs[i] = (js[i].array_end - js[i].array_start)
+                       / js[i].array_stride + 1;
+    }
+    free(w);
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_SUBMIT_MANY;
+    hdr.status = MBD_OK;
+    hdr.length = (int) (len - PACKET_HEADER_SIZE);
+
+    if (auth_sign_header(&hdr) < 0) {
+        free(buf);
+        free(njobs);
+        errno = EPROTO;
+        return -1;
+    }
+
+    uint32_t count = (uint32_t) n;
+    XDR xdrs;
+    xdrmem_create(&xdrs, buf, PACKET_HEADER_SIZE + sizeof(uint32_t),
+                  XDR_ENCODE);
+    if (!xdr_pack_hdr(&xdrs, &hdr) || !xdr_uint32_t(&xdrs, &count)) {
+        xdr_destroy(&xdrs);
+        free(buf);
+        free(njobs);
+        errno = EPROTO;
+        return -1;
+    }
+    xdr_destroy(&xdrs);
+
+    void *rbuf = NULL;
+    struct protocol_header rhdr;
+    memset(&rhdr, 0, sizeof(rhdr));
+    if (call_mbd(buf, len, &rbuf, &rhdr) < 0) {
+        int e = errno;
+        free(buf);
+        free(njobs);
+        errno = e;
+        return -1;
+    }
+    free(buf);
+
+    struct wire_job_submit_many_reply rep;
+    memset(&rep, 0, sizeof(rep));
+    XDR rxdrs;
+    xdrmem_create(&rxdrs, rbuf, rhdr.length, XDR_DECODE);
+    if (!xdr_wire_job_submit_many_reply(&rxdrs, &rep)) {
+        xdr_destroy(&rxdrs);
+        free(rbuf);
+        free(njobs);
+        errno = EPROTO;
+        return -1;
+    }
+    xdr_destroy(&rxdrs);
+    free(rbuf);
+
+    int64_t id = rep.first_id;
+    for (int32_t i = 0; i < n; i++) {
+        job_ids[i] = id;
+        id += njobs[i];
+    }
+    free(njobs);
+
+    if (rep.first_id <= 0 || id != rep.last_id + 1) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
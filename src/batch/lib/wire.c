@@ -3,6 +3,7 @@
  * GPL v2
  */
 
+#include <string.h>
 #include <sys/param.h>
 #include <rpc/types.h>
 #include <rpc/xdr.h>
@@ -72,6 +73,13 @@ bool_t xdr_wire_job_finish(XDR *xdr, struct wire_job_finish *f)
     return true;
 }
 
+bool_t xdr_wire_auth_session(XDR *xdrs, struct wire_auth_session *p)
+{
+    if (!xdr_opaque(xdrs, (char *) p->nonce, sizeof(p->nonce)))
+        return false;
+    return true;
+}
+
 bool_t xdr_wire_job_script(XDR *xdrs, struct wire_job_script *p)
 {
     if (!xdr_bytes(xdrs, &p->data, &p->len, UINT32_MAX))
@@ -90,6 +98,40 @@ bool_t xdr_wire_job_sig(XDR *xdrs, struct wire_job_sig *p)
     return true;
 }
 
+/* The numeric fields of a submission, the same in both encodings. */
+static bool_t xdr_job_submit_values(XDR *xdrs, struct wire_job_submit *s)
+{
+    if (!xdr_int32_t(xdrs, &s->num_cpus))
+        return false;
+    if (!xdr_int32_t(xdrs, &s->num_hosts))
+        return false;
+    if (!xdr_int32_t(xdrs, &s->num_gpus))
+        return false;
+    if (!xdr_uint64_t(xdrs, &s->mem_mb))
+        return false;
+    if (!xdr_uint64_t(xdrs, &s->storage_mb))
+        return false;
+    if (!xdr_uint32_t(xdrs, &s->umask))
+        return false;
+    if (!xdr_uint32_t(xdrs, &s->flags))
+        return false;
+    if (!xdr_int64_t(xdrs, &s->begin_time))
+        return false;
+    if (!xdr_int64_t(xdrs, &s->term_time))
+        return false;
+    if (!xdr_int64_t(xdrs, &s->susp_time))
+        return false;
+    if (!xdr_int64_t(xdrs, &s->resume_time))
+        return false;
+    if (!xdr_int32_t(xdrs, &s->array_start))
+        return false;
+    if (!xdr_int32_t(xdrs, &s->array_end))
+        return false;
+    if (!xdr_int32_t(xdrs, &s->array_stride))
+        return false;
+    return true;
+}
+
 bool_t xdr_wire_job_submit(XDR *xdrs, struct wire_job_submit *s)
 {
     if (!xdr_opaque(xdrs, s->name, sizeof(s->name)))
@@ -124,35 +166,61 @@ bool_t xdr_wire_job_submit(XDR *xdrs, struct wire_job_submit *s)
         return false;
     if (!xdr_opaque(xdrs, s->tokenpool, sizeof(s->tokenpool)))
         return false;
-    if (!xdr_int32_t(xdrs, &s->num_cpus))
+    return xdr_job_submit_values(xdrs, s);
+}
+
+/*
+ * A fixed buffer as a counted string: only the part in use goes on the
+ * wire, and decoding fails rather than overrun the buffer.
+ */
+static bool_t xdr_fixed_str(XDR *xdrs, char *buf, u_int size)
+{
+    if (xdrs->x_op == XDR_FREE)
+        return true;
+    if (xdrs->x_op == XDR_ENCODE && strnlen(buf, size) == size)
         return false;
-    if (!xdr_int32_t(xdrs, &s->num_hosts))
+    return xdr_string(xdrs, &buf, size - 1);
+}
+
+/*
+ * Encode or decode a submission with its strings packed, for the bulk
+ * submit where thousands of them share a message.
+ */
+bool_t xdr_wire_job_submit_packed(XDR *xdrs, struct wire_job_submit *s)
+{
+    if (!xdr_fixed_str(xdrs, s->name, sizeof(s->name)))
         return false;
-    if (!xdr_int32_t(xdrs, &s->num_gpus))
+    if (!xdr_fixed_str(xdrs, s->queue, sizeof(s->queue)))
         return false;
-    if (!xdr_uint64_t(xdrs, &s->mem_mb))
+    if (!xdr_fixed_str(xdrs, s->project, sizeof(s->project)))
         return false;
-    if (!xdr_uint64_t(xdrs, &s->storage_mb))
+    if (!xdr_fixed_str(xdrs, s->comment, sizeof(s->comment)))
         return false;
-    if (!xdr_uint32_t(xdrs, &s->umask))
+    if (!xdr_fixed_str(xdrs, s->machines, sizeof(s->machines)))
         return false;
-    if (!xdr_uint32_t(xdrs, &s->flags))
+    if (!xdr_fixed_str(xdrs, s->in_file, sizeof(s->in_file)))
         return false;
-    if (!xdr_int64_t(xdrs, &s->begin_time))
+    if (!xdr_fixed_str(xdrs, s->out_file, sizeof(s->out_file)))
         return false;
-    if (!xdr_int64_t(xdrs, &s->term_time))
+    if (!xdr_fixed_str(xdrs, s->err_file, sizeof(s->err_file)))
         return false;
-    if (!xdr_int64_t(xdrs, &s->susp_time))
+    if (!xdr_fixed_str(xdrs, s->cwd, sizeof(s->cwd)))
         return false;
-    if (!xdr_int64_t(xdrs, &s->resume_time))
+    if (!xdr_fixed_str(xdrs, s->depend_cond, sizeof(s->depend_cond)))
         return false;
-    if (!xdr_int32_t(xdrs, &s->array_start))
+    if (!xdr_fixed_str(xdrs, s->command, sizeof(s->command)))
         return false;
-    if (!xdr_int32_t(xdrs, &s->array_end))
+    if (!xdr_fixed_str(xdrs, s->gpu_model, sizeof(s->gpu_model)))
         return false;
-    if (!xdr_int32_t(xdrs, &s->array_stride))
+    if (!xdr_fixed_str(xdrs, s->submit_host, sizeof(s->submit_host)))
         return false;
-    return true;
+    if (!xdr_fixed_str(xdrs, s->username, sizeof(s->username)))
+        return false;
+    if (!xdr_fixed_str(xdrs, s->home_dir, sizeof(s->home_dir)))
+        return false;
+    if (!xdr_fixed_str(xdrs, s->tokenpool, sizeof(s->tokenpool)))
+        return false;
+    return xdr_job_submit_values(xdrs, s);
 }
 
 bool_t xdr_wire_job_submit_reply(XDR *xdrs, struct wire_job_submit_reply *r)
@@ -162,6 +230,16 @@ bool_t xdr_wire_job_submit_reply(XDR *xdrs, struct wire_job_submit_reply *r)
     return true;
 }
 
+bool_t xdr_wire_job_submit_many_reply(XDR *xdrs,
+                                      struct wire_job_submit_many_reply *r)
+{
+    if (!xdr_int64_t(xdrs, &r->first_id))
+        return false;
+    if (!xdr_int64_t(xdrs, &r->last_id))
+        return false;
+    return true;
+}
+
 bool_t xdr_wire_job_info_req(XDR *xdrs, struct wire_job_info_req *p)
 {
     if (!xdr_int64_t(xdrs, &p->job_id))
@@ -212,6 +290,116 @@ bool_t xdr_wire_job_info(XDR *xdrs, struct wire_job_info *p)
     return true;
 }
 
+static bool_t xdr_job_str(XDR *xdrs, char **s)
+{
+    return xdr_string(xdrs, s, LL_BUFSIZ_4K);
+}
+
+/*
+ * Encode or decode the fields of a v2 job info record, job_id,
+ * array_id and array_index are always there.
+ */
+bool_t xdr_wire_job_info2(XDR *xdrs, struct wire_job_info2 *p,
+                          uint32_t fields)
+{
+    if (!xdr_int64_t(xdrs, &p->job_id))
+        return false;
+    if (!xdr_int64_t(xdrs, &p->array_id))
+        return false;
+    if (!xdr_int32_t(xdrs, &p->array_index))
+        return false;
+
+    if (fields & LLB_JOB_F_USER) {
+        if (!xdr_uint32_t(xdrs, &p->uid))
+            return false;
+    }
+    if (fields & LLB_JOB_F_STATE) {
+        if (!xdr_int32_t(xdrs, &p->state))
+            return false;
+        if (!xdr_int32_t(xdrs, &p->exit_status))
+            return false;
+        if (!xdr_int32_t(xdrs, &p->pend_reason))
+            return false;
+    }
+    if (fields & LLB_JOB_F_PID) {
+        if (!xdr_int32_t(xdrs, &p->pid))
+            return false;
+    }
+    if (fields & LLB_JOB_F_PRIORITY) {
+        if (!xdr_int32_t(xdrs, &p->priority))
+            return false;
+    }
+    if (fields & LLB_JOB_F_TIMES) {
+        if (!xdr_int64_t(xdrs, &p->submit_time))
+            return false;
+        if (!xdr_int64_t(xdrs, &p->dispatch_time))
+            return false;
+        if (!xdr_int64_t(xdrs, &p->end_time))
+            return false;
+        if (!xdr_int64_t(xdrs, &p->susp_time))
+            return false;
+    }
+    if (fields & LLB_JOB_F_NAME) {
+        if (!xdr_job_str(xdrs, &p->name))
+            return false;
+    }
+    if (fields & LLB_JOB_F_QUEUE) {
+        if (!xdr_job_str(xdrs, &p->queue))
+            return false;
+    }
+    if (fields & LLB_JOB_F_SUBMIT_HOST) {
+        if (!xdr_job_str(xdrs, &p->submit_host))
+            return false;
+    }
+    if (fields & LLB_JOB_F_RUN_HOSTS) {
+        if (!xdr_int32_t(xdrs, &p->ncpus))
+            return false;
+        if (!xdr_array(xdrs, (char **) &p->hosts, (u_int *) &p->nhosts,
+                       LL_BUFSIZ_16K, sizeof(uint32_t),
+                       (xdrproc_t) xdr_uint32_t))
+            return false;
+    }
+    if (fields & LLB_JOB_F_COMMENT) {
+        if (!xdr_job_str(xdrs, &p->comment))
+            return false;
+    }
+    return true;
+}
+
+static size_t xdr_str_size(const char *s)
+{
+    return 4 + ((strlen(s) + 3) & ~(size_t) 3);
+}
+
+/* Encoded size of a v2 job info record. */
+size_t wire_job_info2_size(const struct wire_job_info2 *p, uint32_t fields)
+{
+    size_t n = 8 + 8 + 4;
+
+    if (fields & LLB_JOB_F_USER)
+        n += 4;
+    if (fields & LLB_JOB_F_STATE)
+        n += 3 * 4;
+    if (fields & LLB_JOB_F_PID)
+        n += 4;
+    if (fields & LLB_JOB_F_PRIORITY)
+        n += 4;
+    if (fields & LLB_JOB_F_TIMES)
+        n += 4 * 8;
+    if (fields & LLB_JOB_F_NAME)
+        n += xdr_str_size(p->name);
+    if (fields & LLB_JOB_F_QUEUE)
+        n += xdr_str_size(p->queue);
+    if (fields & LLB_JOB_F_SUBMIT_HOST)
+        n += xdr_str_size(p->submit_host);
+    if (fields & LLB_JOB_F_RUN_HOSTS)
+        n += 4 + 4 + 4 * (size_t) p->nhosts;
+    if (fields & LLB_JOB_F_COMMENT)
+        n += xdr_str_size(p->comment);
+
+    return n;
+}
+
 bool_t xdr_wire_job_info_array(XDR *xdrs, struct wire_job_info_array *p)
 {
     if (!xdr_array(xdrs, (char **) &p->jobs, (u_int *) &p->njobs, INT32_MAX,
@@ -427,6 +615,33 @@ bool_t xdr_wire_job_ack(XDR *xdrs, struct wire_job_ack *p)
     return true;
 }
 
+bool_t xdr_wire_job_reply_many(XDR *xdrs, struct wire_job_reply_many *p)
+{
+    if (!xdr_array(xdrs, (char **) &p->replies, (u_int *) &p->num_replies,
+                   WIRE_JOB_BATCH_MAX, sizeof(struct wire_job_reply),
+                   (xdrproc_t) xdr_wire_job_reply))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_finish_many(XDR *xdrs, struct wire_job_finish_many *p)
+{
+    if (!xdr_array(xdrs, (char **) &p->finish, (u_int *) &p->num_finish,
+                   WIRE_JOB_BATCH_MAX, sizeof(struct wire_job_finish),
+                   (xdrproc_t) xdr_wire_job_finish))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_ack_many(XDR *xdrs, struct wire_job_ack_many *p)
+{
+    if (!xdr_array(xdrs, (char **) &p->acks, (u_int *) &p->num_acks,
+                   WIRE_JOB_BATCH_MAX, sizeof(struct wire_job_ack),
+                   (xdrproc_t) xdr_wire_job_ack))
+        return false;
+    return true;
+}
+
 bool_t xdr_wire_token_info(XDR *xdrs, struct wire_token_info *p)
 {
     if (!xdr_opaque(xdrs, p->name, sizeof(p->name)))
@@ -456,6 +671,72 @@ bool_t xdr_wire_job_move(XDR *xdrs, struct wire_job_move *p)
     return true;
 }
 
+bool_t xdr_wire_job_summary_req(XDR *xdrs, struct wire_job_summary_req *r)
+{
+    if (!xdr_int32_t(xdrs, &r->by))
+        return false;
+    if (!xdr_wire_job_filter(xdrs, &r->filter))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_count(XDR *xdrs, struct wire_job_count *c)
+{
+    if (!xdr_opaque(xdrs, c->queue, sizeof(c->queue)))
+        return false;
+    if (!xdr_int32_t(xdrs, &c->id))
+        return false;
+    if (!xdr_int32_t(xdrs, &c->num_pend))
+        return false;
+    if (!xdr_int32_t(xdrs, &c->num_held))
+        return false;
+    if (!xdr_int32_t(xdrs, &c->num_run))
+        return false;
+    if (!xdr_int32_t(xdrs, &c->num_susp))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_summary(XDR *xdrs, struct wire_job_summary *p)
+{
+    if (!xdr_array(xdrs, (char **) &p->counts, (u_int *) &p->ncounts,
+                   INT32_MAX, sizeof(struct wire_job_count),
+                   (xdrproc_t) xdr_wire_job_count))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_delta_req(XDR *xdrs, struct wire_job_delta_req *r)
+{
+    if (!xdr_int64_t(xdrs, &r->epoch))
+        return false;
+    if (!xdr_uint64_t(xdrs, &r->since))
+        return false;
+    if (!xdr_int32_t(xdrs, &r->flags))
+        return false;
+    if (!xdr_uint32_t(xdrs, &r->fields))
+        return false;
+    if (!xdr_int32_t(xdrs, &r->limit))
+        return false;
+    if (!xdr_wire_job_filter(xdrs, &r->filter))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_delta_tail(XDR *xdrs, struct wire_job_delta_tail *t)
+{
+    if (!xdr_int64_t(xdrs, &t->epoch))
+        return false;
+    if (!xdr_uint64_t(xdrs, &t->seq))
+        return false;
+    if (!xdr_uint32_t(xdrs, &t->reset))
+        return false;
+    if (!xdr_array(xdrs, (char **) &t->gone, &t->ngone, INT32_MAX,
+                   sizeof(int64_t), (xdrproc_t) xdr_int64_t))
+        return false;
+    return true;
+}
+
 bool_t xdr_wire_job_priority(XDR *xdrs, struct wire_job_priority *p)
 {
     if (!xdr_int64_t(xdrs, &p->job_id))
@@ -479,3 +760,52 @@ bool_t xdr_wire_job_query(XDR *xdrs, struct wire_job_query *r)
         return false;
     return true;
 }
+
+bool_t xdr_wire_job_cursor(XDR *xdrs, struct wire_job_cursor *c)
+{
+    if (!xdr_int32_t(xdrs, &c->list))
+        return false;
+    if (!xdr_int64_t(xdrs, &c->job_id))
+        return false;
+    if (!xdr_uint64_t(xdrs, &c->seq))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_filter(XDR *xdrs, struct wire_job_filter *f)
+{
+    if (!xdr_opaque(xdrs, f->queue, sizeof(f->queue)))
+        return false;
+    if (!xdr_opaque(xdrs, f->name, sizeof(f->name)))
+        return false;
+    if (!xdr_opaque(xdrs, f->project, sizeof(f->project)))
+        return false;
+    if (!xdr_opaque(xdrs, f->host, sizeof(f->host)))
+        return false;
+    if (!xdr_int64_t(xdrs, &f->array_id))
+        return false;
+    if (!xdr_int64_t(xdrs, &f->submit_from))
+        return false;
+    if (!xdr_int64_t(xdrs, &f->submit_to))
+        return false;
+    if (!xdr_int32_t(xdrs, &f->pend_reason))
+        return false;
+    if (!xdr_int32_t(xdrs, &f->has_pend_reason))
+        return false;
+    return true;
+}
+
+bool_t xdr_wire_job_query2(XDR *xdrs, struct wire_job_query2 *r)
+{
+    if (!xdr_wire_job_query(xdrs, &r->query))
+        return false;
+    if (!xdr_uint32_t(xdrs, &r->fields))
+        return false;
+    if (!xdr_int32_t(xdrs, &r->limit))
+        return false;
+    if (!xdr_wire_job_cursor(xdrs, &r->after))
+        return false;
+    if (!xdr_wire_job_filter(xdrs, &r->filter))
+        return false;
+    return true;
+}
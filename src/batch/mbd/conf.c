@@ -319,6 +319,7 @@ static int parse_hosts(const char *path)
             return -1;
         }
 
+        h->host_idx = ll_list_count(&host_list);
         ll_list_append(&host_list, &h->ent);
         ll_hash_insert(&host_name_hash, h->net.name, h, 0);
         ll_hash_insert(&host_addr_hash, h->net.addr, h, 0);
@@ -479,6 +480,7 @@ static int commit_queue(struct queue_conf *qc)
     q->priority = qc->priority;
     q->state = QUEUE_OPEN;
 
+    q->queue_idx = ll_list_count(&queue_list);
     ll_list_append(&queue_list, &q->ent);
     ll_hash_insert(&queue_name_hash, q->name, q, 0);
 
@@ -728,6 +730,7 @@ static int parse_sim(const char *path)
                        sizeof(h->res.gpu.gpu_ids));
             h->res.gpu.count = count;
         }
+        h->host_idx = ll_list_count(&host_list);
         ll_list_append(&host_list, &h->ent);
         ll_hash_insert(&host_name_hash, h->net.name, h, 0);
 
@@ -7,197 +7,476 @@
 #include <syslog.h>
 #include <errno.h>
 #include <assert.h>
+#include <fnmatch.h>
 
 #include "base/lib/auth.h"
 #include "batch/lib/wire.h"
 #include "batch/mbd/mbd.h"
 
-static void job_data_to_wire(const struct job_data *job,
-                             struct wire_job_info *w)
+/*
+ * Job, host and queue queries are answered from the query snapshot,
+ * see query.c, never from job_data: with the query thread running
+ * they are encoded while the main thread goes on changing the jobs.
+ */
+
+static void query_job_to_wire(const struct query_jobs *s,
+                              const struct query_job *j,
+                              struct wire_job_info *w)
 {
     memset(w, 0, sizeof(*w));
-    w->job_id = job->job_id;
-    w->array_id = job->array_id;
-    w->array_index = job->array_index;
-    w->uid = (uint32_t) job->uid;
-    w->pid = job->pid;
-    w->state = job->state;
-    /*
-     * UNKNOWN is a public/reporting state. Internally the job keeps its last
-     * lifecycle state. If the execution host is disconnected, clients cannot
-     * know whether the process is still running, suspended, or gone.
-     */
-    if ((w->state == JOB_RUNNING || w->state == JOB_SUSPENDED) &&
-        job->run_hosts[0]->sbd_chan < 0)
-        w->state = JOB_UNKNOWN;
-    w->exit_status = job->exit_status;
-    w->priority = job->priority;
-    w->pend_reason = job->pend_reason;
-    w->submit_time = (int64_t) job->submit_time;
-    w->dispatch_time = (int64_t) job->dispatch_time;
-    w->end_time = (int64_t) job->end_time;
-    w->susp_time = (int64_t) job->susp_time;
-
-    ll_strlcpy(w->name, job->name, sizeof(w->name));
-    ll_strlcpy(w->queue, job->queue->name, sizeof(w->queue));
-
-    for (int i = 0; i < job->run_nhosts; i++) {
-        char entry[MAXHOSTNAMELEN + LL_BUFSIZ_64];
-
-        if (i > 0)
-            ll_strlcat(w->run_hosts, " ", sizeof(w->run_hosts));
-        snprintf(entry, sizeof(entry), "%d@%s", job->res.num_cpus,
-                 job->run_hosts[i]->net.name);
-        ll_strlcat(w->run_hosts, entry, sizeof(w->run_hosts));
+    w->job_id = j->job_id;
+    w->array_id = j->array_id;
+    w->array_index = j->array_index;
+    w->uid = (uint32_t) j->uid;
+    w->pid = j->pid;
+    w->state = j->state;
+    w->exit_status = j->exit_status;
+    w->priority = j->priority;
+    w->pend_reason = j->pend_reason;
+    w->submit_time = j->submit_time;
+    w->dispatch_time = j->dispatch_time;
+    w->end_time = j->end_time;
+    w->susp_time = j->susp_time;
+
+    ll_strlcpy(w->name, s->strings + j->name, sizeof(w->name));
+    ll_strlcpy(w->queue, j->queue->name, sizeof(w->queue));
+
+    size_t off = 0;
+    for (int i = 0; i < j->nhosts; i++) {
+        const struct mbd_host *h = s->hosts[s->host_idx[j->hosts + i]];
+        int n = snprintf(w->run_hosts + off, sizeof(w->run_hosts) - off,
+                         "%s%d@%s", i > 0 ? " " : "", j->ncpus, h->net.name);
+        if (n < 0 || (size_t) n >= sizeof(w->run_hosts) - off)
+            break;
+        off += (size_t) n;
     }
 }
 
 /*
- * Append matching jobs from list into dst starting at dst[count].
- * Returns updated count.
+ * Array elements have consecutive job_ids starting at the head's,
+ * by construction (see the assert in job_register()'s array loop), so
+ * each element is resolved directly via query_job_find() instead of
+ * scanning every job of the snapshot.
  */
-static int collect_list(struct ll_list *list, struct wire_job_info *dst,
-                        int count, uid_t uid, int all)
+static int maybe_collect_array(const struct query_jobs *s, int64_t array_id,
+                               const struct query_job **dst, int count,
+                               uid_t uid, int all)
 {
-    for (struct ll_list_entry *e = list->head; e != NULL; e = e->next) {
-        struct job_data *job = (struct job_data *) e;
+    const struct query_job *head = query_job_find(s, array_id);
+    /* head->array_id == head->job_id only for the actual head -- any
+     * other array element carries a nonzero array_id too, pointing
+     * at the head, so array_id alone can't tell "ordinary job" from
+     * "array element that isn't the head". */
+    if (head == NULL || head->array_id != head->job_id)
+        return count;
+
+    int64_t job_id = head->job_id;
 
-        if (!all && job->uid != uid)
+    for (int32_t index = head->array_start; index <= head->array_end;
+         index += head->array_stride, job_id++) {
+        const struct query_job *j = query_job_find(s, job_id);
+        if (j == NULL)
+            continue;   /* shouldn't happen -- head retention guarantees this */
+
+        if (!all && j->uid != uid)
             continue;
-        job_data_to_wire(job, &dst[count]);
-        count++;
+
+        dst[count++] = j;
     }
+
     return count;
 }
+
+/* The element array_index of the array array_id, see job_find_array(). */
+static const struct query_job *find_array(const struct query_jobs *s,
+                                          int64_t array_id,
+                                          int32_t array_index)
+{
+    const struct query_job *head = query_job_find(s, array_id);
+    if (head == NULL || head->array_id != head->job_id)
+        return NULL;
+
+    int64_t job_id = head->job_id;
+
+    for (int32_t index = head->array_start; index <= head->array_end;
+         index += head->array_stride, job_id++) {
+        if (index == array_index)
+            return query_job_find(s, job_id);
+    }
+
+    return NULL;
+}
+
+/* The query flag selecting each job list, indexed by enum job_list_id. */
+static const int job_list_flags[] = {
+    [JOB_LIST_PEND] = LLB_JOB_PEND,
+    [JOB_LIST_RUN] = LLB_JOB_RUN,
+    [JOB_LIST_FINISH] = LLB_JOB_DONE,
+};
+
 /*
- * Collect hash keys into a freshly allocated char* array.
- * Returns number of entries; *out is NULL if hash is empty.
- * Pointers into hash keys — caller must not free the strings.
+ * A page of a job listing: at most limit jobs, 0 for no limit, after
+ * the cursor. The cursor of the last job taken and whether more jobs
+ * follow are returned in next and more.
  */
-static int hash_keys_dup(struct ll_hash *h, char ***out)
+struct jobs_page {
+    int32_t limit;
+    struct wire_job_cursor after;
+    struct wire_job_cursor next;
+    uint32_t more;
+};
+
+/*
+ * Index of the first job of list to list after the cursor. When the
+ * cursor job is still in the list that is the job after it, otherwise,
+ * since jobs are appended, the first job that entered the list after
+ * it did.
+ */
+static int page_resume(const struct query_jobs *s, int list,
+                       const struct wire_job_cursor *c)
 {
-    int n = ll_hash_count(h);
-    *out = NULL;
-    if (n == 0)
+    if (c->list < list)
+        return s->start[list];
+
+    const struct query_job *j = query_job_find(s, c->job_id);
+    if (j != NULL && j >= s->jobs + s->start[list]
+        && j < s->jobs + s->start[list + 1] && j->list_seq == c->seq)
+        return (int) (j - s->jobs) + 1;
+
+    int i;
+    for (i = s->start[list]; i < s->start[list + 1]; i++) {
+        if (s->jobs[i].list_seq > c->seq)
+            break;
+    }
+    return i;
+}
+
+/*
+ * The jobs of a listing the caller may see and its filter, with the
+ * queue and the host of the filter looked up once, so that every job
+ * is tested by comparing pointers and indices.
+ */
+struct jobs_match {
+    uid_t uid;
+    int all;
+    const struct wire_job_filter *f;   /* NULL for none */
+    const struct mbd_queue *queue;
+    const struct mbd_host *host;
+};
+
+/*
+ * Resolve the filter of a listing. Returns 0, or EINVAL when it names
+ * a queue or a host mbd does not know. The name hashes are written
+ * only by conf_init(), so the query thread may search them.
+ */
+static int jobs_match_init(struct jobs_match *m,
+                           const struct protocol_header *hdr,
+                           const struct wire_job_filter *f)
+{
+    memset(m, 0, sizeof(*m));
+    m->uid = hdr->uid;
+    m->all = is_manager(hdr->uid);
+    m->f = f;
+
+    if (f == NULL)
+        return 0;
+
+    if (f->queue[0] != 0) {
+        m->queue = ll_hash_search(&queue_name_hash, f->queue);
+        if (m->queue == NULL)
+            return EINVAL;
+    }
+    if (f->host[0] != 0) {
+        m->host = ll_hash_search(&host_name_hash, f->host);
+        if (m->host == NULL)
+            return EINVAL;
+    }
+
+    return 0;
+}
+
+/* Whether list l can hold a job the filter selects at all. */
+static int jobs_match_list(const struct jobs_match *m, int l)
+{
+    if (m->f == NULL)
+        return 1;
+    /* only pending jobs have a pending reason, and no execution host */
+    if (m->f->has_pend_reason && l != JOB_LIST_PEND)
+        return 0;
+    if (m->host != NULL && l == JOB_LIST_PEND)
+        return 0;
+    return 1;
+}
+
+static int job_matches(const struct jobs_match *m, const struct query_jobs *s,
+                       const struct query_job *j)
+{
+    if (!m->all && j->uid != m->uid)
+        return 0;
+
+    const struct wire_job_filter *f = m->f;
+    if (f == NULL)
+        return 1;
+
+    if (m->queue != NULL && j->queue != m->queue)
+        return 0;
+    if (f->array_id != 0 && j->array_id != f->array_id)
+        return 0;
+    if (f->submit_from != 0 && j->submit_time < f->submit_from)
+        return 0;
+    if (f->submit_to != 0 && j->submit_time > f->submit_to)
         return 0;
-    *out = calloc(n, sizeof(char *));
-    if (*out == NULL)
+    if (f->has_pend_reason && j->pend_reason != f->pend_reason)
+        return 0;
+    if (f->project[0] != 0 && strcmp(s->strings + j->project, f->project) != 0)
+        return 0;
+    if (f->name[0] != 0 && fnmatch(f->name, s->strings + j->name, 0) != 0)
+        return 0;
+
+    if (m->host != NULL) {
+        int i;
+        for (i = 0; i < j->nhosts; i++) {
+            if ((int) s->host_idx[j->hosts + i] == m->host->host_idx)
+                break;
+        }
+        if (i == j->nhosts)
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * The jobs of [lo, hi) in the snapshot a filter can select: with a
+ * queue or a host, the fewer of their jobs, from the index of the
+ * snapshot, otherwise every one.
+ */
+struct jobs_scan {
+    const int32_t *idx; /* NULL for every job */
+    int pos;
+    int end;
+};
+
+/* First position of [b, e) in idx the job index of which is >= i. */
+static int index_lower(const int32_t *idx, int b, int e, int i)
+{
+    while (b < e) {
+        int mid = b + (e - b) / 2;
+        if (idx[mid] < i)
+            b = mid + 1;
+        else
+            e = mid;
+    }
+    return b;
+}
+
+static void jobs_scan_init(struct jobs_scan *c, const struct jobs_match *m,
+                           const struct query_jobs *s, int lo, int hi)
+{
+    const struct query_index *x = NULL;
+    int k = 0;
+
+    if (m->queue != NULL) {
+        x = &s->by_queue;
+        k = m->queue->queue_idx;
+    }
+    if (m->host != NULL) {
+        const struct query_index *h = &s->by_host;
+        int kh = m->host->host_idx;
+
+        if (x == NULL || h->start[kh + 1] - h->start[kh]
+                             < x->start[k + 1] - x->start[k]) {
+            x = h;
+            k = kh;
+        }
+    }
+
+    if (x == NULL) {
+        c->idx = NULL;
+        c->pos = lo;
+        c->end = hi;
+        return;
+    }
+
+    c->idx = x->jobs;
+    c->pos = index_lower(x->jobs, x->start[k], x->start[k + 1], lo);
+    c->end = index_lower(x->jobs, c->pos, x->start[k + 1], hi);
+}
+
+/* The next job index of the scan, -1 at its end. */
+static int jobs_scan_next(struct jobs_scan *c)
+{
+    if (c->pos >= c->end)
         return -1;
-    struct ll_hash_iter it;
-    struct ll_hash_entry *e;
-    int i = 0;
-    ll_hash_iter_init(&it, h);
-    while ((e = ll_hash_iter_next(&it)) != NULL)
-        (*out)[i++] = e->key;
-    return n;
+    if (c->idx == NULL)
+        return c->pos++;
+    return c->idx[c->pos++];
 }
 
 /*
- * Collect every element of array_id into dst[count..]. The head is
- * always retained in job_id_hash while elements are outstanding (see
- * events_rebuild()), and element job_ids are contiguous from the head
- * by construction (see the assert in job_register()'s array loop), so
- * each element is resolved directly via job_find() instead of
- * scanning every job on every list.
+ * Collect the jobs of the lists selected by flags that match, a page
+ * at a time. Returns the number of jobs stored in dst.
  */
-static int maybe_collect_array(int64_t array_id, struct wire_job_info *dst,
-                               int count, uid_t uid, int all)
+static int collect_page(const struct query_jobs *s, int flags,
+                        const struct jobs_match *m, struct jobs_page *pg,
+                        const struct query_job **dst)
 {
-    struct job_data *head = job_find(array_id);
-    /* head->array_id == head->job_id only for the actual head -- any
-     * other array element carries a nonzero array_id too, pointing
-     * at the head, so array_id alone can't tell "ordinary job" from
-     * "array element that isn't the head". */
-    if (head == NULL || head->array_id != head->job_id)
-        return count;
+    int count = 0;
 
-    int64_t job_id = head->job_id;
+    if (flags == 0)
+        flags = LLB_JOB_PEND | LLB_JOB_RUN;
 
-    for (int32_t index = head->array_start; index <= head->array_end;
-         index += head->array_stride, job_id++) {
-        struct job_data *job = job_find(job_id);
-        if (job == NULL)
-            continue;   /* shouldn't happen -- head retention guarantees this */
+    pg->more = 0;
+    pg->next = pg->after;
 
-        if (!all && job->uid != uid)
+    for (int l = pg->after.list < 0 ? 0 : pg->after.list; l < JOB_LISTS; l++) {
+        if (!(flags & job_list_flags[l]) || !jobs_match_list(m, l))
             continue;
 
-        job_data_to_wire(job, &dst[count]);
-        count++;
+        struct jobs_scan c;
+        int i;
+
+        jobs_scan_init(&c, m, s, page_resume(s, l, &pg->after),
+                       s->start[l + 1]);
+        while ((i = jobs_scan_next(&c)) >= 0) {
+            const struct query_job *j = &s->jobs[i];
+
+            if (!job_matches(m, s, j))
+                continue;
+            if (pg->limit > 0 && count == pg->limit) {
+                pg->more = 1;
+                return count;
+            }
+            dst[count++] = j;
+            pg->next.list = l;
+            pg->next.job_id = j->job_id;
+            pg->next.seq = j->list_seq;
+        }
     }
 
     return count;
 }
 
-static int jobs_info_ref(int chan_id,
-                         const struct protocol_header *hdr,
-                         const struct wire_job_query *req)
+/*
+ * jobs_select - the jobs a query refers to that the caller may see, in
+ * a malloc'ed array of *n pointers, a page of them for a listing. A
+ * job reference is always answered in one page and ignores the filter.
+ * Returns 0, an errno for the reply when the reference matches no
+ * visible job or the filter is invalid, or -1 on failure.
+ */
+static int jobs_select(const struct query_jobs *s,
+                       const struct protocol_header *hdr,
+                       const struct wire_job_query *req,
+                       const struct wire_job_filter *filter,
+                       struct jobs_page *pg, const struct query_job ***out,
+                       int *n)
 {
-    int n = 0;
     int all = is_manager(hdr->uid);
     uid_t uid = hdr->uid;
+    int count = 0;
+    int ref = req->job_id != -1 || req->array_id != 0;
 
-    int ntotal = ll_list_count(&pend_jobs_list) +
-                 ll_list_count(&run_jobs_list) +
-                 ll_list_count(&finish_jobs_list);
+    *out = NULL;
+    *n = 0;
+    pg->more = 0;
+
+    struct jobs_match m;
+    if (!ref) {
+        int rc = jobs_match_init(&m, hdr, filter);
+        if (rc != 0)
+            return rc;
+    }
 
+    int ntotal = s->njobs;
+    if (!ref && pg->limit > 0 && pg->limit < ntotal)
+        ntotal = pg->limit;
     if (ntotal == 0)
         ntotal = 1;
-    struct wire_job_info *jobs = calloc(ntotal, sizeof(struct wire_job_info));
+
+    const struct query_job **jobs = calloc(ntotal, sizeof(*jobs));
     if (jobs == NULL) {
         LL_ERR("calloc failed");
         return -1;
     }
 
-    /*
-     * Explicit array element: N[m].
-     */
-    if (req->array_id != 0) {
-        struct job_data *job =
-            job_find_array(req->array_id, req->array_index);
+    if (ref) {
+        const struct query_job *j = NULL;
 
-        if (job == NULL) {
-            free(jobs);
-            return enqueue_header(chan_id, BATCH_JOB_INFO_ACK, ESRCH);
+        /*
+         * Explicit array element: N[m]. A numeric reference N is first
+         * taken as an array_id, which does not depend on the first
+         * array element still being in memory, then as a job_id.
+         */
+        if (req->array_id != 0) {
+            j = find_array(s, req->array_id, req->array_index);
+        } else {
+            count = maybe_collect_array(s, req->job_id, jobs, 0, uid, all);
+            if (count == 0)
+                j = query_job_find(s, req->job_id);
         }
 
-        if (!all && job->uid != uid) {
-            free(jobs);
-            return enqueue_header(chan_id, BATCH_JOB_INFO_ACK, EPERM);
+        if (count == 0) {
+            if (j == NULL) {
+                free(jobs);
+                return ESRCH;
+            }
+            if (!all && j->uid != uid) {
+                free(jobs);
+                return EPERM;
+            }
+            jobs[count++] = j;
         }
+    } else {
+        count = collect_page(s, req->flags, &m, pg, jobs);
+    }
 
-        job_data_to_wire(job, &jobs[0]);
-        n = 1;
+    *out = jobs;
+    *n = count;
+    return 0;
+}
 
-    /*
-     * Numeric reference: N.
-     *
-     * First interpret N as an array_id.  This does not depend on
-     * the first array element still being present in memory.
-     * If no array exists, interpret N as an ordinary job_id.
-     */
-    } else {
-        n = maybe_collect_array(req->job_id, jobs, 0, uid, all);
+/*
+ * jobs_info - the v1 reply to a job query. Like every query handler it
+ * returns 0 with the encoded reply in *reply, an errno to answer with,
+ * or -1 when the channel is to be closed.
+ */
+int jobs_info(XDR *xdrs, const struct protocol_header *hdr,
+              const struct query_jobs *s, struct chan_buffer **reply)
+{
+    struct wire_job_query req;
 
-        if (n == 0) {
-            struct job_data *job = job_find(req->job_id);
+    memset(&req, 0, sizeof(req));
 
-            if (job == NULL) {
-                free(jobs);
-                return enqueue_header(chan_id, BATCH_JOB_INFO_ACK, ESRCH);
-            }
+    if (!xdr_wire_job_query(xdrs, &req)) {
+        LL_ERRX("xdr_wire_job_query failed");
+        return -1;
+    }
 
-            if (!all && job->uid != uid) {
-                free(jobs);
-                return enqueue_header(chan_id, BATCH_JOB_INFO_ACK, EPERM);
-            }
+    struct jobs_page pg = {.limit = 0, .after = {.list = -1}};
+    const struct query_job **sel;
+    int n;
+    int rc = jobs_select(s, hdr, &req, NULL, &pg, &sel, &n);
+    if (rc < 0) {
+        LL_ERRX("jobs_select failed");
+        return -1;
+    }
+    if (rc > 0)
+        return rc;
 
-            job_data_to_wire(job, &jobs[0]);
-            n = 1;
+    struct wire_job_info *jobs = NULL;
+    if (n > 0) {
+        jobs = calloc(n, sizeof(struct wire_job_info));
+        if (jobs == NULL) {
+            LL_ERR("calloc failed");
+            free(sel);
+            return -1;
         }
     }
+    for (int i = 0; i < n; i++)
+        query_job_to_wire(s, sel[i], &jobs[i]);
+    free(sel);
 
-    struct wire_job_info_array reply = {
+    struct wire_job_info_array r = {
         .njobs = n,
         .jobs = jobs
     };
@@ -211,204 +490,749 @@ static int jobs_info_ref(int chan_id,
     rep_hdr.operation = BATCH_JOB_INFO_ACK;
     rep_hdr.status = MBD_OK;
 
-    if (enqueue_payload(chan_id, &rep_hdr, &reply,
-                        siz, xdr_wire_job_info_array) < 0) {
-        LL_ERR("enqueue_payload failed");
-        free(jobs);
+    rc = encode_payload(&rep_hdr, &r, siz, xdr_wire_job_info_array, reply);
+    free(jobs);
+    return rc;
+}
+
+/*
+ * v2 job info reply, encoded straight from the selected jobs: only
+ * the requested fields are sent, and an execution host is a slot in
+ * the host table of the reply.
+ */
+struct job_info2_reply {
+    const struct query_jobs *snap;
+    uint32_t fields;
+    int nhosts;
+    const struct mbd_host **hosts;  /* host table, by slot */
+    int *slot;                /* host_idx -> slot, -1 if not in the table */
+    uint32_t *job_slots;      /* scratch, SCHED_PLAN_MAX slots of one job */
+    int njobs;
+    const struct query_job **jobs;
+    struct jobs_page page;
+};
+
+static void query_job_to_wire2(const struct query_job *j,
+                               const struct job_info2_reply *r,
+                               struct wire_job_info2 *w)
+{
+    static char empty[] = "";
+    const struct query_jobs *s = r->snap;
+
+    memset(w, 0, sizeof(*w));
+    w->job_id = j->job_id;
+    w->array_id = j->array_id;
+    w->array_index = j->array_index;
+    w->uid = (uint32_t) j->uid;
+    w->pid = j->pid;
+    w->state = j->state;
+    w->exit_status = j->exit_status;
+    w->priority = j->priority;
+    w->pend_reason = j->pend_reason;
+    w->submit_time = j->submit_time;
+    w->dispatch_time = j->dispatch_time;
+    w->end_time = j->end_time;
+    w->susp_time = j->susp_time;
+    /* encoded only, never written through */
+    w->name = (char *) s->strings + j->name;
+    w->queue = (char *) j->queue->name;
+    w->submit_host = empty;  /* not kept by mbd */
+    w->comment = empty;
+
+    if (!(r->fields & LLB_JOB_F_RUN_HOSTS))
+        return;
+
+    int nhosts = j->nhosts < SCHED_PLAN_MAX ? j->nhosts : SCHED_PLAN_MAX;
+
+    w->ncpus = j->ncpus;
+    w->nhosts = (uint32_t) nhosts;
+    w->hosts = r->job_slots;
+    for (int i = 0; i < nhosts; i++)
+        r->job_slots[i] = (uint32_t) r->slot[s->host_idx[j->hosts + i]];
+}
+
+static bool_t xdr_job_info2_reply(XDR *xdrs, struct job_info2_reply *r)
+{
+    if (!xdr_uint32_t(xdrs, &r->fields))
+        return false;
+
+    uint32_t nhosts = (uint32_t) r->nhosts;
+    if (!xdr_uint32_t(xdrs, &nhosts))
+        return false;
+    for (int i = 0; i < r->nhosts; i++) {
+        char *name = (char *) r->hosts[i]->net.name;
+        if (!xdr_wrapstring(xdrs, &name))
+            return false;
+    }
+
+    uint32_t njobs = (uint32_t) r->njobs;
+    if (!xdr_uint32_t(xdrs, &njobs))
+        return false;
+    for (int i = 0; i < r->njobs; i++) {
+        struct wire_job_info2 w;
+        query_job_to_wire2(r->jobs[i], r, &w);
+        if (!xdr_wire_job_info2(xdrs, &w, r->fields))
+            return false;
+    }
+
+    if (!xdr_uint32_t(xdrs, &r->page.more))
+        return false;
+    if (!xdr_wire_job_cursor(xdrs, &r->page.next))
+        return false;
+
+    return true;
+}
+
+/*
+ * Fill the host table with the execution hosts of the selected jobs
+ * and return the encoded size of the reply.
+ */
+static size_t job_info2_prepare(struct job_info2_reply *r)
+{
+    const struct query_jobs *s = r->snap;
+    /* fields, nhosts, njobs, more and the cursor */
+    size_t siz = 4 * sizeof(uint32_t) + sizeof(struct wire_job_cursor);
+
+    for (int i = 0; i < r->njobs; i++) {
+        const struct query_job *j = r->jobs[i];
+
+        if (r->fields & LLB_JOB_F_RUN_HOSTS) {
+            for (int k = 0; k < j->nhosts; k++) {
+                uint32_t idx = s->host_idx[j->hosts + k];
+                if (r->slot[idx] >= 0)
+                    continue;
+                const struct mbd_host *h = s->hosts[idx];
+                r->slot[idx] = r->nhosts;
+                r->hosts[r->nhosts++] = h;
+                siz += 4 + ((strlen(h->net.name) + 3) & ~(size_t) 3);
+            }
+        }
+
+        struct wire_job_info2 w;
+        query_job_to_wire2(j, r, &w);
+        siz += wire_job_info2_size(&w, r->fields);
+    }
+
+    return siz;
+}
+
+int jobs_info2(XDR *xdrs, const struct protocol_header *hdr,
+               const struct query_jobs *s, struct chan_buffer **reply)
+{
+    struct wire_job_query2 req;
+
+    memset(&req, 0, sizeof(req));
+
+    if (!xdr_wire_job_query2(xdrs, &req)) {
+        LL_ERRX("xdr_wire_job_query2 failed");
         return -1;
     }
 
-    free(jobs);
+    struct job_info2_reply r;
+    memset(&r, 0, sizeof(r));
+    r.snap = s;
+    r.fields = req.fields & LLB_JOB_F_ALL;
+    if (r.fields == 0)
+        r.fields = LLB_JOB_F_ALL;
+
+    r.page.limit = req.limit < 0 ? 0 : req.limit;
+    r.page.after = req.after;
+
+    struct wire_job_filter *f = &req.filter;
+    f->queue[sizeof(f->queue) - 1] = 0;
+    f->name[sizeof(f->name) - 1] = 0;
+    f->project[sizeof(f->project) - 1] = 0;
+    f->host[sizeof(f->host) - 1] = 0;
+
+    int rc = jobs_select(s, hdr, &req.query, f, &r.page, &r.jobs, &r.njobs);
+    if (rc < 0) {
+        LL_ERRX("jobs_select failed");
+        return -1;
+    }
+    if (rc > 0)
+        return rc;
+
+    r.hosts = calloc(s->nhosts + 1, sizeof(*r.hosts));
+    r.slot = malloc((s->nhosts + 1) * sizeof(*r.slot));
+    r.job_slots = malloc(SCHED_PLAN_MAX * sizeof(*r.job_slots));
+    if (r.hosts == NULL || r.slot == NULL || r.job_slots == NULL) {
+        LL_ERR("calloc failed");
+        free(r.hosts);
+        free(r.slot);
+        free(r.job_slots);
+        free(r.jobs);
+        return -1;
+    }
+    for (int i = 0; i <= s->nhosts; i++)
+        r.slot[i] = -1;
+
+    size_t siz = job_info2_prepare(&r) + PACKET_HEADER_SIZE + LL_BUFSIZ_64;
+
+    struct protocol_header rep_hdr;
+    init_protocol_header(&rep_hdr);
+    rep_hdr.operation = BATCH_JOB_INFO2_ACK;
+    rep_hdr.status = MBD_OK;
+
+    rc = encode_payload(&rep_hdr, &r, siz, xdr_job_info2_reply, reply);
+
+    free(r.hosts);
+    free(r.slot);
+    free(r.job_slots);
+    free(r.jobs);
+    return rc;
+}
+
+/* -----------------------------------------------------------
+ * job summary
+ * ----------------------------------------------------------- */
+
+/* The groups of a summary, by queue pointer, uid or pending reason. */
+struct sum_table {
+    int n;
+    int cap;
+    int64_t *keys;
+    struct wire_job_count *counts;
+    uint32_t nslots;
+    int32_t *slots;     /* key -> index + 1, 0 for none */
+};
+
+static uint32_t sum_hash(int64_t key, uint32_t nslots)
+{
+    return (uint32_t) (((uint64_t) key * 0x9E3779B97F4A7C15ULL) >> 32)
+           & (nslots - 1);
+}
+
+static int sum_rehash(struct sum_table *t, uint32_t nslots)
+{
+    int32_t *slots = calloc(nslots, sizeof(*slots));
+    if (slots == NULL)
+        return -1;
+
+    for (int i = 0; i < t->n; i++) {
+        uint32_t k = sum_hash(t->keys[i], nslots);
+        while (slots[k] != 0)
+            k = (k + 1) & (nslots - 1);
+        slots[k] = i + 1;
+    }
+
+    free(t->slots);
+    t->slots = slots;
+    t->nslots = nslots;
     return 0;
 }
 
-static int jobs_info_list(int chan_id,
-                          const struct protocol_header *hdr,
-                          const struct wire_job_query *req)
+static struct wire_job_count *sum_group(struct sum_table *t, int64_t key)
 {
-    int n = 0;
-    int all = 0;
-    uid_t uid = 0;
+    uint32_t k = sum_hash(key, t->nslots);
 
-    if (is_manager(hdr->uid))
-        all = 1;
-    else
-        uid = hdr->uid;
+    for (; t->slots[k] != 0; k = (k + 1) & (t->nslots - 1)) {
+        if (t->keys[t->slots[k] - 1] == key)
+            return &t->counts[t->slots[k] - 1];
+    }
 
-    int ntotal = ll_list_count(&pend_jobs_list) +
-                 ll_list_count(&run_jobs_list) +
-                 ll_list_count(&finish_jobs_list);
+    if (t->n == t->cap) {
+        int cap = t->cap * 2;
+        int64_t *keys = realloc(t->keys, cap * sizeof(*keys));
+        if (keys == NULL)
+            return NULL;
+        t->keys = keys;
+        struct wire_job_count *counts =
+            realloc(t->counts, cap * sizeof(*counts));
+        if (counts == NULL)
+            return NULL;
+        t->counts = counts;
+        t->cap = cap;
+    }
 
-    struct wire_job_info *jobs = NULL;
+    struct wire_job_count *c = &t->counts[t->n];
+    memset(c, 0, sizeof(*c));
+    t->keys[t->n] = key;
+    t->slots[k] = ++t->n;
 
-    if (ntotal > 0) {
-        jobs = calloc(ntotal, sizeof(struct wire_job_info));
-        if (jobs == NULL) {
-            LL_ERR("calloc failed");
-            return -1;
-        }
+    if ((uint32_t) t->n * 2 > t->nslots && sum_rehash(t, t->nslots * 2) < 0)
+        return NULL;
 
-        if (req->flags == 0) {
-            n = collect_list(&pend_jobs_list, jobs, n, uid, all);
-            n = collect_list(&run_jobs_list, jobs, n, uid, all);
-        } else {
-            if (req->flags & LLB_JOB_PEND)
-                n = collect_list(&pend_jobs_list, jobs, n, uid, all);
+    return c;
+}
 
-            if (req->flags & LLB_JOB_RUN)
-                n = collect_list(&run_jobs_list, jobs, n, uid, all);
+static int sum_init(struct sum_table *t)
+{
+    memset(t, 0, sizeof(*t));
+    t->cap = 64;
+    t->keys = malloc(t->cap * sizeof(*t->keys));
+    t->counts = malloc(t->cap * sizeof(*t->counts));
+    if (t->keys == NULL || t->counts == NULL || sum_rehash(t, 128) < 0) {
+        free(t->keys);
+        free(t->counts);
+        return -1;
+    }
+    return 0;
+}
+
+static void sum_free(struct sum_table *t)
+{
+    free(t->keys);
+    free(t->counts);
+    free(t->slots);
+}
 
-            if (req->flags & LLB_JOB_DONE)
-                n = collect_list(&finish_jobs_list, jobs, n, uid, all);
+/* Count a job in the column of the queue counters that counts it. */
+static void sum_count(struct wire_job_count *c, int state)
+{
+    switch (state) {
+    case JOB_PENDING:
+    case JOB_ORPHAN:
+    case JOB_BROKEN:
+        c->num_pend++;
+        break;
+    case JOB_HELD:
+        c->num_held++;
+        break;
+    case JOB_RUNNING:
+    case JOB_UNKNOWN:
+        c->num_run++;
+        break;
+    case JOB_SUSPENDED:
+        c->num_susp++;
+        break;
+    }
+}
+
+static int filter_empty(const struct wire_job_filter *f)
+{
+    return f->queue[0] == 0 && f->name[0] == 0 && f->project[0] == 0
+           && f->host[0] == 0 && f->array_id == 0 && f->submit_from == 0
+           && f->submit_to == 0 && !f->has_pend_reason;
+}
+
+static int sum_count_cmp(const void *a, const void *b)
+{
+    const struct wire_job_count *x = a;
+    const struct wire_job_count *y = b;
+
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/*
+ * jobs_summary - the counts of the active jobs a listing with the
+ * filter would select, by queue, user or pending reason. An
+ * administrator's summary by queue without a filter is the queue
+ * counters job.c maintains, copied into the snapshot; any other one
+ * takes one pass over the pending and running jobs.
+ */
+int jobs_summary(XDR *xdrs, const struct protocol_header *hdr,
+                 const struct query_jobs *s, struct chan_buffer **reply)
+{
+    struct wire_job_summary_req req;
+
+    memset(&req, 0, sizeof(req));
+
+    if (!xdr_wire_job_summary_req(xdrs, &req)) {
+        LL_ERRX("xdr_wire_job_summary_req failed");
+        return -1;
+    }
+    if (req.by != LLB_SUM_QUEUE && req.by != LLB_SUM_USER
+        && req.by != LLB_SUM_PEND_REASON)
+        return EINVAL;
+
+    struct wire_job_filter *f = &req.filter;
+    f->queue[sizeof(f->queue) - 1] = 0;
+    f->name[sizeof(f->name) - 1] = 0;
+    f->project[sizeof(f->project) - 1] = 0;
+    f->host[sizeof(f->host) - 1] = 0;
+
+    struct jobs_match m;
+    int rc = jobs_match_init(&m, hdr, f);
+    if (rc != 0)
+        return rc;
+
+    struct sum_table t;
+    if (sum_init(&t) < 0) {
+        LL_ERR("sum_init failed");
+        return -1;
+    }
+
+    /* every queue has a row, like in bqueues */
+    if (req.by == LLB_SUM_QUEUE) {
+        for (int i = 0; i < s->nqueues; i++) {
+            const struct query_queue_count *q = &s->queues[i];
+            if (m.queue != NULL && q->queue != m.queue)
+                continue;
+            struct wire_job_count *c = sum_group(&t, (intptr_t) q->queue);
+            if (c == NULL)
+                goto nomem;
+            ll_strlcpy(c->queue, q->queue->name, sizeof(c->queue));
+            if (m.all && filter_empty(f)) {
+                c->num_pend = q->num_pend;
+                c->num_held = q->num_held;
+                c->num_run = q->num_run;
+                c->num_susp = q->num_susp;
+            }
         }
     }
 
-    struct wire_job_info_array reply = {
-        .njobs = n,
-        .jobs = jobs
+    if (req.by != LLB_SUM_QUEUE || !m.all || !filter_empty(f)) {
+        for (int l = JOB_LIST_PEND; l <= JOB_LIST_RUN; l++) {
+            if (!jobs_match_list(&m, l)
+                || (req.by == LLB_SUM_PEND_REASON && l != JOB_LIST_PEND))
+                continue;
+
+            struct jobs_scan c;
+            int i;
+
+            jobs_scan_init(&c, &m, s, s->start[l], s->start[l + 1]);
+            while ((i = jobs_scan_next(&c)) >= 0) {
+                const struct query_job *j = &s->jobs[i];
+                if (!job_matches(&m, s, j))
+                    continue;
+
+                int64_t key;
+                if (req.by == LLB_SUM_QUEUE)
+                    key = (intptr_t) j->queue;
+                else if (req.by == LLB_SUM_USER)
+                    key = j->uid;
+                else
+                    key = j->pend_reason;
+
+                struct wire_job_count *c = sum_group(&t, key);
+                if (c == NULL)
+                    goto nomem;
+                if (req.by == LLB_SUM_QUEUE && c->queue[0] == 0)
+                    ll_strlcpy(c->queue, j->queue->name, sizeof(c->queue));
+                c->id = (int32_t) key;
+                sum_count(c, j->state);
+            }
+        }
+    }
+
+    if (req.by == LLB_SUM_QUEUE) {
+        for (int i = 0; i < t.n; i++)
+            t.counts[i].id = 0;
+    } else {
+        qsort(t.counts, t.n, sizeof(*t.counts), sum_count_cmp);
+    }
+
+    struct wire_job_summary w = {
+        .ncounts = t.n,
+        .counts = t.counts
     };
 
-    size_t siz = sizeof(struct wire_job_info) * n +
-                 sizeof(struct wire_job_info_array) +
-                 PACKET_HEADER_SIZE + LL_BUFSIZ_64;
+    size_t siz = sizeof(struct wire_job_count) * t.n +
+                 sizeof(struct wire_job_summary) + PACKET_HEADER_SIZE +
+                 LL_BUFSIZ_64;
 
     struct protocol_header rep_hdr;
     init_protocol_header(&rep_hdr);
-    rep_hdr.operation = BATCH_JOB_INFO_ACK;
+    rep_hdr.operation = BATCH_JOB_SUMMARY_ACK;
     rep_hdr.status = MBD_OK;
 
-    if (enqueue_payload(chan_id, &rep_hdr, &reply,
-                        siz, xdr_wire_job_info_array) < 0) {
-        LL_ERR("enqueue_payload failed");
-        free(jobs);
-        return -1;
-    }
+    rc = encode_payload(&rep_hdr, &w, siz, xdr_wire_job_summary, reply);
+    sum_free(&t);
+    return rc;
 
-    free(jobs);
-    return 0;
+nomem:
+    LL_ERR("job summary groups=%d", t.n);
+    sum_free(&t);
+    return ENOMEM;
 }
 
+/* -----------------------------------------------------------
+ * job delta
+ * ----------------------------------------------------------- */
+
+struct job_delta_reply {
+    struct job_info2_reply body;
+    struct wire_job_delta_tail tail;
+};
 
-int jobs_info(XDR *xdrs, int chan_id, const struct protocol_header *hdr)
+static bool_t xdr_job_delta_reply(XDR *xdrs, struct job_delta_reply *d)
 {
-    int rc;
-    struct wire_job_query req;
+    if (!xdr_job_info2_reply(xdrs, &d->body))
+        return false;
+    if (!xdr_wire_job_delta_tail(xdrs, &d->tail))
+        return false;
+    return true;
+}
+
+static int change_seq_cmp(const void *a, const void *b)
+{
+    const struct query_job *x = *(const struct query_job *const *) a;
+    const struct query_job *y = *(const struct query_job *const *) b;
+
+    return (x->change_seq > y->change_seq) - (x->change_seq < y->change_seq);
+}
+
+static int query_job_list(const struct query_jobs *s,
+                          const struct query_job *j)
+{
+    int i = (int) (j - s->jobs);
+    int l = 0;
+
+    while (i >= s->start[l + 1])
+        l++;
+    return l;
+}
+
+/* The first tombstone past since, the tombstones are in seq order. */
+static int tomb_after(const struct query_jobs *s, uint64_t since)
+{
+    int lo = 0;
+    int hi = s->ntombs;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (s->tombs[mid].seq <= since)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/*
+ * jobs_delta - the jobs changed since the change sequence number of
+ * the request, in change order and at most limit changes per reply.
+ * A changed job the listing selects is sent whole; one it no longer
+ * selects, and a job purged since, is sent as gone. When the request
+ * is from before the last start of mbd or older than the oldest
+ * tombstone kept, the reply resets: the caller forgets its jobs and
+ * gets every job of the listing, in change order as well.
+ */
+int jobs_delta(XDR *xdrs, const struct protocol_header *hdr,
+               const struct query_jobs *s, struct chan_buffer **reply)
+{
+    struct wire_job_delta_req req;
 
     memset(&req, 0, sizeof(req));
 
-    if (!xdr_wire_job_query(xdrs, &req)) {
-        LL_ERRX("xdr_wire_job_query failed chan_id=%d", chan_id);
+    if (!xdr_wire_job_delta_req(xdrs, &req)) {
+        LL_ERRX("xdr_wire_job_delta_req failed");
         return -1;
     }
 
-    if (req.job_id != -1 || req.array_id != 0) {
-        rc = jobs_info_ref(chan_id, hdr, &req);
-        if (rc < 0)
-            LL_ERRX("jobs_info_ref failed chan_id=%d", chan_id);
+    struct wire_job_filter *f = &req.filter;
+    f->queue[sizeof(f->queue) - 1] = 0;
+    f->name[sizeof(f->name) - 1] = 0;
+    f->project[sizeof(f->project) - 1] = 0;
+    f->host[sizeof(f->host) - 1] = 0;
+
+    struct jobs_match m;
+    int rc = jobs_match_init(&m, hdr, f);
+    if (rc != 0)
         return rc;
+
+    int flags = req.flags;
+    if (flags == 0)
+        flags = LLB_JOB_PEND | LLB_JOB_RUN;
+
+    struct job_delta_reply d;
+    memset(&d, 0, sizeof(d));
+    d.body.snap = s;
+    d.body.fields = req.fields & LLB_JOB_F_ALL;
+    if (d.body.fields == 0)
+        d.body.fields = LLB_JOB_F_ALL;
+    d.body.page.next.list = -1;
+
+    uint64_t since = req.since;
+    if (req.epoch != s->epoch || since > s->change_seq
+        || since < s->tomb_floor) {
+        d.tail.reset = 1;
+        since = 0;
     }
 
-    rc = jobs_info_list(chan_id, hdr, &req);
-    if (rc < 0)
-        LL_ERRX("jobs_info_list failed chan_id=%d", chan_id);
+    /* the visible jobs changed since, in change order */
+    int nchg = 0;
+    const struct query_job **chg = malloc((s->njobs + 1) * sizeof(*chg));
+    if (chg == NULL) {
+        LL_ERR("malloc delta jobs=%d failed", s->njobs);
+        return -1;
+    }
+    for (int i = 0; i < s->njobs; i++) {
+        const struct query_job *j = &s->jobs[i];
+        if (j->change_seq > since && (m.all || j->uid == m.uid))
+            chg[nchg++] = j;
+    }
+    qsort(chg, nchg, sizeof(*chg), change_seq_cmp);
+
+    int t = d.tail.reset ? s->ntombs : tomb_after(s, since);
+    int limit = req.limit > 0 ? req.limit : INT32_MAX;
+
+    d.body.jobs = malloc((nchg + 1) * sizeof(*d.body.jobs));
+    d.tail.gone = malloc((nchg + s->ntombs - t + 1) * sizeof(int64_t));
+    d.body.hosts = calloc(s->nhosts + 1, sizeof(*d.body.hosts));
+    d.body.slot = malloc((s->nhosts + 1) * sizeof(*d.body.slot));
+    d.body.job_slots = malloc(SCHED_PLAN_MAX * sizeof(*d.body.job_slots));
+    if (d.body.jobs == NULL || d.tail.gone == NULL || d.body.hosts == NULL
+        || d.body.slot == NULL || d.body.job_slots == NULL) {
+        LL_ERR("malloc delta changes=%d failed", nchg);
+        rc = -1;
+        goto out;
+    }
+    for (int i = 0; i <= s->nhosts; i++)
+        d.body.slot[i] = -1;
+
+    /* merge the changed jobs and the tombstones by seq */
+    uint64_t last = since;
+    int c = 0;
+    int n = 0;
+    while ((c < nchg || t < s->ntombs) && n < limit) {
+        if (t == s->ntombs
+            || (c < nchg && chg[c]->change_seq < s->tombs[t].seq)) {
+            const struct query_job *j = chg[c++];
+            int l = query_job_list(s, j);
+
+            last = j->change_seq;
+            if ((flags & job_list_flags[l]) && jobs_match_list(&m, l)
+                && job_matches(&m, s, j))
+                d.body.jobs[d.body.njobs++] = j;
+            else if (!d.tail.reset)
+                d.tail.gone[d.tail.ngone++] = j->job_id;
+        } else {
+            const struct job_tomb *tb = &s->tombs[t++];
+
+            last = tb->seq;
+            if (m.all || tb->uid == m.uid)
+                d.tail.gone[d.tail.ngone++] = tb->job_id;
+        }
+        n++;
+    }
+    d.body.page.more = c < nchg || t < s->ntombs;
 
+    d.tail.epoch = s->epoch;
+    d.tail.seq = d.body.page.more ? last : s->change_seq;
+
+    size_t siz = job_info2_prepare(&d.body) + 3 * sizeof(uint64_t) +
+                 sizeof(uint32_t) + d.tail.ngone * sizeof(int64_t) +
+                 PACKET_HEADER_SIZE + LL_BUFSIZ_64;
+
+    struct protocol_header rep_hdr;
+    init_protocol_header(&rep_hdr);
+    rep_hdr.operation = BATCH_JOB_DELTA_ACK;
+    rep_hdr.status = MBD_OK;
+
+    rc = encode_payload(&rep_hdr, &d, siz, xdr_job_delta_reply, reply);
+
+out:
+    free(chg);
+    free(d.body.jobs);
+    free(d.body.hosts);
+    free(d.body.slot);
+    free(d.body.job_slots);
+    free(d.tail.gone);
     return rc;
 }
 
 /* -----------------------------------------------------------
  * queue info
  * ----------------------------------------------------------- */
-int queues_info(XDR *xdrs, int chan_id)
+
+/*
+ * Collect hash keys into a freshly allocated char* array.
+ * Returns number of entries; *out is NULL if hash is empty.
+ * Pointers into hash keys — caller must not free the strings.
+ */
+static int hash_keys_dup(struct ll_hash *h, char ***out)
 {
-    (void) xdrs;
+    *out = NULL;
+
+    if (h->nentries == 0)
+        return 0;
+
+    char **keys = calloc(h->nentries, sizeof(char *));
+    if (keys == NULL)
+        return -1;
+
+    int n = 0;
+    for (size_t b = 0; b < h->nbuckets; b++) {
+        for (struct ll_hash_entry *e = h->buckets[b]; e != NULL; e = e->next)
+            keys[n++] = e->key;
+    }
 
+    *out = keys;
+    return n;
+}
+
+/*
+ * The *_info() functions below encode their whole reply from the live
+ * state into *reply, which query.c keeps and sends to every request
+ * until the state changes. They return 0 or -1.
+ */
+int queues_info(struct chan_buffer **reply)
+{
     int nqueues = ll_list_count(&queue_list);
     struct wire_queue_info *queues =
-        calloc(nqueues, sizeof(struct wire_queue_info));
+        calloc(nqueues ? nqueues : 1, sizeof(struct wire_queue_info));
     if (queues == NULL) {
-        LL_ERR("queue_info: calloc failed");
+        LL_ERR("calloc queues=%d failed", nqueues);
         return -1;
     }
 
+    int rc = -1;
     int i = 0;
     size_t siz = 0;
     for (struct ll_list_entry *e = queue_list.head; e != NULL; e = e->next) {
         struct mbd_queue *q = (struct mbd_queue *) e;
-
-        ll_strlcpy(queues[i].name, q->name, sizeof(queues[i].name));
-        ll_strlcpy(queues[i].description, q->description,
-                   sizeof(queues[i].description));
-        queues[i].status = q->state;
-        queues[i].priority = q->priority;
-        queues[i].max_jobs = q->max_jobs;
-        queues[i].num_jobs = q->num_jobs;
-        queues[i].num_pend = q->num_pend;
-        queues[i].num_run = q->num_run;
-        queues[i].num_susp = q->num_susp;
-        queues[i].num_held = q->num_held;
-        queues[i].num_cpus_used = q->num_cpus_used;
-        queues[i].num_hosts_used = q->num_hosts_used;
-
-        queues[i].num_hosts = hash_keys_dup(&q->host_hash,
-                                            &queues[i].hosts);
-        queues[i].num_users = hash_keys_dup(&q->user_hash,
-                                            &queues[i].users);
-        if (queues[i].num_hosts < 0 || queues[i].num_users < 0) {
+        struct wire_queue_info *w = &queues[i++];
+
+        ll_strlcpy(w->name, q->name, sizeof(w->name));
+        ll_strlcpy(w->description, q->description, sizeof(w->description));
+        w->status = q->state;
+        w->priority = q->priority;
+        w->max_jobs = q->max_jobs;
+        w->num_jobs = q->num_jobs;
+        w->num_pend = q->num_pend;
+        w->num_run = q->num_run;
+        w->num_susp = q->num_susp;
+        w->num_held = q->num_held;
+        w->num_cpus_used = q->num_cpus_used;
+        w->num_hosts_used = q->num_hosts_used;
+
+        w->num_hosts = hash_keys_dup(&q->host_hash, &w->hosts);
+        w->num_users = hash_keys_dup(&q->user_hash, &w->users);
+        if (w->num_hosts < 0 || w->num_users < 0) {
             LL_ERR("hash_keys_dup failed num_hosts=%d num_users=%d",
-                   queues[i].num_hosts, queues[i].num_users);
-            goto fail;
+                   w->num_hosts, w->num_users);
+            goto out;
         }
-        for (int j = 0; j < queues[i].num_hosts; j++)
-            siz += strlen(queues[i].hosts[j]) + 4;
-        for (int j = 0; j < queues[i].num_users; j++)
-            siz += strlen(queues[i].users[j]) + 4;
+        for (int j = 0; j < w->num_hosts; j++)
+            siz += strlen(w->hosts[j]) + 4;
+        for (int j = 0; j < w->num_users; j++)
+            siz += strlen(w->users[j]) + 4;
         siz += 8;  /* num_hosts + num_users int32 */
-        i++;
     }
 
-    struct wire_queue_info_array reply;
-    reply.nqueues = nqueues;
-    reply.queues = queues;
+    struct wire_queue_info_array w;
+    w.nqueues = nqueues;
+    w.queues = queues;
 
-    siz = siz + sizeof(struct wire_queue_info) * nqueues
-        + sizeof(struct wire_queue_info_array) + PACKET_HEADER_SIZE +
-        LL_BUFSIZ_64;
+    siz += sizeof(struct wire_queue_info) * nqueues +
+           sizeof(struct wire_queue_info_array) + PACKET_HEADER_SIZE +
+           LL_BUFSIZ_64;
 
     struct protocol_header hdr;
     init_protocol_header(&hdr);
     hdr.operation = BATCH_QUEUE_INFO_ACK;
     hdr.status = MBD_OK;
 
-    if (enqueue_payload(chan_id, &hdr, &reply, siz, xdr_wire_queue_info_array) <
-        0) {
-        LL_ERR("queue_info: enqueue_payload failed");
-        free(queues);
-        return -1;
-    }
-    for (int j = 0; j < nqueues; j++) {
+    rc = encode_payload(&hdr, &w, siz, xdr_wire_queue_info_array, reply);
+
+out:
+    for (int j = 0; j < i; j++) {
         free(queues[j].hosts);
         free(queues[j].users);
     }
     free(queues);
-    return 0;
-
-fail:
-    for (int j = 0; j <= i; j++)
-        free(queues[j].hosts), free(queues[j].users);
-    free(queues);
-    return -1;
+    return rc;
 }
 
 /* -----------------------------------------------------------
  * host group info
  * ----------------------------------------------------------- */
-int host_group_info(XDR *xdrs, int chan_id)
+int host_group_info(struct chan_buffer **reply)
 {
-    (void) xdrs;
-
     int ngroups = ll_list_count(&group_list);
     struct wire_group_info *groups =
-        calloc(ngroups, sizeof(struct wire_group_info));
+        calloc(ngroups ? ngroups : 1, sizeof(struct wire_group_info));
     if (groups == NULL) {
         LL_ERR("host_group_info: calloc failed");
         return -1;
@@ -424,9 +1248,9 @@ int host_group_info(XDR *xdrs, int chan_id)
         i++;
     }
 
-    struct wire_group_info_array reply;
-    reply.ngroups = ngroups;
-    reply.groups = groups;
+    struct wire_group_info_array w;
+    w.ngroups = ngroups;
+    w.groups = groups;
 
     size_t siz = sizeof(struct wire_group_info) * ngroups +
                  sizeof(struct wire_group_info_array) + PACKET_HEADER_SIZE +
@@ -437,29 +1261,22 @@ int host_group_info(XDR *xdrs, int chan_id)
     hdr.operation = BATCH_GROUP_INFO_ACK;
     hdr.status = MBD_OK;
 
-    if (enqueue_payload(chan_id, &hdr, &reply, siz, xdr_wire_group_info_array) <
-        0) {
-        LL_ERR("host_group_info: enqueue_payload failed");
-        free(groups);
-        return -1;
-    }
+    int rc = encode_payload(&hdr, &w, siz, xdr_wire_group_info_array, reply);
 
     free(groups);
-    return 0;
+    return rc;
 }
 
 /* -----------------------------------------------------------
  * host info
  * ----------------------------------------------------------- */
-int hosts_info(XDR *xdrs, int chan_id)
+int hosts_info(struct chan_buffer **reply)
 {
-    (void) xdrs;
-
     int nhosts = ll_list_count(&host_list);
     struct wire_host_info *hosts =
         calloc(nhosts ? nhosts : 1, sizeof(struct wire_host_info));
     if (hosts == NULL) {
-        LL_ERR("host_info: calloc failed");
+        LL_ERR("calloc hosts=%d failed", nhosts);
         return -1;
     }
 
@@ -489,9 +1306,9 @@ int hosts_info(XDR *xdrs, int chan_id)
         i++;
     }
 
-    struct wire_host_info_array reply;
-    reply.nhosts = nhosts;
-    reply.hosts = hosts;
+    struct wire_host_info_array w;
+    w.nhosts = nhosts;
+    w.hosts = hosts;
 
     size_t siz = sizeof(struct wire_host_info) * nhosts +
                  sizeof(struct wire_host_info_array) + PACKET_HEADER_SIZE +
@@ -502,38 +1319,30 @@ int hosts_info(XDR *xdrs, int chan_id)
     hdr.operation = BATCH_HOST_INFO_ACK;
     hdr.status = MBD_OK;
 
-    if (enqueue_payload(chan_id, &hdr, &reply, siz, xdr_wire_host_info_array) <
-        0) {
-        LL_ERR("host_info: enqueue_payload failed");
-        free(hosts);
-        return -1;
-    }
+    int rc = encode_payload(&hdr, &w, siz, xdr_wire_host_info_array, reply);
 
     free(hosts);
-    return 0;
+    return rc;
 }
 
-int tokens_info(XDR *xdrs, int chan_id)
+/* -----------------------------------------------------------
+ * token info
+ * ----------------------------------------------------------- */
+int tokens_info(struct chan_buffer **reply)
 {
-    (void) xdrs;
-
-    struct ll_list_entry *e;
-    int n = 0;
-
-    for (e = token_pool_list.head; e != NULL; e = e->next)
-        n++;
+    int n = ll_list_count(&token_pool_list);
 
     struct wire_token_info_array w;
     w.ntokens = n;
-    w.tokens = calloc(n, sizeof(struct wire_token_info));
+    w.tokens = calloc(n ? n : 1, sizeof(struct wire_token_info));
     if (w.tokens == NULL) {
         LL_ERR("calloc failed n=%d", n);
-        enqueue_header(chan_id, BATCH_TOKEN_INFO_ACK, errno);
         return -1;
     }
 
     int i = 0;
-    for (e = token_pool_list.head; e != NULL; e = e->next) {
+    for (struct ll_list_entry *e = token_pool_list.head; e != NULL;
+         e = e->next) {
         struct mbd_token_pool *t = (struct mbd_token_pool *) e;
 
         ll_strlcpy(w.tokens[i].name, t->name, sizeof(w.tokens[i].name));
@@ -550,11 +1359,11 @@ int tokens_info(XDR *xdrs, int chan_id)
     size_t bufsz =
         PACKET_HEADER_SIZE + n * sizeof(struct wire_token_info) + LL_BUFSIZ_256;
 
-    enqueue_payload(chan_id, &hdr, &w, bufsz,
-                    (bool_t(*)()) xdr_wire_token_info_array);
+    int rc = encode_payload(&hdr, &w, bufsz,
+                            (bool_t(*)()) xdr_wire_token_info_array, reply);
 
     free(w.tokens);
-    return 0;
+    return rc;
 }
 /* -----------------------------------------------------------
  * queue admin (open/close)
@@ -11,20 +11,79 @@
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <time.h>
 #include <assert.h>
 
 #include "batch/lib/wire.h"
 #include "batch/lib/log.h"
+#include "batch/lib/logindex.h"
+#include "batch/lib/spool.h"
 #include "base/lib/ll.conf.h"
 #include "base/lib/ll.syslog.h"
 #include "base/lib/ll.hash.h"
 #include "batch/mbd/mbd.h"
 
+static char state_dir[PATH_MAX];
 static char manifest_path[PATH_MAX];
 char jobs_dir[PATH_MAX];
 static ino_t manifest_ino = 0;
 static uint32_t manifest_seq = 0;
 static int job_finish_threshold = 1000;
+static char checkpoint_path[PATH_MAX];
+static int checkpoint_interval = 300;
+static pid_t checkpoint_pid = 0;
+static time_t checkpoint_last;
+static ino_t checkpoint_ino = 0;
+static off_t checkpoint_offset = -1;
+static int replay_threads = 0;
+static int job_id_lease = 1000;
+static int64_t job_id_leased;
+static char compact_path[PATH_MAX];
+static pid_t compact_pid = 0;
+static pid_t index_pid = 0;
+static ino_t compact_ino;
+static off_t compact_offset;
+static struct job_data **compact_drop;
+static int compact_ndrop;
+static int spool_reap_rate = 500;
+static pid_t spool_reap_pid = 0;
+static int64_t *spool_reap_ids;
+static int spool_reap_nids;
+static int spool_reap_max;
+static uint32_t *spool_reap_segs;
+static int spool_reap_nsegs;
+static int spool_reap_segmax;
+
+static struct compact_stats {
+    struct timespec start;
+    int64_t runs;
+    int64_t fork_ms;
+    int64_t last_ms;
+    int64_t last_stall_ms;
+    int64_t max_stall_ms;
+} compact_stats;
+
+/*
+ * sync_state_dir - fsync the mbd state directory. A file created, linked
+ * or renamed into it is durable only once the directory entry is.
+ */
+static int sync_state_dir(void)
+{
+    int fd = open(state_dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        LL_ERR("open dir=%s", state_dir);
+        return -1;
+    }
+    if (fsync(fd) < 0) {
+        LL_ERR("fsync dir=%s", state_dir);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
 
 static FILE *open_manifest(void)
 {
@@ -47,6 +106,11 @@ static FILE *open_manifest(void)
         fclose(fp);
         mbd_die(MBD_EXIT_EVENTS);
     }
+    // first open may have created the manifest
+    if (manifest_ino == 0 && sync_state_dir() < 0) {
+        fclose(fp);
+        mbd_die(MBD_EXIT_EVENTS);
+    }
     manifest_ino = st.st_ino;
     return fp;
 }
@@ -242,6 +306,10 @@ void event_job_new(const struct job_data *job, const struct wire_job_submit *ws)
     ll_strlcpy(e.project_name, ws->project, sizeof(e.project_name));
     ll_strlcpy(e.tokenpool, ws->tokenpool, sizeof(e.tokenpool));
     ll_strlcpy(e.depend_cond, ws->depend_cond, sizeof(e.depend_cond));
+    ll_strlcpy(e.script, job->script, sizeof(e.script));
+    e.journal_seq = job->journal.seq;
+    e.journal_off = job->journal.off;
+    e.journal_len = job->journal.len;
 
     FILE *fp = open_manifest();
     if (log_write_job_new(fp, &e) < 0) {
@@ -450,6 +518,14 @@ static struct job_data *replay_alloc(const struct log_job_new *e)
 
     job_replay_deps(job, e->depend_cond);
 
+    ll_strlcpy(job->script, e->script, sizeof(job->script));
+    script_ref(job->script);
+
+    job->journal.seq = e->journal_seq;
+    job->journal.off = e->journal_off;
+    job->journal.len = e->journal_len;
+    journal_ref(&job->journal);
+
     return job;
 }
 
@@ -466,32 +542,26 @@ static int replay_insert(struct job_data *job)
     return 1;
 }
 
-static int replay_job_new(const struct event_rec *rec, int64_t *max_id)
+static int replay_job_new(const struct log_job_new *e, int64_t *max_id)
 {
-    struct log_job_new e;
-    memset(&e, 0, sizeof(e));
-    if (log_parse_job_new(rec, &e) < 0) {
-        LL_ERR("parse JOB_NEW failed");
-        return 0;
-    }
-    if (e.job_id > *max_id)
-        *max_id = e.job_id;
+    if (e->job_id > *max_id)
+        *max_id = e->job_id;
 
-    struct job_data *job = replay_alloc(&e);
+    struct job_data *job = replay_alloc(e);
     if (job == NULL) {
-        LL_ERR("failed replay job_id=%ld", e.job_id);
+        LL_ERR("failed replay job_id=%ld", e->job_id);
         return 0;
     }
 
     int rc = replay_insert(job);
     if (rc == 0) {
-        LL_ERR("failed insert job_id=%ld", e.job_id);
+        LL_ERR("failed insert job_id=%ld", e->job_id);
         return 0;
     }
 
     LL_DEBUG("JOB_NEW job_id=%ld array_id=%ld array_index=%d depend=%s",
-             e.job_id, e.array_id, e.array_index,
-             (e.depend_cond[0] != 0) ? e.depend_cond : "none");
+             e->job_id, e->array_id, e->array_index,
+             (e->depend_cond[0] != 0) ? e->depend_cond : "none");
     return rc;
 }
 
@@ -537,17 +607,11 @@ static int replay_set_run_hosts(struct job_data *job,
     return 0;
 }
 
-static void replay_job_start(const struct event_rec *rec)
+static void replay_job_start(const struct log_job_start *e)
 {
-    struct log_job_start e;
-    memset(&e, 0, sizeof(e));
-    if (log_parse_job_start(rec, &e) < 0) {
-        LL_ERR("parse JOB_START failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERR("JOB_START job_id=%ld not found", e.job_id);
+        LL_ERR("JOB_START job_id=%ld not found", e->job_id);
         return;
     }
 
@@ -557,83 +621,66 @@ static void replay_job_start(const struct event_rec *rec)
         return;
     }
 
-    if (replay_set_run_hosts(job, &e) < 0) {
+    if (replay_set_run_hosts(job, e) < 0) {
         /* JOB_START references a host that is not present in the current config
          * The job cannot be reconstructed safely.
          * Mark it BROKEN and leave it in the pending lists
          * An administrator or owner may later terminate it.
          */
         LL_ERRX("job_id=%ld is broken cannot rebuild its runtime status "
-                "configuration changed?", e.job_id);
+                "configuration changed?", e->job_id);
         job->state = JOB_BROKEN;
         // return preventing any resource allocation
         return;
     }
 
     job->state = JOB_RUNNING;
-    job->dispatch_time = e.dispatch_time;
-    ll_strlcpy(job->gpu_assigned, e.gpu_assigned, sizeof(job->gpu_assigned));
+    job->dispatch_time = e->dispatch_time;
+    ll_strlcpy(job->gpu_assigned, e->gpu_assigned, sizeof(job->gpu_assigned));
     job_move_list(job, &pend_jobs_list, &run_jobs_list, JOB_LIST_RUN);
 
     LL_DEBUG("JOB_START job_id=%ld nhosts=%d cpus=%d gpus=%d gpu_assigned=%s",
-             e.job_id, e.nhosts, e.cpus_per_host, e.gpus_per_host,
-             (e.gpu_assigned[0] != 0) ? e.gpu_assigned : "none");
+             e->job_id, e->nhosts, e->cpus_per_host, e->gpus_per_host,
+             (e->gpu_assigned[0] != 0) ? e->gpu_assigned : "none");
 }
 
-static void replay_job_fork(const struct event_rec *rec)
+static void replay_job_fork(const struct log_job_fork *e)
 {
-    struct log_job_fork e;
-
-    if (log_parse_job_fork(rec, &e) < 0) {
-        LL_ERR("parse JOB_FORK failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERR("JOB_FORK job_id=%ld not found", e.job_id);
+        LL_ERR("JOB_FORK job_id=%ld not found", e->job_id);
         return;
     }
-    job->pid = (pid_t) e.job_pid;
-    job->fork_time = e.fork_time;
+    job->pid = (pid_t) e->job_pid;
+    job->fork_time = e->fork_time;
 
-    LL_DEBUG("JOB_FORK job_id=%ld pid=%d", e.job_id, e.job_pid);
+    LL_DEBUG("JOB_FORK job_id=%ld pid=%d", e->job_id, e->job_pid);
 }
 
-static void replay_job_signal(const struct event_rec *rec)
+static void replay_job_signal(const struct log_job_signal *e)
 {
-    struct log_job_signal e;
-    if (log_parse_job_signal(rec, &e) < 0) {
-        LL_ERR("parse JOB_SIGNAL failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERR("JOB_SIGNAL job_id=%ld not found", e.job_id);
+        LL_ERR("JOB_SIGNAL job_id=%ld not found", e->job_id);
         return;
     }
-    job->signal_time = e.signal_time;
-    LL_DEBUG("JOB_SIGNAL job_id=%ld sig=%d uid=%u", e.job_id, e.signal_num,
-             e.uid);
+    job->signal_time = e->signal_time;
+    LL_DEBUG("JOB_SIGNAL job_id=%ld sig=%d uid=%u", e->job_id, e->signal_num,
+             e->uid);
 }
 
-static void replay_job_finish(const struct event_rec *rec)
+static void replay_job_finish(const struct log_job_finish *e)
 {
-    struct log_job_finish e;
-    memset(&e, 0, sizeof(e));
-    if (log_parse_job_finish(rec, &e) < 0) {
-        LL_ERR("parse JOB_FINISH failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERR("JOB_FINISH job_id=%ld not found", e.job_id);
+        LL_ERR("JOB_FINISH job_id=%ld not found", e->job_id);
         return;
     }
 
-    job->state = e.state;
-    job->exit_status = e.exit_status;
-    job->uid = e.uid;
-    job->end_time = e.end_time;
+    job->state = e->state;
+    job->exit_status = e->exit_status;
+    job->uid = e->uid;
+    job->end_time = e->end_time;
 
     // The job could be broken so still in the pending list, or just
     // simply pending and then bkilled
@@ -643,68 +690,53 @@ static void replay_job_finish(const struct event_rec *rec)
     job_move_list(job, from, &finish_jobs_list, JOB_LIST_FINISH);
     job_array_element_finished(job);
 
-    LL_DEBUG("JOB_FINISH job_id=%ld", e.job_id);
+    LL_DEBUG("JOB_FINISH job_id=%ld", e->job_id);
     /* No counter updates. These updates are performed only after
      * the full replay and only for jobs in pending or running lists.
      */
 }
 
-static void replay_job_pend_susp(const struct event_rec *rec)
+static void replay_job_pend_susp(const struct log_job_pend_susp *e)
 {
-    struct log_job_pend_susp e;
-    if (log_parse_job_pend_susp(rec, &e) < 0) {
-        LL_ERR("parse JOB_PEND_SUSP failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_PEND_SUSP job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_PEND_SUSP job_id=%ld not found", e->job_id);
         return;
     }
     if (!(job->state == JOB_PENDING)) {
-        LL_ERRX("JOB_PEND_SUSP job_id=%ld not in PEND", e.job_id);
+        LL_ERRX("JOB_PEND_SUSP job_id=%ld not in PEND", e->job_id);
         assert(0);
         return;
     }
     job->state = JOB_HELD;
-    LL_DEBUG("JOB_PEND_SUSP job_id=%ld", e.job_id);
+    LL_DEBUG("JOB_PEND_SUSP job_id=%ld", e->job_id);
 }
 
-static void replay_job_pending_resume(const struct event_rec *rec)
+static void replay_job_pending_resume(const struct log_job_pend_resume *e)
 {
-    struct log_job_pend_resume e;
-    if (log_parse_job_pend_resume(rec, &e) < 0) {
-        LL_ERR("parse JOB_RESUME failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_RESUME job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_RESUME job_id=%ld not found", e->job_id);
         return;
     }
     if (!(job->state == JOB_HELD)) {
-        LL_ERRX("JOB_PENDING_RESUME job_id=%ld not in PEND_SUSP", e.job_id);
+        LL_ERRX("JOB_PENDING_RESUME job_id=%ld not in PEND_SUSP", e->job_id);
         assert(0);
         return;
     }
     job->state = JOB_PENDING;
-    LL_DEBUG("JOB_RESUME job_id=%ld", e.job_id);
+    LL_DEBUG("JOB_RESUME job_id=%ld", e->job_id);
 }
 
-static void replay_job_susp(const struct event_rec *rec)
+static void replay_job_susp(const struct log_job_susp *e)
 {
-    struct log_job_susp e;
-    if (log_parse_job_susp(rec, &e) < 0) {
-        LL_ERR("parse JOB_SUSP failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_SUSP job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_SUSP job_id=%ld not found", e->job_id);
         return;
     }
     job->state = JOB_SUSPENDED;
-    LL_DEBUG("JOB_SUSP job_id=%ld", e.job_id);
+    LL_DEBUG("JOB_SUSP job_id=%ld", e->job_id);
 }
 
 /*
@@ -746,24 +778,25 @@ static void manifest_seq_scan(void)
 
 int events_init(void)
 {
-    char dir[PATH_MAX];
-    int n = snprintf(dir, sizeof(dir), "%s/mbd", ll_params[LL_STATE_DIR].val);
-    if (n < 0 || n >= (int) sizeof(dir))
+    int n = snprintf(state_dir, sizeof(state_dir), "%s/mbd",
+                     ll_params[LL_STATE_DIR].val);
+    if (n < 0 || n >= (int) sizeof(state_dir))
         mbd_die(MBD_EXIT_EVENTS);
 
     // bhist run by users need to read the events
-    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
-        LL_ERR("mkdir(%s) failed", dir);
+    if (mkdir(state_dir, 0755) == -1 && errno != EEXIST) {
+        LL_ERR("mkdir(%s) failed", state_dir);
         mbd_die(MBD_EXIT_FATAL);
     }
-    LL_INFO("working dir initialized %s", dir);
+    LL_INFO("working dir initialized %s", state_dir);
 
-    n = snprintf(manifest_path, sizeof(manifest_path), "%s/manifest", dir);
+    n = snprintf(manifest_path, sizeof(manifest_path), "%s/manifest",
+                 state_dir);
     if (n < 0 || n >= (int) sizeof(manifest_path))
         mbd_die(MBD_EXIT_EVENTS);
     LL_INFO("job events initialized %s", manifest_path);
 
-    n = snprintf(jobs_dir, sizeof(jobs_dir), "%s/jobs", dir);
+    n = snprintf(jobs_dir, sizeof(jobs_dir), "%s/jobs", state_dir);
     if (n < 0 || n >= (int) sizeof(jobs_dir))
         mbd_die(MBD_EXIT_EVENTS);
 
@@ -773,18 +806,52 @@ int events_init(void)
     }
     LL_INFO("job working dir initialized %s", jobs_dir);
 
-    for (int i = 0; i < JOB_BUCKETS; i++) {
-        char bucket[PATH_MAX];
-        int nb = snprintf(bucket, sizeof(bucket), "%s/%d", jobs_dir, i);
-        if (nb < 0 || nb >= (int) sizeof(bucket))
-            mbd_die(MBD_EXIT_EVENTS);
-        if (mkdir(bucket, 0755) == -1 && errno != EEXIST) {
-            LL_ERRX("mkdir(%s) failed", bucket);
+    int version = spool_version(jobs_dir);
+    if (version < 0) {
+        LL_ERR("spool version of %s", jobs_dir);
+        mbd_die(MBD_EXIT_EVENTS);
+    }
+    if (version > SPOOL_VERSION) {
+        LL_ERRX("spool %s version=%d is newer than this mbd version=%d",
+                jobs_dir, version, SPOOL_VERSION);
+        mbd_die(MBD_EXIT_EVENTS);
+    }
+    if (version < SPOOL_VERSION) {
+        if (spool_set_version(jobs_dir, SPOOL_VERSION) < 0) {
+            LL_ERR("spool_set_version %s", jobs_dir);
             mbd_die(MBD_EXIT_EVENTS);
         }
+        char legacy[PATH_MAX + LL_BUFSIZ_32];
+        struct stat lst;
+        snprintf(legacy, sizeof(legacy), "%s/0", jobs_dir);
+        if (stat(legacy, &lst) == 0)
+            LL_INFO("spool %s has job directories of the legacy layout, "
+                    "bmanifest --spool moves them", jobs_dir);
+    }
+    LL_INFO("spool layout version=%d", SPOOL_VERSION);
+
+    if (!ll_atoi(ll_params[LL_MBD_SPOOL_REAP_RATE].val, &spool_reap_rate)
+        || spool_reap_rate < 0) {
+        LL_ERRX("invalid LL_MBD_SPOOL_REAP_RATE=%s using default=500",
+                ll_params[LL_MBD_SPOOL_REAP_RATE].val);
+        spool_reap_rate = 500;
     }
 
-    LL_INFO("%d bucket dirs initialized", JOB_BUCKETS);
+    if (script_store_init() < 0)
+        mbd_die(MBD_EXIT_EVENTS);
+
+    if (journal_init() < 0)
+        mbd_die(MBD_EXIT_EVENTS);
+
+    if (stage_init() < 0)
+        mbd_die(MBD_EXIT_EVENTS);
+
+    if (!ll_atoi(ll_params[LL_MBD_JOB_ID_LEASE].val, &job_id_lease)
+        || job_id_lease < 0) {
+        LL_ERRX("invalid LL_MBD_JOB_ID_LEASE=%s using default=1000",
+                ll_params[LL_MBD_JOB_ID_LEASE].val);
+        job_id_lease = 1000;
+    }
 
     if (!ll_atoi(ll_params[LL_MBD_JOB_FINISH_THRESHOLD].val,
                  &job_finish_threshold)) {
@@ -799,6 +866,42 @@ int events_init(void)
         job_finish_threshold = 1000;
     }
 
+    if (!ll_atoi(ll_params[LL_MBD_CHECKPOINT_INTERVAL].val,
+                 &checkpoint_interval) || checkpoint_interval < 0) {
+        LL_ERRX("invalid LL_MBD_CHECKPOINT_INTERVAL=%s using default=300",
+                ll_params[LL_MBD_CHECKPOINT_INTERVAL].val);
+        checkpoint_interval = 300;
+    }
+
+    if (!ll_atoi(ll_params[LL_MBD_REPLAY_THREADS].val, &replay_threads)
+        || replay_threads < 0) {
+        LL_ERRX("invalid LL_MBD_REPLAY_THREADS=%s using default=0",
+                ll_params[LL_MBD_REPLAY_THREADS].val);
+        replay_threads = 0;
+    }
+
+    n = snprintf(compact_path, sizeof(compact_path), "%s.compact",
+                 manifest_path);
+    if (n < 0 || n >= (int) sizeof(compact_path))
+        mbd_die(MBD_EXIT_EVENTS);
+    // left behind by a compaction that never reached its switchover
+    unlink(compact_path);
+
+    n = snprintf(checkpoint_path, sizeof(checkpoint_path), "%s/checkpoint",
+                 state_dir);
+    if (n < 0 || n >= (int) sizeof(checkpoint_path))
+        mbd_die(MBD_EXIT_EVENTS);
+    LL_INFO("checkpoint %s interval=%d", checkpoint_path, checkpoint_interval);
+
+    enum log_format format;
+    if (log_format_parse(ll_params[LL_MBD_MANIFEST_FORMAT].val, &format) < 0) {
+        LL_ERRX("invalid LL_MBD_MANIFEST_FORMAT=%s using default=text",
+                ll_params[LL_MBD_MANIFEST_FORMAT].val);
+        format = LOG_FORMAT_TEXT;
+    }
+    log_set_format(format);
+    LL_INFO("manifest format=%s", log_format_str(format));
+
     manifest_seq_scan();
 
     LL_INFO("manifest seq initialized seq=%u", manifest_seq);
@@ -812,6 +915,8 @@ int events_init(void)
  * Sets job_id_seq to max(current, persisted) so the event log replay
  * value and the persisted value are both respected. If the file does
  * not exist (first run) the value stays at whatever replay set it to.
+ * The file holds the end of the last lease, see job_id_seq_lease(), so
+ * numbering resumes past every id that lease may have handed out.
  *
  * Resist the temptation to delete this file as compact may leave a
  * manifest empty file so the job_id would go backwards.
@@ -840,61 +945,45 @@ static void job_id_seq_read(void)
                 seq, job_id_seq);
         job_id_seq = seq;
     }
+    job_id_leased = job_id_seq;
 }
 
-static void replay_job_move(const struct event_rec *rec)
+static void replay_job_move(const struct log_job_move *e)
 {
-    struct log_job_move e;
-    if (log_parse_job_move(rec, &e) < 0) {
-        LL_ERR("parse JOB_MOVE failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_MOVE job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_MOVE job_id=%ld not found", e->job_id);
         return;
     }
-    struct mbd_queue *to = ll_hash_search(&queue_name_hash, e.to_queue);
+    struct mbd_queue *to = ll_hash_search(&queue_name_hash, e->to_queue);
     if (to == NULL) {
         LL_ERRX("JOB_MOVE job_id=%ld queue=%s not found, orphaned",
-                e.job_id, e.to_queue);
+                e->job_id, e->to_queue);
         job->state = JOB_ORPHAN;
         return;
     }
     job->queue = to;
-    LL_DEBUG("JOB_MOVE job_id=%ld from=%s to=%s", e.job_id,
-             e.from_queue, e.to_queue);
+    LL_DEBUG("JOB_MOVE job_id=%ld from=%s to=%s", e->job_id,
+             e->from_queue, e->to_queue);
 }
 
-static void replay_job_priority(const struct event_rec *rec)
+static void replay_job_priority(const struct log_job_priority *e)
 {
-    struct log_job_priority e;
-    if (log_parse_job_priority(rec, &e) < 0) {
-        LL_ERR("parse JOB_PRIORITY failed");
-        return;
-    }
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_PRIORITY job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_PRIORITY job_id=%ld not found", e->job_id);
         return;
     }
-    job->priority = e.new_priority;
+    job->priority = e->new_priority;
     LL_DEBUG("JOB_PRIORITY job_id=%ld old=%d new=%d",
-             e.job_id, e.old_priority, e.new_priority);
+             e->job_id, e->old_priority, e->new_priority);
 }
 
-static void replay_job_pend(const struct event_rec *rec)
+static void replay_job_pend(const struct log_job_pend *e)
 {
-    struct log_job_pend e;
-
-    if (log_parse_job_pend(rec, &e) < 0) {
-        LL_ERR("parse JOB_PEND failed");
-        return;
-    }
-
-    struct job_data *job = job_find(e.job_id);
+    struct job_data *job = job_find(e->job_id);
     if (job == NULL) {
-        LL_ERRX("JOB_PEND job_id=%ld not found", e.job_id);
+        LL_ERRX("JOB_PEND job_id=%ld not found", e->job_id);
         return;
     }
 
@@ -908,7 +997,221 @@ static void replay_job_pend(const struct event_rec *rec)
     job->state = JOB_PENDING;
     job->run_nhosts = 0;
 
-    LL_DEBUG("JOB_PEND job_id=%ld", e.job_id);
+    LL_DEBUG("JOB_PEND job_id=%ld", e->job_id);
+}
+
+/*
+ * replay_record - apply one decoded record to the in-memory job state.
+ * Returns 1 when it created a job, 0 otherwise.
+ */
+int replay_record(const struct log_record *r, int64_t *max_id)
+{
+    if (r->rc < 0) {
+        LL_ERR("parse %s failed", log_event_name(r->type));
+        return 0;
+    }
+
+    switch (r->type) {
+    case EVENT_JOB_NEW:
+        return replay_job_new(&r->p.job_new, max_id);
+    case EVENT_JOB_START:
+        replay_job_start(&r->p.start);
+        break;
+    case EVENT_JOB_FORK:
+        replay_job_fork(&r->p.fork);
+        break;
+    case EVENT_JOB_SIGNAL:
+        replay_job_signal(&r->p.signal);
+        break;
+    case EVENT_JOB_FINISH:
+        replay_job_finish(&r->p.finish);
+        break;
+    case EVENT_JOB_PEND_SUSP:
+        replay_job_pend_susp(&r->p.pend_susp);
+        break;
+    case EVENT_JOB_PEND_RESUME:
+        replay_job_pending_resume(&r->p.pend_resume);
+        break;
+    case EVENT_JOB_SUSP:
+        replay_job_susp(&r->p.susp);
+        break;
+    case EVENT_JOB_MOVE:
+        replay_job_move(&r->p.move);
+        break;
+    case EVENT_JOB_PRIORITY:
+        replay_job_priority(&r->p.priority);
+        break;
+    case EVENT_JOB_PEND:
+        replay_job_pend(&r->p.pend);
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/*
+ * replay_stream - apply every record read from fp to the in-memory job
+ * state. Returns -1 when a record fails its checksum or is cut short,
+ * 0 otherwise, read errors are left for the caller to check with
+ * ferror(). *restored is incremented for every job created.
+ */
+static int replay_stream(FILE *fp, const char *path, int64_t *max_id,
+                         int *restored)
+{
+    struct event_rec rec;
+    struct log_record r;
+    int recno = 0;
+
+    for (;;) {
+        ++recno;
+        memset(&rec, 0, sizeof(struct event_rec));
+        errno = 0;
+        if (log_read_hdr(fp, &rec) < 0) {
+            /* A record that fails its checksum, is cut short or comes
+             * from a newer mbd ends the replay, everything before it
+             * has been applied. A torn tail is what a crash in the
+             * middle of an append leaves behind.
+             */
+            if (errno == EINVAL || errno == EBADMSG || errno == EPROTO) {
+                LL_ERRX("replay stopped at bad record file=%s record=%d: %s",
+                        path, recno, strerror(errno));
+                return -1;
+            }
+            return 0;
+        }
+        log_decode(&rec, &r);
+        *restored += replay_record(&r, max_id);
+    }
+}
+
+/* -----------------------------------------------------------------------
+ * checkpoint
+ *
+ * A checkpoint is the compacted image of every job held in memory,
+ * written by a forked child from its copy-on-write view of mbd, together
+ * with the manifest position it covers. At startup it is replayed in
+ * place of the manifest prefix and only the records appended after that
+ * position are read. Host, queue and token usage are not stored, they
+ * are rebuilt by replay_rebuild_counters() exactly as after a full
+ * replay.
+ *
+ * The header line records the manifest sequence, inode and size at fork
+ * time. A checkpoint that does not describe the live manifest, because
+ * a compaction rotated it or an admin replaced it, is ignored.
+ * ----------------------------------------------------------------------- */
+#define CHECKPOINT_VERSION 1
+
+struct checkpoint_hdr {
+    int version;
+    int64_t time;
+    uint32_t manifest_seq;
+    uint64_t manifest_ino;
+    int64_t offset;
+    int64_t job_id_seq;
+    int num_jobs;
+};
+
+/*
+ * checkpoint_discard - drop every job a rejected checkpoint created so
+ * the full manifest can be replayed from an empty state.
+ */
+static void checkpoint_discard(void)
+{
+    struct ll_list *lists[] = {&pend_jobs_list, &run_jobs_list,
+                               &finish_jobs_list};
+
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        struct ll_list_entry *e;
+        struct ll_list_entry *next;
+
+        for (e = lists[i]->head; e; e = next) {
+            next = e->next;
+            struct job_data *job = (struct job_data *) e;
+
+            ll_list_remove(lists[i], &job->ent);
+
+            char key[LL_BUFSIZ_32];
+            sprintf(key, "%ld", job->job_id);
+            ll_hash_remove(&job_id_hash, key);
+
+            job_free(job);
+        }
+    }
+}
+
+/*
+ * checkpoint_load - restore the jobs saved in the checkpoint if it
+ * matches the manifest open in mfp. Returns the manifest offset at
+ * which replay continues, 0 when there is no usable checkpoint and the
+ * whole manifest must be replayed.
+ */
+static off_t checkpoint_load(FILE *mfp, int64_t *max_id, int *restored)
+{
+    FILE *fp = fopen(checkpoint_path, "r");
+    if (fp == NULL) {
+        if (errno != ENOENT)
+            LL_ERR("fopen %s", checkpoint_path);
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fileno(mfp), &st) < 0) {
+        LL_ERR("fstat manifest=%s", manifest_path);
+        fclose(fp);
+        return 0;
+    }
+
+    char buf[LL_BUFSIZ_256];
+    struct checkpoint_hdr h;
+    memset(&h, 0, sizeof(h));
+
+    if (fgets(buf, sizeof(buf), fp) == NULL
+        || sscanf(buf, "CHECKPOINT %d %ld %u %lu %ld %ld %d", &h.version,
+                  &h.time, &h.manifest_seq, &h.manifest_ino, &h.offset,
+                  &h.job_id_seq, &h.num_jobs) != 7) {
+        LL_ERRX("checkpoint %s: bad header, ignored", checkpoint_path);
+        fclose(fp);
+        return 0;
+    }
+
+    if (h.version != CHECKPOINT_VERSION || h.manifest_seq != manifest_seq
+        || h.manifest_ino != (uint64_t) st.st_ino || h.offset <= 0
+        || h.offset > (int64_t) st.st_size) {
+        LL_INFO("checkpoint %s: seq=%u offset=%ld does not match manifest "
+                "seq=%u size=%ld, ignored", checkpoint_path, h.manifest_seq,
+                h.offset, manifest_seq, (long) st.st_size);
+        fclose(fp);
+        return 0;
+    }
+
+    int n = 0;
+    int64_t id = 0;
+    int rc = replay_stream(fp, checkpoint_path, &id, &n);
+    if (rc < 0 || ferror(fp) || n != h.num_jobs) {
+        LL_ERRX("checkpoint %s: restored %d of %d jobs, discarded, full "
+                "replay", checkpoint_path, n, h.num_jobs);
+        fclose(fp);
+        checkpoint_discard();
+        return 0;
+    }
+    fclose(fp);
+
+    if (h.job_id_seq > id)
+        id = h.job_id_seq;
+    *max_id = id;
+    *restored = n;
+
+    /* the manifest is unchanged since this checkpoint, nothing
+     * to write until new events arrive */
+    checkpoint_ino = st.st_ino;
+    checkpoint_offset = (off_t) h.offset;
+
+    LL_INFO("checkpoint loaded jobs=%d seq=%u offset=%ld time=%ld", n,
+            h.manifest_seq, h.offset, h.time);
+
+    return (off_t) h.offset;
 }
 
 int jobs_replay(void)
@@ -923,65 +1226,26 @@ int jobs_replay(void)
         mbd_die(MBD_EXIT_EVENTS);
     }
 
-    int lineno = 0;
     int restored = 0;
     int64_t max_id = 0;
 
-    for (;;) {
-        ++lineno;
-        struct event_rec rec;
-        memset(&rec, 0, sizeof(struct event_rec));
-        if (log_read_hdr(fp, &rec) < 0)
-            break;
-        if (rec.type == EVENT_JOB_NEW) {
-            restored += replay_job_new(&rec, &max_id);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_START) {
-            replay_job_start(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_FORK) {
-            replay_job_fork(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_SIGNAL) {
-            replay_job_signal(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_FINISH) {
-            replay_job_finish(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_PEND_SUSP) {
-            replay_job_pend_susp(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_PEND_RESUME) {
-            replay_job_pending_resume(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_SUSP) {
-            replay_job_susp(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_MOVE) {
-            replay_job_move(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_PRIORITY) {
-            replay_job_priority(&rec);
-            continue;
-        }
-        if (rec.type == EVENT_JOB_PEND) {
-            replay_job_pend(&rec);
-            continue;
-        }
+    /* Start from the checkpoint when it matches this manifest, then
+     * read only the records appended after it.
+     */
+    off_t offset = checkpoint_load(fp, &max_id, &restored);
+    if (offset > 0 && fseeko(fp, offset, SEEK_SET) < 0) {
+        LL_ERR("fseeko manifest=%s offset=%ld", manifest_path, (long) offset);
+        mbd_die(MBD_EXIT_EVENTS);
     }
 
+    if (replay_threads == 0
+        || replay_parallel(fileno(fp), offset, manifest_path, replay_threads,
+                           &max_id, &restored) < 0)
+        replay_stream(fp, manifest_path, &max_id, &restored);
+
     if (ferror(fp)) {
         fclose(fp);
-        LL_ERR("I/O error reading job manifest=%s line=%d", manifest_path, lineno);
+        LL_ERR("I/O error reading job manifest=%s", manifest_path);
         mbd_die(MBD_EXIT_EVENTS);
     }
 
@@ -999,12 +1263,15 @@ int jobs_replay(void)
     // debug
     mbd_assert_counters();
 
+    script_store_sweep();
+    journal_sweep();
+
     LL_INFO("replay: done, %d jobs restored, job_id_seq=%ld", restored,
             job_id_seq);
     return restored;
 }
 
-static void compact_write_job_new(FILE *fp, const struct job_data *job)
+static int compact_write_job_new(FILE *fp, const struct job_data *job)
 {
     struct log_job_new e;
     memset(&e, 0, sizeof(e));
@@ -1036,12 +1303,15 @@ static void compact_write_job_new(FILE *fp, const struct job_data *job)
     ll_strlcpy(e.tokenpool, job->res.tokenpool_str, sizeof(e.tokenpool));
     ll_strlcpy(e.machines, job->res.machines_str, sizeof(e.machines));
     ll_strlcpy(e.depend_cond, job->depend_cond, sizeof(e.depend_cond));
+    ll_strlcpy(e.script, job->script, sizeof(e.script));
+    e.journal_seq = job->journal.seq;
+    e.journal_off = job->journal.off;
+    e.journal_len = job->journal.len;
 
-    if (log_write_job_new(fp, &e) < 0)
-        mbd_die(MBD_EXIT_EVENTS);
+    return log_write_job_new(fp, &e);
 }
 
-static void compact_write_job_start(FILE *fp, const struct job_data *job)
+static int compact_write_job_start(FILE *fp, const struct job_data *job)
 {
     struct log_job_start e;
     memset(&e, 0, sizeof(e));
@@ -1052,6 +1322,7 @@ static void compact_write_job_start(FILE *fp, const struct job_data *job)
     e.cpus_per_host = job->res.num_cpus;
     e.gpus_per_host = job->res.num_gpus;
     ll_strlcpy(e.gpu_model, job->res.gpu_model, sizeof(e.gpu_model));
+    ll_strlcpy(e.gpu_assigned, job->gpu_assigned, sizeof(e.gpu_assigned));
 
     for (int i = 0; i < job->res.num_hosts; i++) {
         if (i > 0)
@@ -1059,11 +1330,10 @@ static void compact_write_job_start(FILE *fp, const struct job_data *job)
         ll_strlcat(e.hosts, job->run_hosts[i]->net.name, sizeof(e.hosts));
     }
 
-    if (log_write_job_start(fp, &e) < 0)
-        mbd_die(MBD_EXIT_EVENTS);
+    return log_write_job_start(fp, &e);
 }
 
-static void compact_write_job_fork(FILE *fp, const struct job_data *job)
+static int compact_write_job_fork(FILE *fp, const struct job_data *job)
 {
     struct log_job_fork e;
     memset(&e, 0, sizeof(e));
@@ -1072,11 +1342,10 @@ static void compact_write_job_fork(FILE *fp, const struct job_data *job)
     e.fork_time = job->fork_time;
     e.job_pid = job->pid;
 
-    if (log_write_job_fork(fp, &e) < 0)
-        mbd_die(MBD_EXIT_EVENTS);
+    return log_write_job_fork(fp, &e);
 }
 
-static void compact_write_job_finish(FILE *fp, const struct job_data *job)
+static int compact_write_job_finish(FILE *fp, const struct job_data *job)
 {
     struct log_job_finish e;
     memset(&e, 0, sizeof(e));
@@ -1087,8 +1356,7 @@ static void compact_write_job_finish(FILE *fp, const struct job_data *job)
     e.exit_status = job->exit_status;
     e.end_time = job->end_time;
 
-    if (log_write_job_finish(fp, &e) < 0)
-        mbd_die(MBD_EXIT_EVENTS);
+    return log_write_job_finish(fp, &e);
 }
 
 /*
@@ -1106,25 +1374,69 @@ static void compact_write_job_finish(FILE *fp, const struct job_data *job)
  * job can be rejected by sbd and never fork at all, so a started job
  * with no fork is a real, expected case -- not a state to assert against.
  */
-static void compact_write_job_finished(FILE *fp, const struct job_data *job)
+static int compact_write_job_finished(FILE *fp, const struct job_data *job)
 {
-    compact_write_job_new(fp, job);
+    if (compact_write_job_new(fp, job) < 0)
+        return -1;
     if (job->dispatch_time) {
-        compact_write_job_start(fp, job);
-        if (job->fork_time)
-            compact_write_job_fork(fp, job);
+        if (compact_write_job_start(fp, job) < 0)
+            return -1;
+        if (job->fork_time && compact_write_job_fork(fp, job) < 0)
+            return -1;
     }
-    compact_write_job_finish(fp, job);
+    return compact_write_job_finish(fp, job);
 }
 
 /*
- * job_id_seq_write - persist the current job_id_seq to disk.
- *
- * Called after every job submission so that mbd restart after a full
- * compaction (empty manifest) still resumes from the correct sequence
- * number and never reuses a job_id.
+ * compact_write_job_susp - a suspended running job is rewritten as
+ * START followed by SUSP, replay_job_start() alone leaves it RUNNING.
+ */
+static int compact_write_job_susp(FILE *fp, const struct job_data *job)
+{
+    struct log_job_susp e;
+    memset(&e, 0, sizeof(e));
+
+    e.job_id = job->job_id;
+    e.event_time = job->susp_time;
+    if (e.event_time == 0)
+        e.event_time = job->dispatch_time;
+
+    return log_write_job_susp(fp, &e);
+}
+
+/*
+ * compact_write_live - rewrite every pending and running job, the part
+ * of the in-memory state shared by compaction and checkpoints.
+ */
+static int compact_write_live(FILE *fp)
+{
+    struct ll_list_entry *e;
+
+    for (e = pend_jobs_list.head; e; e = e->next) {
+        if (compact_write_job_new(fp, (struct job_data *) e) < 0)
+            return -1;
+    }
+
+    for (e = run_jobs_list.head; e; e = e->next) {
+        struct job_data *job = (struct job_data *) e;
+
+        if (compact_write_job_new(fp, job) < 0)
+            return -1;
+        if (compact_write_job_start(fp, job) < 0)
+            return -1;
+        if (job->fork_time && compact_write_job_fork(fp, job) < 0)
+            return -1;
+        if (job->state == JOB_SUSPENDED && compact_write_job_susp(fp, job) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * job_id_seq_write - persist seq as the job_id_seq to disk.
  */
-void job_id_seq_write(void)
+static void job_id_seq_write(int64_t seq)
 {
     char path[PATH_MAX];
     snprintf(path, sizeof(path), "%s/mbd/job_id_seq",
@@ -1138,7 +1450,7 @@ void job_id_seq_write(void)
         LL_ERR("fopen job_id_seq=%s: %m", tmp);
         mbd_die(MBD_EXIT_EVENTS);
     }
-    fprintf(fp, "%ld\n", job_id_seq);
+    fprintf(fp, "%ld\n", seq);
     if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
         LL_ERR("fsync job_id_seq failed");
         fclose(fp);
@@ -1150,81 +1462,304 @@ void job_id_seq_write(void)
         LL_ERR("rename job_id_seq %s -> %s: %m", tmp, path);
         mbd_die(MBD_EXIT_EVENTS);
     }
+    if (sync_state_dir() < 0)
+        mbd_die(MBD_EXIT_EVENTS);
 }
 
-static void manifest_rebuild(void)
+/*
+ * job_id_seq_lease - called after every job submission so that mbd
+ * restart after a full compaction (empty manifest) still resumes from
+ * the correct sequence number and never reuses a job_id. Instead of the
+ * sequence itself the file holds the end of a lease of job_id_lease ids
+ * and is rewritten only once the submissions have used them up; a
+ * restart skips what is left of the lease.
+ */
+void job_id_seq_lease(void)
 {
-    char archived[PATH_MAX + LL_BUFSIZ_32];
-    /*
-     * Sequence number is derived by manifest_seq_scan() at startup from
-     * the filenames already present in the directory. No separate sequence
-     * file is kept, so admins may delete old archives freely without
-     * having to update any state.
-     */
-    manifest_seq++;
-    snprintf(archived, sizeof(archived), "%s.%u", manifest_path, manifest_seq);
+    if (job_id_seq <= job_id_leased)
+        return;
 
-    if (rename(manifest_path, archived) < 0) {
-        LL_ERR("rename(%s, %s)", manifest_path, archived);
-        mbd_die(MBD_EXIT_EVENTS);
-    }
+    job_id_leased = job_id_seq + job_id_lease;
+    job_id_seq_write(job_id_leased);
+}
 
-    int fd = open(manifest_path, O_CREAT | O_WRONLY | O_APPEND, 0640);
+/*
+ * event_sync - flush the manifest to disk, for the group commit of the
+ * submit journal.
+ */
+void event_sync(void)
+{
+    int fd = open(manifest_path, O_WRONLY | O_APPEND);
     if (fd < 0) {
         LL_ERR("open=%s", manifest_path);
         mbd_die(MBD_EXIT_EVENTS);
     }
-
-    FILE *fp = fdopen(fd, "a");
-    if (!fp) {
-        LL_ERR("fdopen=%s", manifest_path);
+    if (fdatasync(fd) < 0) {
+        LL_ERR("fdatasync manifest=%s", manifest_path);
         close(fd);
         mbd_die(MBD_EXIT_EVENTS);
     }
+    close(fd);
+}
 
-    struct ll_list_entry *e;
-    struct ll_list_entry *next;
-
-    for (e = pend_jobs_list.head; e; e = e->next)
-        compact_write_job_new(fp, (struct job_data *) e);
+/* -----------------------------------------------------------------------
+ * compaction
+ *
+ * Compaction rewrites the manifest with only the records needed to
+ * rebuild the jobs still in memory. It runs in a forked child that
+ * writes manifest.compact from its copy-on-write view of the job lists,
+ * so the event loop only pays for the fork. Events logged while the
+ * child runs keep going to the live manifest. Once the child is done
+ * the parent appends that tail to manifest.compact, archives the live
+ * manifest as manifest.<seq> with a hard link and renames
+ * manifest.compact over it, so a crash at any point leaves a complete
+ * manifest in place. The finished jobs the child leaves out are freed
+ * by the parent only then: freeing them while the child runs would
+ * copy every page they touch.
+ * ----------------------------------------------------------------------- */
 
-    for (e = run_jobs_list.head; e; e = e->next) {
-        struct job_data *job = (struct job_data *) e;
-        compact_write_job_new(fp, job);
-        compact_write_job_start(fp, job);
-        if (job->fork_time)
-            compact_write_job_fork(fp, job);
+/*
+ * compact_retained - whether a finished job has to survive compaction.
+ *
+ * Every finished job is dropped from memory on compaction unless
+ * something still needs it: a pending job's dependency expression
+ * still references it, or it's an array head with elements still
+ * running/pending. No partial retain window -- either a job is
+ * still referenced or it isn't.
+ */
+static int compact_retained(const struct job_data *job)
+{
+    /* still referenced by a pending job's dependency expression,
+     * purging it now would leave that job unable to ever resolve */
+    if (job->dep_refcnt > 0) {
+        LL_DEBUG("job_id=%ld retained by compaction dep_refcnt=%d",
+                 job->job_id, job->dep_refcnt);
+        return 1;
     }
 
+    /* array head: other elements may still be pending/running and
+     * need job_find(array_id) to resolve array_start/end/stride */
+    if (job->array_id == job->job_id && job->array_id != 0
+        && job->array_element_cnt > 0) {
+        LL_DEBUG("job_id=%ld retained by compaction array_element_cnt=%d",
+                 job->job_id, job->array_element_cnt);
+        return 1;
+    }
 
-    /*
-     * Every finished job is dropped from memory on compaction unless
-     * something still needs it: a pending job's dependency expression
-     * still references it, or it's an array head with elements still
-     * running/pending. No partial retain window -- either a job is
-     * still referenced or it isn't.
-     */
-    for (e = finish_jobs_list.head; e; e = next) {
-        next = e->next;
+    return 0;
+}
+
+/*
+ * compact_write - child side, write the compacted manifest from the
+ * state frozen at fork time: every pending and running job and the
+ * finished jobs compact_retained() keeps.
+ */
+static int compact_write(void)
+{
+    FILE *fp = fopen(compact_path, "w");
+    if (fp == NULL) {
+        LL_ERR("fopen compact=%s", compact_path);
+        return -1;
+    }
 
-        struct job_data *job = (struct job_data *)e;
+    if (compact_write_live(fp) < 0) {
+        LL_ERR("write compact=%s", compact_path);
+        fclose(fp);
+        return -1;
+    }
 
-        /* still referenced by a pending job's dependency expression,
-         * purging it now would leave that job unable to ever resolve */
-        if (job->dep_refcnt > 0) {
-            LL_DEBUG("job_id=%ld retained by compaction dep_refcnt=%d",
-                     job->job_id, job->dep_refcnt);
-            compact_write_job_finished(fp, job);
+    struct ll_list_entry *e;
+    for (e = finish_jobs_list.head; e; e = e->next) {
+        struct job_data *job = (struct job_data *) e;
+
+        if (!compact_retained(job))
             continue;
+        if (compact_write_job_finished(fp, job) < 0) {
+            LL_ERR("write compact=%s", compact_path);
+            fclose(fp);
+            return -1;
+        }
+    }
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        LL_ERR("fsync compact=%s", compact_path);
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    return 0;
+}
+
+/*
+ * compact_select - parent side, before the fork, list the finished jobs
+ * the child will not write. They stay in memory until the switchover.
+ */
+static int compact_select(void)
+{
+    int n = ll_list_count(&finish_jobs_list);
+
+    compact_ndrop = 0;
+    compact_drop = calloc(n + 1, sizeof(struct job_data *));
+    if (compact_drop == NULL) {
+        LL_ERR("calloc compact_drop n=%d", n);
+        return -1;
+    }
+
+    struct ll_list_entry *e;
+    for (e = finish_jobs_list.head; e; e = e->next) {
+        struct job_data *job = (struct job_data *) e;
+
+        if (!compact_retained(job))
+            compact_drop[compact_ndrop++] = job;
+    }
+
+    return 0;
+}
+
+/*
+ * spool_reap_add - queue the directory of a purged job for the next
+ * spool reaper child.
+ */
+static void spool_reap_add(int64_t job_id)
+{
+    if (spool_reap_rate == 0)
+        return;
+
+    if (spool_reap_nids == spool_reap_max) {
+        int max = spool_reap_max ? spool_reap_max * 2 : 1024;
+        int64_t *ids = realloc(spool_reap_ids, max * sizeof(int64_t));
+        if (ids == NULL) {
+            /* the directory stays, bhist keeps showing the job details */
+            LL_ERR("realloc spool reap list max=%d", max);
+            return;
+        }
+        spool_reap_ids = ids;
+        spool_reap_max = max;
+    }
+    spool_reap_ids[spool_reap_nids++] = job_id;
+}
+
+/*
+ * spool_reap_segment - queue a submit journal segment no job refers to
+ * any longer. The child removes it after the directories, so bhist never
+ * sees a job whose directory outlived its sidecar.
+ */
+void spool_reap_segment(uint32_t seq)
+{
+    if (spool_reap_rate == 0)
+        return;
+
+    if (spool_reap_nsegs == spool_reap_segmax) {
+        int max = spool_reap_segmax ? spool_reap_segmax * 2 : 16;
+        uint32_t *segs = realloc(spool_reap_segs, max * sizeof(uint32_t));
+        if (segs == NULL) {
+            LL_ERR("realloc spool reap segments max=%d", max);
+            return;
+        }
+        spool_reap_segs = segs;
+        spool_reap_segmax = max;
+    }
+    spool_reap_segs[spool_reap_nsegs++] = seq;
+}
+
+/*
+ * spool_reap_start - remove the directories of the purged jobs in a
+ * child, at most spool_reap_rate per second so that a compaction that
+ * purged many jobs does not flood the state filesystem with unlinks,
+ * then the journal segments queued with them. The child works on its
+ * copy of the lists; jobs purged while it runs wait for the next child.
+ * The lists are lost if mbd stops first, those directories are then
+ * left behind and the segments removed by the child of the next run.
+ */
+static void spool_reap_start(void)
+{
+    if (spool_reap_pid > 0
+        || (spool_reap_nids == 0 && spool_reap_nsegs == 0))
+        return;
+
+    spool_reap_pid = fork();
+    if (spool_reap_pid < 0) {
+        spool_reap_pid = 0;
+        LL_ERR("fork(spool reap)");
+        return;
+    }
+
+    if (spool_reap_pid == 0) {
+        reset_signals();
+        ll_setlogtag("spool reap child");
+
+        struct spool_rate rate;
+        int removed = 0;
+
+        spool_rate_init(&rate, spool_reap_rate);
+        for (int i = 0; i < spool_reap_nids; i++) {
+            char dir[PATH_MAX];
+            if (spool_find_dir(dir, sizeof(dir), jobs_dir,
+                               spool_reap_ids[i]) < 0)
+                continue;
+            if (spool_remove_dir(dir) < 0)
+                LL_ERR("remove %s", dir);
+            else
+                removed++;
+            spool_rate_wait(&rate);
         }
+        int segs = 0;
+        for (int i = 0; i < spool_reap_nsegs; i++) {
+            char path[PATH_MAX];
+            if (spool_journal_path(path, sizeof(path), state_dir,
+                                   spool_reap_segs[i]) < 0)
+                continue;
+            if (unlink(path) < 0 && errno != ENOENT)
+                LL_ERR("unlink %s", path);
+            else
+                segs++;
+            spool_rate_wait(&rate);
+        }
+        LL_INFO("spool reap removed=%d of %d segments=%d", removed,
+                spool_reap_nids, segs);
+        _exit(0);
+    }
+
+    LL_DEBUG("spool reap started pid=%d jobs=%d segments=%d",
+             (int) spool_reap_pid, spool_reap_nids, spool_reap_nsegs);
+    spool_reap_nids = 0;
+    spool_reap_nsegs = 0;
+}
+
+static void spool_reap_collect(void)
+{
+    int status;
+
+    if (spool_reap_pid > 0) {
+        pid_t pid = waitpid(spool_reap_pid, &status, WNOHANG);
+        if (pid == 0)
+            return;
+        spool_reap_pid = 0;
+
+        if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            LL_ERRX("spool reap child failed status=0x%x", status);
+    }
 
-        /* array head: other elements may still be pending/running and
-         * need job_find(array_id) to resolve array_start/end/stride */
-        if (job->array_id == job->job_id && job->array_id != 0
-            && job->array_element_cnt > 0) {
-            LL_DEBUG("job_id=%ld retained by compaction array_element_cnt=%d",
-                     job->job_id, job->array_element_cnt);
-            compact_write_job_finished(fp, job);
+    spool_reap_start();
+}
+
+/*
+ * compact_purge - parent side, at the switchover, free the finished
+ * jobs the child did not write. A job that became referenced while the
+ * child ran, by a new dependency, is kept and its records appended to
+ * the compacted manifest instead.
+ */
+static int compact_purge(FILE *fp, int *purged)
+{
+    *purged = 0;
+
+    for (int i = 0; i < compact_ndrop; i++) {
+        struct job_data *job = compact_drop[i];
+
+        if (compact_retained(job)) {
+            if (compact_write_job_finished(fp, job) < 0)
+                return -1;
             continue;
         }
 
@@ -1236,24 +1771,302 @@ static void manifest_rebuild(void)
         struct job_data *j2 = ll_hash_remove(&job_id_hash, key);
         assert(j2 == job);
 
+        spool_reap_add(job->job_id);
+        job_tombstone(job);
         job_free(job);
+        (*purged)++;
     }
 
-    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0)
-        mbd_die(MBD_EXIT_EVENTS);
+    return 0;
+}
+
+static void compact_select_free(void)
+{
+    free(compact_drop);
+    compact_drop = NULL;
+    compact_ndrop = 0;
+}
+
+/*
+ * compact_tail - append to manifest.compact the records the parent
+ * logged while the child was writing it, everything in the live
+ * manifest past compact_offset, then drop the jobs left out.
+ */
+static int compact_tail(off_t *tail, int *purged)
+{
+    FILE *in = fopen(manifest_path, "r");
+    if (in == NULL) {
+        LL_ERR("fopen manifest=%s", manifest_path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fileno(in), &st) < 0 || st.st_ino != compact_ino
+        || st.st_size < compact_offset) {
+        LL_ERRX("manifest=%s changed during compaction", manifest_path);
+        fclose(in);
+        return -1;
+    }
+
+    if (fseeko(in, compact_offset, SEEK_SET) < 0) {
+        LL_ERR("fseeko manifest=%s offset=%ld", manifest_path,
+               (long) compact_offset);
+        fclose(in);
+        return -1;
+    }
+
+    FILE *out = fopen(compact_path, "a");
+    if (out == NULL) {
+        LL_ERR("fopen compact=%s", compact_path);
+        fclose(in);
+        return -1;
+    }
+
+    char buf[LL_BUFSIZ_8K];
+    size_t n;
+    *tail = 0;
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n)
+            break;
+        *tail += (off_t) n;
+    }
+
+    int rc = 0;
+    if (ferror(in) || ferror(out)) {
+        LL_ERR("copy manifest tail to compact=%s", compact_path);
+        rc = -1;
+    }
+
+    if (rc == 0 && compact_purge(out, purged) < 0) {
+        LL_ERR("write compact=%s", compact_path);
+        rc = -1;
+    }
+
+    if (rc == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0)) {
+        LL_ERR("fsync compact=%s", compact_path);
+        rc = -1;
+    }
+
+    fclose(in);
+    fclose(out);
+    return rc;
+}
+
+/*
+ * index_start - build the index of a freshly rotated archive in a
+ * child, the archive is immutable from now on so the child needs
+ * nothing from mbd but its name. A rotation that finds the previous
+ * child still running leaves its archive without an index, bhist then
+ * scans it in full until bmanifest --index builds one.
+ */
+static void index_start(const char *archived)
+{
+    if (index_pid > 0) {
+        LL_INFO("index of %s skipped, previous index child pid=%d running",
+                archived, (int) index_pid);
+        return;
+    }
+
+    index_pid = fork();
+    if (index_pid < 0) {
+        index_pid = 0;
+        LL_ERR("fork(index)");
+        return;
+    }
+
+    if (index_pid == 0) {
+        reset_signals();
+        ll_setlogtag("index child");
+
+        if (log_index_build(archived) < 0) {
+            LL_ERR("log_index_build %s", archived);
+            _exit(1);
+        }
+        _exit(0);
+    }
+}
+
+static void index_reap(void)
+{
+    int status;
+
+    if (index_pid <= 0)
+        return;
+
+    pid_t pid = waitpid(index_pid, &status, WNOHANG);
+    if (pid == 0)
+        return;
+    index_pid = 0;
+
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        LL_ERRX("archive index child failed status=0x%x", status);
+}
+
+/*
+ * compact_switch - make manifest.compact the live manifest and keep the
+ * old one as the next manifest.<seq> archive.
+ */
+static int compact_switch(off_t *tail, int *purged)
+{
+    char archived[PATH_MAX + LL_BUFSIZ_32];
+
+    if (compact_tail(tail, purged) < 0)
+        return -1;
+
+    /*
+     * Sequence number is derived by manifest_seq_scan() at startup from
+     * the filenames already present in the directory. No separate sequence
+     * file is kept, so admins may delete old archives freely without
+     * having to update any state.
+     */
+    snprintf(archived, sizeof(archived), "%s.%u", manifest_path,
+             manifest_seq + 1);
+
+    /* link, not rename, so manifest never goes missing */
+    if (link(manifest_path, archived) < 0) {
+        LL_ERR("link(%s, %s)", manifest_path, archived);
+        return -1;
+    }
+
+    if (rename(compact_path, manifest_path) < 0) {
+        LL_ERR("rename(%s, %s)", compact_path, manifest_path);
+        unlink(archived);
+        return -1;
+    }
+    manifest_seq++;
+    /* the switch is done either way, a failed sync is only logged */
+    sync_state_dir();
 
     /* new manifest file has a new inode -- update tracking so
      * open_manifest() does not falsely detect integrity loss */
     struct stat st;
-    if (fstat(fileno(fp), &st) < 0) {
-        LL_ERR("fstat manifest after compact");
+    if (stat(manifest_path, &st) < 0) {
+        LL_ERR("stat manifest after compact");
         mbd_die(MBD_EXIT_EVENTS);
     }
     manifest_ino = st.st_ino;
 
-    fclose(fp);
-
     LL_INFO("manifest rebuild seq=%u archived=%s", manifest_seq, archived);
+    index_start(archived);
+    return 0;
+}
+
+static int64_t elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (int64_t) (t1.tv_sec - t0->tv_sec) * 1000
+        + (t1.tv_nsec - t0->tv_nsec) / 1000000;
+}
+
+/*
+ * compact_reap - collect the compaction child and, if it succeeded,
+ * switch to the manifest it wrote. Logs the compaction metrics: the
+ * wall time from fork to switchover and the time the event loop was
+ * held, by the fork and purge and then by the switchover.
+ */
+static void compact_reap(void)
+{
+    int status;
+
+    if (compact_pid <= 0)
+        return;
+
+    pid_t pid = waitpid(compact_pid, &status, WNOHANG);
+    if (pid == 0)
+        return;
+    compact_pid = 0;
+
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        LL_ERRX("compaction child failed status=0x%x, manifest kept",
+                status);
+        unlink(compact_path);
+        compact_select_free();
+        return;
+    }
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    off_t tail = 0;
+    int purged = 0;
+    int rc = compact_switch(&tail, &purged);
+    compact_select_free();
+    if (rc < 0) {
+        /* jobs purged before the failure are still in the old
+         * manifest, a restart brings them back as finished jobs */
+        LL_ERRX("compaction switchover failed, manifest kept");
+        unlink(compact_path);
+        return;
+    }
+
+    int64_t switch_ms = elapsed_ms(&t0);
+    int64_t stall_ms = compact_stats.fork_ms + switch_ms;
+
+    compact_stats.runs++;
+    compact_stats.last_ms = elapsed_ms(&compact_stats.start);
+    compact_stats.last_stall_ms = stall_ms;
+    if (stall_ms > compact_stats.max_stall_ms)
+        compact_stats.max_stall_ms = stall_ms;
+
+    /* the purged jobs dropped their script references */
+    script_store_gc();
+    journal_gc();
+    spool_reap_start();
+
+    LL_INFO("compaction done runs=%ld duration_ms=%ld stall_ms=%ld "
+            "fork_ms=%ld switch_ms=%ld tail_bytes=%ld purged=%d "
+            "max_stall_ms=%ld", compact_stats.runs, compact_stats.last_ms,
+            stall_ms, compact_stats.fork_ms, switch_ms, (long) tail, purged,
+            compact_stats.max_stall_ms);
+}
+
+/*
+ * manifest_rebuild - start a compaction in a child process.
+ */
+static void manifest_rebuild(void)
+{
+    struct stat st;
+    if (stat(manifest_path, &st) < 0) {
+        LL_ERR("stat manifest=%s", manifest_path);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &compact_stats.start);
+
+    /* Every event is appended and closed before its in-memory change,
+     * so the manifest size now is exactly the position the child's
+     * snapshot covers.
+     */
+    compact_ino = st.st_ino;
+    compact_offset = st.st_size;
+
+    if (compact_select() < 0)
+        return;
+
+    compact_pid = fork();
+    if (compact_pid < 0) {
+        compact_pid = 0;
+        LL_ERR("fork(compact)");
+        compact_select_free();
+        return;
+    }
+
+    if (compact_pid == 0) {
+        reset_signals();
+        ll_setlogtag("compact child");
+
+        if (compact_write() < 0)
+            _exit(1);
+        _exit(0);
+    }
+
+    compact_stats.fork_ms = elapsed_ms(&compact_stats.start);
+
+    LL_INFO("compaction started pid=%d offset=%ld drop=%d fork_ms=%ld",
+            (int) compact_pid, (long) compact_offset, compact_ndrop,
+            compact_stats.fork_ms);
 }
 
 /* Rebuild the event log when the number of finished jobs
@@ -1261,6 +2074,13 @@ static void manifest_rebuild(void)
  */
 void maybe_rebuild_manifest(void)
 {
+    index_reap();
+    spool_reap_collect();
+    compact_reap();
+
+    if (compact_pid > 0)
+        return;
+
     if (ll_list_count(&finish_jobs_list) < job_finish_threshold)
         return;
 
@@ -1270,6 +2090,160 @@ void maybe_rebuild_manifest(void)
     manifest_rebuild();
 }
 
+/*
+ * checkpoint_write - write every job in memory after the header line,
+ * as log records in the configured format, to a temporary file that is
+ * renamed over the previous checkpoint once it is on disk.
+ */
+static int checkpoint_write(const struct checkpoint_hdr *h)
+{
+    char tmp[PATH_MAX + LL_BUFSIZ_64];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", checkpoint_path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        LL_ERR("fopen checkpoint=%s", tmp);
+        return -1;
+    }
+
+    fprintf(fp, "CHECKPOINT %d %ld %u %lu %ld %ld %d\n", h->version, h->time,
+            h->manifest_seq, h->manifest_ino, h->offset, h->job_id_seq,
+            h->num_jobs);
+
+    if (compact_write_live(fp) < 0) {
+        LL_ERR("write checkpoint=%s", tmp);
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+
+    struct ll_list_entry *e;
+    for (e = finish_jobs_list.head; e; e = e->next) {
+        if (compact_write_job_finished(fp, (struct job_data *) e) < 0) {
+            LL_ERR("write checkpoint=%s", tmp);
+            fclose(fp);
+            unlink(tmp);
+            return -1;
+        }
+    }
+
+    if (fflush(fp) != 0 || fsync(fileno(fp)) != 0) {
+        LL_ERR("fsync checkpoint=%s", tmp);
+        fclose(fp);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(fp);
+
+    if (rename(tmp, checkpoint_path) < 0) {
+        LL_ERR("rename checkpoint %s -> %s", tmp, checkpoint_path);
+        unlink(tmp);
+        return -1;
+    }
+    if (sync_state_dir() < 0)
+        return -1;
+
+    return 0;
+}
+
+static void checkpoint_reap(void)
+{
+    int status;
+
+    if (checkpoint_pid <= 0)
+        return;
+
+    pid_t pid = waitpid(checkpoint_pid, &status, WNOHANG);
+    if (pid == 0)
+        return;
+
+    if (pid < 0)
+        LL_ERR("waitpid checkpoint pid=%d", (int) checkpoint_pid);
+    else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        LL_ERRX("checkpoint child pid=%d failed status=0x%x",
+                (int) checkpoint_pid, status);
+    else
+        LL_DEBUG("checkpoint child pid=%d done", (int) checkpoint_pid);
+
+    checkpoint_pid = 0;
+}
+
+/*
+ * maybe_checkpoint - every LL_MBD_CHECKPOINT_INTERVAL seconds fork a
+ * child that writes the current job state to the checkpoint file. The
+ * parent only pays for the fork, the child sees a frozen copy of the
+ * job lists while mbd keeps appending to the manifest. Nothing is done
+ * while the manifest has not grown since the last checkpoint.
+ */
+void maybe_checkpoint(void)
+{
+    checkpoint_reap();
+
+    if (checkpoint_interval == 0 || checkpoint_pid > 0)
+        return;
+
+    time_t now = time(NULL);
+    if (now - checkpoint_last < checkpoint_interval)
+        return;
+
+    struct stat st;
+    if (stat(manifest_path, &st) < 0)
+        return;
+
+    if (st.st_size == 0
+        || (st.st_ino == checkpoint_ino && st.st_size == checkpoint_offset))
+        return;
+
+    checkpoint_last = now;
+
+    /* Every event is appended and closed before its in-memory change,
+     * so between two handlers the manifest size is exactly the
+     * position this state covers.
+     */
+    struct checkpoint_hdr h;
+    memset(&h, 0, sizeof(h));
+    h.version = CHECKPOINT_VERSION;
+    h.time = now;
+    h.manifest_seq = manifest_seq;
+    h.manifest_ino = st.st_ino;
+    h.offset = st.st_size;
+    h.job_id_seq = job_id_seq;
+    h.num_jobs = ll_list_count(&pend_jobs_list) + ll_list_count(&run_jobs_list)
+        + ll_list_count(&finish_jobs_list);
+
+    checkpoint_pid = fork();
+    if (checkpoint_pid < 0) {
+        checkpoint_pid = 0;
+        LL_ERR("fork(checkpoint)");
+        return;
+    }
+    if (checkpoint_pid > 0) {
+        checkpoint_ino = st.st_ino;
+        checkpoint_offset = st.st_size;
+        LL_DEBUG("checkpoint child pid=%d seq=%u offset=%ld jobs=%d",
+                 (int) checkpoint_pid, h.manifest_seq, h.offset, h.num_jobs);
+        return;
+    }
+
+    reset_signals();
+    ll_setlogtag("checkpoint child");
+
+    struct timespec t0;
+    struct timespec t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    if (checkpoint_write(&h) < 0)
+        _exit(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    LL_INFO("checkpoint written jobs=%d seq=%u offset=%ld elapsed_ms=%ld",
+            h.num_jobs, h.manifest_seq, h.offset,
+            (long) ((t1.tv_sec - t0.tv_sec) * 1000
+                    + (t1.tv_nsec - t0.tv_nsec) / 1000000));
+
+    _exit(0);
+}
+
 void event_job_move(const struct job_data *job, const char *to_queue)
 {
     struct log_job_move e;
@@ -6,13 +6,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include <syslog.h>
 #include <assert.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
 
-#include "base/lib/auth.h"
 #include "base/lib/ll.syslog.h"
 #include "base/lib/ll.conf.h"
 #include "base/lib/ll.list.h"
@@ -21,6 +21,7 @@
 #include "batch/lib/wire.h"
 #include "batch/lib/log.h"
 #include "batch/lib/dependency.h"
+#include "batch/lib/spool.h"
 
 struct ll_list pend_jobs_list;
 struct ll_list run_jobs_list;
@@ -41,6 +42,8 @@ static int64_t next_job_id(void)
 
 void job_free(struct job_data *job)
 {
+    script_unref(job->script);
+    journal_unref(&job->journal);
     dep_list_free(&job->deps);
     free(job->run_hosts);
     ll_hash_clear(&job->res.machines, NULL);
@@ -177,96 +180,26 @@ void machines_hash_populate(struct ll_hash *h, const char *machines)
     }
 }
 
-static int write_script(const struct job_data *job,
-                        const struct wire_job_script *script)
-{
-    char dir[PATH_MAX];
-    int n = snprintf(dir, sizeof(dir), "%s/%ld/%ld", jobs_dir,
-                     (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(dir))
-        return -1;
-
-    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
-        int e = errno;
-        LL_ERR("mkdir=%s", dir);
-        errno = e;
-        return -1;
-    }
-
-    char path[PATH_MAX];
-    n = snprintf(path, sizeof(path), "%s/%ld/%ld/script.sh", jobs_dir,
-                 (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(path))
-        return -1;
-
-    char tmp[PATH_MAX];
-    n = snprintf(tmp, sizeof(tmp), "%s/%ld/%ld/script.sh.tmp", jobs_dir,
-                 (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(tmp))
-        return -1;
-
-    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0700);
-    if (fd < 0) {
-        int e = errno;
-        LL_ERR("open %s", tmp);
-        errno = e;
-        return -1;
-    }
-
-    ssize_t nw = write(fd, script->data, script->len);
-    if (nw < 0 || (uint32_t) nw != script->len) {
-        int e = errno;
-        LL_ERR("write %s", tmp);
-        close(fd);
-        errno = e;
-        return -1;
-    }
-
-    if (fsync(fd) < 0) {
-        int e = errno;
-        LL_ERR("fsync %s", tmp);
-        close(fd);
-        errno = e;
-        return -1;
-    }
-    close(fd);
-
-    if (rename(tmp, path) < 0) {
-        int e = errno;
-        LL_ERR("rename %s -> %s", tmp, path);
-        errno = e;
-        return -1;
-    }
-
-    return 0;
-}
-
-static int write_sidecar(const struct job_data *job,
-                         const struct wire_job_submit *ws)
+/*
+ * journal_submit - append the submit sidecar of a submission to the
+ * submit journal, once for all its jobs. The records are the KEY=VALUE
+ * lines the per-job sidecar file used to hold.
+ */
+static int journal_submit(const struct wire_job_submit *ws,
+                          const struct protocol_header *hdr,
+                          const char *script, struct journal_ref *ref)
 {
-    char path[PATH_MAX];
-    int n = snprintf(path, sizeof(path), "%s/%ld/%ld/submit", jobs_dir,
-                     (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(path))
-        return -1;
+    char *buf = NULL;
+    size_t len = 0;
 
-    char tmp[PATH_MAX];
-    n = snprintf(tmp, sizeof(tmp), "%s/%ld/%ld/submit.tmp", jobs_dir,
-                 (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(tmp))
-        return -1;
-
-    FILE *fp = fopen(tmp, "w");
+    FILE *fp = open_memstream(&buf, &len);
     if (fp == NULL) {
-        int e = errno;
-        LL_ERR("fopen %s: %m", tmp);
-        errno = e;
+        LL_ERR("open_memstream");
         return -1;
     }
 
-    fprintf(fp, "JOB_ID=%ld\n", job->job_id);
-    fprintf(fp, "UID=%u\n", job->uid);
-    fprintf(fp, "GID=%u\n", job->gid);
+    fprintf(fp, "UID=%u\n", (uid_t) hdr->uid);
+    fprintf(fp, "GID=%u\n", (gid_t) hdr->gid);
     fprintf(fp, "USERNAME=%s\n", ws->username);
     fprintf(fp, "NAME=%s\n", ws->name);
     fprintf(fp, "QUEUE=%s\n", ws->queue);
@@ -291,31 +224,26 @@ static int write_sidecar(const struct job_data *job,
     fprintf(fp, "GPU_MODEL=%s\n", ws->gpu_model);
     fprintf(fp, "COMMENT=%s\n", ws->comment);
     fprintf(fp, "TOKENPOOL=%s\n", ws->tokenpool);
+    fprintf(fp, "SCRIPT=%s\n", script);
 
-    if (fflush(fp) != 0 || ferror(fp)) {
-        int e = errno;
-        LL_ERR("write error %s: %m", tmp);
-        fclose(fp);
-        errno = e;
-        return -1;
-    }
-    fclose(fp);
-
-    if (rename(tmp, path) < 0) {
-        int e = errno;
-        LL_ERR("rename %s -> %s: %m", tmp, path);
-        errno = e;
+    if (fclose(fp) != 0 || buf == NULL) {
+        LL_ERR("sidecar record");
+        free(buf);
         return -1;
     }
 
-    if (chmod(path, 0644) < 0) {
-        int e = errno;
-        LL_ERR("job_id=%ld chmod=%s to 644 failed", job->job_id, path);
-        errno = e;
-        return -1;
+    int cc = journal_append(buf, len, ref);
+    int e = errno;
+    if (cc == 0) {
+        /* the jobs are likely dispatched before it leaves the cache */
+        char key[STAGE_KEY_LEN];
+        stage_journal_key(key, sizeof(key), ref);
+        stage_put(key, buf, len);
     }
+    free(buf);
+    errno = e;
 
-    return 0;
+    return cc;
 }
 
 static int job_uses_host(struct job_data *job, struct mbd_host *h)
@@ -374,11 +302,13 @@ static int job_parse_tokens(struct job_data *job, const char *tokenpool)
 static int job_write_usage(const struct job_data *job,
                            const struct wire_job_finish *s)
 {
-    char dir[PATH_MAX + LL_BUFSIZ_32];
-    int n = snprintf(dir, sizeof(dir), "%s/%ld/%ld", jobs_dir,
-                     (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(dir))
+    /* created only now, a job submitted to the journal has no sidecar */
+    char dir[PATH_MAX];
+    if (spool_find_dir(dir, sizeof(dir), jobs_dir, job->job_id) < 0
+        && spool_create_dir(dir, sizeof(dir), jobs_dir, job->job_id) < 0) {
+        LL_ERR("job_id=%ld mkdir=%s", job->job_id, dir);
         return -1;
+    }
 
     char path[PATH_MAX + LL_BUFSIZ_64];
     snprintf(path, sizeof(path), "%s/usage", dir);
@@ -454,12 +384,6 @@ static void mbd_job_reject_dispatch(struct job_data *job)
     hdr.operation = BATCH_NEW_JOB_REPLY_ACK;
     hdr.status = MBD_OK;
 
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERR("job_id=%ld failed to sign header for host=%s",
-               job->job_id, h->net.name);
-        return;
-    }
-
     if (enqueue_payload(sbd_chan, &hdr, &ack, LL_BUFSIZ_1K,
                         xdr_wire_job_ack) < 0) {
         LL_ERR("job_id=%ld enqueue_payload failed", job->job_id);
@@ -601,7 +525,8 @@ static void job_register_error(int chan_id, int status)
 
 static struct job_data *
 job_prepare(struct wire_job_submit *ws,
-            const struct wire_job_script *script,
+            const char *script,
+            const struct journal_ref *journal,
             const struct protocol_header *hdr,
             int *err)
 {
@@ -616,19 +541,11 @@ job_prepare(struct wire_job_submit *ws,
     job->uid = (uid_t) hdr->uid;
     job->gid = (gid_t) hdr->gid;
 
-    if (write_script(job, script) < 0) {
-        *err = errno;
-        LL_ERR("write_script failed job_id=%ld", job->job_id);
-        job_free(job);
-        return NULL;
-    }
+    ll_strlcpy(job->script, script, sizeof(job->script));
+    script_ref(job->script);
 
-    if (write_sidecar(job, ws) < 0) {
-        *err = errno;
-        LL_ERR("write_sidecar failed job_id=%ld", job->job_id);
-        job_free(job);
-        return NULL;
-    }
+    job->journal = *journal;
+    journal_ref(&job->journal);
 
     if (job_parse_tokens(job, ws->tokenpool) < 0) {
         *err = errno;
@@ -652,9 +569,11 @@ job_prepare(struct wire_job_submit *ws,
 
 static void job_discard(struct job_data *job)
 {
-    /*
-     * TODO: remove the per-job directory and files before freeing the job.
-     */
+    char dir[PATH_MAX];
+
+    if (spool_job_dir(dir, sizeof(dir), jobs_dir, job->job_id) == 0
+        && spool_remove_dir(dir) < 0)
+        LL_ERR("job_id=%ld remove %s", job->job_id, dir);
     job_free(job);
 }
 
@@ -714,27 +633,18 @@ static void job_commit_prepared(struct ll_list *prepared,
     }
 }
 
-void job_register(XDR *xdrs, int chan_id,
-                  const struct protocol_header *hdr)
+/*
+ * job_submission_prepare - store the script of a submission, journal its
+ * sidecar and prepare its jobs on prepared, one per array element. The
+ * jobs stay private to the caller until job_commit_prepared(). With
+ * staged the script is left for script_store_sync(). Frees script->data.
+ * Returns 0, or -1 with *err set and nothing left on prepared.
+ */
+static int job_submission_prepare(struct wire_job_submit *ws,
+                                  struct wire_job_script *script, int staged,
+                                  const struct protocol_header *hdr,
+                                  struct ll_list *prepared, int *err)
 {
-    struct wire_job_submit ws;
-    memset(&ws, 0, sizeof(ws));
-
-    if (!xdr_wire_job_submit(xdrs, &ws)) {
-        LL_ERRX("xdr_wire_job_submit failed");
-        chan_shutdown(chan_id);
-        return;
-    }
-
-    struct wire_job_script script;
-    memset(&script, 0, sizeof(script));
-
-    if (!xdr_wire_job_script(xdrs, &script)) {
-        LL_ERRX("xdr_wire_job_script failed");
-        chan_shutdown(chan_id);
-        return;
-    }
-
     /*
      * An ordinary job uses the default 0-0 range and therefore executes
      * this loop once. An array replaces the range with the user request.
@@ -743,43 +653,72 @@ void job_register(XDR *xdrs, int chan_id,
     int32_t end = 0;
     int32_t stride = 1;
 
-    if (ws.flags & JOB_FLAG_ARRAY) {
+    if (ws->flags & JOB_FLAG_ARRAY) {
 
-        if (ws.array_stride <= 0 || ws.array_end < ws.array_start) {
+        if (ws->array_stride <= 0 || ws->array_end < ws->array_start) {
             LL_ERRX("invalid array range %d-%d:%d uid=%d",
-                    ws.array_start, ws.array_end, ws.array_stride, hdr->uid);
-            job_register_error(chan_id, EINVAL);
-            free(script.data);
-            return;
+                    ws->array_start, ws->array_end, ws->array_stride,
+                    hdr->uid);
+            free(script->data);
+            script->data = NULL;
+            *err = EINVAL;
+            return -1;
         }
 
-        start = ws.array_start;
-        end = ws.array_end;
-        stride = ws.array_stride;
+        start = ws->array_start;
+        end = ws->array_end;
+        stride = ws->array_stride;
     }
 
-    struct ll_list prepared_jobs;
-    ll_list_init(&prepared_jobs);
+    /*
+     * The script is stored once for the whole submission, every array
+     * element refers to it by hash.
+     */
+    char hash[LOG_SCRIPT_HASH_LEN + 1];
+    int cc;
+    if (staged)
+        cc = script_store_stage(script, hash);
+    else
+        cc = script_store_put(script, hash);
+    if (cc < 0) {
+        *err = errno ? errno : EIO;
+        LL_ERR("script_store_put failed uid=%d", hdr->uid);
+        free(script->data);
+        script->data = NULL;
+        return -1;
+    }
+
+    char key[STAGE_KEY_LEN];
+    stage_script_key(key, sizeof(key), hash);
+    stage_put(key, script->data, script->len);
+    free(script->data);
+    script->data = NULL;
+
+    struct journal_ref journal;
+    if (journal_submit(ws, hdr, hash, &journal) < 0) {
+        *err = errno ? errno : EIO;
+        LL_ERR("journal_submit failed uid=%d", hdr->uid);
+        script_store_drop(hash);
+        return -1;
+    }
 
     int64_t array_id = 0;
     int64_t prev_id = 0;
     struct job_data *array_head = NULL;
-    int err = 0;
 
     for (int32_t index = start; index <= end; index += stride) {
         struct job_data *job;
 
-        job = job_prepare(&ws, &script, hdr, &err);
+        job = job_prepare(ws, hash, &journal, hdr, err);
         if (job == NULL) {
-            assert(err != 0);
+            assert(*err != 0);
 
             LL_ERRX("job preparation failed index=%d uid=%d user=%s err=%d",
-                    index, hdr->uid, ws.username, err);
+                    index, hdr->uid, ws->username, *err);
 
-            job_discard_prepared(&prepared_jobs);
-            free(script.data);
-            job_register_error(chan_id, err);
-            return;
+            job_discard_prepared(prepared);
+            script_store_drop(hash);
+            return -1;
         }
 
         if (array_id == 0) {
@@ -793,7 +732,7 @@ void job_register(XDR *xdrs, int chan_id,
         }
         prev_id = job->job_id;
 
-        if (ws.flags & JOB_FLAG_ARRAY) {
+        if (ws->flags & JOB_FLAG_ARRAY) {
             job->array_id = array_id;
             job->array_index = index;
             job->array_start = start;
@@ -806,33 +745,223 @@ void job_register(XDR *xdrs, int chan_id,
          * Prepared jobs remain private to this submission. They are not
          * visible through the global hash or pending list yet.
          */
-        ll_list_append(&prepared_jobs, &job->ent);
+        ll_list_append(prepared, &job->ent);
+    }
+
+    return 0;
+}
+
+void job_register(XDR *xdrs, int chan_id,
+                  const struct protocol_header *hdr)
+{
+    struct wire_job_submit ws;
+    memset(&ws, 0, sizeof(ws));
+
+    if (!xdr_wire_job_submit(xdrs, &ws)) {
+        LL_ERRX("xdr_wire_job_submit failed");
+        chan_shutdown(chan_id);
+        return;
+    }
+
+    struct wire_job_script script;
+    memset(&script, 0, sizeof(script));
+
+    if (!xdr_wire_job_script(xdrs, &script)) {
+        LL_ERRX("xdr_wire_job_script failed");
+        chan_shutdown(chan_id);
+        return;
     }
 
-    free(script.data);
+    struct ll_list prepared_jobs;
+    ll_list_init(&prepared_jobs);
+
+    int err = 0;
+    if (job_submission_prepare(&ws, &script, 0, hdr, &prepared_jobs,
+                               &err) < 0) {
+        job_register_error(chan_id, err);
+        return;
+    }
 
     /*
      * array_id is also the ordinary job ID when the loop executes once.
      * For arrays it is the first element's job ID and the common array ID.
      */
+    struct job_data *head = (struct job_data *) prepared_jobs.head;
+    int64_t array_id = head->job_id;
     if (job_register_reply(chan_id, array_id) < 0) {
+        char hash[LOG_SCRIPT_HASH_LEN + 1];
+        ll_strlcpy(hash, head->script, sizeof(hash));
         job_discard_prepared(&prepared_jobs);
+        script_store_drop(hash);
         return;
     }
 
     job_commit_prepared(&prepared_jobs, &ws);
-    job_id_seq_write();  /* sequence must never go backwards */
+    job_id_seq_lease();  /* sequence must never go backwards */
+}
+
+/*
+ * Bulk submission: every pair of the batch is prepared as job_register()
+ * prepares one, and the batch is committed only once all of them are,
+ * so that either all its jobs exist or none does. The journal records of
+ * the batch are synced by the group commit of the pass, its new scripts
+ * by one script_store_sync(). An entry keeps only where its submission
+ * starts in the request, which is decoded again, in one scratch
+ * wire_job_submit, to commit its jobs.
+ */
+struct submit_many_ent {
+    u_int pos;
+    struct ll_list prepared;
+};
+
+static void job_register_many_reply(int chan_id, int status,
+                                    int64_t first_id, int64_t last_id)
+{
+    struct wire_job_submit_many_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.first_id = first_id;
+    reply.last_id = last_id;
+
+    struct protocol_header rep_hdr;
+    init_protocol_header(&rep_hdr);
+    rep_hdr.operation = BATCH_JOB_SUBMIT_MANY_ACK;
+    rep_hdr.status = status;
+
+    size_t siz = PACKET_HEADER_SIZE + sizeof(reply) + LL_BUFSIZ_64;
+
+    if (enqueue_payload(chan_id, &rep_hdr, &reply, siz,
+                        xdr_wire_job_submit_many_reply) < 0)
+        LL_ERR("enqueue_payload failed first_id=%ld", first_id);
+}
+
+/* Discard the prepared jobs of the batch and the scripts it staged. */
+static void job_discard_many(struct submit_many_ent *m, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++) {
+        struct job_data *head = (struct job_data *) m[i].prepared.head;
+        if (head == NULL)
+            continue;
+
+        char hash[LOG_SCRIPT_HASH_LEN + 1];
+        ll_strlcpy(hash, head->script, sizeof(hash));
+        job_discard_prepared(&m[i].prepared);
+        script_store_drop(hash);
+    }
+    free(m);
+}
+
+void job_register_many(XDR *xdrs, int chan_id,
+                       const struct protocol_header *hdr)
+{
+    uint32_t count;
+
+    if (!xdr_uint32_t(xdrs, &count)) {
+        LL_ERRX("xdr count failed");
+        chan_shutdown(chan_id);
+        return;
+    }
+    if (count == 0 || count > LLB_SUBMIT_MANY_MAX) {
+        LL_ERRX("invalid batch count=%u uid=%d", count, hdr->uid);
+        job_register_many_reply(chan_id, EINVAL, -1, -1);
+        return;
+    }
+
+    struct submit_many_ent *m = calloc(count, sizeof(*m));
+    if (m == NULL) {
+        LL_ERR("calloc batch count=%u", count);
+        job_register_many_reply(chan_id, ENOMEM, -1, -1);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+        ll_list_init(&m[i].prepared);
+
+    struct wire_job_submit ws;
+    int64_t first_id = 0;
+    int64_t last_id = 0;
+    int err = 0;
+    uint32_t i;
+
+    for (i = 0; i < count; i++) {
+        struct wire_job_script script;
+        memset(&script, 0, sizeof(script));
+
+        m[i].pos = xdr_getpos(xdrs);
+        if (!xdr_wire_job_submit_packed(xdrs, &ws)
+            || !xdr_wire_job_script(xdrs, &script)) {
+            LL_ERRX("xdr batch entry=%u failed", i);
+            free(script.data);
+            script_store_sync();
+            job_discard_many(m, i);
+            chan_shutdown(chan_id);
+            return;
+        }
+
+        if (job_submission_prepare(&ws, &script, 1, hdr,
+                                   &m[i].prepared, &err) < 0)
+            break;
+
+        struct job_data *head = (struct job_data *) m[i].prepared.head;
+        struct job_data *tail = (struct job_data *) m[i].prepared.tail;
+
+        /* the client numbers the jobs of the batch from first_id */
+        if (first_id == 0) {
+            first_id = head->job_id;
+        } else if (head->job_id != last_id + 1) {
+            LL_ERRX("batch entry=%u job_id=%ld not after %ld", i,
+                    head->job_id, last_id);
+            err = EAGAIN;
+            break;
+        }
+        last_id = tail->job_id;
+    }
+
+    if (script_store_sync() < 0 && err == 0)
+        err = errno ? errno : EIO;
+
+    if (err != 0) {
+        LL_ERRX("batch of %u failed at entry=%u uid=%d err=%d", count,
+                i, hdr->uid, err);
+        job_discard_many(m, i < count ? i + 1 : count);
+        job_register_many_reply(chan_id, err, -1, -1);
+        return;
+    }
+
+    job_register_many_reply(chan_id, MBD_OK, first_id, last_id);
+
+    for (i = 0; i < count; i++) {
+        // decoded once already, the request has not changed since
+        if (!xdr_setpos(xdrs, m[i].pos)
+            || !xdr_wire_job_submit_packed(xdrs, &ws)) {
+            LL_ERRX("xdr batch entry=%u failed again", i);
+            mbd_die(MBD_EXIT_JOBS);
+        }
+        job_commit_prepared(&m[i].prepared, &ws);
+    }
+    free(m);
+    job_id_seq_lease();  /* sequence must never go backwards */
+
+    LL_INFO("batch of %u submissions job_id=%ld-%ld uid=%d", count,
+            first_id, last_id, hdr->uid);
 }
 
 /*
  * job_set_list - append job to list and record which list it is on.
  * Always use this instead of bare ll_list_append for job lists.
  */
+/*
+ * Every entry into a list is numbered. Jobs are appended, so along the
+ * run and finish lists the numbers grow, which lets a paged listing
+ * resume after a job that has since left its list.
+ */
+static uint64_t job_list_seq;
+
 void job_set_list(struct job_data *job, struct ll_list *list,
                   enum job_list_id list_id)
 {
     ll_list_append(list, &job->ent);
     job->list_id = list_id;
+    job->list_seq = ++job_list_seq;
+    job_touch(job);
 }
 
 /*
@@ -845,6 +974,68 @@ void job_move_list(struct job_data *job, struct ll_list *from,
     ll_list_remove(from, &job->ent);
     ll_list_append(to, &job->ent);
     job->list_id = list_id;
+    job->list_seq = ++job_list_seq;
+    job_touch(job);
+}
+
+/*
+ * Every change of a job a listing shows, its state, priority, queue or
+ * pending reason, takes the next number of one sequence, so that a
+ * poller can ask for the jobs changed since the last number it saw.
+ * The sequence starts over with mbd, job_epoch tells a poller it did.
+ * Jobs purged by compaction leave a tombstone numbered from the same
+ * sequence; the oldest are dropped past JOB_TOMBS_MAX, and a poller
+ * behind job_tomb_floor has to list the jobs again.
+ */
+#define JOB_TOMBS_MAX 65536
+
+int64_t job_epoch;
+uint64_t job_change_seq;
+struct job_tomb *job_tombs;
+int job_ntombs;
+uint64_t job_tomb_floor;
+
+void job_touch(struct job_data *job)
+{
+    job->change_seq = ++job_change_seq;
+}
+
+/* The jobs of a host that connected or was lost change their public state. */
+void job_touch_host(const struct mbd_host *h)
+{
+    for (struct ll_list_entry *e = run_jobs_list.head; e != NULL;
+         e = e->next) {
+        struct job_data *job = (struct job_data *) e;
+
+        if (job->run_nhosts > 0 && job->run_hosts[0] == h)
+            job_touch(job);
+    }
+}
+
+void job_tombstone(const struct job_data *job)
+{
+    if (job_tombs == NULL) {
+        job_tombs = malloc(JOB_TOMBS_MAX * sizeof(*job_tombs));
+        if (job_tombs == NULL) {
+            /* pollers behind this purge list the jobs again */
+            LL_ERR("malloc tombstones failed");
+            job_tomb_floor = ++job_change_seq;
+            return;
+        }
+    }
+
+    if (job_ntombs == JOB_TOMBS_MAX) {
+        int drop = JOB_TOMBS_MAX / 2;
+        job_tomb_floor = job_tombs[drop - 1].seq;
+        memmove(job_tombs, job_tombs + drop,
+                (size_t) (job_ntombs - drop) * sizeof(*job_tombs));
+        job_ntombs -= drop;
+    }
+
+    struct job_tomb *t = &job_tombs[job_ntombs++];
+    t->job_id = job->job_id;
+    t->uid = job->uid;
+    t->seq = ++job_change_seq;
 }
 
 /*
@@ -1069,6 +1260,11 @@ void job_deps_release(struct job_data *job)
 
 int job_init(void)
 {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    job_epoch = (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
     ll_hash_init(&job_id_hash, 1021);
     ll_list_init(&pend_jobs_list);
     ll_list_init(&run_jobs_list);
@@ -1089,164 +1285,180 @@ int job_init(void)
     return 0;
 }
 
-void mbd_new_job_reply(struct mbd_host *n, XDR *xdrs,
-                       struct protocol_header *hdr)
+/* Ack a job record of an sbd, BATCH_NEW_JOB_REPLY or BATCH_JOB_FINISH. */
+static void job_ack(struct mbd_host *n, int32_t ack_op, int64_t job_id)
 {
-    struct wire_job_reply r;
-    memset(&r, 0, sizeof(r));
-    if (!xdr_wire_job_reply(xdrs, &r)) {
-        LL_ERR("xdr_wire_job_reply decode failed from=%s",
-               chan_addr_str(n->sbd_chan));
+    struct wire_job_ack ack;
+    memset(&ack, 0, sizeof(ack));
+    ack.job_id = job_id;
+    ack.ack_op = ack_op;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    if (ack_op == BATCH_JOB_FINISH)
+        hdr.operation = BATCH_JOB_FINISH_ACK;
+    else
+        hdr.operation = BATCH_NEW_JOB_REPLY_ACK;
+    hdr.status = MBD_OK;
+
+    if (enqueue_payload(n->sbd_chan, &hdr, &ack, LL_BUFSIZ_1K,
+                        xdr_wire_job_ack) < 0)
+        LL_ERR("job_id=%ld enqueue_payload failed", job_id);
+}
+
+/* Ack the records of a message of several jobs in one message. */
+static void job_ack_many(struct mbd_host *n, struct wire_job_ack *acks,
+                         int32_t num)
+{
+    if (num == 0)
         return;
-    }
 
-    struct job_data *job = job_find(r.job_id);
+    struct wire_job_ack_many many;
+    many.num_acks = num;
+    many.acks = acks;
+
+    struct protocol_header hdr;
+    init_protocol_header(&hdr);
+    hdr.operation = BATCH_JOB_ACK_MANY;
+    hdr.status = MBD_OK;
+
+    // an ack encodes in 12 bytes
+    size_t siz = LL_BUFSIZ_1K + (size_t) num * 16;
+    if (enqueue_payload(n->sbd_chan, &hdr, &many, siz,
+                        xdr_wire_job_ack_many) < 0)
+        LL_ERR("enqueue_payload of num=%d acks failed host=%s", num,
+               n->net.name);
+}
+
+/*
+ * Record the pid reply of a job, return 1 when sbd is to be acked. A
+ * dispatch sbd rejected is acked by mbd_job_reject_dispatch().
+ */
+static int job_new_reply_apply(struct mbd_host *n,
+                               const struct wire_job_reply *r, int32_t status)
+{
+    struct job_data *job = job_find(r->job_id);
     if (job == NULL) {
         LL_ERR("job_id=%ld not found from=%s - admin intervention required",
-               r.job_id, chan_addr_str(n->sbd_chan));
-        return;
+               r->job_id, chan_addr_str(n->sbd_chan));
+        return 0;
     }
 
     // Something went really wrong
-    if (r.state == JOB_PENDING) {
+    if (r->state == JOB_PENDING) {
 
         if (job->state == JOB_PENDING || job->state == JOB_HELD) {
             assert(job->list_id == JOB_LIST_PEND);
-            LL_INFO("job_id=%ld duplicated event received", r.job_id);
-            return;
+            LL_INFO("job_id=%ld duplicated event received", r->job_id);
+            return 0;
         }
 
         LL_ERR("job_id=%ld rejected by sbd=%s status=%d (%s)",
-               r.job_id, chan_addr_str(n->sbd_chan),
-               hdr->status, strerror(hdr->status));
+               r->job_id, chan_addr_str(n->sbd_chan), status,
+               strerror(status));
 
         mbd_job_reject_dispatch(job);
-        return;
+        return 0;
     }
 
-    int duplicate = 0;
     /* duplicate: skip event log, sbd resends if it restarts before ack
      */
     if (job->fork_time > 0) {
-        LL_INFO("job_id=%ld fork duplicate from=%s", r.job_id,
+        LL_INFO("job_id=%ld fork duplicate from=%s", r->job_id,
                 chan_addr_str(n->sbd_chan));
-        duplicate = 1;
-        // fall through
+        return 1;
     }
 
-    struct wire_job_ack ack;
-    memset(&ack, 0, sizeof(ack));
-    ack.job_id = r.job_id;
-    ack.ack_op = BATCH_NEW_JOB_REPLY;
-
-    struct protocol_header rep_hdr;
-    init_protocol_header(&rep_hdr);
-    rep_hdr.operation = BATCH_NEW_JOB_REPLY_ACK;
-    rep_hdr.status = MBD_OK;
+    job->pid = (pid_t) r->pid;
+    job->fork_time = time(NULL);
+    job->state = JOB_RUNNING;
+    job_touch(job);
+    event_job_fork(job);
+    LL_INFO("job_id=%ld pid=%d acked", r->job_id, r->pid);
+    return 1;
+}
 
-    if (auth_sign_header(&rep_hdr) < 0) {
-        LL_ERR("job_id=%ld failed to sign header for host=%s", job->job_id,
-               n->net.name);
+void mbd_new_job_reply(struct mbd_host *n, XDR *xdrs,
+                       struct protocol_header *hdr)
+{
+    struct wire_job_reply r;
+    memset(&r, 0, sizeof(r));
+    if (!xdr_wire_job_reply(xdrs, &r)) {
+        LL_ERR("xdr_wire_job_reply decode failed from=%s",
+               chan_addr_str(n->sbd_chan));
         return;
     }
 
-    if (enqueue_payload(n->sbd_chan, &rep_hdr, &ack, LL_BUFSIZ_1K,
-                        xdr_wire_job_ack) < 0) {
-        LL_ERR("job_id=%ld enqueue_payload failed", r.job_id);
+    if (job_new_reply_apply(n, &r, hdr->status))
+        job_ack(n, BATCH_NEW_JOB_REPLY, r.job_id);
+}
+
+void mbd_new_job_reply_many(struct mbd_host *n, XDR *xdrs,
+                            struct protocol_header *hdr)
+{
+    struct wire_job_reply_many m;
+    memset(&m, 0, sizeof(m));
+    if (!xdr_wire_job_reply_many(xdrs, &m)) {
+        LL_ERR("xdr_wire_job_reply_many decode failed from=%s",
+               chan_addr_str(n->sbd_chan));
+        xdr_free((xdrproc_t) xdr_wire_job_reply_many, (char *) &m);
         return;
     }
 
-    if (duplicate)
+    // sbd resends what is not acked
+    struct wire_job_ack *acks = calloc(m.num_replies + 1, sizeof(*acks));
+    if (acks == NULL) {
+        LL_ERR("calloc num=%d acks failed", m.num_replies);
+        xdr_free((xdrproc_t) xdr_wire_job_reply_many, (char *) &m);
         return;
+    }
 
-    job->pid = (pid_t) r.pid;
-    job->fork_time = time(NULL);
-    job->state = JOB_RUNNING;
-    event_job_fork(job);
-    LL_INFO("job_id=%ld pid=%d acked", r.job_id, r.pid);
+    int32_t num = 0;
+    for (int32_t i = 0; i < m.num_replies; i++) {
+        if (!job_new_reply_apply(n, &m.replies[i], hdr->status))
+            continue;
+        acks[num].job_id = m.replies[i].job_id;
+        acks[num].ack_op = BATCH_NEW_JOB_REPLY;
+        num++;
+    }
+
+    job_ack_many(n, acks, num);
+    free(acks);
+    xdr_free((xdrproc_t) xdr_wire_job_reply_many, (char *) &m);
 }
 
-void mbd_job_finish(struct mbd_host *n, XDR *xdrs)
+/* Record the finish report of a job, return 1 when sbd is to be acked. */
+static int job_finish_apply(struct mbd_host *n,
+                            const struct wire_job_finish *f)
 {
-    struct wire_job_finish f;
-
-    memset(&f, 0, sizeof(f));
-    if (!xdr_wire_job_finish(xdrs, &f)) {
-        LL_ERR("xdr_wire_job_finish decode failed from=%s",
-               chan_addr_str(n->sbd_chan));
-        return;
-    }
-
-    struct job_data *job = job_find(f.job_id);
+    struct job_data *job = job_find(f->job_id);
     if (job == NULL) {
         // Distinguish missing from duplicate for code and logical clarity
-        LL_ERR("job_id=%ld not found from=%s", f.job_id,
+        LL_ERR("job_id=%ld not found from=%s", f->job_id,
                chan_addr_str(n->sbd_chan));
-        struct wire_job_ack ack;
-        memset(&ack, 0, sizeof(ack));
-        ack.job_id = f.job_id;
-        ack.ack_op = BATCH_JOB_FINISH;
-        struct protocol_header hdr;
-        init_protocol_header(&hdr);
-        hdr.operation = BATCH_JOB_FINISH_ACK;
-        hdr.status = MBD_OK;
-        if (auth_sign_header(&hdr) < 0) {
-            LL_ERR("job_id=%ld failed to sign header", f.job_id);
-            return;
-        }
-        enqueue_payload(n->sbd_chan, &hdr, &ack, LL_BUFSIZ_1K,
-                        xdr_wire_job_ack);
-        return;
+        return 1;
     }
 
     if (strcmp(n->net.name, job->run_hosts[0]->net.name) != 0) {
         LL_WARNING("job_id=%ld finish reported by host=%s but dispatched to "
                    " host=%s — ignoring", job->job_id, n->net.name,
                    job->run_hosts[0]->net.name);
-        return;
+        return 0;
     }
 
-    int duplicate = 0;
     if (job->end_time > 0) {
-        LL_INFO("job_id=%ld finish duplicate from=%s", f.job_id,
+        LL_INFO("job_id=%ld finish duplicate from=%s", f->job_id,
                 chan_addr_str(n->sbd_chan));
-        duplicate = 1;
-        goto send_ack;
+        return 1;
     }
     // run the assert only the first time sbd is reporting job finished
     assert((job->state == JOB_RUNNING) || (job->state == JOB_SUSPENDED));
 
-send_ack:
-    struct wire_job_ack ack;
-    memset(&ack, 0, sizeof(ack));
-    ack.job_id = f.job_id;
-    ack.ack_op = BATCH_JOB_FINISH;
-
-    struct protocol_header hdr;
-    init_protocol_header(&hdr);
-    hdr.operation = BATCH_JOB_FINISH_ACK;
-    hdr.status = MBD_OK;
-
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERR("job_id=%ld failed to sign header for host=%s", job->job_id,
-               n->net.name);
-        return;
-    }
-
-    if (enqueue_payload(n->sbd_chan, &hdr, &ack, LL_BUFSIZ_1K,
-                        xdr_wire_job_ack) < 0) {
-        LL_ERR("job_id=%ld enqueue_payload failed", f.job_id);
-        return;
-    }
-
-    if (duplicate)
-        return;
-
     job->end_time = time(NULL);
-    job->exit_status = f.exit_status;
+    job->exit_status = f->exit_status;
 
-    LL_INFO("job_id=%ld usage mem=%luMB swap=%luMB cpu=%.2fs", f.job_id, f.mem_mb,
-            f.swap_mb, f.cpu_time);
+    LL_INFO("job_id=%ld usage mem=%luMB swap=%luMB cpu=%.2fs", f->job_id,
+            f->mem_mb, f->swap_mb, f->cpu_time);
 
     // this function depends on the state of the job not
     // being DONE|EXIT yet
@@ -1264,7 +1476,7 @@ send_ack:
     job->queue->num_hosts_used -= job->run_nhosts;
     job->queue->num_jobs--;
 
-    if (f.state == 0)
+    if (f->state == 0)
         job->state = JOB_DONE;
     else
         job->state = JOB_EXITED;
@@ -1272,12 +1484,12 @@ send_ack:
     job_move_list(job, &run_jobs_list, &finish_jobs_list, JOB_LIST_FINISH);
     job_array_element_finished(job);
 
-    LL_INFO("job_id=%ld finish acked state=%s", f.job_id,
+    LL_INFO("job_id=%ld finish acked state=%s", f->job_id,
             job_state_str(job->state));
 
     // We free the job only when we compact the events file
     event_job_finish(job);
-    if (job_write_usage(job, &f) < 0) {
+    if (job_write_usage(job, f) < 0) {
         LL_ERR("job_id=%ld failed job_write_usage", job->job_id);
     }
 
@@ -1286,6 +1498,55 @@ send_ack:
 
     // debug code
     mbd_assert_counters();
+    return 1;
+}
+
+void mbd_job_finish(struct mbd_host *n, XDR *xdrs)
+{
+    struct wire_job_finish f;
+
+    memset(&f, 0, sizeof(f));
+    if (!xdr_wire_job_finish(xdrs, &f)) {
+        LL_ERR("xdr_wire_job_finish decode failed from=%s",
+               chan_addr_str(n->sbd_chan));
+        return;
+    }
+
+    if (job_finish_apply(n, &f))
+        job_ack(n, BATCH_JOB_FINISH, f.job_id);
+}
+
+void mbd_job_finish_many(struct mbd_host *n, XDR *xdrs)
+{
+    struct wire_job_finish_many m;
+    memset(&m, 0, sizeof(m));
+    if (!xdr_wire_job_finish_many(xdrs, &m)) {
+        LL_ERR("xdr_wire_job_finish_many decode failed from=%s",
+               chan_addr_str(n->sbd_chan));
+        xdr_free((xdrproc_t) xdr_wire_job_finish_many, (char *) &m);
+        return;
+    }
+
+    // sbd resends what is not acked
+    struct wire_job_ack *acks = calloc(m.num_finish + 1, sizeof(*acks));
+    if (acks == NULL) {
+        LL_ERR("calloc num=%d acks failed", m.num_finish);
+        xdr_free((xdrproc_t) xdr_wire_job_finish_many, (char *) &m);
+        return;
+    }
+
+    int32_t num = 0;
+    for (int32_t i = 0; i < m.num_finish; i++) {
+        if (!job_finish_apply(n, &m.finish[i]))
+            continue;
+        acks[num].job_id = m.finish[i].job_id;
+        acks[num].ack_op = BATCH_JOB_FINISH;
+        num++;
+    }
+
+    job_ack_many(n, acks, num);
+    free(acks);
+    xdr_free((xdrproc_t) xdr_wire_job_finish_many, (char *) &m);
 }
 
 char *job_state_str(int state)
@@ -1342,12 +1603,14 @@ void mbd_job_signal_reply(struct mbd_host *n, XDR *xdrs,
         job->queue->num_susp++;
         n->num_susp++;
         n->num_run--;
+        job_touch(job);
     } else if (sig.sig == SIGCONT) {
         job->state = JOB_RUNNING;
         job->queue->num_susp--;
         job->queue->num_run++;
         n->num_susp--;
         n->num_run++;
+        job_touch(job);
     }
 
     LL_DEBUG("queue=%s num_pend=%d num_run=%d num_susp=%d", job->queue->name,
@@ -1543,6 +1806,7 @@ int job_move(XDR *xdrs, int chan_id, const struct protocol_header *hdr)
     event_job_move(job, to->name);
 
     job->queue = to;
+    job_touch(job);
 
     /* update counters on to queue */
     if (job->state == JOB_PENDING)
@@ -1595,6 +1859,7 @@ static int stop_pending_job(struct job_data *job, const struct wire_job_sig *ws)
 
     job->state = JOB_HELD;
     job->signal_time = time(NULL);
+    job_touch(job);
     LL_INFO("stop_pending_job: job_id=%ld sig=%d -> PSUSP", (long) job->job_id,
             ws->sig);
     event_job_signal(job, ws);
@@ -1609,6 +1874,25 @@ static int stop_pending_job(struct job_data *job, const struct wire_job_sig *ws)
     return MBD_OK;
 }
 
+/*
+ * job_hold - hold a pending job mbd cannot dispatch, in PSUSP as if its
+ * user had stopped it, until it is resumed with SIGCONT.
+ */
+void job_hold(struct job_data *job)
+{
+    if (job->state != JOB_PENDING)
+        return;
+
+    job->state = JOB_HELD;
+    job->payload_failures = 0;
+    job_touch(job);
+    LL_INFO("job_id=%ld -> PSUSP", (long) job->job_id);
+    event_job_pend_susp(job);
+
+    job->queue->num_pend--;
+    job->queue->num_held++;
+}
+
 static int resume_pending_job(struct job_data *job,
                               const struct wire_job_sig *ws)
 {
@@ -1617,6 +1901,7 @@ static int resume_pending_job(struct job_data *job,
 
     job->state = JOB_PENDING;
     job->signal_time = time(NULL);
+    job_touch(job);
     LL_INFO("resume_pending_job: job_id=%ld sig=%d -> PEND", (long) job->job_id,
             ws->sig);
     event_job_signal(job, ws);
@@ -1664,12 +1949,6 @@ static int signal_running_job(struct job_data *job,
     hdr.operation = BATCH_SBD_JOB_SIGNAL;
     hdr.status = MBD_OK;
 
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERR("job_id=%ld failed to sign header for host=%s", job->job_id,
-               job->run_hosts[0]->net.name);
-        return EAGAIN;
-    }
-
     if (enqueue_payload(job->run_hosts[0]->sbd_chan, &hdr, (void *) ws,
                         LL_BUFSIZ_1K, xdr_wire_job_sig) < 0) {
         LL_ERR("job_id=%ld enqueue_payload failed", job->job_id);
@@ -1949,6 +2228,7 @@ int job_priority(XDR *xdrs, int chan_id, const struct protocol_header *hdr)
     if (wp.priority == old_priority)
         return enqueue_header(chan_id, BATCH_JOB_PRIORITY_ACK, MBD_OK);
     job->priority = wp.priority;
+    job_touch(job);
 
     event_job_priority(job, old_priority);
 
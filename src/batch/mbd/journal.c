@@ -0,0 +1,330 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "base/lib/ll.syslog.h"
+#include "base/lib/ll.conf.h"
+#include "base/lib/ll.hash.h"
+#include "batch/lib/spool.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Submit journal.
+ *
+ * A submission used to create a directory per job and write its sidecar
+ * there. Now the sidecar of the whole submission is one record appended
+ * to the current segment of the journal, and every job of it keeps the
+ * segment, offset and length of the record, which its JOB_NEW record
+ * carries too. Appends are not synced one by one: journal_commit() runs
+ * once per pass of the event loop, before the replies of that pass are
+ * sent, and syncs the journal and the manifest for every submission
+ * handled in it.
+ *
+ * mbd starts a new segment at startup and when the current one grows
+ * past JOURNAL_SEGMENT_MAX. Like the script store it counts the jobs in
+ * memory referring to each segment. A segment left without a job is
+ * handed to the spool reaper at the next compaction, which removes it
+ * after the directories of the jobs purged with it; bhist reads the
+ * sidecar of a purged job from its segment, so with
+ * LL_MBD_SPOOL_REAP_RATE=0 segments are kept like the directories.
+ */
+
+#define JOURNAL_SEGMENT_MAX (64 << 20)
+
+struct journal_seg {
+    uint32_t seq;
+    int32_t refs;
+};
+
+static char mbd_dir[PATH_MAX];
+static int journal_fd = -1;
+static uint32_t journal_seq;
+static off_t journal_size;
+static int journal_dirty;
+static struct ll_hash journal_hash;
+
+static int journal_open(void)
+{
+    char path[PATH_MAX];
+    if (spool_journal_path(path, sizeof(path), mbd_dir, journal_seq) < 0)
+        return -1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        LL_ERR("open %s", path);
+        return -1;
+    }
+
+    if (journal_fd >= 0)
+        close(journal_fd);
+    journal_fd = fd;
+    journal_size = 0;
+
+    LL_INFO("submit journal segment %s", path);
+    return 0;
+}
+
+static int journal_seq_parse(const char *name, uint32_t *seq)
+{
+    size_t n = strlen(SPOOL_JOURNAL_PREFIX);
+    if (strncmp(name, SPOOL_JOURNAL_PREFIX, n) != 0)
+        return -1;
+
+    char *end;
+    errno = 0;
+    unsigned long v = strtoul(name + n, &end, 10);
+    if (name[n] == 0 || *end != 0 || errno != 0 || v > UINT32_MAX)
+        return -1;
+
+    *seq = (uint32_t) v;
+    return 0;
+}
+
+int journal_init(void)
+{
+    int n = snprintf(mbd_dir, sizeof(mbd_dir), "%s/mbd",
+                     ll_params[LL_STATE_DIR].val);
+    if (n < 0 || n >= (int) sizeof(mbd_dir))
+        return -1;
+
+    char dir[PATH_MAX + LL_BUFSIZ_32];
+    snprintf(dir, sizeof(dir), "%s/%s", mbd_dir, SPOOL_JOURNAL_DIR);
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        LL_ERR("mkdir(%s) failed", dir);
+        return -1;
+    }
+
+    if (ll_hash_init(&journal_hash, 61) < 0) {
+        LL_ERR("journal hash init failed");
+        return -1;
+    }
+
+    /* never append to a segment of a previous run, its tail may be torn */
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        LL_ERR("opendir %s", dir);
+        return -1;
+    }
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        uint32_t seq;
+        if (journal_seq_parse(de->d_name, &seq) == 0 && seq >= journal_seq)
+            journal_seq = seq + 1;
+    }
+    closedir(dp);
+
+    return journal_open();
+}
+
+/*
+ * journal_append - append one sidecar record and return where it is.
+ * The record is durable only after the next journal_commit().
+ */
+int journal_append(const char *buf, size_t len, struct journal_ref *ref)
+{
+    if (len == 0 || len > UINT32_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (journal_size > 0
+        && journal_size + (off_t) len > JOURNAL_SEGMENT_MAX) {
+        /* the full segment must be on disk before the next one is used */
+        journal_commit();
+        journal_seq++;
+        if (journal_open() < 0)
+            return -1;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t nw = write(journal_fd, buf + done, len - done);
+        if (nw < 0) {
+            if (errno == EINTR)
+                continue;
+            int e = errno;
+            LL_ERR("write journal seq=%u", journal_seq);
+            /* a partial record is never referenced, skip past it */
+            journal_size += (off_t) done;
+            errno = e;
+            return -1;
+        }
+        done += (size_t) nw;
+    }
+
+    ref->seq = journal_seq;
+    ref->off = journal_size;
+    ref->len = (uint32_t) len;
+    journal_size += (off_t) len;
+    journal_dirty = 1;
+
+    return 0;
+}
+
+/*
+ * journal_commit - group commit, sync the journal and the manifest once
+ * for every submission appended since the last call. Called by the
+ * event loop before it sends the replies queued during the pass.
+ */
+void journal_commit(void)
+{
+    if (!journal_dirty)
+        return;
+
+    if (fdatasync(journal_fd) < 0) {
+        LL_ERR("fdatasync journal seq=%u", journal_seq);
+        mbd_die(MBD_EXIT_EVENTS);
+    }
+    event_sync();
+    journal_dirty = 0;
+}
+
+/*
+ * journal_read - the sidecar record of a job, malloc'ed and NUL
+ * terminated, NULL if it cannot be read.
+ */
+char *journal_read(const struct journal_ref *ref)
+{
+    char *buf = spool_journal_read(mbd_dir, ref->seq, ref->off, ref->len);
+    if (buf == NULL)
+        LL_ERR("read journal seq=%u off=%ld len=%u", ref->seq,
+               (long) ref->off, ref->len);
+
+    return buf;
+}
+
+void journal_ref(const struct journal_ref *ref)
+{
+    char key[LL_BUFSIZ_32];
+
+    if (ref->len == 0)
+        return;
+
+    snprintf(key, sizeof(key), "%u", ref->seq);
+    struct journal_seg *s = ll_hash_search(&journal_hash, key);
+    if (s == NULL) {
+        s = calloc(1, sizeof(*s));
+        if (s == NULL) {
+            /* without an entry the segment is never collected */
+            LL_ERR("calloc journal segment failed");
+            return;
+        }
+        s->seq = ref->seq;
+        ll_hash_insert(&journal_hash, key, s, 0);
+    }
+    s->refs++;
+}
+
+void journal_unref(const struct journal_ref *ref)
+{
+    char key[LL_BUFSIZ_32];
+
+    if (ref->len == 0)
+        return;
+
+    snprintf(key, sizeof(key), "%u", ref->seq);
+    struct journal_seg *s = ll_hash_search(&journal_hash, key);
+    if (s == NULL || s->refs == 0) {
+        LL_ERRX("journal seq=%u unref without a reference", ref->seq);
+        return;
+    }
+    s->refs--;
+}
+
+static int journal_live(uint32_t seq)
+{
+    char key[LL_BUFSIZ_32];
+
+    if (seq == journal_seq)
+        return 1;
+
+    snprintf(key, sizeof(key), "%u", seq);
+    struct journal_seg *s = ll_hash_search(&journal_hash, key);
+    return s != NULL && s->refs > 0;
+}
+
+/*
+ * journal_gc - hand the segments, other than the current one, no job in
+ * memory refers to to the spool reaper. Called after a compaction has
+ * purged finished jobs, before the reaper child is started.
+ */
+void journal_gc(void)
+{
+    struct ll_hash_iter it;
+    struct ll_hash_entry *e;
+    char **dead = NULL;
+    size_t ndead = 0;
+    size_t cap = 0;
+
+    ll_hash_iter_init(&it, &journal_hash);
+    while ((e = ll_hash_iter_next(&it)) != NULL) {
+        struct journal_seg *s = e->value;
+        if (s->refs > 0 || s->seq == journal_seq)
+            continue;
+        if (ndead == cap) {
+            size_t ncap = cap ? cap * 2 : 16;
+            char **d = realloc(dead, ncap * sizeof(char *));
+            if (d == NULL)
+                break;
+            dead = d;
+            cap = ncap;
+        }
+        dead[ndead++] = e->key;
+    }
+
+    for (size_t i = 0; i < ndead; i++) {
+        struct journal_seg *s = ll_hash_remove(&journal_hash, dead[i]);
+        spool_reap_segment(s->seq);
+        free(s);
+    }
+    free(dead);
+
+    if (ndead > 0)
+        LL_INFO("submit journal gc dead=%zu live=%zu", ndead,
+                journal_hash.nentries);
+}
+
+/*
+ * journal_sweep - at startup, after replay, hand the spool reaper the
+ * segments no replayed job refers to, those of jobs purged by a
+ * compaction whose reaper mbd did not live to run.
+ */
+void journal_sweep(void)
+{
+    char dir[PATH_MAX + LL_BUFSIZ_32];
+    int dead = 0;
+
+    snprintf(dir, sizeof(dir), "%s/%s", mbd_dir, SPOOL_JOURNAL_DIR);
+    DIR *dp = opendir(dir);
+    if (dp == NULL) {
+        LL_ERR("opendir %s", dir);
+        return;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dp)) != NULL) {
+        uint32_t seq;
+        if (journal_seq_parse(de->d_name, &seq) < 0 || journal_live(seq))
+            continue;
+        char key[LL_BUFSIZ_32];
+        snprintf(key, sizeof(key), "%u", seq);
+        free(ll_hash_remove(&journal_hash, key));
+        spool_reap_segment(seq);
+        dead++;
+    }
+    closedir(dp);
+
+    LL_INFO("submit journal sweep dead=%d live=%zu", dead,
+            journal_hash.nentries);
+}
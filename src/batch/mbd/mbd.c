@@ -26,14 +26,13 @@ struct ll_list group_list;
 struct ll_hash group_name_hash;
 struct ll_list queue_list;
 struct ll_hash queue_name_hash;
-struct ll_hash sbd_chan_hash;
 struct ll_list token_pool_list;
 struct ll_hash token_pool_name_hash;
 
 struct mbd_manager mbd_mgr;
 
 int mbd_efd;
-struct epoll_event mbd_events[CHAN_MAX];
+struct epoll_event mbd_events[CHAN_EVENTS];
 uint16_t mbd_port;
 int chan_mbd;
 int chan_timer;
@@ -70,7 +69,6 @@ static int mbd_init(void)
     ll_hash_init(&group_name_hash, 127);
     ll_list_init(&queue_list);
     ll_hash_init(&queue_name_hash, 31);
-    ll_hash_init(&sbd_chan_hash, 1021);
     ll_list_init(&token_pool_list);
     ll_hash_init(&token_pool_name_hash, 1021);
 
@@ -97,6 +95,11 @@ static int mbd_init(void)
         return -1;
     }
 
+    if (query_init() < 0) {
+        LL_ERRX("query_init failed");
+        return -1;
+    }
+
     if (job_init() < 0) {
         LL_ERRX("job_init failed");
     }
@@ -111,6 +114,10 @@ static int mbd_init(void)
         return -1;
     }
 
+    /* monitoring only, mbd runs without it */
+    if (status_init() < 0)
+        LL_ERRX("status_init failed");
+
     return 0;
 }
 
@@ -187,7 +194,8 @@ int main(int argc, char **argv)
             ll_params[LL_MBD_HOST].val, sched_timer);
 
     for (;;) {
-        int nevents = chan_epoll(mbd_efd, mbd_events, CHAN_MAX, -1);
+        int nevents = chan_epoll(mbd_efd, mbd_events, CHAN_EVENTS,
+                                 query_timeout());
         if (nevents < 0) {
             if (errno != EINTR) {
                 LL_ERR("chan_epoll(%d) failed", mbd_efd);
@@ -216,8 +224,11 @@ int main(int argc, char **argv)
                 if (n < 0 && errno != EINTR)
                     LL_ERR("read timer failed");
                 LL_DEBUG("sched_timer expired timer=%d", sched_timer);
+                query_touch(QUERY_TOUCH_ALL);
                 schedule();
+                status_publish();
                 maybe_rebuild_manifest();
+                maybe_checkpoint();
                 continue;
             }
 
@@ -226,9 +237,21 @@ int main(int argc, char **argv)
                 continue;
             }
 
+            if (chan_id == chan_query) {
+                query_done();
+                continue;
+            }
+
             if (chan_is_readable(chan_id))
                 mbd_message(chan_id);
         }
+
+        /* before the next chan_epoll() sends the replies of this pass */
+        journal_commit();
+        /* then answer the queries waiting for the state it left */
+        query_flush();
+        /* and write all that the pass queued */
+        net_flush();
     }
 
     return 0;
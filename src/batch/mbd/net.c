@@ -51,12 +51,112 @@ int valid_batch_op(int op)
     case BATCH_JOB_PRIORITY:
     case BATCH_JOB_PRIORITY_ACK:
     case BATCH_JOB_MISSING:
+    case BATCH_JOB_INFO2:
+    case BATCH_JOB_INFO2_ACK:
+    case BATCH_JOB_SUMMARY:
+    case BATCH_JOB_SUMMARY_ACK:
+    case BATCH_JOB_DELTA:
+    case BATCH_JOB_DELTA_ACK:
+    case BATCH_JOB_SUBMIT_MANY:
+    case BATCH_JOB_SUBMIT_MANY_ACK:
+    case BATCH_AUTH_SESSION:
+    case BATCH_AUTH_SESSION_ACK:
+    case BATCH_NEW_JOB_REPLY_MANY:
+    case BATCH_JOB_FINISH_MANY:
+    case BATCH_JOB_ACK_MANY:
         return 1;
     default:
         return 0;
     }
 }
 
+/* The state a client request may change, for the query snapshots. */
+static unsigned route_touches(int op)
+{
+    switch (op) {
+    case BATCH_JOB_SUBMIT:
+    case BATCH_JOB_SUBMIT_MANY:
+    case BATCH_JOB_MOVE:
+        return QUERY_TOUCH_JOBS | QUERY_TOUCH_QUEUES;
+    case BATCH_JOB_PRIORITY:
+        return QUERY_TOUCH_JOBS;
+    case BATCH_QUEUE_ADMIN:
+        return QUERY_TOUCH_QUEUES;
+    case BATCH_HOST_ADMIN:
+        return QUERY_TOUCH_HOSTS;
+    case BATCH_AUTH_SESSION:
+        return 0;
+    default:
+        return QUERY_TOUCH_ALL;
+    }
+}
+
+/*
+ * The sequence number of the client request being answered. A client
+ * may keep several requests in flight on a connection and match the
+ * replies by it: queries are answered from the query thread, after
+ * requests that came later.
+ */
+static int32_t reply_sequence;
+
+void net_reply_sequence(int32_t sequence)
+{
+    reply_sequence = sequence;
+}
+
+/*
+ * A peer opening a session on its connection, see base/lib/auth.h:
+ * answer with a nonce of our own, signed in full, and take the messages
+ * of the channel signed with the session from then on.
+ */
+static int net_session_accept(XDR *xdrs, int chan_id,
+                              const struct protocol_header *hdr)
+{
+    struct wire_auth_session req;
+    if (!xdr_wire_auth_session(xdrs, &req)) {
+        LL_ERRX("xdr_wire_auth_session failed from=%s",
+                chan_addr_str(chan_id));
+        return -1;
+    }
+
+    if (channels[chan_id].session != NULL) {
+        LL_ERRX("session already open from=%s", chan_addr_str(chan_id));
+        return -1;
+    }
+
+    struct wire_auth_session rep;
+    if (auth_nonce(rep.nonce) < 0) {
+        LL_ERR("auth_nonce failed");
+        return -1;
+    }
+
+    struct auth_session *s = auth_session_new(req.nonce, rep.nonce, 0);
+    if (s == NULL) {
+        LL_ERR("auth_session_new failed");
+        return -1;
+    }
+
+    struct protocol_header rep_hdr;
+    init_protocol_header(&rep_hdr);
+    rep_hdr.sequence = hdr->sequence;
+    rep_hdr.operation = BATCH_AUTH_SESSION_ACK;
+    rep_hdr.status = MBD_OK;
+
+    if (auth_sign_header(&rep_hdr) < 0
+        || enqueue_payload(chan_id, &rep_hdr, &rep,
+                           PACKET_HEADER_SIZE + LL_BUFSIZ_64,
+                           xdr_wire_auth_session) < 0) {
+        LL_ERR("session reply failed from=%s", chan_addr_str(chan_id));
+        auth_session_free(s);
+        return -1;
+    }
+
+    chan_set_session(chan_id, s);
+    LL_DEBUG("session open chan_id=%d from=%s", chan_id,
+             chan_addr_str(chan_id));
+    return 0;
+}
+
 static void route(int chan_id)
 {
     struct chan_buffer *buf;
@@ -95,7 +195,7 @@ static void route(int chan_id)
         return;
     }
 
-    if (auth_verify_header(&hdr) < 0) {
+    if (auth_verify_packet(channels[chan_id].session, buf->data, &hdr) < 0) {
         LL_ERR("failed validate header opcode=%s from=%s",
                batch_op_str(hdr.operation), chan_addr_str(chan_id));
         xdr_destroy(&xdrs);
@@ -114,39 +214,39 @@ static void route(int chan_id)
     }
 
     LL_DEBUG("chan_id=%d protocol=%s", chan_id, batch_op_str(hdr.operation));
+    reply_sequence = hdr.sequence;
+
+    /* read-only, answered from the query snapshot which owns buf now */
+    if (query_op(hdr.operation)) {
+        u_int pos = xdr_getpos(&xdrs);
+        xdr_destroy(&xdrs);
+        if (query_request(chan_id, &hdr, buf, pos) < 0)
+            chan_shutdown(chan_id);
+        return;
+    }
+
+    query_touch(route_touches(hdr.operation));
 
     // Invalid operation has been already rejected
     switch (hdr.operation) {
     case BATCH_JOB_SUBMIT:
         job_register(&xdrs, chan_id, &hdr);
         break;
-    case BATCH_JOB_SIGNAL:
-        if (jobs_signal(&xdrs, chan_id, &hdr) < 0)
-            chan_shutdown(chan_id);
-        break;
-    case BATCH_GROUP_INFO:
-        if (host_group_info(&xdrs, chan_id) < 0)
-            chan_shutdown(chan_id);
-        break;
-    case BATCH_QUEUE_INFO:
-        if (queues_info(&xdrs, chan_id) < 0)
-            chan_shutdown(chan_id);
+    case BATCH_JOB_SUBMIT_MANY:
+        job_register_many(&xdrs, chan_id, &hdr);
         break;
-    case BATCH_JOB_INFO:
-        if (jobs_info(&xdrs, chan_id, &hdr) < 0)
+    case BATCH_AUTH_SESSION:
+        if (net_session_accept(&xdrs, chan_id, &hdr) < 0)
             chan_shutdown(chan_id);
         break;
-    case BATCH_HOST_INFO:
-        if (hosts_info(&xdrs, chan_id) < 0)
+    case BATCH_JOB_SIGNAL:
+        if (jobs_signal(&xdrs, chan_id, &hdr) < 0)
             chan_shutdown(chan_id);
         break;
     case BATCH_SBD_REGISTER:
         if (mbd_sbd_register(&xdrs, chan_id) < 0)
             chan_shutdown(chan_id);
         break;
-    case BATCH_TOKEN_INFO:
-        tokens_info(&xdrs, chan_id);
-        break;
     case BATCH_QUEUE_ADMIN:
         queue_admin(&xdrs, chan_id, &hdr);
         break;
@@ -168,18 +268,16 @@ static void route(int chan_id)
     chan_free_buf(buf);
 }
 
-void mbd_message(int chan_id)
+static void message(int chan_id)
 {
-    char key[LL_BUFSIZ_32];
-
     LL_DEBUG("chan_id=%d sock=%d chan_events=%d", chan_id,
              channels[chan_id].sock, channels[chan_id].chan_events);
 
-    snprintf(key, sizeof(key), "%d", chan_id);
-    struct mbd_host *n = ll_hash_search(&sbd_chan_hash, key);
-    if (n != NULL) {
+    if (channels[chan_id].owner == MBD_CHAN_SBD) {
+        struct mbd_host *n = channels[chan_id].owner_data;
         LL_DEBUG("the client is an sbd %s", n->net.name);
         assert(n->sbd_chan == chan_id);
+        query_touch(QUERY_TOUCH_ALL);
         mbd_sbd_route(n);
         return;
     }
@@ -187,6 +285,15 @@ void mbd_message(int chan_id)
     route(chan_id);
 }
 
+/* One read may have framed several messages, serve all of them. */
+void mbd_message(int chan_id)
+{
+    do {
+        message(chan_id);
+    } while (chan_sock(chan_id) >= 0 && !chan_has_error(chan_id)
+             && !ll_list_is_empty(&channels[chan_id].recv));
+}
+
 int network_init(void)
 {
     struct epoll_event ev;
@@ -197,7 +304,14 @@ int network_init(void)
         return -1;
     }
 
-    chan_init();
+    if (ll_set_limits() < 0)
+        LL_ERR("ll_set_limits failed, channels limited to the soft limits");
+    if (chan_init() < 0) {
+        LL_ERR("chan_init failed");
+        close(mbd_efd);
+        return -1;
+    }
+    LL_INFO("channel table of %d channels", chan_max);
     if (!ll_atoi(ll_params[LL_MBD_PORT].val, (int *) &mbd_port)) {
         LL_ERRX("cannot convert to int LL_MBD_PORT=%s",
                 ll_params[LL_MBD_PORT].val);
@@ -291,12 +405,18 @@ int mbd_accept(int chan_id)
 
 void chan_shutdown(int chan_id)
 {
+    query_cancel(chan_id);
     epoll_ctl(mbd_efd, EPOLL_CTL_DEL, chan_sock(chan_id), NULL);
     chan_close(chan_id);
 }
 
-int32_t enqueue_payload(int chan_id, struct protocol_header *hdr, void *payload,
-                        size_t siz, bool_t (*xdr_func)())
+/*
+ * encode_payload - encode a reply into a buffer of siz bytes, to send
+ * with enqueue_buf(). Does not touch the channels, so the query thread
+ * can encode its replies.
+ */
+int encode_payload(struct protocol_header *hdr, void *payload, size_t siz,
+                   bool_t (*xdr_func)(), struct chan_buffer **out)
 {
     struct chan_buffer *buf;
     XDR xdrs;
@@ -319,15 +439,79 @@ int32_t enqueue_payload(int chan_id, struct protocol_header *hdr, void *payload,
     buf->len = (size_t) xdr_getpos(&xdrs);
     xdr_destroy(&xdrs);
 
-    if (chan_enqueue(chan_id, buf) < 0) {
-        LL_ERR("chan_enqueue failed op=%d len=%d", hdr->operation,
-               (int) buf->len);
-        chan_free_buf(buf);
+    *out = buf;
+    return 0;
+}
+
+/*
+ * Channels with messages queued during this pass of the event loop.
+ * Nothing is written before net_flush(): a reply must not leave before
+ * journal_commit() made what it acknowledges durable.
+ */
+static char flush_mark[CHAN_MAX];
+static int flush_chans[CHAN_MAX];
+static int num_flush;
+
+/*
+ * The sequence is the first word of an encoded header. It goes in the
+ * buffer's own head, never in data: a cached reply shares its data with
+ * every channel it is queued on.
+ */
+static void stamp_sequence(struct chan_buffer *buf, int32_t sequence)
+{
+    XDR xdrs;
+
+    xdrmem_create(&xdrs, buf->head, sizeof(buf->head), XDR_ENCODE);
+    xdr_int32_t(&xdrs, &sequence);
+    xdr_destroy(&xdrs);
+    buf->head_len = (int) sizeof(buf->head);
+}
+
+static int enqueue(int chan_id, struct chan_buffer *buf)
+{
+    // client replies carry a sequence, sbd messages are signed here, in
+    // the order they are sent
+    if (channels[chan_id].owner == MBD_CHAN_CLIENT)
+        stamp_sequence(buf, reply_sequence);
+    else if (auth_sign_packet(channels[chan_id].session, buf->data) < 0)
+        return -1;
+
+    if (chan_enqueue(chan_id, buf) < 0)
         return -1;
+
+    if (!flush_mark[chan_id]) {
+        flush_mark[chan_id] = 1;
+        flush_chans[num_flush++] = chan_id;
     }
+    return 0;
+}
 
-    if (chan_set_write_interest(chan_id, mbd_efd, 1) < 0) {
-        LL_ERR("chan_set_write_interest failed");
+/*
+ * net_flush - write the messages queued during the pass, all those of a
+ * channel in one call, leaving EPOLLOUT to the channels the socket of
+ * which is full.
+ */
+void net_flush(void)
+{
+    for (int i = 0; i < num_flush; i++) {
+        int chan_id = flush_chans[i];
+
+        flush_mark[chan_id] = 0;
+        // closed during the pass
+        if (chan_sock(chan_id) < 0)
+            continue;
+        if (chan_flush(chan_id, mbd_efd) < 0)
+            LL_ERR("chan_flush failed chan_id=%d", chan_id);
+    }
+    num_flush = 0;
+}
+
+/* Queue an encoded message on the channel, the channel owns it then. */
+int enqueue_buf(int chan_id, struct chan_buffer *buf)
+{
+    if (enqueue(chan_id, buf) < 0) {
+        LL_ERR("chan_enqueue failed chan_id=%d len=%d", chan_id,
+               (int) buf->len);
         chan_free_buf(buf);
         return -1;
     }
@@ -335,6 +519,17 @@ int32_t enqueue_payload(int chan_id, struct protocol_header *hdr, void *payload,
     return 0;
 }
 
+int32_t enqueue_payload(int chan_id, struct protocol_header *hdr, void *payload,
+                        size_t siz, bool_t (*xdr_func)())
+{
+    struct chan_buffer *buf;
+
+    if (encode_payload(hdr, payload, siz, xdr_func, &buf) < 0)
+        return -1;
+
+    return enqueue_buf(chan_id, buf);
+}
+
 int32_t enqueue_header(int chan_id, int operation, int status)
 {
     struct chan_buffer *buf;
@@ -361,15 +556,10 @@ int32_t enqueue_header(int chan_id, int operation, int status)
     buf->len = (size_t) xdr_getpos(&xdrs);
     xdr_destroy(&xdrs);
 
-    if (chan_enqueue(chan_id, buf) < 0) {
+    if (enqueue(chan_id, buf) < 0) {
         LL_ERR("chan_enqueue failed op=%d", operation);
         chan_free_buf(buf);
         return -1;
     }
-    if (chan_set_write_interest(chan_id, mbd_efd, 1) < 0) {
-        LL_ERR("chan_set_write_interest failed op=%d", operation);
-        chan_free_buf(buf);
-        return -1;
-    }
     return 0;
 }
@@ -0,0 +1,884 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "base/lib/ll.syslog.h"
+#include "base/lib/ll.conf.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Query snapshot.
+ *
+ * bjobs, bhosts, bqueues, bgroups and btokens used to be answered by
+ * the main thread from the live structures, in turn with submissions,
+ * sbd traffic and scheduling passes, so that dashboards polling them
+ * delayed everything else. Now the main thread only reads such a
+ * request off its channel and queues it. A job query is answered from
+ * a snapshot, an immutable copy of the jobs the main thread builds, by
+ * the query thread, which decodes it and encodes the reply while the
+ * main thread goes on. The snapshot of the hosts, the queues, the
+ * groups or the tokens is their encoded reply, the main thread queues
+ * it as is.
+ *
+ * Every message bumps the generation of each kind of state it may
+ * change, see query_touch(). A request is answered from a snapshot
+ * built at or after the generation of its kind it arrived in, so it
+ * sees every change acknowledged before it was sent. Snapshots are
+ * built at the end of a pass of the event loop, only for the requests
+ * waiting for one, so that all of them share it, and at most once per
+ * LL_MBD_QUERY_REFRESH_MS; under a steady stream of changes a request
+ * waits for the next one. A snapshot is referenced by the main thread
+ * until it is replaced and by each request answered from it, and freed
+ * by the main thread once the last of them is sent.
+ *
+ * With LL_MBD_QUERY_THREAD=0 the main thread encodes the replies
+ * itself, from the same snapshots.
+ */
+
+/* in the order of the QUERY_TOUCH_* bits */
+enum query_kind {
+    QUERY_JOBS,
+    QUERY_HOSTS,
+    QUERY_QUEUES,
+    QUERY_TOKENS,
+    QUERY_GROUPS,   /* written by conf_init() only, never touched */
+    QUERY_KINDS
+};
+
+struct query_req {
+    struct ll_list_entry ent;  /* waiting or running, main thread only */
+    struct query_req *next;    /* work and done queues, under query_lock */
+    int chan_id;
+    int cancelled;             /* the channel was closed meanwhile */
+    enum query_kind kind;
+    uint64_t gen;              /* needs a snapshot at least this recent */
+    struct protocol_header hdr;
+    struct chan_buffer *buf;   /* the request, its body at pos */
+    u_int pos;
+    struct query_part *snap;
+    int rc;                    /* of the handler, see jobs_info() */
+    struct chan_buffer *reply;
+};
+
+int chan_query = -1;
+
+static int query_threaded;
+static int query_refresh_ms;
+static uint64_t query_gen[QUERY_KINDS] = {1, 1, 1, 1, 1};
+static struct query_part *query_snap[QUERY_KINDS];
+static int64_t query_built[QUERY_KINDS];
+static struct ll_list query_waiting;
+static struct ll_list query_running;
+
+static pthread_t query_thread;
+static pthread_mutex_t query_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t query_cond = PTHREAD_COND_INITIALIZER;
+static struct query_req *work_head;
+static struct query_req *work_tail;
+static struct query_req *done_head;
+static struct query_req *done_tail;
+
+static int64_t query_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void query_part_unref(struct query_part *p)
+{
+    if (p != NULL && --p->refs == 0)
+        p->free(p);
+}
+
+/* -----------------------------------------------------------
+ * jobs
+ * ----------------------------------------------------------- */
+
+/*
+ * UNKNOWN is a public/reporting state. Internally the job keeps its last
+ * lifecycle state. If the execution host is disconnected, clients cannot
+ * know whether the process is still running, suspended, or gone.
+ */
+static int job_public_state(const struct job_data *job)
+{
+    if ((job->state == JOB_RUNNING || job->state == JOB_SUSPENDED) &&
+        job->run_hosts[0]->sbd_chan < 0)
+        return JOB_UNKNOWN;
+
+    return job->state;
+}
+
+static uint32_t slot_hash(int64_t job_id, uint32_t nslots)
+{
+    return (uint32_t) (((uint64_t) job_id * 0x9E3779B97F4A7C15ULL) >> 32)
+           & (nslots - 1);
+}
+
+const struct query_job *query_job_find(const struct query_jobs *s,
+                                       int64_t job_id)
+{
+    uint32_t mask = s->nslots - 1;
+
+    for (uint32_t i = slot_hash(job_id, s->nslots);; i = (i + 1) & mask) {
+        int32_t k = s->slots[i];
+        if (k == 0)
+            return NULL;
+        if (s->jobs[k - 1].job_id == job_id)
+            return &s->jobs[k - 1];
+    }
+}
+
+static void query_jobs_free(struct query_part *p)
+{
+    struct query_jobs *s = (struct query_jobs *) p;
+
+    free(s->jobs);
+    free(s->slots);
+    free(s->strings);
+    free(s->host_idx);
+    free(s->hosts);
+    free(s->queues);
+    free(s->by_queue.start);
+    free(s->by_queue.jobs);
+    free(s->by_host.start);
+    free(s->by_host.jobs);
+    free(s->tombs);
+    free(s);
+}
+
+struct snap_arena {
+    size_t len;
+    size_t cap;
+};
+
+/* Append str to the strings of the snapshot, "" is at offset 0. */
+static int snap_str(struct query_jobs *s, struct snap_arena *a,
+                    const char *str, uint32_t *off)
+{
+    size_t n = strlen(str) + 1;
+
+    if (n == 1) {
+        *off = 0;
+        return 0;
+    }
+    if (a->len + n > UINT32_MAX)
+        return -1;
+    if (a->len + n > a->cap) {
+        size_t cap = a->cap * 2 + n;
+        char *p = realloc(s->strings, cap);
+        if (p == NULL)
+            return -1;
+        s->strings = p;
+        a->cap = cap;
+    }
+
+    memcpy(s->strings + a->len, str, n);
+    *off = (uint32_t) a->len;
+    a->len += n;
+    return 0;
+}
+
+static int snap_hosts(struct query_jobs *s, struct snap_arena *a,
+                      const struct job_data *job, uint32_t *off)
+{
+    size_t n = (size_t) job->run_nhosts;
+
+    if (a->len + n > a->cap) {
+        size_t cap = a->cap * 2 + n;
+        uint32_t *p = realloc(s->host_idx, cap * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        s->host_idx = p;
+        a->cap = cap;
+    }
+
+    for (size_t i = 0; i < n; i++)
+        s->host_idx[a->len + i] = (uint32_t) job->run_hosts[i]->host_idx;
+    *off = (uint32_t) a->len;
+    a->len += n;
+    return 0;
+}
+
+static int snap_job(struct query_jobs *s, struct snap_arena *str,
+                    struct snap_arena *hosts, const struct job_data *job,
+                    struct query_job *j)
+{
+    j->job_id = job->job_id;
+    j->array_id = job->array_id;
+    j->array_index = job->array_index;
+    j->array_start = job->array_start;
+    j->array_end = job->array_end;
+    j->array_stride = job->array_stride;
+    j->uid = job->uid;
+    j->pid = job->pid;
+    j->state = job_public_state(job);
+    j->exit_status = job->exit_status;
+    j->priority = job->priority;
+    j->pend_reason = job->pend_reason;
+    j->ncpus = job->res.num_cpus;
+    j->nhosts = job->run_nhosts;
+    j->list_seq = job->list_seq;
+    j->change_seq = job->change_seq;
+    j->submit_time = (int64_t) job->submit_time;
+    j->dispatch_time = (int64_t) job->dispatch_time;
+    j->end_time = (int64_t) job->end_time;
+    j->susp_time = (int64_t) job->susp_time;
+    j->queue = job->queue;
+
+    if (snap_str(s, str, job->name, &j->name) < 0
+        || snap_str(s, str, job->project, &j->project) < 0
+        || snap_hosts(s, hosts, job, &j->hosts) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int queue_key(const struct query_jobs *s, const struct query_job *j,
+                     int n)
+{
+    (void) s;
+    return n == 0 ? j->queue->queue_idx : -1;
+}
+
+static int host_key(const struct query_jobs *s, const struct query_job *j,
+                    int n)
+{
+    return n < j->nhosts ? (int) s->host_idx[j->hosts + n] : -1;
+}
+
+/*
+ * Index the jobs of the snapshot by the keys, nkeys at most, key()
+ * gives each of them, counting the jobs of every key first.
+ */
+static int snap_index(const struct query_jobs *s, struct query_index *x,
+                      int nkeys,
+                      int (*key)(const struct query_jobs *,
+                                 const struct query_job *, int))
+{
+    int nrefs = 0;
+    int k;
+
+    x->start = calloc(nkeys + 1, sizeof(*x->start));
+    if (x->start == NULL)
+        return -1;
+    for (int i = 0; i < s->njobs; i++) {
+        for (int n = 0; (k = key(s, &s->jobs[i], n)) >= 0; n++) {
+            x->start[k + 1]++;
+            nrefs++;
+        }
+    }
+    for (k = 0; k < nkeys; k++)
+        x->start[k + 1] += x->start[k];
+
+    x->jobs = malloc((nrefs + 1) * sizeof(*x->jobs));
+    if (x->jobs == NULL)
+        return -1;
+    /* start[k] is the next slot of key k, then the start of key k + 1 */
+    for (int i = 0; i < s->njobs; i++) {
+        for (int n = 0; (k = key(s, &s->jobs[i], n)) >= 0; n++)
+            x->jobs[x->start[k]++] = i;
+    }
+    for (k = nkeys; k > 0; k--)
+        x->start[k] = x->start[k - 1];
+    x->start[0] = 0;
+
+    return 0;
+}
+
+static struct query_part *query_jobs_build(void)
+{
+    static struct ll_list *const lists[JOB_LISTS] = {
+        [JOB_LIST_PEND] = &pend_jobs_list,
+        [JOB_LIST_RUN] = &run_jobs_list,
+        [JOB_LIST_FINISH] = &finish_jobs_list,
+    };
+
+    struct query_jobs *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        LL_ERR("calloc query jobs failed");
+        return NULL;
+    }
+    s->part.free = query_jobs_free;
+
+    int n = 0;
+    for (int l = 0; l < JOB_LISTS; l++)
+        n += ll_list_count(lists[l]);
+
+    s->nslots = 64;
+    while (s->nslots < 2 * (uint32_t) n)
+        s->nslots <<= 1;
+    s->nhosts = ll_list_count(&host_list);
+
+    struct snap_arena str = {.len = 1, .cap = (size_t) n * 16 + 1};
+    struct snap_arena hosts = {.len = 0, .cap = (size_t) n + 1};
+
+    s->jobs = malloc((n + 1) * sizeof(*s->jobs));
+    s->slots = calloc(s->nslots, sizeof(*s->slots));
+    s->strings = malloc(str.cap);
+    s->host_idx = malloc(hosts.cap * sizeof(*s->host_idx));
+    s->hosts = calloc(s->nhosts + 1, sizeof(*s->hosts));
+    s->queues = calloc(ll_list_count(&queue_list) + 1, sizeof(*s->queues));
+    s->tombs = malloc((job_ntombs + 1) * sizeof(*s->tombs));
+    if (s->jobs == NULL || s->slots == NULL || s->strings == NULL
+        || s->host_idx == NULL || s->hosts == NULL || s->queues == NULL
+        || s->tombs == NULL) {
+        LL_ERR("malloc query jobs=%d failed", n);
+        goto fail;
+    }
+    s->strings[0] = 0;
+
+    for (struct ll_list_entry *e = host_list.head; e != NULL; e = e->next) {
+        struct mbd_host *h = (struct mbd_host *) e;
+        s->hosts[h->host_idx] = h;
+    }
+
+    for (struct ll_list_entry *e = queue_list.head; e != NULL; e = e->next) {
+        const struct mbd_queue *q = (const struct mbd_queue *) e;
+        struct query_queue_count *c = &s->queues[s->nqueues++];
+
+        c->queue = q;
+        c->num_pend = q->num_pend;
+        c->num_held = q->num_held;
+        c->num_run = q->num_run;
+        c->num_susp = q->num_susp;
+    }
+
+    s->epoch = job_epoch;
+    s->change_seq = job_change_seq;
+    s->tomb_floor = job_tomb_floor;
+    s->ntombs = job_ntombs;
+    if (job_ntombs > 0)
+        memcpy(s->tombs, job_tombs, job_ntombs * sizeof(*s->tombs));
+
+    int i = 0;
+    for (int l = 0; l < JOB_LISTS; l++) {
+        s->start[l] = i;
+        for (struct ll_list_entry *e = lists[l]->head; e != NULL;
+             e = e->next) {
+            const struct job_data *job = (const struct job_data *) e;
+
+            if (snap_job(s, &str, &hosts, job, &s->jobs[i]) < 0) {
+                LL_ERR("query snapshot of job=%ld failed", job->job_id);
+                goto fail;
+            }
+
+            uint32_t k = slot_hash(job->job_id, s->nslots);
+            while (s->slots[k] != 0)
+                k = (k + 1) & (s->nslots - 1);
+            s->slots[k] = i + 1;
+            i++;
+        }
+    }
+    s->start[JOB_LISTS] = i;
+    s->njobs = i;
+
+    if (snap_index(s, &s->by_queue, s->nqueues, queue_key) < 0
+        || snap_index(s, &s->by_host, s->nhosts, host_key) < 0) {
+        LL_ERR("query snapshot index jobs=%d failed", n);
+        goto fail;
+    }
+
+    return &s->part;
+
+fail:
+    query_jobs_free(&s->part);
+    return NULL;
+}
+
+/* -----------------------------------------------------------
+ * hosts, queues, groups and tokens
+ * ----------------------------------------------------------- */
+
+/*
+ * These replies are small next to the job listing and the same for
+ * every caller, so their snapshot is the encoded reply itself. It is
+ * queued on every channel asking for it, the send queues sharing its
+ * one buffer.
+ */
+static void query_reply_free(struct query_part *p)
+{
+    struct query_reply *s = (struct query_reply *) p;
+
+    chan_shared_unref(s->msg);
+    free(s);
+}
+
+static struct query_part *
+query_reply_build(int (*encode)(struct chan_buffer **))
+{
+    struct query_reply *s = calloc(1, sizeof(*s));
+    if (s == NULL) {
+        LL_ERR("calloc query reply failed");
+        return NULL;
+    }
+    s->part.free = query_reply_free;
+
+    struct chan_buffer *buf;
+    if (encode(&buf) < 0) {
+        free(s);
+        return NULL;
+    }
+
+    s->msg = chan_share(buf);
+    if (s->msg == NULL) {
+        LL_ERR("chan_share failed");
+        chan_free_buf(buf);
+        free(s);
+        return NULL;
+    }
+
+    return &s->part;
+}
+
+static struct query_part *query_hosts_build(void)
+{
+    return query_reply_build(hosts_info);
+}
+
+static struct query_part *query_queues_build(void)
+{
+    return query_reply_build(queues_info);
+}
+
+static struct query_part *query_groups_build(void)
+{
+    return query_reply_build(host_group_info);
+}
+
+static struct query_part *query_tokens_build(void)
+{
+    return query_reply_build(tokens_info);
+}
+
+/* -----------------------------------------------------------
+ * requests
+ * ----------------------------------------------------------- */
+
+static struct query_part *(*const query_build[QUERY_KINDS])(void) = {
+    [QUERY_JOBS] = query_jobs_build,
+    [QUERY_HOSTS] = query_hosts_build,
+    [QUERY_QUEUES] = query_queues_build,
+    [QUERY_TOKENS] = query_tokens_build,
+    [QUERY_GROUPS] = query_groups_build,
+};
+
+int query_op(int op)
+{
+    switch (op) {
+    case BATCH_JOB_INFO:
+    case BATCH_JOB_INFO2:
+    case BATCH_JOB_SUMMARY:
+    case BATCH_JOB_DELTA:
+    case BATCH_HOST_INFO:
+    case BATCH_QUEUE_INFO:
+    case BATCH_GROUP_INFO:
+    case BATCH_TOKEN_INFO:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int query_ack(int op)
+{
+    switch (op) {
+    case BATCH_JOB_INFO:
+        return BATCH_JOB_INFO_ACK;
+    case BATCH_JOB_INFO2:
+        return BATCH_JOB_INFO2_ACK;
+    case BATCH_JOB_SUMMARY:
+        return BATCH_JOB_SUMMARY_ACK;
+    case BATCH_JOB_DELTA:
+        return BATCH_JOB_DELTA_ACK;
+    case BATCH_HOST_INFO:
+        return BATCH_HOST_INFO_ACK;
+    case BATCH_GROUP_INFO:
+        return BATCH_GROUP_INFO_ACK;
+    case BATCH_TOKEN_INFO:
+        return BATCH_TOKEN_INFO_ACK;
+    default:
+        return BATCH_QUEUE_INFO_ACK;
+    }
+}
+
+static enum query_kind query_kind(int op)
+{
+    switch (op) {
+    case BATCH_HOST_INFO:
+        return QUERY_HOSTS;
+    case BATCH_QUEUE_INFO:
+        return QUERY_QUEUES;
+    case BATCH_GROUP_INFO:
+        return QUERY_GROUPS;
+    case BATCH_TOKEN_INFO:
+        return QUERY_TOKENS;
+    default:
+        return QUERY_JOBS;
+    }
+}
+
+/* Decode a job request and encode its reply, in either thread. */
+static void query_serve(struct query_req *q)
+{
+    XDR xdrs;
+
+    xdrmem_create(&xdrs, q->buf->data, q->buf->len, XDR_DECODE);
+    if (!xdr_setpos(&xdrs, q->pos)) {
+        LL_ERRX("xdr_setpos failed chan_id=%d", q->chan_id);
+        xdr_destroy(&xdrs);
+        q->rc = -1;
+        return;
+    }
+
+    const struct query_jobs *s = (const struct query_jobs *) q->snap;
+    switch (q->hdr.operation) {
+    case BATCH_JOB_INFO:
+        q->rc = jobs_info(&xdrs, &q->hdr, s, &q->reply);
+        break;
+    case BATCH_JOB_INFO2:
+        q->rc = jobs_info2(&xdrs, &q->hdr, s, &q->reply);
+        break;
+    case BATCH_JOB_SUMMARY:
+        q->rc = jobs_summary(&xdrs, &q->hdr, s, &q->reply);
+        break;
+    case BATCH_JOB_DELTA:
+        q->rc = jobs_delta(&xdrs, &q->hdr, s, &q->reply);
+        break;
+    }
+
+    xdr_destroy(&xdrs);
+}
+
+/* Send the reply of a served request, main thread. */
+static void query_complete(struct query_req *q)
+{
+    ll_list_remove(&query_running, &q->ent);
+    net_reply_sequence(q->hdr.sequence);
+
+    if (q->cancelled) {
+        chan_free_buf(q->reply);
+    } else if (q->rc == 0) {
+        if (enqueue_buf(q->chan_id, q->reply) < 0)
+            chan_shutdown(q->chan_id);
+    } else if (q->rc > 0) {
+        enqueue_header(q->chan_id, query_ack(q->hdr.operation), q->rc);
+    } else {
+        chan_shutdown(q->chan_id);
+    }
+
+    query_part_unref(q->snap);
+    chan_free_buf(q->buf);
+    free(q);
+}
+
+static void *query_main(void *arg)
+{
+    (void) arg;
+
+    for (;;) {
+        pthread_mutex_lock(&query_lock);
+        while (work_head == NULL)
+            pthread_cond_wait(&query_cond, &query_lock);
+        struct query_req *q = work_head;
+        work_head = q->next;
+        if (work_head == NULL)
+            work_tail = NULL;
+        pthread_mutex_unlock(&query_lock);
+
+        query_serve(q);
+
+        pthread_mutex_lock(&query_lock);
+        q->next = NULL;
+        if (done_tail != NULL)
+            done_tail->next = q;
+        else
+            done_head = q;
+        done_tail = q;
+        pthread_mutex_unlock(&query_lock);
+
+        uint64_t one = 1;
+        if (write(chan_sock(chan_query), &one, sizeof(one)) < 0
+            && errno != EAGAIN)
+            LL_ERR("write query event");
+    }
+
+    return NULL;
+}
+
+int query_init(void)
+{
+    if (!ll_atoi(ll_params[LL_MBD_QUERY_THREAD].val, &query_threaded)
+        || query_threaded < 0 || query_threaded > 1) {
+        LL_ERRX("invalid LL_MBD_QUERY_THREAD=%s using default=1",
+                ll_params[LL_MBD_QUERY_THREAD].val);
+        query_threaded = 1;
+    }
+    if (!ll_atoi(ll_params[LL_MBD_QUERY_REFRESH_MS].val, &query_refresh_ms)
+        || query_refresh_ms < 0) {
+        LL_ERRX("invalid LL_MBD_QUERY_REFRESH_MS=%s using default=100",
+                ll_params[LL_MBD_QUERY_REFRESH_MS].val);
+        query_refresh_ms = 100;
+    }
+
+    ll_list_init(&query_waiting);
+    ll_list_init(&query_running);
+
+    if (query_threaded) {
+        chan_query = chan_create_event();
+        if (chan_query < 0) {
+            LL_ERR("chan_create_event failed");
+            return -1;
+        }
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = chan_query;
+        if (epoll_ctl(mbd_efd, EPOLL_CTL_ADD, chan_sock(chan_query), &ev) < 0) {
+            LL_ERR("epoll_ctl add chan_query=%d failed", chan_query);
+            return -1;
+        }
+
+        /* signals are for the main thread */
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        int rc = pthread_create(&query_thread, NULL, query_main, NULL);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (rc != 0) {
+            errno = rc;
+            LL_ERR("pthread_create query thread failed");
+            return -1;
+        }
+    }
+
+    LL_INFO("query snapshot thread=%d refresh_ms=%d", query_threaded,
+            query_refresh_ms);
+    return 0;
+}
+
+/*
+ * query_request - queue a read-only request for the next snapshot. The
+ * request buffer, its body at pos, belongs to the query now.
+ */
+int query_request(int chan_id, const struct protocol_header *hdr,
+                  struct chan_buffer *buf, u_int pos)
+{
+    struct query_req *q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        LL_ERR("calloc query request failed");
+        chan_free_buf(buf);
+        return -1;
+    }
+
+    q->chan_id = chan_id;
+    q->hdr = *hdr;
+    q->buf = buf;
+    q->pos = pos;
+    q->kind = query_kind(hdr->operation);
+    q->gen = query_gen[q->kind];
+
+    ll_list_append(&query_waiting, &q->ent);
+    return 0;
+}
+
+/*
+ * query_touch - the QUERY_TOUCH_* state may change, later requests for
+ * it need a new snapshot.
+ */
+void query_touch(unsigned what)
+{
+    for (int k = 0; k < QUERY_GROUPS; k++) {
+        if (what & (1U << k))
+            query_gen[k]++;
+    }
+}
+
+static int query_fresh(const struct query_req *q)
+{
+    const struct query_part *p = query_snap[q->kind];
+
+    return p != NULL && p->gen >= q->gen;
+}
+
+static void query_fail(enum query_kind kind)
+{
+    struct ll_list_entry *e = query_waiting.head;
+
+    while (e != NULL) {
+        struct query_req *q = (struct query_req *) e;
+        e = e->next;
+        if (q->kind != kind)
+            continue;
+        ll_list_remove(&query_waiting, &q->ent);
+        net_reply_sequence(q->hdr.sequence);
+        enqueue_header(q->chan_id, query_ack(q->hdr.operation), ENOMEM);
+        chan_free_buf(q->buf);
+        free(q);
+    }
+}
+
+static void query_publish(enum query_kind kind, int64_t now)
+{
+    struct query_part *p = query_build[kind]();
+    if (p == NULL) {
+        query_fail(kind);
+        return;
+    }
+
+    p->gen = query_gen[kind];
+    p->refs = 1;
+    query_part_unref(query_snap[kind]);
+    query_snap[kind] = p;
+    query_built[kind] = now;
+
+    LL_DEBUG("query snapshot kind=%d gen=%lu ms=%ld", kind,
+             (unsigned long) p->gen, (long) (query_clock() - now));
+}
+
+/*
+ * query_flush - build the snapshots the waiting requests need, if due,
+ * and answer the requests they make fresh. Called by the event loop
+ * at the end of every pass.
+ */
+void query_flush(void)
+{
+    if (query_waiting.count == 0)
+        return;
+
+    int64_t now = query_clock();
+    int stale[QUERY_KINDS] = {0};
+
+    for (struct ll_list_entry *e = query_waiting.head; e != NULL; e = e->next) {
+        struct query_req *q = (struct query_req *) e;
+        if (!query_fresh(q))
+            stale[q->kind] = 1;
+    }
+    for (int k = 0; k < QUERY_KINDS; k++) {
+        if (stale[k] && now - query_built[k] >= query_refresh_ms)
+            query_publish(k, now);
+    }
+
+    struct query_req *head = NULL;
+    struct query_req *tail = NULL;
+    struct ll_list_entry *e = query_waiting.head;
+    while (e != NULL) {
+        struct query_req *q = (struct query_req *) e;
+        e = e->next;
+        if (!query_fresh(q))
+            continue;
+
+        ll_list_remove(&query_waiting, &q->ent);
+        ll_list_append(&query_running, &q->ent);
+        q->snap = query_snap[q->kind];
+        q->snap->refs++;
+
+        if (q->kind != QUERY_JOBS) {
+            struct query_reply *r = (struct query_reply *) q->snap;
+            q->reply = chan_shared_buf(r->msg);
+            q->rc = q->reply != NULL ? 0 : ENOMEM;
+            query_complete(q);
+            continue;
+        }
+        if (!query_threaded) {
+            query_serve(q);
+            query_complete(q);
+            continue;
+        }
+        q->next = NULL;
+        if (tail != NULL)
+            tail->next = q;
+        else
+            head = q;
+        tail = q;
+    }
+
+    if (head == NULL)
+        return;
+
+    pthread_mutex_lock(&query_lock);
+    if (work_tail != NULL)
+        work_tail->next = head;
+    else
+        work_head = head;
+    work_tail = tail;
+    pthread_cond_signal(&query_cond);
+    pthread_mutex_unlock(&query_lock);
+}
+
+/* query_done - send the replies the query thread has encoded */
+void query_done(void)
+{
+    uint64_t n;
+
+    if (read(chan_sock(chan_query), &n, sizeof(n)) < 0 && errno != EAGAIN)
+        LL_ERR("read query event");
+
+    pthread_mutex_lock(&query_lock);
+    struct query_req *q = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&query_lock);
+
+    while (q != NULL) {
+        struct query_req *next = q->next;
+        query_complete(q);
+        q = next;
+    }
+}
+
+/* query_cancel - drop the requests of a channel being closed */
+void query_cancel(int chan_id)
+{
+    struct ll_list_entry *e = query_waiting.head;
+
+    while (e != NULL) {
+        struct query_req *q = (struct query_req *) e;
+        e = e->next;
+        if (q->chan_id != chan_id)
+            continue;
+        ll_list_remove(&query_waiting, &q->ent);
+        chan_free_buf(q->buf);
+        free(q);
+    }
+
+    for (e = query_running.head; e != NULL; e = e->next) {
+        struct query_req *q = (struct query_req *) e;
+        if (q->chan_id == chan_id)
+            q->cancelled = 1;
+    }
+}
+
+/*
+ * query_timeout - milliseconds the event loop may sleep before a
+ * snapshot a waiting request needs is due, -1 with none waiting.
+ */
+int query_timeout(void)
+{
+    if (query_waiting.count == 0)
+        return -1;
+
+    int64_t now = query_clock();
+    int64_t tmo = query_refresh_ms;
+
+    for (struct ll_list_entry *e = query_waiting.head; e != NULL; e = e->next) {
+        struct query_req *q = (struct query_req *) e;
+        int64_t due = query_built[q->kind] + query_refresh_ms - now;
+        if (due < tmo)
+            tmo = due;
+    }
+
+    return tmo < 0 ? 0 : (int) tmo;
+}
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#include "batch/lib/log.h"
+#include "base/lib/ll.syslog.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Parallel manifest replay.
+ *
+ * The manifest is mapped read only and cut into chunks at record
+ * boundaries. Worker threads decode whole chunks into arrays of
+ * struct log_record, the calling thread applies the chunks strictly in
+ * file order with replay_record(). Only the calling thread touches the
+ * job state or the log, the workers see nothing but their chunk and
+ * their slot. At most nslots chunks are decoded ahead of the applier,
+ * which bounds the memory held by decoded records.
+ */
+
+#define REPLAY_CHUNK_RECS 128
+#define REPLAY_MAX_THREADS 64
+
+struct replay_chunk {
+    size_t off;
+    size_t len;
+};
+
+struct replay_slot {
+    struct log_record *recs;
+    int cap;
+    int nrec;
+    int done;
+    int bad;   // errno of the corrupt, cut short or newer record
+    int short_read; // stopped before the end of the chunk, no error
+    int err;   // errno of a failure to decode the chunk at all
+};
+
+struct replay_pipe {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    const char *base;
+    struct replay_chunk *chunks;
+    long nchunks;
+    long next;    // next chunk to hand to a worker
+    long applied; // chunks applied so far
+    int stop;
+    int nslots;
+    struct replay_slot *slots;
+};
+
+/*
+ * replay_split - cut [off, size) into chunks of REPLAY_CHUNK_RECS
+ * records. A record whose size cannot be determined ends the split,
+ * everything from it to the end of the file goes into a last chunk so
+ * the decoder reports it exactly as the sequential reader would.
+ */
+static int replay_split(struct replay_pipe *rp, size_t off, size_t size)
+{
+    long cap = 0;
+
+    rp->chunks = NULL;
+    rp->nchunks = 0;
+
+    while (off < size) {
+        size_t start = off;
+        int n = 0;
+
+        while (off < size && n < REPLAY_CHUNK_RECS) {
+            ssize_t len = log_rec_size(rp->base + off, size - off);
+            if (len <= 0) {
+                off = size;
+                break;
+            }
+            off += (size_t) len;
+            n++;
+        }
+
+        if (rp->nchunks == cap) {
+            long ncap = cap ? cap * 2 : 1024;
+            struct replay_chunk *c = realloc(rp->chunks, ncap * sizeof(*c));
+            if (c == NULL) {
+                free(rp->chunks);
+                rp->chunks = NULL;
+                return -1;
+            }
+            rp->chunks = c;
+            cap = ncap;
+        }
+        rp->chunks[rp->nchunks].off = start;
+        rp->chunks[rp->nchunks].len = off - start;
+        rp->nchunks++;
+    }
+
+    return 0;
+}
+
+static void replay_decode(const struct replay_pipe *rp,
+                          const struct replay_chunk *c,
+                          struct replay_slot *s)
+{
+    struct event_rec rec;
+
+    s->nrec = 0;
+    s->bad = 0;
+    s->short_read = 0;
+    s->err = 0;
+
+    FILE *fp = fmemopen((void *) (rp->base + c->off), c->len, "r");
+    if (fp == NULL) {
+        s->err = errno;
+        return;
+    }
+
+    for (;;) {
+        if (s->nrec == s->cap) {
+            int ncap = s->cap ? s->cap * 2 : REPLAY_CHUNK_RECS;
+            struct log_record *r = realloc(s->recs, ncap * sizeof(*r));
+            if (r == NULL) {
+                s->err = ENOMEM;
+                break;
+            }
+            s->recs = r;
+            s->cap = ncap;
+        }
+
+        memset(&rec, 0, sizeof(struct event_rec));
+        errno = 0;
+        if (log_read_hdr(fp, &rec) < 0) {
+            if (errno == EINVAL || errno == EBADMSG || errno == EPROTO)
+                s->bad = errno;
+            else if (ftello(fp) < (off_t) c->len)
+                s->short_read = 1;
+            break;
+        }
+        log_decode(&rec, &s->recs[s->nrec]);
+        s->nrec++;
+    }
+
+    fclose(fp);
+}
+
+static void *replay_worker(void *arg)
+{
+    struct replay_pipe *rp = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&rp->lock);
+        while (!rp->stop && rp->next < rp->nchunks
+               && rp->next >= rp->applied + rp->nslots)
+            pthread_cond_wait(&rp->cond, &rp->lock);
+        if (rp->stop || rp->next >= rp->nchunks) {
+            pthread_mutex_unlock(&rp->lock);
+            return NULL;
+        }
+        long c = rp->next++;
+        pthread_mutex_unlock(&rp->lock);
+
+        struct replay_slot *s = &rp->slots[c % rp->nslots];
+        replay_decode(rp, &rp->chunks[c], s);
+
+        pthread_mutex_lock(&rp->lock);
+        s->done = 1;
+        pthread_cond_broadcast(&rp->cond);
+        pthread_mutex_unlock(&rp->lock);
+    }
+}
+
+/*
+ * replay_apply - apply the decoded chunks in file order. Returns -1 at
+ * a bad record, 0 otherwise.
+ */
+static int replay_apply(struct replay_pipe *rp, const char *path,
+                        int64_t *max_id, int *restored)
+{
+    int recno = 0;
+
+    for (long c = 0; c < rp->nchunks; c++) {
+        struct replay_slot *s = &rp->slots[c % rp->nslots];
+
+        pthread_mutex_lock(&rp->lock);
+        while (!s->done)
+            pthread_cond_wait(&rp->cond, &rp->lock);
+        pthread_mutex_unlock(&rp->lock);
+
+        if (s->err) {
+            errno = s->err;
+            LL_ERR("replay decode file=%s record=%d", path, recno + 1);
+            mbd_die(MBD_EXIT_MEM);
+        }
+
+        for (int i = 0; i < s->nrec; i++)
+            *restored += replay_record(&s->recs[i], max_id);
+        recno += s->nrec;
+
+        if (s->bad) {
+            LL_ERRX("replay stopped at bad record file=%s record=%d: %s",
+                    path, recno + 1, strerror(s->bad));
+            return -1;
+        }
+        if (s->short_read)
+            return 0;
+
+        pthread_mutex_lock(&rp->lock);
+        s->done = 0;
+        rp->applied++;
+        pthread_cond_broadcast(&rp->cond);
+        pthread_mutex_unlock(&rp->lock);
+    }
+
+    return 0;
+}
+
+static void replay_stop(struct replay_pipe *rp, pthread_t *tids, int n)
+{
+    pthread_mutex_lock(&rp->lock);
+    rp->stop = 1;
+    pthread_cond_broadcast(&rp->cond);
+    pthread_mutex_unlock(&rp->lock);
+
+    for (int i = 0; i < n; i++)
+        pthread_join(tids[i], NULL);
+}
+
+static double elapsed_ms(const struct timespec *t0)
+{
+    struct timespec t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    return (double) (t1.tv_sec - t0->tv_sec) * 1000.0 +
+           (double) (t1.tv_nsec - t0->tv_nsec) / 1e6;
+}
+
+/*
+ * replay_parallel - replay the manifest open on fd from offset with
+ * nthreads decoding threads. Returns -1 when the pipeline could not be
+ * set up, nothing has been applied then and the caller replays the file
+ * sequentially. A bad record ends the replay as in replay_stream(), it
+ * is logged and 0 is returned.
+ */
+int replay_parallel(int fd, off_t offset, const char *path, int nthreads,
+                    int64_t *max_id, int *restored)
+{
+    struct replay_pipe rp;
+    struct timespec t0;
+    struct stat st;
+    pthread_t tids[REPLAY_MAX_THREADS];
+    int nstarted = 0;
+    int rc = -1;
+
+    if (nthreads > REPLAY_MAX_THREADS)
+        nthreads = REPLAY_MAX_THREADS;
+
+    if (fstat(fd, &st) < 0) {
+        LL_ERR("fstat manifest=%s", path);
+        return -1;
+    }
+    if (st.st_size <= offset)
+        return 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    size_t size = (size_t) st.st_size;
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LL_ERR("mmap manifest=%s size=%zu", path, size);
+        return -1;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    memset(&rp, 0, sizeof(rp));
+    rp.base = map;
+    if (replay_split(&rp, (size_t) offset, size) < 0) {
+        LL_ERR("replay split manifest=%s", path);
+        munmap(map, size);
+        return -1;
+    }
+
+    rp.nslots = 2 * nthreads;
+    rp.slots = calloc(rp.nslots, sizeof(struct replay_slot));
+    if (rp.slots == NULL) {
+        LL_ERR("calloc %d replay slots", rp.nslots);
+        goto out;
+    }
+
+    pthread_mutex_init(&rp.lock, NULL);
+    pthread_cond_init(&rp.cond, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        int cc = pthread_create(&tids[i], NULL, replay_worker, &rp);
+        if (cc != 0) {
+            errno = cc;
+            LL_ERR("pthread_create replay thread %d", i);
+            break;
+        }
+        nstarted++;
+    }
+
+    if (nstarted > 0) {
+        replay_apply(&rp, path, max_id, restored);
+        rc = 0;
+    }
+    replay_stop(&rp, tids, nstarted);
+
+    pthread_cond_destroy(&rp.cond);
+    pthread_mutex_destroy(&rp.lock);
+
+    if (rc == 0)
+        LL_INFO("replay: manifest=%s threads=%d chunks=%ld bytes=%zu "
+                "elapsed_ms=%.0f", path, nstarted, rp.nchunks,
+                size - (size_t) offset, elapsed_ms(&t0));
+
+out:
+    if (rp.slots != NULL) {
+        for (int i = 0; i < rp.nslots; i++)
+            free(rp.slots[i].recs);
+        free(rp.slots);
+    }
+    free(rp.chunks);
+    munmap(map, size);
+
+    return rc;
+}
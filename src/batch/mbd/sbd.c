@@ -16,6 +16,7 @@
 #include "base/lib/ll.hash.h"
 #include "base/lib/ll.list.h"
 #include "batch/lib/rpc.h"
+#include "batch/lib/spool.h"
 #include "batch/mbd/mbd.h"
 
 static int build_sbd_run_list(struct mbd_host *n,
@@ -90,9 +91,7 @@ int mbd_sbd_register(XDR *xdrs, int32_t chan_id)
         return -1;
     }
     n->sbd_chan = chan_id;
-    char key[LL_BUFSIZ_32];
-    snprintf(key, sizeof(key), "%d", chan_id);
-    ll_hash_insert(&sbd_chan_hash, key, n, 0);
+    chan_set_owner(chan_id, MBD_CHAN_SBD, n);
 
     struct wire_sbd_register reg_ack;
     memset(&reg_ack, 0, sizeof(reg_ack));
@@ -102,6 +101,7 @@ int mbd_sbd_register(XDR *xdrs, int32_t chan_id)
         return -1;
     }
     n->state = HOST_OK | (n->state & HOST_CLOSED);
+    job_touch_host(n);
     LL_INFO("hostname=%s canon=%s addr=%s chan_fd=%d state=%d",
             hostname, n->net.name, n->net.addr, chan_id, n->state);
 
@@ -110,13 +110,6 @@ int mbd_sbd_register(XDR *xdrs, int32_t chan_id)
     hdr.operation = BATCH_SBD_REGISTER_ACK;
     hdr.status = MBD_OK;
 
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERR("auth_sign_header failed");
-        xdr_free((xdrproc_t)xdr_wire_sbd_register, &reg_ack);
-        mbd_sbd_disconnect(n);
-        return -1;
-    }
-
     size_t siz = sizeof(struct protocol_header) + MAXHOSTNAMELEN +
                  sizeof(int32_t) +
                  reg_ack.num_jobs * sizeof(struct wire_sbd_job) + LL_BUFSIZ_64;
@@ -166,7 +159,7 @@ int32_t mbd_sbd_route(struct mbd_host *n)
         return -1;
     }
 
-    if (auth_verify_header(&hdr) < 0) {
+    if (auth_verify_packet(channels[chan_id].session, buf->data, &hdr) < 0) {
         LL_ERR("failed validate header opcode=%s from=%s",
                batch_op_str(hdr.operation), chan_addr_str(chan_id));
         xdr_destroy(&xdrs);
@@ -191,6 +184,12 @@ int32_t mbd_sbd_route(struct mbd_host *n)
     case BATCH_JOB_FINISH:
         mbd_job_finish(n, &xdrs);
         break;
+    case BATCH_NEW_JOB_REPLY_MANY:
+        mbd_new_job_reply_many(n, &xdrs, &hdr);
+        break;
+    case BATCH_JOB_FINISH_MANY:
+        mbd_job_finish_many(n, &xdrs);
+        break;
     case BATCH_SBD_JOB_SIGNAL_REPLY:
         mbd_job_signal_reply(n, &xdrs, &hdr);
         break;
@@ -214,30 +213,78 @@ int mbd_sbd_disconnect(struct mbd_host *n)
 
     n->sbd_chan = -1;
     n->state = HOST_UNAVAIL | (n->state & HOST_CLOSED);
+    job_touch_host(n);
 
-    char key[LL_BUFSIZ_32];
-    snprintf(key, sizeof(key), "%d", chan_id);
-    ll_hash_remove(&sbd_chan_hash, key);
+    chan_set_owner(chan_id, MBD_CHAN_CLIENT, NULL);
     chan_shutdown(chan_id);
 
     return 0;
 }
 
-static int read_sidecar(const struct job_data *job, struct wire_job_start *ws)
+/*
+ * open_sidecar - the submit sidecar of the job, its record in the submit
+ * journal, from the staging cache when it holds it, or, for a job
+ * submitted to an older mbd, the submit file in its spool directory.
+ * *rec is the journal record to free after fclose, *staged is set when
+ * the record came from the cache.
+ */
+static FILE *open_sidecar(const struct job_data *job, char **rec,
+                          int *staged)
 {
-    char path[PATH_MAX];
-    int n;
+    *rec = NULL;
+    *staged = 0;
+
+    if (job->journal.len != 0) {
+        char key[STAGE_KEY_LEN];
+        size_t len;
+
+        stage_journal_key(key, sizeof(key), &job->journal);
+        const char *data = stage_get(key, &len);
+        if (data != NULL && len == job->journal.len) {
+            /* read only, the cache is not touched before fclose */
+            FILE *fp = fmemopen((void *) data, len, "r");
+            if (fp != NULL) {
+                *staged = 1;
+                return fp;
+            }
+        }
 
-    n = snprintf(path, sizeof(path), "%s/%ld/%ld/submit", jobs_dir,
-                 (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(path))
-        return -1;
+        *rec = journal_read(&job->journal);
+        if (*rec == NULL)
+            return NULL;
+        stage_put(key, *rec, job->journal.len);
+        FILE *fp = fmemopen(*rec, job->journal.len, "r");
+        if (fp == NULL) {
+            LL_ERR("job_id=%ld fmemopen", job->job_id);
+            free(*rec);
+            *rec = NULL;
+        }
+        return fp;
+    }
+
+    char dir[PATH_MAX];
+    if (spool_find_dir(dir, sizeof(dir), jobs_dir, job->job_id) < 0) {
+        LL_ERR("job_id=%ld no spool directory %s", job->job_id, dir);
+        return NULL;
+    }
+
+    char path[PATH_MAX + LL_BUFSIZ_32];
+    snprintf(path, sizeof(path), "%s/submit", dir);
 
     FILE *fp = fopen(path, "r");
-    if (fp == NULL) {
+    if (fp == NULL)
         LL_ERR("fopen=%s failed", path);
+
+    return fp;
+}
+
+static int read_sidecar(const struct job_data *job, struct wire_job_start *ws,
+                        int *staged)
+{
+    char *rec;
+    FILE *fp = open_sidecar(job, &rec, staged);
+    if (fp == NULL)
         return -1;
-    }
 
     char line[PATH_MAX + 16];
     while (fgets(line, sizeof(line), fp) != NULL) {
@@ -278,24 +325,52 @@ static int read_sidecar(const struct job_data *job, struct wire_job_start *ws)
     }
 
     fclose(fp);
+    free(rec);
     return 0;
 }
 
 /*
- * Read the job script into ws->script.
+ * Read the job script into ws->script, from the staging cache or the
+ * script store or, for a job submitted to an older mbd, from its own
+ * script.sh. *staged is set when it came from the cache.
  * Caller must free ws->script.data on success.
  * Returns 0 on success, -1 on error.
  */
 static int read_script(const struct job_data *job,
-                       struct wire_job_script *script)
+                       struct wire_job_script *script, int *staged)
 {
-    char path[PATH_MAX];
-    int n;
-
-    n = snprintf(path, sizeof(path), "%s/%ld/%ld/script.sh", jobs_dir,
-                 (job->job_id % JOB_BUCKETS), job->job_id);
-    if (n < 0 || n >= (int) sizeof(path))
-        return -1;
+    char path[PATH_MAX + LL_BUFSIZ_32];
+    char key[STAGE_KEY_LEN];
+
+    *staged = 0;
+    key[0] = 0;
+
+    if (job->script[0] != 0) {
+        size_t len;
+
+        stage_script_key(key, sizeof(key), job->script);
+        const char *data = stage_get(key, &len);
+        if (data != NULL && len > 0) {
+            script->data = malloc(len + 1);
+            if (script->data == NULL) {
+                LL_ERR("malloc failed size=%zu", len);
+                return -1;
+            }
+            memcpy(script->data, data, len + 1);
+            script->len = (uint32_t) len;
+            *staged = 1;
+            return 0;
+        }
+        if (script_store_path(job->script, path, sizeof(path)) < 0)
+            return -1;
+    } else {
+        char dir[PATH_MAX];
+        if (spool_find_dir(dir, sizeof(dir), jobs_dir, job->job_id) < 0) {
+            LL_ERR("job_id=%ld no spool directory %s", job->job_id, dir);
+            return -1;
+        }
+        snprintf(path, sizeof(path), "%s/script.sh", dir);
+    }
 
     struct stat st;
     if (stat(path, &st) < 0) {
@@ -336,6 +411,9 @@ static int read_script(const struct job_data *job,
     script->data[nr] = 0;
     script->len = (uint32_t) nr;
 
+    if (key[0] != 0)
+        stage_put(key, script->data, nr);
+
     return 0;
 }
 
@@ -381,6 +459,23 @@ static void build_gpu_assigned_str(struct mbd_gpu *g, int num_gpus,
     }
 }
 
+/* dispatches of a job the payload of which cannot be read before it is
+ * held */
+#define DISPATCH_PAYLOAD_RETRIES 5
+
+static void dispatch_payload_failed(struct job_data *job)
+{
+    job->pend_reason = PEND_PAYLOAD;
+    job_touch(job);
+
+    if (++job->payload_failures < DISPATCH_PAYLOAD_RETRIES)
+        return;
+
+    LL_ERRX("job_id=%ld payload unreadable %d times, holding the job",
+            job->job_id, job->payload_failures);
+    job_hold(job);
+}
+
 int mbd_dispatch_job(struct job_data *job)
 {
     struct mbd_host *h = job->run_hosts[0];
@@ -395,19 +490,26 @@ int mbd_dispatch_job(struct job_data *job)
     struct wire_job_start ws;
     memset(&ws, 0, sizeof(ws));
 
-    /* read file redirections from sidecar */
-    if (read_sidecar(job, &ws) < 0) {
+    int64_t t0 = stage_clock();
+    int sidecar_staged;
+    int script_staged;
+
+    /* read file redirections from sidecar, the job stays pending */
+    if (read_sidecar(job, &ws, &sidecar_staged) < 0) {
         LL_ERRX("job_id=%ld read_sidecar failed", job->job_id);
-        abort();
+        dispatch_payload_failed(job);
         return -1;
     }
 
-    /* read script from disk into ws.script */
-    if (read_script(job, &ws.script) < 0) {
+    /* read script into ws.script */
+    if (read_script(job, &ws.script, &script_staged) < 0) {
         LL_ERRX("job_id=%ld read_script failed", job->job_id);
-        abort();
+        dispatch_payload_failed(job);
         return -1;
     }
+    job->payload_failures = 0;
+
+    stage_record(stage_clock() - t0, sidecar_staged && script_staged);
 
     /* fill wire_job_start from job_data and sched_plan */
     ws.job_id = job->job_id;
@@ -437,12 +539,6 @@ int mbd_dispatch_job(struct job_data *job)
     hdr.operation = BATCH_NEW_JOB;
     hdr.status = MBD_OK;
 
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERRX("job_id=%ld auth_sign_header failed", job->job_id);
-        free(ws.script.data);
-        return -1;
-    }
-
     /* buffer size: fixed struct + script payload + XDR overhead */
     size_t bufsz = PACKET_HEADER_SIZE + sizeof(struct wire_job_start) +
                    ws.script.len + LL_BUFSIZ_64;
@@ -383,6 +383,15 @@ static int tokens_available(const struct job_data *job)
     return 1;
 }
 
+/* The pass sets the reason of every pending job, only a new one is a change */
+static void set_pend_reason(struct job_data *job, enum pend_reason reason)
+{
+    if (job->pend_reason == reason)
+        return;
+    job->pend_reason = reason;
+    job_touch(job);
+}
+
 void schedule(void)
 {
     LL_DEBUG("num_pend_jobs=%d", ll_list_count(&pend_jobs_list));
@@ -405,22 +414,22 @@ void schedule(void)
 
         LL_DEBUG("is job_id=%ld ready for scheduling", job->job_id);
         if (!job_is_ready(job)) {
-            job->pend_reason = PEND_JOB_NOT_READY;
+            set_pend_reason(job, PEND_JOB_NOT_READY);
             continue;
         }
 
         if (job->queue->state == QUEUE_CLOSED) {
-            job->pend_reason = PEND_QUEUE_CLOSED;
+            set_pend_reason(job, PEND_QUEUE_CLOSED);
             continue;
         }
 
         if (!tokens_available(job)) {
-            job->pend_reason = PEND_TOKENS;
+            set_pend_reason(job, PEND_TOKENS);
             continue;
         }
 
         if (!job_dep_satisfied(job)) {
-            job->pend_reason = PEND_DEPEND;
+            set_pend_reason(job, PEND_DEPEND);
             continue;
         }
 
@@ -433,13 +442,13 @@ void schedule(void)
             return;
         }
         if (n == 0) {
-            job->pend_reason = diag_reason(&diag);
+            set_pend_reason(job, diag_reason(&diag));
             LL_INFO("job_id=%ld not enough hosts found to build a plan",
                     job->job_id);
             continue;
         }
 
-        job->pend_reason = PEND_NONE;
+        set_pend_reason(job, PEND_NONE);
         if (mbd_dispatch_job(job) < 0) {
             LL_ERRX("job_id=%ld dispatch failed", job->job_id);
             continue;
@@ -469,6 +478,7 @@ void schedule(void)
             break;
 
     }
+    stage_report();
     mbd_assert_counters();
 }
 
@@ -0,0 +1,370 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "base/lib/ll.syslog.h"
+#include "base/lib/ll.conf.h"
+#include "base/lib/ll.hash.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Job script store.
+ *
+ * Scripts live in LL_STATE_DIR/mbd/scripts/<xx>/<hash>, named by the
+ * SHA-256 of their content, xx being the first two hex digits. Every
+ * element of an array, and every resubmission of the same script, shares
+ * one file: it is written and fsynced once, when the first job refers
+ * to it. A bulk submission writes its new scripts unsynced and syncs
+ * the file system once for all of them, with script_store_sync(), before
+ * it answers. mbd counts the jobs in memory referring to each script; a
+ * script whose count drops to zero is removed at the next compaction,
+ * by which time the jobs that used it have been purged; one stored for
+ * a submission that failed is removed at once. The counts are rebuilt
+ * from the JOB_NEW records at replay.
+ */
+
+struct script_ent {
+    int32_t refs;
+};
+
+static char scripts_dir[PATH_MAX];
+static struct ll_hash script_hash;
+static int scripts_unsynced;
+
+static int script_path(const char *hash, char *path, size_t size)
+{
+    int n = snprintf(path, size, "%s/%.2s/%s", scripts_dir, hash, hash);
+    if (n < 0 || n >= (int) size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int script_digest(const struct wire_job_script *script, char *hash)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len = 0;
+
+    if (!EVP_Digest(script->data, script->len, md, &len, EVP_sha256(),
+                    NULL) || len * 2 != LOG_SCRIPT_HASH_LEN) {
+        errno = EPROTO;
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < len; i++)
+        sprintf(hash + 2 * i, "%02x", md[i]);
+    hash[LOG_SCRIPT_HASH_LEN] = 0;
+
+    return 0;
+}
+
+static int script_write(const char *hash, const struct wire_job_script *script,
+                        int sync)
+{
+    char dir[PATH_MAX];
+    int n = snprintf(dir, sizeof(dir), "%s/%.2s", scripts_dir, hash);
+    if (n < 0 || n >= (int) sizeof(dir))
+        return -1;
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST) {
+        int e = errno;
+        LL_ERR("mkdir=%s", dir);
+        errno = e;
+        return -1;
+    }
+
+    char path[PATH_MAX];
+    if (script_path(hash, path, sizeof(path)) < 0)
+        return -1;
+
+    char tmp[PATH_MAX + LL_BUFSIZ_32];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    if (fd < 0) {
+        int e = errno;
+        LL_ERR("open %s", tmp);
+        errno = e;
+        return -1;
+    }
+
+    ssize_t nw = write(fd, script->data, script->len);
+    if (nw < 0 || (uint32_t) nw != script->len) {
+        int e = errno;
+        LL_ERR("write %s", tmp);
+        close(fd);
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+
+    if (sync && fsync(fd) < 0) {
+        int e = errno;
+        LL_ERR("fsync %s", tmp);
+        close(fd);
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+    close(fd);
+
+    if (rename(tmp, path) < 0) {
+        int e = errno;
+        LL_ERR("rename %s -> %s", tmp, path);
+        unlink(tmp);
+        errno = e;
+        return -1;
+    }
+    if (!sync)
+        scripts_unsynced = 1;
+
+    return 0;
+}
+
+int script_store_init(void)
+{
+    int n = snprintf(scripts_dir, sizeof(scripts_dir), "%s/mbd/scripts",
+                     ll_params[LL_STATE_DIR].val);
+    if (n < 0 || n >= (int) sizeof(scripts_dir))
+        return -1;
+
+    if (mkdir(scripts_dir, 0755) < 0 && errno != EEXIST) {
+        LL_ERR("mkdir(%s) failed", scripts_dir);
+        return -1;
+    }
+
+    if (ll_hash_init(&script_hash, 1021) < 0) {
+        LL_ERR("script hash init failed");
+        return -1;
+    }
+
+    LL_INFO("job script store initialized %s", scripts_dir);
+    return 0;
+}
+
+/*
+ * script_store_put - make the script available in the store and return
+ * its hash in hash[LOG_SCRIPT_HASH_LEN + 1]. The content is written only
+ * when no file of that hash exists yet. The caller takes a reference
+ * for every job with script_ref().
+ */
+static int script_store(const struct wire_job_script *script, char *hash,
+                        int sync)
+{
+    if (script_digest(script, hash) < 0) {
+        LL_ERR("script digest failed len=%u", script->len);
+        return -1;
+    }
+
+    struct script_ent *s = ll_hash_search(&script_hash, hash);
+    if (s != NULL && s->refs > 0)
+        return 0;
+
+    char path[PATH_MAX];
+    if (script_path(hash, path, sizeof(path)) < 0)
+        return -1;
+
+    struct stat st;
+    if (stat(path, &st) == 0 && (uint64_t) st.st_size == script->len)
+        return 0;
+
+    return script_write(hash, script, sync);
+}
+
+int script_store_put(const struct wire_job_script *script, char *hash)
+{
+    return script_store(script, hash, 1);
+}
+
+/*
+ * script_store_stage - script_store_put() without the fsync, the script
+ * is durable after the next script_store_sync().
+ */
+int script_store_stage(const struct wire_job_script *script, char *hash)
+{
+    return script_store(script, hash, 0);
+}
+
+/*
+ * script_store_sync - sync the scripts staged since the last call, one
+ * syncfs() of the file system holding the store.
+ */
+int script_store_sync(void)
+{
+    if (!scripts_unsynced)
+        return 0;
+
+    int fd = open(scripts_dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        LL_ERR("open %s", scripts_dir);
+        return -1;
+    }
+    if (syncfs(fd) < 0) {
+        int e = errno;
+        LL_ERR("syncfs %s", scripts_dir);
+        close(fd);
+        errno = e;
+        return -1;
+    }
+    close(fd);
+    scripts_unsynced = 0;
+
+    return 0;
+}
+
+/*
+ * script_store_drop - undo the store of a submission that failed before
+ * its jobs were committed: remove the script of hash unless a job in
+ * memory refers to it.
+ */
+void script_store_drop(const char *hash)
+{
+    struct script_ent *s = ll_hash_search(&script_hash, hash);
+    if (s != NULL && s->refs > 0)
+        return;
+
+    char path[PATH_MAX];
+    if (script_path(hash, path, sizeof(path)) == 0 && unlink(path) < 0
+        && errno != ENOENT)
+        LL_ERR("unlink %s", path);
+
+    if (s != NULL)
+        free(ll_hash_remove(&script_hash, hash));
+}
+
+void script_ref(const char *hash)
+{
+    if (hash[0] == 0)
+        return;
+
+    struct script_ent *s = ll_hash_search(&script_hash, hash);
+    if (s == NULL) {
+        s = calloc(1, sizeof(*s));
+        if (s == NULL) {
+            /* without an entry the script is never collected */
+            LL_ERR("calloc script entry failed");
+            return;
+        }
+        ll_hash_insert(&script_hash, hash, s, 0);
+    }
+    s->refs++;
+}
+
+void script_unref(const char *hash)
+{
+    if (hash[0] == 0)
+        return;
+
+    struct script_ent *s = ll_hash_search(&script_hash, hash);
+    if (s == NULL || s->refs == 0) {
+        LL_ERRX("script=%s unref without a reference", hash);
+        return;
+    }
+    s->refs--;
+}
+
+/*
+ * script_store_path - the file holding the script of hash.
+ */
+int script_store_path(const char *hash, char *path, size_t size)
+{
+    return script_path(hash, path, size);
+}
+
+/*
+ * script_store_gc - remove the scripts no job in memory refers to.
+ * Called after a compaction has purged finished jobs.
+ */
+void script_store_gc(void)
+{
+    struct ll_hash_iter it;
+    struct ll_hash_entry *e;
+    char **dead = NULL;
+    size_t ndead = 0;
+    size_t cap = 0;
+
+    ll_hash_iter_init(&it, &script_hash);
+    while ((e = ll_hash_iter_next(&it)) != NULL) {
+        struct script_ent *s = e->value;
+        if (s->refs > 0)
+            continue;
+        if (ndead == cap) {
+            size_t ncap = cap ? cap * 2 : 64;
+            char **d = realloc(dead, ncap * sizeof(char *));
+            if (d == NULL)
+                break;
+            dead = d;
+            cap = ncap;
+        }
+        dead[ndead++] = e->key;
+    }
+
+    int removed = 0;
+    for (size_t i = 0; i < ndead; i++) {
+        char path[PATH_MAX];
+        if (script_path(dead[i], path, sizeof(path)) == 0) {
+            if (unlink(path) == 0)
+                removed++;
+            else if (errno != ENOENT)
+                LL_ERR("unlink %s", path);
+        }
+        free(ll_hash_remove(&script_hash, dead[i]));
+    }
+    free(dead);
+
+    if (removed > 0)
+        LL_INFO("script store gc removed=%d live=%zu", removed,
+                script_hash.nentries);
+}
+
+/*
+ * script_store_sweep - at startup, after replay, remove the files of
+ * the store no replayed job refers to: scripts whose jobs were purged
+ * by a compaction mbd did not live to collect, and temporary files of
+ * an interrupted write.
+ */
+void script_store_sweep(void)
+{
+    int removed = 0;
+
+    for (int i = 0; i < 256; i++) {
+        char dir[PATH_MAX + LL_BUFSIZ_32];
+        snprintf(dir, sizeof(dir), "%s/%02x", scripts_dir, i);
+
+        DIR *dp = opendir(dir);
+        if (dp == NULL)
+            continue;
+
+        struct dirent *de;
+        while ((de = readdir(dp)) != NULL) {
+            if (de->d_name[0] == '.')
+                continue;
+            struct script_ent *s = ll_hash_search(&script_hash, de->d_name);
+            if (s != NULL && s->refs > 0)
+                continue;
+            if (unlinkat(dirfd(dp), de->d_name, 0) == 0)
+                removed++;
+        }
+        closedir(dp);
+    }
+
+    /* entries left with no reference have just lost their file */
+    script_store_gc();
+
+    LL_INFO("script store sweep removed=%d live=%zu", removed,
+            script_hash.nentries);
+}
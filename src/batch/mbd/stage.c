@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "base/lib/ll.bufsiz.h"
+#include "base/lib/ll.syslog.h"
+#include "base/lib/ll.conf.h"
+#include "base/lib/ll.hash.h"
+#include "base/lib/ll.list.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Dispatch staging.
+ *
+ * To start a job mbd sends sbd its submit sidecar and its script. Both
+ * used to be read from disk by the scheduler while it dispatched, one
+ * journal pread and one script file per job. The staging cache keeps
+ * them in memory from the moment mbd writes them at submission, so a
+ * job dispatched shortly after it was submitted, the common case, is
+ * started without touching the filesystem. The sidecar is kept once
+ * per submission and the script once per content hash, so every
+ * element of an array shares them.
+ *
+ * Entries are evicted least recently used first once their total size
+ * exceeds LL_MBD_DISPATCH_CACHE_MB. A miss, after a restart or an
+ * eviction, reads the disk as before and stages what it read.
+ */
+
+#define STAGE_SAMPLES 1024
+/* seconds between two reports of the build times */
+#define STAGE_REPORT_INTERVAL 60
+
+struct stage_ent {
+    struct ll_list_entry ent; /* LRU, the head is evicted first */
+    char key[STAGE_KEY_LEN];
+    size_t len;
+    char data[];
+};
+
+static size_t stage_max;
+static size_t stage_bytes;
+static struct ll_list stage_lru;
+static struct ll_hash stage_hash;
+
+/* build times of the last STAGE_SAMPLES dispatches in microseconds */
+static int64_t stage_usec[STAGE_SAMPLES];
+static int stage_nsamples;
+static int stage_next;
+static int stage_pending;
+static int64_t stage_hits;
+static int64_t stage_misses;
+
+int stage_init(void)
+{
+    int mb;
+
+    if (!ll_atoi(ll_params[LL_MBD_DISPATCH_CACHE_MB].val, &mb) || mb < 0) {
+        LL_ERRX("invalid LL_MBD_DISPATCH_CACHE_MB=%s using default=64",
+                ll_params[LL_MBD_DISPATCH_CACHE_MB].val);
+        mb = 64;
+    }
+    stage_max = (size_t) mb << 20;
+
+    ll_list_init(&stage_lru);
+    if (ll_hash_init(&stage_hash, 1021) < 0) {
+        LL_ERR("stage hash init failed");
+        return -1;
+    }
+
+    LL_INFO("dispatch staging cache_mb=%d", mb);
+    return 0;
+}
+
+static void stage_evict(struct stage_ent *s)
+{
+    ll_list_remove(&stage_lru, &s->ent);
+    ll_hash_remove(&stage_hash, s->key);
+    stage_bytes -= s->len;
+    free(s);
+}
+
+/*
+ * stage_put - keep a copy of len bytes under key, replacing what was
+ * staged under it. Nothing is kept when the cache is disabled or the
+ * data alone is larger than the cache.
+ */
+void stage_put(const char *key, const char *data, size_t len)
+{
+    if (len > stage_max || strlen(key) >= STAGE_KEY_LEN)
+        return;
+
+    struct stage_ent *s = ll_hash_search(&stage_hash, key);
+    if (s != NULL)
+        stage_evict(s);
+
+    while (stage_bytes + len > stage_max && stage_lru.head != NULL)
+        stage_evict((struct stage_ent *) stage_lru.head);
+
+    s = malloc(sizeof(*s) + len + 1);
+    if (s == NULL) {
+        /* only a cache, the dispatch reads the disk */
+        LL_ERR("malloc stage entry len=%zu", len);
+        return;
+    }
+    ll_strlcpy(s->key, key, sizeof(s->key));
+    memcpy(s->data, data, len);
+    s->data[len] = 0;
+    s->len = len;
+
+    if (ll_hash_insert(&stage_hash, key, s, 0) != LL_HASH_INSERTED) {
+        LL_ERRX("stage insert key=%s failed", key);
+        free(s);
+        return;
+    }
+
+    ll_list_append(&stage_lru, &s->ent);
+    stage_bytes += len;
+}
+
+/*
+ * stage_get - the data staged under key, NUL terminated, and its length
+ * in *len, or NULL. The data stays valid until the next stage_put().
+ */
+const char *stage_get(const char *key, size_t *len)
+{
+    struct stage_ent *s = ll_hash_search(&stage_hash, key);
+    if (s == NULL)
+        return NULL;
+
+    ll_list_remove(&stage_lru, &s->ent);
+    ll_list_append(&stage_lru, &s->ent);
+    *len = s->len;
+
+    return s->data;
+}
+
+/* Keys of the sidecar record of a submission and of a script. */
+void stage_journal_key(char *buf, size_t size, const struct journal_ref *ref)
+{
+    snprintf(buf, size, "journal:%u:%ld", ref->seq, (long) ref->off);
+}
+
+void stage_script_key(char *buf, size_t size, const char *hash)
+{
+    snprintf(buf, size, "script:%s", hash);
+}
+
+int64_t stage_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/*
+ * stage_record - account the time spent building the start payload of
+ * a job, hit when neither its sidecar nor its script was read from disk.
+ */
+void stage_record(int64_t usec, int hit)
+{
+    stage_usec[stage_next] = usec;
+    stage_next = (stage_next + 1) % STAGE_SAMPLES;
+    if (stage_nsamples < STAGE_SAMPLES)
+        stage_nsamples++;
+    stage_pending++;
+
+    if (hit)
+        stage_hits++;
+    else
+        stage_misses++;
+}
+
+static int stage_usec_cmp(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * stage_report - log the payload build time percentiles over the last
+ * STAGE_SAMPLES dispatches, called by the scheduler after every pass,
+ * at most once every STAGE_REPORT_INTERVAL seconds and only when jobs
+ * were dispatched since the last report.
+ */
+void stage_report(void)
+{
+    static int64_t sorted[STAGE_SAMPLES];
+    static time_t last;
+
+    if (stage_pending == 0)
+        return;
+
+    time_t now = time(NULL);
+    if (now - last < STAGE_REPORT_INTERVAL)
+        return;
+    last = now;
+
+    int n = stage_nsamples;
+    memcpy(sorted, stage_usec, (size_t) n * sizeof(sorted[0]));
+    qsort(sorted, (size_t) n, sizeof(sorted[0]), stage_usec_cmp);
+
+    LL_INFO("dispatch staging jobs=%d hits=%ld misses=%ld window=%d "
+            "p50_us=%ld p90_us=%ld p99_us=%ld max_us=%ld "
+            "entries=%d bytes=%zu", stage_pending, (long) stage_hits,
+            (long) stage_misses, n, (long) sorted[n / 2],
+            (long) sorted[n * 9 / 10], (long) sorted[n * 99 / 100],
+            (long) sorted[n - 1], stage_lru.count, stage_bytes);
+
+    stage_pending = 0;
+}
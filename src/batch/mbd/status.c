@@ -0,0 +1,224 @@
+/*
+ * Copyright (C) LavaLite Contributors
+ * GPL v2
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "base/lib/ll.syslog.h"
+#include "base/lib/ll.conf.h"
+#include "batch/lib/status.h"
+#include "batch/mbd/mbd.h"
+
+/*
+ * Cluster status export, see batch/lib/status.h.
+ *
+ * Monitoring agents on the master host used to poll bhosts and
+ * bqueues, each poll a connection, a request for the event loop and an
+ * encoded reply. The status file gives them the same records with no
+ * call to mbd at all: the event loop rewrites it at the end of every
+ * scheduling pass, which costs a copy of the hosts, the queues and the
+ * token pools, and readers copy it out of their mapping.
+ */
+
+static struct ll_status_header *status_map;
+static size_t status_size;
+
+static size_t status_align(size_t n)
+{
+    return (n + 7) & ~(size_t) 7;
+}
+
+/*
+ * Tell the readers of the file of a previous mbd, open on fd, to map
+ * the new one, once the new one has taken its name.
+ */
+static void status_retire(int fd, const char *path)
+{
+    if (fd < 0)
+        return;
+
+    uint32_t magic = 0;
+    if (pwrite(fd, &magic, sizeof(magic), 0) != sizeof(magic))
+        LL_ERR("retire %s failed", path);
+    close(fd);
+}
+
+int status_init(void)
+{
+    int on;
+
+    if (!ll_atoi(ll_params[LL_MBD_STATUS_EXPORT].val, &on) || on < 0
+        || on > 1) {
+        LL_ERRX("invalid LL_MBD_STATUS_EXPORT=%s using default=1",
+                ll_params[LL_MBD_STATUS_EXPORT].val);
+        on = 1;
+    }
+    if (!on)
+        return 0;
+
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+    int n = snprintf(path, sizeof(path), "%s/mbd/%s",
+                     ll_params[LL_STATE_DIR].val, LL_STATUS_FILE);
+    if (n < 0 || n >= (int) sizeof(path)
+        || snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int) sizeof(tmp)) {
+        LL_ERRX("status file path too long");
+        return -1;
+    }
+
+    uint32_t nhosts = (uint32_t) ll_list_count(&host_list);
+    uint32_t nqueues = (uint32_t) ll_list_count(&queue_list);
+    uint32_t ntokens = (uint32_t) ll_list_count(&token_pool_list);
+
+    size_t host_off = status_align(sizeof(struct ll_status_header));
+    size_t queue_off =
+        host_off + status_align(nhosts * sizeof(struct ll_status_host));
+    size_t token_off =
+        queue_off + status_align(nqueues * sizeof(struct ll_status_queue));
+    status_size =
+        token_off + status_align(ntokens * sizeof(struct ll_status_token));
+
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        LL_ERR("open %s failed", tmp);
+        return -1;
+    }
+    if (ftruncate(fd, (off_t) status_size) < 0) {
+        LL_ERR("ftruncate %s size=%zu failed", tmp, status_size);
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+
+    void *p = mmap(NULL, status_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        LL_ERR("mmap %s size=%zu failed", tmp, status_size);
+        unlink(tmp);
+        return -1;
+    }
+
+    status_map = p;
+    status_map->version = LL_STATUS_VERSION;
+    status_map->size = status_size;
+    status_map->nhosts = nhosts;
+    status_map->host_off = (uint32_t) host_off;
+    status_map->nqueues = nqueues;
+    status_map->queue_off = (uint32_t) queue_off;
+    status_map->ntokens = ntokens;
+    status_map->token_off = (uint32_t) token_off;
+    status_publish();
+    __atomic_store_n(&status_map->magic, LL_STATUS_MAGIC, __ATOMIC_RELEASE);
+
+    // readers remapping the name must never find the old file retired
+    int old_fd = open(path, O_WRONLY);
+    if (rename(tmp, path) < 0) {
+        LL_ERR("rename %s -> %s failed", tmp, path);
+        if (old_fd >= 0)
+            close(old_fd);
+        munmap(status_map, status_size);
+        status_map = NULL;
+        unlink(tmp);
+        return -1;
+    }
+    status_retire(old_fd, path);
+
+    LL_INFO("status export path=%s hosts=%u queues=%u tokens=%u size=%zu",
+            path, nhosts, nqueues, ntokens, status_size);
+    return 0;
+}
+
+static void status_write(void)
+{
+    char *base = (char *) status_map;
+    struct ll_status_host *hosts =
+        (struct ll_status_host *) (base + status_map->host_off);
+    struct ll_status_queue *queues =
+        (struct ll_status_queue *) (base + status_map->queue_off);
+    struct ll_status_token *tokens =
+        (struct ll_status_token *) (base + status_map->token_off);
+
+    uint32_t i = 0;
+    for (struct ll_list_entry *e = host_list.head;
+         e != NULL && i < status_map->nhosts; e = e->next) {
+        struct mbd_host *h = (struct mbd_host *) e;
+        struct ll_status_host *s = &hosts[i++];
+
+        ll_strlcpy(s->name, h->net.name, sizeof(s->name));
+        s->state = h->state;
+        s->total_cpu = h->res.total_cpu;
+        s->free_cpu = h->res.free_cpu;
+        s->total_gpu = h->res.gpu.count;
+        s->free_gpu = gpu_ids_count_free(&h->res.gpu);
+        s->num_jobs = h->num_jobs;
+        s->num_run = h->num_run;
+        s->num_susp = h->num_susp;
+        s->total_mem_mb = h->res.total_mem_mb;
+        s->free_mem_mb = h->res.free_mem_mb;
+        s->total_storage_mb = h->res.total_storage_mb;
+        s->free_storage_mb = h->res.free_storage_mb;
+        ll_strlcpy(s->gpu_model, h->res.gpu.gpu_model, sizeof(s->gpu_model));
+        ll_strlcpy(s->gpu_ids, h->res.gpu.gpu_ids, sizeof(s->gpu_ids));
+    }
+
+    i = 0;
+    for (struct ll_list_entry *e = queue_list.head;
+         e != NULL && i < status_map->nqueues; e = e->next) {
+        struct mbd_queue *q = (struct mbd_queue *) e;
+        struct ll_status_queue *s = &queues[i++];
+
+        ll_strlcpy(s->name, q->name, sizeof(s->name));
+        ll_strlcpy(s->description, q->description, sizeof(s->description));
+        s->status = q->state;
+        s->priority = q->priority;
+        s->max_jobs = q->max_jobs;
+        s->num_jobs = q->num_jobs;
+        s->num_pend = q->num_pend;
+        s->num_held = q->num_held;
+        s->num_run = q->num_run;
+        s->num_susp = q->num_susp;
+        s->num_cpus_used = q->num_cpus_used;
+        s->num_hosts_used = q->num_hosts_used;
+    }
+
+    i = 0;
+    for (struct ll_list_entry *e = token_pool_list.head;
+         e != NULL && i < status_map->ntokens; e = e->next) {
+        struct mbd_token_pool *t = (struct mbd_token_pool *) e;
+        struct ll_status_token *s = &tokens[i++];
+
+        ll_strlcpy(s->name, t->name, sizeof(s->name));
+        s->total = t->total;
+        s->free = t->free;
+    }
+
+    status_map->update_time = (int64_t) time(NULL);
+}
+
+/*
+ * status_publish - rewrite the records of the status file under its
+ * sequence lock, at the end of a scheduling pass.
+ */
+void status_publish(void)
+{
+    if (status_map == NULL)
+        return;
+
+    uint64_t gen = status_map->gen;
+
+    __atomic_store_n(&status_map->gen, gen + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    status_write();
+    __atomic_store_n(&status_map->gen, gen + 2, __ATOMIC_RELEASE);
+}
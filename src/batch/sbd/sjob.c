@@ -732,9 +732,8 @@ int sbd_job_new_reply(struct sbd_job *job)
     r.pgid = job->pgid;
     r.state = JOB_RUNNING;
 
-    if (sbd_send_msg(BATCH_NEW_JOB_REPLY, MBD_OK, &r, LL_BUFSIZ_1K,
-                     (bool_t(*)()) xdr_wire_job_reply) < 0) {
-        LL_ERR("job=%ld sbd_send_msg failed", job->job_id);
+    if (sbd_send_job_reply(&r) < 0) {
+        LL_ERR("job=%ld sbd_send_job_reply failed", job->job_id);
         return -1;
     }
 
@@ -746,19 +745,11 @@ int sbd_job_new_reply(struct sbd_job *job)
 /* -----------------------------------------------------------------------
  * job new ack  (mbd -> sbd: mbd committed pid/pgid)
  * ----------------------------------------------------------------------- */
-void sbd_job_new_reply_ack(XDR *xdrs)
+static void job_new_reply_acked(const struct wire_job_ack *ack)
 {
-    struct wire_job_ack ack;
-    memset(&ack, 0, sizeof(ack));
-
-    if (!xdr_wire_job_ack(xdrs, &ack)) {
-        LL_ERR("xdr_wire_job_ack decode failed");
-        return;
-    }
-
-    struct sbd_job *job = sbd_job_lookup(ack.job_id);
+    struct sbd_job *job = sbd_job_lookup(ack->job_id);
     if (job == NULL) {
-        LL_ERR("new_job_ack for unknown job=%ld", ack.job_id);
+        LL_ERR("new_job_ack for unknown job=%ld", ack->job_id);
         return;
     }
 
@@ -782,6 +773,19 @@ void sbd_job_new_reply_ack(XDR *xdrs)
     assert(job->finish_acked == false);
 }
 
+void sbd_job_new_reply_ack(XDR *xdrs)
+{
+    struct wire_job_ack ack;
+    memset(&ack, 0, sizeof(ack));
+
+    if (!xdr_wire_job_ack(xdrs, &ack)) {
+        LL_ERR("xdr_wire_job_ack decode failed");
+        return;
+    }
+
+    job_new_reply_acked(&ack);
+}
+
 /* -----------------------------------------------------------------------
  * job finish  (sbd -> mbd: job exited)
  * ----------------------------------------------------------------------- */
@@ -832,9 +836,9 @@ int sbd_job_finish(struct sbd_job *job)
     f.swap_mb = job->res_usage.swap_mb;
     f.cpu_time = job->res_usage.cpu_time;
 
-    if (sbd_send_msg(BATCH_JOB_FINISH, MBD_OK, &f, LL_BUFSIZ_1K,
-                     (bool_t(*)()) xdr_wire_job_finish) < 0) {
-        LL_ERR("job=%ld sbd_job_finish sbd_send_msg failed", job->job_id);
+    if (sbd_send_job_finish(&f) < 0) {
+        LL_ERR("job=%ld sbd_job_finish sbd_send_job_finish failed",
+               job->job_id);
         return -1;
     }
 
@@ -847,26 +851,11 @@ int sbd_job_finish(struct sbd_job *job)
  * job finish ack  (mbd -> sbd: mbd committed finish)
  * ----------------------------------------------------------------------- */
 
-void sbd_job_finish_ack(XDR *xdrs)
+static void job_finish_acked(const struct wire_job_ack *ack)
 {
-    struct wire_job_ack ack;
-    memset(&ack, 0, sizeof(ack));
-
-    if (!xdr_wire_job_ack(xdrs, &ack)) {
-        LL_ERR("xdr_wire_job_ack decode failed");
-        return;
-    }
-
-    if (ack.ack_op != BATCH_JOB_FINISH) {
-        LL_ERR("finish ack mismatch: ack_op=%d job=%ld", ack.ack_op,
-               ack.job_id);
-        abort();
-        return;
-    }
-
-    struct sbd_job *job = sbd_job_lookup(ack.job_id);
+    struct sbd_job *job = sbd_job_lookup(ack->job_id);
     if (job == NULL) {
-        LL_ERR("job_finish_ack: unknown job=%ld", ack.job_id);
+        LL_ERR("job_finish_ack: unknown job=%ld", ack->job_id);
         return;
     }
 
@@ -907,6 +896,60 @@ void sbd_job_finish_ack(XDR *xdrs)
     free(job);
 }
 
+void sbd_job_finish_ack(XDR *xdrs)
+{
+    struct wire_job_ack ack;
+    memset(&ack, 0, sizeof(ack));
+
+    if (!xdr_wire_job_ack(xdrs, &ack)) {
+        LL_ERR("xdr_wire_job_ack decode failed");
+        return;
+    }
+
+    if (ack.ack_op != BATCH_JOB_FINISH) {
+        LL_ERR("finish ack mismatch: ack_op=%d job=%ld", ack.ack_op,
+               ack.job_id);
+        abort();
+        return;
+    }
+
+    job_finish_acked(&ack);
+}
+
+/* -----------------------------------------------------------------------
+ * job acks  (mbd -> sbd: the records of a coalesced message committed)
+ * ----------------------------------------------------------------------- */
+
+void sbd_job_ack_many(XDR *xdrs)
+{
+    struct wire_job_ack_many m;
+    memset(&m, 0, sizeof(m));
+
+    if (!xdr_wire_job_ack_many(xdrs, &m)) {
+        LL_ERR("xdr_wire_job_ack_many decode failed");
+        xdr_free((xdrproc_t) xdr_wire_job_ack_many, (char *) &m);
+        return;
+    }
+
+    for (int32_t i = 0; i < m.num_acks; i++) {
+        const struct wire_job_ack *ack = &m.acks[i];
+
+        switch (ack->ack_op) {
+        case BATCH_NEW_JOB_REPLY:
+            job_new_reply_acked(ack);
+            break;
+        case BATCH_JOB_FINISH:
+            job_finish_acked(ack);
+            break;
+        default:
+            LL_ERR("unknown ack_op=%d job=%ld", ack->ack_op, ack->job_id);
+            break;
+        }
+    }
+
+    xdr_free((xdrproc_t) xdr_wire_job_ack_many, (char *) &m);
+}
+
 /* job signal  (mbd -> sbd: send signal to job)
  * LavaLite-managed job control:
  * STOP/CONT/KILL are implemented through cgroup v2.
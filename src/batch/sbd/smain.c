@@ -52,7 +52,7 @@ int sbd_timer_chan = -1;
 int sbd_mbd_chan = -1;
 int sbd_efd = -1;
 pid_t pruner_pid = -1;
-static struct epoll_event sbd_events[CHAN_MAX];
+static struct epoll_event sbd_events[CHAN_EVENTS];
 static int sbd_resend_timer;
 
 // Handler sets these variables to signal events
@@ -117,6 +117,9 @@ static int sbd_init(void)
         return -1;
     }
 
+    if (sbd_send_init() < 0)
+        return -1;
+
     if (sbd_ll_check_conf()) {
         LL_ERRX("sbd_check_conf failed cannot run");
         return -1;
@@ -211,7 +214,12 @@ static int sbd_init_network(void)
     }
     sbd_port = (sim_port > 0) ? (uint16_t) sim_port : (uint16_t) t;
 
-    chan_init();
+    if (ll_set_limits() < 0)
+        LL_ERR("ll_set_limits failed, channels limited to the soft limits");
+    if (chan_init() < 0) {
+        LL_ERR("chan_init failed");
+        return -1;
+    }
 
     // now open the sbd server channel
     sbd_listen_chan = chan_tcp_server(sbd_port);
@@ -637,8 +645,15 @@ static void sbd_run_daemon(void)
             break;
         }
 
-        // We pass -1 as the timer channel will ring
-        int nready = chan_epoll(sbd_efd, sbd_events, CHAN_MAX, -1);
+        // Send what the passes coalesced when there is nothing left to
+        // read, a job start larger than the receive ring is read in a
+        // pass of its own, and at the latest on the next timer tick.
+        int nready = chan_epoll(sbd_efd, sbd_events, CHAN_EVENTS, 0);
+        if (nready == 0) {
+            sbd_send_flush();
+            // We pass -1 as the timer channel will ring
+            nready = chan_epoll(sbd_efd, sbd_events, CHAN_EVENTS, -1);
+        }
         // save the epoll errno as the coming reap children can change it
         int epoll_errno = errno;
 
@@ -682,6 +697,8 @@ static void sbd_run_daemon(void)
                 job_finish_drive();
                 job_status_checking();
                 sbd_prune_jobs_try();
+                // bound the wait of the records on a host never idle
+                sbd_send_flush();
                 // rest the state
                 channels[chan_id].chan_events = CHAN_EPOLLNONE;
                 continue;
@@ -694,7 +711,10 @@ static void sbd_run_daemon(void)
             // There is an event on the permament channel
             // connection with mbd
             if (chan_id == sbd_mbd_chan) {
-                sbd_mbd_route(chan_id);
+                // one read may have framed several messages
+                while (sbd_mbd_route(chan_id) == 0 && chan_id == sbd_mbd_chan
+                       && !ll_list_is_empty(&channels[chan_id].recv))
+                    ;
                 // reset the channel state
                 channels[chan_id].chan_events = CHAN_EPOLLNONE;
                 continue;
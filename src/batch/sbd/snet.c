@@ -3,6 +3,7 @@
  * GPL v2
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <assert.h>
@@ -15,6 +16,18 @@
 #include "batch/sbd/sbd.h"
 #include "batch/lib/rpc.h"
 
+/*
+ * Pid replies and finish reports coalesced during a pass of the event
+ * loop, sent by sbd_send_flush() before it waits again: one message and
+ * one ack for the jobs a pass started or reaped, instead of one each.
+ * A pass with a single record sends the message of a job.
+ */
+static int msg_batch_max;
+static struct wire_job_reply *batch_replies;
+static int32_t num_batch_replies;
+static struct wire_job_finish *batch_finish;
+static int32_t num_batch_finish;
+
 static int32_t sbd_enqueue_payload(int chan_id, struct protocol_header *hdr,
                                    void *payload, size_t siz,
                                    bool_t (*xdr_func)())
@@ -40,15 +53,15 @@ static int32_t sbd_enqueue_payload(int chan_id, struct protocol_header *hdr,
     buf->len = (size_t) xdr_getpos(&xdrs);
     xdr_destroy(&xdrs);
 
-    if (chan_enqueue(chan_id, buf) < 0) {
-        LL_ERR("chan_enqueue failed op=%d len=%d", hdr->operation,
-               (int) buf->len);
+    if (auth_sign_packet(channels[chan_id].session, buf->data) < 0) {
+        LL_ERRX("auth_sign_packet failed op=%d", hdr->operation);
         chan_free_buf(buf);
         return -1;
     }
 
-    if (chan_set_write_interest(chan_id, sbd_efd, 1) < 0) {
-        LL_ERR("chan_set_write_interest failed");
+    if (chan_send(chan_id, buf, sbd_efd) < 0) {
+        LL_ERR("chan_send failed op=%d len=%d", hdr->operation,
+               (int) buf->len);
         chan_free_buf(buf);
         return -1;
     }
@@ -83,6 +96,18 @@ int sbd_mbd_connect(void)
         return -1;
     }
 
+    // The session is opened while the socket still blocks, every
+    // message after it is signed with the session key.
+    int session;
+    if (ll_atoi(ll_params[LL_AUTH_SESSION].val, &session) && session
+        && mbd_session_open(sbd_mbd_chan, 3) < 0) {
+        LL_ERR("cannot open authenticated session with mbd chan=%d",
+               sbd_mbd_chan);
+        sbd_chan_shutdown(sbd_mbd_chan);
+        sbd_mbd_chan = -1;
+        return -1;
+    }
+
     // Now we set the socket as non blocking for all our
     // communication with mbd
     if (io_non_block(chan_sock(sbd_mbd_chan)) < 0) {
@@ -113,6 +138,9 @@ void sbd_mbd_link_down(void)
 
     sbd_mbd_chan = -1;
 
+    // records not sent are sent again once the link is back
+    num_batch_replies = num_batch_finish = 0;
+
     struct ll_list_entry *e;
     for (e = sbd_job_list.head; e; e = e->next) {
         struct sbd_job *job = (struct sbd_job *) e;
@@ -217,7 +245,7 @@ int sbd_mbd_route(int chan_id)
         return -1;
     }
 
-    if (auth_verify_header(&hdr) < 0) {
+    if (auth_verify_packet(channels[chan_id].session, buf->data, &hdr) < 0) {
         LL_ERR("failed validate header opcode=%s from=%s",
                batch_op_str(hdr.operation), chan_addr_str(chan_id));
         xdr_destroy(&xdrs);
@@ -243,6 +271,9 @@ int sbd_mbd_route(int chan_id)
     case BATCH_JOB_FINISH_ACK:
         sbd_job_finish_ack(&xdrs);
         break;
+    case BATCH_JOB_ACK_MANY:
+        sbd_job_ack_many(&xdrs);
+        break;
     case BATCH_SBD_JOB_SIGNAL:
         sbd_job_signal(&xdrs);
         break;
@@ -327,11 +358,6 @@ int sbd_send_msg(int32_t op, int32_t status, void *payload, size_t siz,
     hdr.operation = op;
     hdr.status = status;
 
-    if (auth_sign_header(&hdr) < 0) {
-        LL_ERR("auth_sign_header failed op=%d", op);
-        return -1;
-    }
-
     int cc = sbd_enqueue_payload(sbd_mbd_chan, &hdr, payload, siz, xdr_func);
     if (cc < 0) {
         LL_ERR("sbd_enqueue_payload failed closing chan=%d to mbd",
@@ -342,3 +368,109 @@ int sbd_send_msg(int32_t op, int32_t status, void *payload, size_t siz,
 
     return 0;
 }
+
+int sbd_send_init(void)
+{
+    if (!ll_atoi(ll_params[LL_SBD_MSG_BATCH].val, &msg_batch_max)
+        || msg_batch_max < 1 || msg_batch_max > WIRE_JOB_BATCH_MAX) {
+        LL_ERRX("invalid LL_SBD_MSG_BATCH=%s using default=256",
+                ll_params[LL_SBD_MSG_BATCH].val);
+        msg_batch_max = 256;
+    }
+
+    if (msg_batch_max > 1) {
+        batch_replies = calloc(msg_batch_max, sizeof(*batch_replies));
+        batch_finish = calloc(msg_batch_max, sizeof(*batch_finish));
+        if (batch_replies == NULL || batch_finish == NULL) {
+            LL_ERR("calloc of LL_SBD_MSG_BATCH=%d records failed",
+                   msg_batch_max);
+            return -1;
+        }
+    }
+
+    LL_INFO("LL_SBD_MSG_BATCH=%d", msg_batch_max);
+    return 0;
+}
+
+static int flush_replies(void)
+{
+    int32_t num = num_batch_replies;
+
+    num_batch_replies = 0;
+    if (num == 0)
+        return 0;
+    if (num == 1)
+        return sbd_send_msg(BATCH_NEW_JOB_REPLY, MBD_OK, &batch_replies[0],
+                            LL_BUFSIZ_1K, (bool_t(*)()) xdr_wire_job_reply);
+
+    struct wire_job_reply_many m;
+    m.num_replies = num;
+    m.replies = batch_replies;
+
+    // a reply encodes in 20 bytes
+    return sbd_send_msg(BATCH_NEW_JOB_REPLY_MANY, MBD_OK, &m,
+                        LL_BUFSIZ_1K + (size_t) num * 32,
+                        (bool_t(*)()) xdr_wire_job_reply_many);
+}
+
+static int flush_finish(void)
+{
+    int32_t num = num_batch_finish;
+
+    num_batch_finish = 0;
+    if (num == 0)
+        return 0;
+    if (num == 1)
+        return sbd_send_msg(BATCH_JOB_FINISH, MBD_OK, &batch_finish[0],
+                            LL_BUFSIZ_1K, (bool_t(*)()) xdr_wire_job_finish);
+
+    struct wire_job_finish_many m;
+    m.num_finish = num;
+    m.finish = batch_finish;
+
+    // a finish report encodes in 44 bytes
+    return sbd_send_msg(BATCH_JOB_FINISH_MANY, MBD_OK, &m,
+                        LL_BUFSIZ_1K + (size_t) num * 64,
+                        (bool_t(*)()) xdr_wire_job_finish_many);
+}
+
+int sbd_send_job_reply(struct wire_job_reply *r)
+{
+    if (msg_batch_max == 1)
+        return sbd_send_msg(BATCH_NEW_JOB_REPLY, MBD_OK, r, LL_BUFSIZ_1K,
+                            (bool_t(*)()) xdr_wire_job_reply);
+
+    batch_replies[num_batch_replies++] = *r;
+    if (num_batch_replies == msg_batch_max)
+        return flush_replies();
+    return 0;
+}
+
+int sbd_send_job_finish(struct wire_job_finish *f)
+{
+    if (msg_batch_max == 1)
+        return sbd_send_msg(BATCH_JOB_FINISH, MBD_OK, f, LL_BUFSIZ_1K,
+                            (bool_t(*)()) xdr_wire_job_finish);
+
+    batch_finish[num_batch_finish++] = *f;
+    if (num_batch_finish == msg_batch_max)
+        return flush_finish();
+    return 0;
+}
+
+/*
+ * sbd_send_flush - send the records coalesced during the pass, the pid
+ * replies first. A failure takes the link down and the records are
+ * sent again after it reconnects.
+ */
+void sbd_send_flush(void)
+{
+    if (!sbd_mbd_link_ready()) {
+        num_batch_replies = num_batch_finish = 0;
+        return;
+    }
+
+    if (flush_replies() < 0)
+        return;
+    flush_finish();
+}
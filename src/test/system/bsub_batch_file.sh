@@ -0,0 +1,66 @@
+#!/bin/bash
+# tests/system/bsub_batch_file.sh
+
+NAME="bsub_batch_file"
+N=3
+
+fail() {
+    echo "FAIL $NAME: $1"
+    exit 1
+}
+
+FILE=$(mktemp) || fail "mktemp failed"
+trap 'rm -f "$FILE"' EXIT
+
+# N jobs between a comment, a blank line and an indented comment,
+# none of which may count as a submission
+cat > "$FILE" <<EOF
+# batch file of $NAME
+-o /dev/null -e /dev/null true
+
+-o /dev/null -e /dev/null true
+    # indented comment
+-o /dev/null -e /dev/null true
+EOF
+
+JIDS=$(bsub --batch-file "$FILE" 2>&1 | grep -oP 'Job <\K[0-9]+')
+[ -z "$JIDS" ] && fail "no jobids returned"
+NJOBS=$(echo "$JIDS" | wc -l)
+[ "$NJOBS" -eq "$N" ] || fail "expected $N jobs, got $NJOBS: $JIDS"
+echo "RUN: $NAME jobids=$(echo $JIDS)"
+
+# one request, one range of consecutive job IDs
+PREV=""
+for JID in $JIDS; do
+    [ -n "$PREV" ] && [ "$JID" -ne $((PREV + 1)) ] \
+        && fail "job IDs not consecutive: $(echo $JIDS)"
+    PREV=$JID
+done
+
+for JID in $JIDS; do
+    STATE=""
+    for i in $(seq 1 15); do
+        STATE=$(bjobs $JID 2>/dev/null | awk 'NR==2 {print $3}')
+        [ "$STATE" = "DONE" ] && break
+        sleep 1
+    done
+    [ "$STATE" != "DONE" ] && fail "timeout waiting for DONE of $JID, last state=$STATE"
+done
+
+# mbd rejects the line naming a missing queue, so the held jobs of the
+# lines around it must not be submitted either
+cat > "$FILE" <<EOF
+--hold -o /dev/null -e /dev/null true
+--hold --queue no_such_queue_$$ -o /dev/null -e /dev/null true
+--hold -o /dev/null -e /dev/null true
+EOF
+
+BEFORE=$(bjobs 2>/dev/null | awk 'NR>1' | wc -l)
+OUT=$(bsub --batch-file "$FILE" 2>&1)
+[ $? -eq 0 ] && fail "batch file with an invalid line was accepted: $OUT"
+echo "$OUT" | grep -q 'Job <' && fail "jobs of a rejected batch file reported: $OUT"
+AFTER=$(bjobs 2>/dev/null | awk 'NR>1' | wc -l)
+[ "$AFTER" -eq "$BEFORE" ] || fail "rejected batch file left $((AFTER - BEFORE)) jobs"
+
+echo "PASS: $NAME"
+exit 0